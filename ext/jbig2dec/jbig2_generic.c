@@ -51,6 +51,19 @@ jbig2_generic_stats_size(Jbig2Ctx *ctx, int template)
 }
 
 
+static void
+copy_prev_row(Jbig2Image *image, int row)
+{
+  if (!row) {
+    /* no previous row */
+    memset( image->data, 0, image->stride );
+  } else {
+    /* duplicate data from the previous row */
+    uint8_t *src = image->data + (row - 1) * image->stride;
+    memcpy( src + image->stride, src, image->stride );
+  }
+}
+
 static int
 jbig2_decode_generic_template0(Jbig2Ctx *ctx,
 			       Jbig2Segment *segment,
@@ -63,6 +76,7 @@ jbig2_decode_generic_template0(Jbig2Ctx *ctx,
   const int GBH = image->height;
   const int rowstride = image->stride;
   int x, y;
+  int LTP = 0;
   byte *gbreg_line = (byte *)image->data;
 
   /* todo: currently we only handle the nominal gbat location */
@@ -81,6 +95,23 @@ jbig2_decode_generic_template0(Jbig2Ctx *ctx,
       uint32_t line_m2;
       int padded_width = (GBW + 7) & -8;
 
+      if (params->TPGDON)
+	{
+	  int SLTP = jbig2_arith_decode(as, &GB_stats[0x9B25]);
+	  if (SLTP < 0)
+	    return -1;
+	  LTP ^= SLTP;
+	  if (LTP)
+	    {
+	      copy_prev_row(image, y);
+#ifdef OUTPUT_PBM
+	      fwrite(gbreg_line, 1, rowstride, stdout);
+#endif
+	      gbreg_line += rowstride;
+	      continue;
+	    }
+	}
+
       line_m1 = (y >= 1) ? gbreg_line[-rowstride] : 0;
       line_m2 = (y >= 2) ? gbreg_line[-(rowstride << 1)] << 6 : 0;
       CONTEXT = (line_m1 & 0x7f0) | (line_m2 & 0xf800);
@@ -137,10 +168,21 @@ jbig2_decode_generic_template0_unopt(Jbig2Ctx *ctx,
   uint32_t CONTEXT;
   int x,y;
   bool bit;
+  int LTP = 0;
 
   /* this version is generic and easy to understand, but very slow */
 
   for (y = 0; y < GBH; y++) {
+    if (params->TPGDON) {
+      bit = jbig2_arith_decode(as, &GB_stats[0x9B25]);
+      if (bit < 0)
+        return -1;
+      LTP ^= bit;
+      if (LTP) {
+        copy_prev_row(image, y);
+        continue;
+      }
+    }
     for (x = 0; x < GBW; x++) {
       CONTEXT = 0;
       CONTEXT |= jbig2_image_get_pixel(image, x - 1, y) << 0;
@@ -184,6 +226,7 @@ jbig2_decode_generic_template1(Jbig2Ctx *ctx,
   const int GBH = image->height;
   const int rowstride = image->stride;
   int x, y;
+  int LTP = 0;
   byte *gbreg_line = (byte *)image->data;
 
   /* todo: currently we only handle the nominal gbat location */
@@ -202,6 +245,23 @@ jbig2_decode_generic_template1(Jbig2Ctx *ctx,
       uint32_t line_m2;
       int padded_width = (GBW + 7) & -8;
 
+      if (params->TPGDON)
+	{
+	  int SLTP = jbig2_arith_decode(as, &GB_stats[0x0795]);
+	  if (SLTP < 0)
+	    return -1;
+	  LTP ^= SLTP;
+	  if (LTP)
+	    {
+	      copy_prev_row(image, y);
+#ifdef OUTPUT_PBM
+	      fwrite(gbreg_line, 1, rowstride, stdout);
+#endif
+	      gbreg_line += rowstride;
+	      continue;
+	    }
+	}
+
       line_m1 = (y >= 1) ? gbreg_line[-rowstride] : 0;
       line_m2 = (y >= 2) ? gbreg_line[-(rowstride << 1)] << 5 : 0;
       CONTEXT = ((line_m1 >> 1) & 0x1f8) | ((line_m2 >> 1) & 0x1e00);
@@ -245,6 +305,57 @@ jbig2_decode_generic_template1(Jbig2Ctx *ctx,
   return 0;
 }
 
+static int
+jbig2_decode_generic_template1_unopt(Jbig2Ctx *ctx,
+				Jbig2Segment *segment,
+				const Jbig2GenericRegionParams *params,
+				Jbig2ArithState *as,
+				Jbig2Image *image,
+				Jbig2ArithCx *GB_stats)
+{
+  const int GBW = image->width;
+  const int GBH = image->height;
+  uint32_t CONTEXT;
+  int x, y;
+  bool bit;
+  int LTP = 0;
+
+  for (y = 0; y < GBH; y++) {
+    if (params->TPGDON) {
+      bit = jbig2_arith_decode(as, &GB_stats[0x0795]);
+      if (bit < 0)
+        return -1;
+      LTP ^= bit;
+    }
+    if (!LTP) {
+      for (x = 0; x < GBW; x++) {
+        CONTEXT  = jbig2_image_get_pixel(image, x - 1, y);
+        CONTEXT |= jbig2_image_get_pixel(image, x - 2, y) << 1;
+        CONTEXT |= jbig2_image_get_pixel(image, x - 3, y) << 2;
+        CONTEXT |= jbig2_image_get_pixel(image, x + params->gbat[0],
+					y + params->gbat[1]) << 3;
+        CONTEXT |= jbig2_image_get_pixel(image, x + 2, y - 1) << 4;
+        CONTEXT |= jbig2_image_get_pixel(image, x + 1, y - 1) << 5;
+        CONTEXT |= jbig2_image_get_pixel(image, x    , y - 1) << 6;
+        CONTEXT |= jbig2_image_get_pixel(image, x - 1, y - 1) << 7;
+        CONTEXT |= jbig2_image_get_pixel(image, x - 2, y - 1) << 8;
+        CONTEXT |= jbig2_image_get_pixel(image, x + 2, y - 2) << 9;
+        CONTEXT |= jbig2_image_get_pixel(image, x + 1, y - 2) << 10;
+        CONTEXT |= jbig2_image_get_pixel(image, x    , y - 2) << 11;
+        CONTEXT |= jbig2_image_get_pixel(image, x - 1, y - 2) << 12;
+        bit = jbig2_arith_decode(as, &GB_stats[CONTEXT]);
+        if (bit < 0)
+	  return -1;
+        jbig2_image_set_pixel(image, x, y, bit);
+      }
+    } else {
+      copy_prev_row(image, y);
+    }
+  }
+
+  return 0;
+}
+
 static int
 jbig2_decode_generic_template2(Jbig2Ctx *ctx,
 			       Jbig2Segment *segment,
@@ -257,6 +368,7 @@ jbig2_decode_generic_template2(Jbig2Ctx *ctx,
   const int GBH = image->height;
   const int rowstride = image->stride;
   int x, y;
+  int LTP = 0;
   byte *gbreg_line = (byte *)image->data;
 
   /* todo: currently we only handle the nominal gbat location */
@@ -275,6 +387,23 @@ jbig2_decode_generic_template2(Jbig2Ctx *ctx,
       uint32_t line_m2;
       int padded_width = (GBW + 7) & -8;
 
+      if (params->TPGDON)
+	{
+	  int SLTP = jbig2_arith_decode(as, &GB_stats[0xE5]);
+	  if (SLTP < 0)
+	    return -1;
+	  LTP ^= SLTP;
+	  if (LTP)
+	    {
+	      copy_prev_row(image, y);
+#ifdef OUTPUT_PBM
+	      fwrite(gbreg_line, 1, rowstride, stdout);
+#endif
+	      gbreg_line += rowstride;
+	      continue;
+	    }
+	}
+
       line_m1 = (y >= 1) ? gbreg_line[-rowstride] : 0;
       line_m2 = (y >= 2) ? gbreg_line[-(rowstride << 1)] << 4 : 0;
       CONTEXT = ((line_m1 >> 3) & 0x7c) | ((line_m2 >> 3) & 0x380);
@@ -330,6 +459,7 @@ jbig2_decode_generic_template2a(Jbig2Ctx *ctx,
   const int GBH = image->height;
   const int rowstride = image->stride;
   int x, y;
+  int LTP = 0;
   byte *gbreg_line = (byte *)image->data;
 
   /* This is a special case for GBATX1 = 3, GBATY1 = -1 */
@@ -348,6 +478,23 @@ jbig2_decode_generic_template2a(Jbig2Ctx *ctx,
       uint32_t line_m2;
       int padded_width = (GBW + 7) & -8;
 
+      if (params->TPGDON)
+	{
+	  int SLTP = jbig2_arith_decode(as, &GB_stats[0xE5]);
+	  if (SLTP < 0)
+	    return -1;
+	  LTP ^= SLTP;
+	  if (LTP)
+	    {
+	      copy_prev_row(image, y);
+#ifdef OUTPUT_PBM
+	      fwrite(gbreg_line, 1, rowstride, stdout);
+#endif
+	      gbreg_line += rowstride;
+	      continue;
+	    }
+	}
+
       line_m1 = (y >= 1) ? gbreg_line[-rowstride] : 0;
       line_m2 = (y >= 2) ? gbreg_line[-(rowstride << 1)] << 4 : 0;
       CONTEXT = ((line_m1 >> 3) & 0x78) | ((line_m1 >> 2) & 0x4) | ((line_m2 >> 3) & 0x380);
@@ -392,6 +539,54 @@ jbig2_decode_generic_template2a(Jbig2Ctx *ctx,
   return 0;
 }
 
+static int
+jbig2_decode_generic_template2_unopt(Jbig2Ctx *ctx,
+				Jbig2Segment *segment,
+				const Jbig2GenericRegionParams *params,
+				Jbig2ArithState *as,
+				Jbig2Image *image,
+				Jbig2ArithCx *GB_stats)
+{
+  const int GBW = image->width;
+  const int GBH = image->height;
+  uint32_t CONTEXT;
+  int x, y;
+  bool bit;
+  int LTP = 0;
+
+  for (y = 0; y < GBH; y++) {
+    if (params->TPGDON) {
+      bit = jbig2_arith_decode(as, &GB_stats[0xE5]);
+      if (bit < 0)
+        return -1;
+      LTP ^= bit;
+    }
+    if (!LTP) {
+      for (x = 0; x < GBW; x++) {
+        CONTEXT  = jbig2_image_get_pixel(image, x - 1, y);
+        CONTEXT |= jbig2_image_get_pixel(image, x - 2, y) << 1;
+        CONTEXT |= jbig2_image_get_pixel(image, x + params->gbat[0],
+					y + params->gbat[1]) << 2;
+        CONTEXT |= jbig2_image_get_pixel(image, x + 1, y - 1) << 3;
+        CONTEXT |= jbig2_image_get_pixel(image, x    , y - 1) << 4;
+        CONTEXT |= jbig2_image_get_pixel(image, x - 1, y - 1) << 5;
+        CONTEXT |= jbig2_image_get_pixel(image, x - 2, y - 1) << 6;
+        CONTEXT |= jbig2_image_get_pixel(image, x + 1, y - 2) << 7;
+        CONTEXT |= jbig2_image_get_pixel(image, x    , y - 2) << 8;
+        CONTEXT |= jbig2_image_get_pixel(image, x - 1, y - 2) << 9;
+        bit = jbig2_arith_decode(as, &GB_stats[CONTEXT]);
+        if (bit < 0)
+	  return -1;
+        jbig2_image_set_pixel(image, x, y, bit);
+      }
+    } else {
+      copy_prev_row(image, y);
+    }
+  }
+
+  return 0;
+}
+
 static int
 jbig2_decode_generic_template3(Jbig2Ctx *ctx,
 			       Jbig2Segment *segment,
@@ -405,6 +600,7 @@ jbig2_decode_generic_template3(Jbig2Ctx *ctx,
   const int rowstride = image->stride;
   byte *gbreg_line = (byte *)image->data;
   int x, y;
+  int LTP = 0;
 
   /* this routine only handles the nominal AT location */
 
@@ -421,6 +617,23 @@ jbig2_decode_generic_template3(Jbig2Ctx *ctx,
       uint32_t line_m1;
       int padded_width = (GBW + 7) & -8;
 
+      if (params->TPGDON)
+	{
+	  int SLTP = jbig2_arith_decode(as, &GB_stats[0x0195]);
+	  if (SLTP < 0)
+	    return -1;
+	  LTP ^= SLTP;
+	  if (LTP)
+	    {
+	      copy_prev_row(image, y);
+#ifdef OUTPUT_PBM
+	      fwrite(gbreg_line, 1, rowstride, stdout);
+#endif
+	      gbreg_line += rowstride;
+	      continue;
+	    }
+	}
+
       line_m1 = (y >= 1) ? gbreg_line[-rowstride] : 0;
       CONTEXT = (line_m1 >> 1) & 0x3f0;
 
@@ -445,7 +658,7 @@ jbig2_decode_generic_template3(Jbig2Ctx *ctx,
 		return -1;
 	      result |= bit << (7 - x_minor);
 	      CONTEXT = ((CONTEXT & 0x1f7) << 1) | bit |
-		((line_m1 >> (10 - x_minor)) & 0x010);
+		((line_m1 >> (8 - x_minor)) & 0x010);
 	    }
 	  gbreg_line[x >> 3] = result;
 	}
@@ -471,10 +684,21 @@ jbig2_decode_generic_template3_unopt(Jbig2Ctx *ctx,
   uint32_t CONTEXT;
   int x,y;
   bool bit;
+  int LTP = 0;
 
   /* this version is generic and easy to understand, but very slow */
 
   for (y = 0; y < GBH; y++) {
+    if (params->TPGDON) {
+      bit = jbig2_arith_decode(as, &GB_stats[0x0195]);
+      if (bit < 0)
+        return -1;
+      LTP ^= bit;
+      if (LTP) {
+        copy_prev_row(image, y);
+        continue;
+      }
+    }
     for (x = 0; x < GBW; x++) {
       CONTEXT = 0;
       CONTEXT |= jbig2_image_get_pixel(image, x - 1, y) << 0;
@@ -497,242 +721,6 @@ jbig2_decode_generic_template3_unopt(Jbig2Ctx *ctx,
   return 0;
 }
 
-static void
-copy_prev_row(Jbig2Image *image, int row)
-{
-  if (!row) {
-    /* no previous row */
-    memset( image->data, 0, image->stride );
-  } else {
-    /* duplicate data from the previous row */
-    uint8_t *src = image->data + (row - 1) * image->stride;
-    memcpy( src + image->stride, src, image->stride );
-  }
-}
-
-static int
-jbig2_decode_generic_template0_TPGDON(Jbig2Ctx *ctx,
-				Jbig2Segment *segment,
-				const Jbig2GenericRegionParams *params, 
-				Jbig2ArithState *as,
-				Jbig2Image *image,
-				Jbig2ArithCx *GB_stats)
-{
-  const int GBW = image->width;
-  const int GBH = image->height;
-  uint32_t CONTEXT;
-  int x, y;
-  bool bit;
-  int LTP = 0;
-
-  for (y = 0; y < GBH; y++)
-  {
-    bit = jbig2_arith_decode(as, &GB_stats[0x9B25]);
-    if (bit < 0)
-      return -1;
-    LTP ^= bit;
-    if (!LTP) {
-      for (x = 0; x < GBW; x++) {
-        CONTEXT  = jbig2_image_get_pixel(image, x - 1, y);
-        CONTEXT |= jbig2_image_get_pixel(image, x - 2, y) << 1;
-        CONTEXT |= jbig2_image_get_pixel(image, x - 3, y) << 2;
-        CONTEXT |= jbig2_image_get_pixel(image, x - 4, y) << 3;
-        CONTEXT |= jbig2_image_get_pixel(image, x + params->gbat[0],
-					y + params->gbat[1]) << 4;
-        CONTEXT |= jbig2_image_get_pixel(image, x + 2, y - 1) << 5;
-        CONTEXT |= jbig2_image_get_pixel(image, x + 1, y - 1) << 6;
-        CONTEXT |= jbig2_image_get_pixel(image, x    , y - 1) << 7;
-        CONTEXT |= jbig2_image_get_pixel(image, x - 1, y - 1) << 8;
-        CONTEXT |= jbig2_image_get_pixel(image, x - 2, y - 1) << 9;
-        CONTEXT |= jbig2_image_get_pixel(image, x + params->gbat[2],
-					y + params->gbat[3]) << 10;
-        CONTEXT |= jbig2_image_get_pixel(image, x + params->gbat[4],
-					y + params->gbat[5]) << 11;
-        CONTEXT |= jbig2_image_get_pixel(image, x + 1, y - 2) << 12;
-        CONTEXT |= jbig2_image_get_pixel(image, x    , y - 2) << 13;
-        CONTEXT |= jbig2_image_get_pixel(image, x - 1, y - 2) << 14;
-        CONTEXT |= jbig2_image_get_pixel(image, x + params->gbat[6],
-					y + params->gbat[7]) << 15;
-        bit = jbig2_arith_decode(as, &GB_stats[CONTEXT]);
-        if (bit < 0)
-	  return -1;
-        jbig2_image_set_pixel(image, x, y, bit);
-      }
-    } else {
-      copy_prev_row(image, y);
-    }
-  }
-
-  return 0;
-}
-
-static int
-jbig2_decode_generic_template1_TPGDON(Jbig2Ctx *ctx, 
-				Jbig2Segment *segment,
-				const Jbig2GenericRegionParams *params, 
-				Jbig2ArithState *as,
-				Jbig2Image *image,
-				Jbig2ArithCx *GB_stats)
-{
-  const int GBW = image->width;
-  const int GBH = image->height;
-  uint32_t CONTEXT;
-  int x, y;
-  bool bit;
-  int LTP = 0;
-
-  for (y = 0; y < GBH; y++) {
-    bit = jbig2_arith_decode(as, &GB_stats[0x0795]);
-    if (bit < 0)
-      return -1;
-    LTP ^= bit;
-    if (!LTP) {
-      for (x = 0; x < GBW; x++) {
-        CONTEXT  = jbig2_image_get_pixel(image, x - 1, y);
-        CONTEXT |= jbig2_image_get_pixel(image, x - 2, y) << 1;
-        CONTEXT |= jbig2_image_get_pixel(image, x - 3, y) << 2;
-        CONTEXT |= jbig2_image_get_pixel(image, x + params->gbat[0],
-					y + params->gbat[1]) << 3;
-        CONTEXT |= jbig2_image_get_pixel(image, x + 2, y - 1) << 4;
-        CONTEXT |= jbig2_image_get_pixel(image, x + 1, y - 1) << 5;
-        CONTEXT |= jbig2_image_get_pixel(image, x    , y - 1) << 6;
-        CONTEXT |= jbig2_image_get_pixel(image, x - 1, y - 1) << 7;
-        CONTEXT |= jbig2_image_get_pixel(image, x - 2, y - 1) << 8;
-        CONTEXT |= jbig2_image_get_pixel(image, x + 2, y - 2) << 9;
-        CONTEXT |= jbig2_image_get_pixel(image, x + 1, y - 2) << 10;
-        CONTEXT |= jbig2_image_get_pixel(image, x    , y - 2) << 11;
-        CONTEXT |= jbig2_image_get_pixel(image, x - 1, y - 2) << 12;
-        bit = jbig2_arith_decode(as, &GB_stats[CONTEXT]);
-        if (bit < 0)
-	  return -1;
-        jbig2_image_set_pixel(image, x, y, bit);
-      }
-    } else {
-      copy_prev_row(image, y);
-    }
-  }
-
-  return 0;
-}
-
-static int
-jbig2_decode_generic_template2_TPGDON(Jbig2Ctx *ctx, 
-				Jbig2Segment *segment,
-				const Jbig2GenericRegionParams *params,
-				Jbig2ArithState *as,
-				Jbig2Image *image,
-				Jbig2ArithCx *GB_stats)
-{
-  const int GBW = image->width;
-  const int GBH = image->height;
-  uint32_t CONTEXT;
-  int x, y;
-  bool bit;
-  int LTP = 0;
-
-  for (y = 0; y < GBH; y++) {
-    bit = jbig2_arith_decode(as, &GB_stats[0xE5]);
-    if (bit < 0)
-      return -1;
-    LTP ^= bit;
-    if (!LTP) {
-      for (x = 0; x < GBW; x++) {
-        CONTEXT  = jbig2_image_get_pixel(image, x - 1, y);
-        CONTEXT |= jbig2_image_get_pixel(image, x - 2, y) << 1;
-        CONTEXT |= jbig2_image_get_pixel(image, x + params->gbat[0],
-					y + params->gbat[1]) << 2;
-        CONTEXT |= jbig2_image_get_pixel(image, x + 1, y - 1) << 3;
-        CONTEXT |= jbig2_image_get_pixel(image, x    , y - 1) << 4;
-        CONTEXT |= jbig2_image_get_pixel(image, x - 1, y - 1) << 5;
-        CONTEXT |= jbig2_image_get_pixel(image, x - 2, y - 1) << 6;
-        CONTEXT |= jbig2_image_get_pixel(image, x + 1, y - 2) << 7;
-        CONTEXT |= jbig2_image_get_pixel(image, x    , y - 2) << 8;
-        CONTEXT |= jbig2_image_get_pixel(image, x - 1, y - 2) << 9;
-        bit = jbig2_arith_decode(as, &GB_stats[CONTEXT]);
-        if (bit < 0)
-	  return -1;
-        jbig2_image_set_pixel(image, x, y, bit);
-      }
-    } else {
-      copy_prev_row(image, y);
-    }
-  }
-
-  return 0;
-}
-
-static int
-jbig2_decode_generic_template3_TPGDON(Jbig2Ctx *ctx, 
-				Jbig2Segment *segment,
-				const Jbig2GenericRegionParams *params,
-				Jbig2ArithState *as,
-				Jbig2Image *image,
-				Jbig2ArithCx *GB_stats)
-{
-  const int GBW = image->width;
-  const int GBH = image->height;
-  uint32_t CONTEXT;
-  int x, y;
-  bool bit;
-  int LTP = 0;
-
-  for (y = 0; y < GBH; y++) {
-    bit = jbig2_arith_decode(as, &GB_stats[0x0195]);
-    if (bit < 0)
-      return -1;
-    LTP ^= bit;
-    if (!LTP) {
-      for (x = 0; x < GBW; x++) {
-        CONTEXT  = jbig2_image_get_pixel(image, x - 1, y);
-        CONTEXT |= jbig2_image_get_pixel(image, x - 2, y) << 1;
-        CONTEXT |= jbig2_image_get_pixel(image, x - 3, y) << 2;
-        CONTEXT |= jbig2_image_get_pixel(image, x - 4, y) << 3;
-        CONTEXT |= jbig2_image_get_pixel(image, x + params->gbat[0],
-					y + params->gbat[1]) << 4;
-        CONTEXT |= jbig2_image_get_pixel(image, x + 1, y - 1) << 5;
-        CONTEXT |= jbig2_image_get_pixel(image, x    , y - 1) << 6;
-        CONTEXT |= jbig2_image_get_pixel(image, x - 1, y - 1) << 7;
-        CONTEXT |= jbig2_image_get_pixel(image, x - 2, y - 1) << 8;
-        CONTEXT |= jbig2_image_get_pixel(image, x - 3, y - 1) << 9;
-        bit = jbig2_arith_decode(as, &GB_stats[CONTEXT]);
-        if (bit < 0)
-	  return -1;
-        jbig2_image_set_pixel(image, x, y, bit);
-      }
-    } else {
-      copy_prev_row(image, y);
-    }
-  }
-
-  return 0;
-}
-
-static int
-jbig2_decode_generic_region_TPGDON(Jbig2Ctx *ctx,
-				Jbig2Segment *segment,
-				const Jbig2GenericRegionParams *params, 
-				Jbig2ArithState *as,
-				Jbig2Image *image,
-				Jbig2ArithCx *GB_stats)
-{
-  switch (params->GBTEMPLATE) {
-    case 0:
-      return jbig2_decode_generic_template0_TPGDON(ctx, segment, 
-			params, as, image, GB_stats);
-    case 1:
-      return jbig2_decode_generic_template1_TPGDON(ctx, segment, 
-			params, as, image, GB_stats);
-    case 2:
-      return jbig2_decode_generic_template2_TPGDON(ctx, segment, 
-			params, as, image, GB_stats);
-    case 3:
-      return jbig2_decode_generic_template3_TPGDON(ctx, segment, 
-			params, as, image, GB_stats);
-  }
-
-  return -1;
-}
-
 /**
  * jbig2_decode_generic_region: Decode a generic region.
  * @ctx: The context for allocation and error reporting.
@@ -760,10 +748,8 @@ jbig2_decode_generic_region(Jbig2Ctx *ctx,
 {
   const int8_t *gbat = params->gbat;
 
-  if (!params->MMR && params->TPGDON) 
-     return jbig2_decode_generic_region_TPGDON(ctx, segment, params, 
-		as, image, GB_stats);
-
+  /* The optimized decoders only handle the nominal gbat locations;
+     all of them handle typical prediction (TPGDON) row by row. */
   if (!params->MMR && params->GBTEMPLATE == 0) {
     if (gbat[0] == +3 && gbat[1] == -1 &&
         gbat[2] == -3 && gbat[3] == -1 &&
@@ -774,21 +760,29 @@ jbig2_decode_generic_region(Jbig2Ctx *ctx,
     else
       return jbig2_decode_generic_template0_unopt(ctx, segment, params,
                                           as, image, GB_stats);
-  } else if (!params->MMR && params->GBTEMPLATE == 1)
-    return jbig2_decode_generic_template1(ctx, segment, params,
-					  as, image, GB_stats);
+  } else if (!params->MMR && params->GBTEMPLATE == 1) {
+    if (gbat[0] == +3 && gbat[1] == -1)
+      return jbig2_decode_generic_template1(ctx, segment, params,
+                                          as, image, GB_stats);
+    else
+      return jbig2_decode_generic_template1_unopt(ctx, segment, params,
+                                          as, image, GB_stats);
+  }
   else if (!params->MMR && params->GBTEMPLATE == 2)
     {
       if (gbat[0] == 3 && gbat[1] == -1)
 	return jbig2_decode_generic_template2a(ctx, segment, params,
 					       as, image, GB_stats);
-      else
+      else if (gbat[0] == 2 && gbat[1] == -1)
 	return jbig2_decode_generic_template2(ctx, segment, params,
                                               as, image, GB_stats);
+      else
+	return jbig2_decode_generic_template2_unopt(ctx, segment, params,
+                                              as, image, GB_stats);
     }
   else if (!params->MMR && params->GBTEMPLATE == 3) {
    if (gbat[0] == 2 && gbat[1] == -1)
-     return jbig2_decode_generic_template3_unopt(ctx, segment, params,
+     return jbig2_decode_generic_template3(ctx, segment, params,
                                          as, image, GB_stats);
    else
      return jbig2_decode_generic_template3_unopt(ctx, segment, params,
@@ -104,7 +104,7 @@ jbig2_huffman_new (Jbig2Ctx *ctx, Jbig2WordStream *ws)
 void
 jbig2_huffman_free (Jbig2Ctx *ctx, Jbig2HuffmanState *hs)
 {
-  if (hs != NULL) free(hs);
+  if (hs != NULL) jbig2_free(ctx->allocator, hs);
   return;
 }
 
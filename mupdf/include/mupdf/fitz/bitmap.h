@@ -43,10 +43,12 @@ typedef struct fz_halftone_s fz_halftone;
 /*
 	fz_halftone_pixmap: Make a bitmap from a pixmap and a halftone.
 
-	pix: The pixmap to generate from. Currently must be a single color
-	component + alpha (where the alpha is assumed to be solid).
+	pix: The pixmap to generate from. The alpha is assumed to be solid.
+	Each color component is halftoned separately; a set bit stands for
+	a dark dot (i.e. CMYK components are inverted before thresholding).
 
-	ht: The halftone to use. NULL implies the default halftone.
+	ht: The halftone to use (with at least as many components as the
+	pixmap). NULL implies the default halftone.
 
 	Returns the resultant bitmap. Throws exceptions in the case of
 	failure to allocate.
@@ -110,6 +110,7 @@ struct fz_context_s
 	fz_font_context *font;
 	fz_colorspace_context *colorspace;
 	fz_aa_context *aa;
+	int ref_paths;
 	fz_store *store;
 	fz_glyph_cache *glyph_cache;
 };
@@ -202,6 +203,81 @@ int fz_aa_level(fz_context *ctx);
 */
 void fz_set_aa_level(fz_context *ctx, int bits);
 
+/*
+	fz_aa_analytic: Get whether anti-aliased paths are rendered by
+	computing the exact area covered within each pixel.
+*/
+int fz_aa_analytic(fz_context *ctx);
+
+/*
+	fz_set_aa_analytic: Select the scan converter for anti-aliased paths.
+
+	analytic: If non-zero, compute the exact area of each pixel covered
+	by a path (the number of bits of antialiasing then only matters in
+	so far as 0 disables antialiasing). Otherwise (the default) paths
+	are supersampled at the resolution given by fz_set_aa_level.
+*/
+void fz_set_aa_analytic(fz_context *ctx, int analytic);
+
+/*
+	Reference code paths
+
+	Optimized code paths (e.g. SIMD kernels) can be replaced at runtime
+	by the plain code they were derived from, so that the optimizations
+	can be checked against it and their benefit be measured (see the -X
+	option of mudraw).
+
+	FZ_REF_SIMD: Use the scalar code instead of the SSE2/AVX2 kernels.
+	The output must be identical.
+
+	FZ_REF_HALFTONE: Build the threshold line for every row when
+	halftoning instead of caching the lines of a tile period. The
+	output must be identical.
+
+	FZ_REF_STROKE: Stroke all paths through the scan converter instead
+	of painting single straight line segments directly (which is only
+	done with analytic antialiasing). The output differs slightly, as
+	the direct painting computes the coverage exactly.
+
+	FZ_REF_COLOR: Convert every pixel of an image on its own instead
+	of reusing the last CMYK color and interpolating large images in
+	other 3 component colorspaces from a grid. The output differs
+	slightly for the latter.
+
+	FZ_REF_SHADE: Paint axial and radial shadings as meshes of
+	triangles instead of looking up the color of every pixel in a
+	ramp. The output differs slightly, as the meshes only approximate
+	circles and interpolate between their vertices.
+
+	FZ_REF_LEX: Read PDF syntax byte by byte instead of scanning the
+	stream's buffer directly. The tokens must be identical.
+*/
+enum
+{
+	FZ_REF_SIMD = 1,
+	FZ_REF_HALFTONE = 2,
+	FZ_REF_STROKE = 4,
+	FZ_REF_COLOR = 8,
+	FZ_REF_SHADE = 16,
+	FZ_REF_LEX = 32
+};
+
+/*
+	fz_reference_paths: Get the code paths currently replaced by their
+	reference implementation (a combination of FZ_REF_* flags).
+*/
+int fz_reference_paths(fz_context *ctx);
+
+/*
+	fz_set_reference_paths: Replace the given optimized code paths by
+	their reference implementation (a combination of FZ_REF_* flags,
+	0 for the default).
+
+	The setting only applies to the given context. Cloned contexts
+	inherit it, just like the anti-aliasing level.
+*/
+void fz_set_reference_paths(fz_context *ctx, int paths);
+
 /*
 	Locking functions
 
@@ -232,9 +308,13 @@ struct fz_locks_context_s
 
 enum {
 	FZ_LOCK_ALLOC = 0,
+	/* the name tables and object pools of pdf documents */
+	FZ_LOCK_PDF,
 	FZ_LOCK_FILE,
 	FZ_LOCK_FREETYPE,
 	FZ_LOCK_GLYPHCACHE,
+	/* one lock per glyph cache shard */
+	FZ_LOCK_GLYPHCACHE_LAST = FZ_LOCK_GLYPHCACHE + 7,
 	FZ_LOCK_MAX
 };
 
@@ -28,6 +28,7 @@ fz_stream *fz_open_predict(fz_stream *chain, int predictor, int columns, int col
 typedef struct fz_jbig2_globals_s fz_jbig2_globals;
 fz_jbig2_globals *fz_load_jbig2_globals(fz_context *ctx, unsigned char *data, int size);
 void fz_free_jbig2_globals_imp(fz_context *ctx, fz_storable *globals);
+unsigned int fz_jbig2_globals_size(fz_jbig2_globals *globals);
 fz_stream *fz_open_jbig2d(fz_stream *chain, fz_jbig2_globals *globals);
 
 #endif
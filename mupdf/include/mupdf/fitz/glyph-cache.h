@@ -18,6 +18,13 @@ fz_glyph_cache *fz_keep_glyph_cache(fz_context *ctx);
 void fz_drop_glyph_cache_context(fz_context *ctx);
 void fz_purge_glyph_cache(fz_context *ctx);
 
+/*
+	fz_set_glyph_cache_size: Set the number of bytes of rendered glyphs
+	the glyph cache may hold (4 MB by default). The least recently used
+	glyphs are evicted to stay within the new budget.
+*/
+void fz_set_glyph_cache_size(fz_context *ctx, unsigned int max_size);
+
 fz_path *fz_outline_ft_glyph(fz_context *ctx, fz_font *font, int gid, const fz_matrix *trm);
 fz_path *fz_outline_glyph(fz_context *ctx, fz_font *font, int gid, const fz_matrix *ctm);
 fz_glyph *fz_render_ft_glyph(fz_context *ctx, fz_font *font, int cid, const fz_matrix *trm, int aa);
@@ -36,6 +36,27 @@ typedef struct fz_image_s fz_image;
 */
 fz_pixmap *fz_new_pixmap_from_image(fz_context *ctx, fz_image *image, int w, int h);
 
+/*
+	fz_new_pixmap_from_image_region: Called to get a handle to a pixmap
+	for part of an image, such as the part visible in a zoomed in view.
+
+	Images which can be decoded a row at a time are decoded only as far
+	as (and keep only the columns of) the part needed, and are cached
+	in tiles, so that neighbouring parts can share them.
+
+	image: The image to retrieve a pixmap from.
+
+	area: The part of the image wanted (in image pixels). Updated to the
+	part of the image actually covered by the returned pixmap; this may
+	be larger, or the whole image.
+
+	w, h: The desired size of the whole image (in pixels), as for
+	fz_new_pixmap_from_image.
+
+	Returns a non NULL pixmap pointer. May throw exceptions.
+*/
+fz_pixmap *fz_new_pixmap_from_image_region(fz_context *ctx, fz_image *image, fz_irect *area, int w, int h);
+
 /*
 	fz_drop_image: Drop a reference to an image.
 
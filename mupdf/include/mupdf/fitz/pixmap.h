@@ -296,6 +296,7 @@ fz_irect *fz_pixmap_bbox_no_ctx(fz_pixmap *src, fz_irect *bbox);
 void fz_decode_tile(fz_pixmap *pix, float *decode);
 void fz_decode_indexed_tile(fz_pixmap *pix, float *decode, int maxval);
 void fz_unpack_tile(fz_pixmap *dst, unsigned char * restrict src, int n, int depth, int stride, int scale);
+void fz_unpack_tile_subsampled(fz_context *ctx, fz_pixmap *dst, unsigned char * restrict src, int w, int h, int stride, int factor);
 
 /*
 	fz_md5_pixmap: Return the md5 digest for a pixmap
@@ -83,6 +83,18 @@ struct fz_store_hash_s
 	} u;
 };
 
+/*
+	Every item in the store belongs to a class (given by its type), for
+	which the store keeps separate statistics and an optional budget.
+*/
+enum
+{
+	FZ_STORE_CLASS_RESOURCE, /* fonts, colorspaces, shadings, images, ... */
+	FZ_STORE_CLASS_PIXMAP, /* decoded images */
+	FZ_STORE_CLASS_TILE, /* rendered tiles */
+	FZ_STORE_CLASS_COUNT
+};
+
 typedef struct fz_store_type_s fz_store_type;
 
 struct fz_store_type_s
@@ -91,6 +103,7 @@ struct fz_store_type_s
 	void *(*keep_key)(fz_context *,void *);
 	void (*drop_key)(fz_context *,void *);
 	int (*cmp_key)(void *, void *);
+	int store_class;
 #ifndef NDEBUG
 	void (*debug)(FILE *, void *);
 #endif
@@ -163,6 +176,36 @@ void *fz_find_item(fz_context *ctx, fz_store_free_fn *free, void *key, fz_store_
 */
 void fz_remove_item(fz_context *ctx, fz_store_free_fn *free, void *key, fz_store_type *type);
 
+/*
+	fz_set_store_class_max: Limit the size of the items of one class.
+
+	The budget is enforced (by evicting items of that class) whenever an
+	item of that class is stored, in addition to the overall limit.
+
+	store_class: One of the FZ_STORE_CLASS_* values.
+
+	max: The maximum size (in bytes) of the items of this class.
+	FZ_STORE_UNLIMITED (the default) means no limit.
+*/
+void fz_set_store_class_max(fz_context *ctx, int store_class, unsigned int max);
+
+typedef struct fz_store_stats_s fz_store_stats;
+
+struct fz_store_stats_s
+{
+	unsigned int size; /* bytes currently stored */
+	unsigned int max; /* budget, or FZ_STORE_UNLIMITED */
+	int count; /* items currently stored */
+	int hits; /* successful lookups */
+	int misses; /* failed lookups */
+	int evictions; /* items evicted to make space */
+};
+
+/*
+	fz_get_store_stats: Read the statistics of one class of items.
+*/
+void fz_get_store_stats(fz_context *ctx, int store_class, fz_store_stats *stats);
+
 /*
 	fz_empty_store: Evict everything from the store.
 */
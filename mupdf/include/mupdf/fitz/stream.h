@@ -139,6 +139,16 @@ enum
 
 int fz_stream_meta(fz_stream *stm, int key, int size, void *ptr);
 
+/*
+	Every stream (including each filter in a chain) buffers this many
+	bytes. Larger buffers mean fewer calls into the filters and let the
+	lexer scan longer stretches directly, at the cost of memory per
+	stream.
+*/
+#ifndef FZ_STREAM_BUFFER_SIZE
+#define FZ_STREAM_BUFFER_SIZE 8192
+#endif
+
 struct fz_stream_s
 {
 	fz_context *ctx;
@@ -156,7 +166,7 @@ struct fz_stream_s
 	/* SumatraPDF: allow to clone a stream */
 	fz_stream *(*reopen)(fz_context *ctx, fz_stream *stm);
 	int (*meta)(fz_stream *stm, int key, int size, void *ptr);
-	unsigned char buf[4096];
+	unsigned char buf[FZ_STREAM_BUFFER_SIZE];
 };
 
 fz_stream *fz_new_stream(fz_context *ctx, void*, int(*)(fz_stream*, unsigned char*, int), void(*)(fz_context *, void *));
@@ -213,6 +213,25 @@ extern void __gnu_mcount_nc(void);
 #endif
 #endif
 
+/* x86 SIMD specific defines */
+
+/* SSE2/AVX2 code paths are compiled in for all x86 builds (unless
+ * FZ_NO_SIMD is defined) and chosen at runtime through fz_cpu_flags.
+ * AVX2 intrinsics require MSVC 2012 or GCC 4.9 resp. clang. */
+#if !defined(ARCH_X86) && !defined(FZ_NO_SIMD) && (defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__))
+#define ARCH_X86
+#endif
+
+#ifdef ARCH_X86
+#if defined(_MSC_VER)
+#if _MSC_VER >= 1700
+#define ARCH_X86_AVX2
+#endif
+#elif defined(__clang__) || __GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9)
+#define ARCH_X86_AVX2
+#endif
+#endif
+
 #ifdef CLUSTER
 #define LOCAL_TRIG_FNS
 #endif
@@ -283,6 +283,23 @@ struct pdf_document_s
 	int num_type3_fonts;
 	int max_type3_fonts;
 	fz_font **type3_fonts;
+
+	/* Interned name objects (open addressing hash table, guarded
+	 * by FZ_LOCK_PDF) */
+	int name_count;
+	int name_cap;
+	pdf_obj **names;
+
+	/* Pool for the fixed size objects (see pdf_alloc_obj, guarded
+	 * by FZ_LOCK_PDF) */
+	struct pdf_obj_slab_s *obj_slabs;
+	int obj_slab_used;
+	pdf_obj *free_objs;
+	int live_objs;
+
+	/* Object streams decoded by pdf_load_obj_stms (sorted by number) */
+	int obj_stm_count;
+	struct pdf_obj_stm_s *obj_stms;
 };
 
 /*
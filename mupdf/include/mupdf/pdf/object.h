@@ -15,6 +15,14 @@ pdf_obj *pdf_new_null(pdf_document *doc);
 pdf_obj *pdf_new_bool(pdf_document *doc, int b);
 pdf_obj *pdf_new_int(pdf_document *doc, int i);
 pdf_obj *pdf_new_real(pdf_document *doc, float f);
+/*
+	pdf_new_name: Return the name object for str.
+
+	Names are interned per document, so that all occurrences of a name
+	share one object, equal names compare equal by pointer and
+	dictionary lookups compare keys by identity only. The objects
+	live until the document is closed.
+*/
 pdf_obj *pdf_new_name(pdf_document *doc, const char *str);
 pdf_obj *pdf_new_string(pdf_document *doc, const char *str, int len);
 pdf_obj *pdf_new_indirect(pdf_document *doc, int num, int gen);
@@ -44,6 +52,9 @@ int pdf_is_stream(pdf_document *doc, int num, int gen);
 
 int pdf_objcmp(pdf_obj *a, pdf_obj *b);
 
+void pdf_drop_name_table(pdf_document *doc);
+void pdf_drop_obj_pool(pdf_document *doc);
+
 /* obj marking and unmarking functions - to avoid infinite recursions. */
 int pdf_obj_marked(pdf_obj *obj);
 int pdf_mark_obj(pdf_obj *obj);
@@ -51,6 +51,37 @@ struct pdf_xref_s
 
 void pdf_cache_object(pdf_document *doc, int num, int gen);
 
+/*
+	Decoding all object streams at once (optional)
+
+	Without this, each object stream is decoded when one of its objects
+	is first needed. Instead, all of them can be decoded right after
+	opening a document, spread over several threads:
+
+	pdf_read_obj_stms: Read the (still compressed) object streams which
+	contain objects that haven't been loaded yet. Like any other function
+	taking the document, this must not run concurrently with other uses
+	of the document.
+
+	pdf_decode_obj_stms: Decode the streams with the index thread,
+	thread + threads, thread + 2 * threads, ... and index the objects in
+	them. Apart from reading the streams' dictionaries, this doesn't use
+	the document, so that it may be called from threads threads at once
+	(each with a context of its own, see fz_clone_context), even while
+	the document is used elsewhere, as long as it isn't modified.
+
+	pdf_load_obj_stms: Hand the decoded streams over to the document
+	(and free the batch). Caching any of their objects then parses all
+	objects of that stream from memory, at the offsets indexed above.
+	Streams which failed to decode (or were never decoded) are left to
+	be decoded when needed.
+*/
+typedef struct pdf_obj_stm_batch_s pdf_obj_stm_batch;
+
+pdf_obj_stm_batch *pdf_read_obj_stms(pdf_document *doc);
+void pdf_decode_obj_stms(fz_context *ctx, pdf_obj_stm_batch *batch, int thread, int threads);
+void pdf_load_obj_stms(pdf_document *doc, pdf_obj_stm_batch *batch);
+
 int pdf_count_objects(pdf_document *doc);
 pdf_obj *pdf_resolve_indirect(pdf_obj *ref);
 pdf_obj *pdf_load_object(pdf_document *doc, int num, int gen);
@@ -1,4 +1,5 @@
 #include "mupdf/fitz.h"
+#include "draw-imp.h"
 
 #define SLOWCMYK
 
@@ -293,11 +294,136 @@ fz_colorspace_is_indexed(fz_colorspace *cs)
 
 /* Fast pixmap color conversions */
 
-static void fast_gray_to_rgb(fz_pixmap *dst, fz_pixmap *src)
+#ifdef ARCH_X86
+/*
+ * SSE2 versions of the conversions between the 8 bit device colorspaces.
+ * Each takes pixels as 32 bit lanes (or pairs of 16 bit ones for gray),
+ * computes exactly what the scalar loop below it does, and returns the
+ * number of pixels done; the scalar loop handles the rest.
+ */
+
+/* Interleave 8 gray values (in 32 bit lanes of lo and hi) with 8 alpha
+ * values (in the top byte of the 32 bit lanes of slo and shi) */
+#define FZ_PACK_GRAY_ALPHA(lo, hi, slo, shi) \
+	_mm_packs_epi32( \
+		_mm_srai_epi32(_mm_slli_epi32(_mm_or_si128(lo, _mm_slli_epi32(_mm_srli_epi32(slo, 24), 8)), 16), 16), \
+		_mm_srai_epi32(_mm_slli_epi32(_mm_or_si128(hi, _mm_slli_epi32(_mm_srli_epi32(shi, 24), 8)), 16), 16))
+
+/* ((s[r]+1) * 77 + (s[1]+1) * 150 + (s[b]+1) * 28) >> 8 for 4 pixels */
+FZ_TARGET_SSE2 static inline __m128i
+fz_rgb_to_gray_epi32(__m128i v, __m128i weights)
+{
+	__m128i zero = _mm_setzero_si128();
+	__m128 lo = _mm_castsi128_ps(_mm_madd_epi16(_mm_unpacklo_epi8(v, zero), weights));
+	__m128 hi = _mm_castsi128_ps(_mm_madd_epi16(_mm_unpackhi_epi8(v, zero), weights));
+	__m128i even = _mm_castps_si128(_mm_shuffle_ps(lo, hi, _MM_SHUFFLE(2, 0, 2, 0)));
+	__m128i odd = _mm_castps_si128(_mm_shuffle_ps(lo, hi, _MM_SHUFFLE(3, 1, 3, 1)));
+	return _mm_srli_epi32(_mm_add_epi32(_mm_add_epi32(even, odd), _mm_set1_epi32(77 + 150 + 28)), 8);
+}
+
+FZ_TARGET_SSE2 static int
+fast_rgb_to_gray_sse2(unsigned char *d, unsigned char *s, int n, int bgr)
+{
+	__m128i weights = bgr ? _mm_set_epi16(0, 77, 150, 28, 0, 77, 150, 28) : _mm_set_epi16(0, 28, 150, 77, 0, 28, 150, 77);
+	int i;
+	for (i = 0; i + 8 <= n; i += 8, s += 32, d += 16)
+	{
+		__m128i v0 = _mm_loadu_si128((const __m128i *)s);
+		__m128i v1 = _mm_loadu_si128((const __m128i *)(s + 16));
+		__m128i g0 = fz_rgb_to_gray_epi32(v0, weights);
+		__m128i g1 = fz_rgb_to_gray_epi32(v1, weights);
+		_mm_storeu_si128((__m128i *)d, FZ_PACK_GRAY_ALPHA(g0, g1, v0, v1));
+	}
+	return i;
+}
+
+FZ_TARGET_SSE2 static int
+fast_gray_to_rgb_sse2(unsigned char *d, unsigned char *s, int n)
+{
+	__m128i zero = _mm_setzero_si128();
+	__m128i gmask = _mm_set1_epi32(0xff);
+	int i;
+	for (i = 0; i + 8 <= n; i += 8, s += 16, d += 32)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i *)s);
+		__m128i lo = _mm_unpacklo_epi16(v, zero);
+		__m128i hi = _mm_unpackhi_epi16(v, zero);
+		__m128i glo = _mm_and_si128(lo, gmask);
+		__m128i ghi = _mm_and_si128(hi, gmask);
+		glo = _mm_or_si128(glo, _mm_slli_epi32(glo, 8));
+		ghi = _mm_or_si128(ghi, _mm_slli_epi32(ghi, 8));
+		/* gray in bytes 0..2, alpha from byte 1 to byte 3 */
+		lo = _mm_or_si128(_mm_or_si128(glo, _mm_slli_epi32(glo, 8)), _mm_slli_epi32(_mm_srli_epi32(lo, 8), 24));
+		hi = _mm_or_si128(_mm_or_si128(ghi, _mm_slli_epi32(ghi, 8)), _mm_slli_epi32(_mm_srli_epi32(hi, 8), 24));
+		_mm_storeu_si128((__m128i *)d, lo);
+		_mm_storeu_si128((__m128i *)(d + 16), hi);
+	}
+	return i;
+}
+
+FZ_TARGET_SSE2 static int
+fast_rgb_to_bgr_sse2(unsigned char *d, unsigned char *s, int n)
+{
+	__m128i keep = _mm_set1_epi32(0xff00ff00);
+	__m128i low = _mm_set1_epi32(0xff);
+	int i;
+	for (i = 0; i + 4 <= n; i += 4, s += 16, d += 16)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i *)s);
+		__m128i r = _mm_and_si128(v, keep);
+		r = _mm_or_si128(r, _mm_slli_epi32(_mm_and_si128(v, low), 16));
+		r = _mm_or_si128(r, _mm_and_si128(_mm_srli_epi32(v, 16), low));
+		_mm_storeu_si128((__m128i *)d, r);
+	}
+	return i;
+}
+
+/* The result is written as 4 bytes of c, m, y, k plus alpha for each
+ * pixel, since there's no SSE2 shuffle for a 5 byte stride */
+FZ_TARGET_SSE2 static int
+fast_rgb_to_cmyk_sse2(unsigned char *d, unsigned char *s, int n, int bgr)
+{
+	__m128i ones = _mm_set1_epi32(-1);
+	__m128i low = _mm_set1_epi32(0xff);
+	int cmyk[4];
+	int i, k;
+	for (i = 0; i + 4 <= n; i += 4)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i *)s);
+		__m128i c = _mm_xor_si128(v, ones);
+		__m128i kk = _mm_min_epu8(c, _mm_min_epu8(_mm_srli_epi32(c, 8), _mm_srli_epi32(c, 16)));
+		kk = _mm_and_si128(kk, low);
+		c = _mm_subs_epu8(c, _mm_or_si128(kk, _mm_or_si128(_mm_slli_epi32(kk, 8), _mm_slli_epi32(kk, 16))));
+		if (bgr)
+			c = _mm_or_si128(_mm_or_si128(_mm_slli_epi32(_mm_and_si128(c, low), 16), _mm_and_si128(_mm_srli_epi32(c, 16), low)), _mm_and_si128(c, _mm_set1_epi32(0xff00)));
+		else
+			c = _mm_and_si128(c, _mm_set1_epi32(0xffffff));
+		c = _mm_or_si128(c, _mm_slli_epi32(kk, 24));
+		_mm_storeu_si128((__m128i *)cmyk, c);
+		for (k = 0; k < 4; k++, s += 4, d += 5)
+		{
+			memcpy(d, &cmyk[k], 4);
+			d[4] = s[3];
+		}
+	}
+	return i;
+}
+#endif
+
+static void fast_gray_to_rgb(fz_context *ctx, fz_pixmap *dst, fz_pixmap *src)
 {
 	unsigned char *s = src->samples;
 	unsigned char *d = dst->samples;
 	int n = src->w * src->h;
+#ifdef ARCH_X86
+	if (fz_cpu_flags(ctx) & FZ_CPU_SSE2)
+	{
+		int done = fast_gray_to_rgb_sse2(d, s, n);
+		s += done * 2;
+		d += done * 4;
+		n -= done;
+	}
+#endif
 	while (n--)
 	{
 		d[0] = s[0];
@@ -326,11 +452,20 @@ static void fast_gray_to_cmyk(fz_pixmap *dst, fz_pixmap *src)
 	}
 }
 
-static void fast_rgb_to_gray(fz_pixmap *dst, fz_pixmap *src)
+static void fast_rgb_to_gray(fz_context *ctx, fz_pixmap *dst, fz_pixmap *src)
 {
 	unsigned char *s = src->samples;
 	unsigned char *d = dst->samples;
 	int n = src->w * src->h;
+#ifdef ARCH_X86
+	if (fz_cpu_flags(ctx) & FZ_CPU_SSE2)
+	{
+		int done = fast_rgb_to_gray_sse2(d, s, n, 0);
+		s += done * 4;
+		d += done * 2;
+		n -= done;
+	}
+#endif
 	while (n--)
 	{
 		d[0] = ((s[0]+1) * 77 + (s[1]+1) * 150 + (s[2]+1) * 28) >> 8;
@@ -340,11 +475,20 @@ static void fast_rgb_to_gray(fz_pixmap *dst, fz_pixmap *src)
 	}
 }
 
-static void fast_bgr_to_gray(fz_pixmap *dst, fz_pixmap *src)
+static void fast_bgr_to_gray(fz_context *ctx, fz_pixmap *dst, fz_pixmap *src)
 {
 	unsigned char *s = src->samples;
 	unsigned char *d = dst->samples;
 	int n = src->w * src->h;
+#ifdef ARCH_X86
+	if (fz_cpu_flags(ctx) & FZ_CPU_SSE2)
+	{
+		int done = fast_rgb_to_gray_sse2(d, s, n, 1);
+		s += done * 4;
+		d += done * 2;
+		n -= done;
+	}
+#endif
 	while (n--)
 	{
 		d[0] = ((s[0]+1) * 28 + (s[1]+1) * 150 + (s[2]+1) * 77) >> 8;
@@ -354,11 +498,20 @@ static void fast_bgr_to_gray(fz_pixmap *dst, fz_pixmap *src)
 	}
 }
 
-static void fast_rgb_to_cmyk(fz_pixmap *dst, fz_pixmap *src)
+static void fast_rgb_to_cmyk(fz_context *ctx, fz_pixmap *dst, fz_pixmap *src)
 {
 	unsigned char *s = src->samples;
 	unsigned char *d = dst->samples;
 	int n = src->w * src->h;
+#ifdef ARCH_X86
+	if (fz_cpu_flags(ctx) & FZ_CPU_SSE2)
+	{
+		int done = fast_rgb_to_cmyk_sse2(d, s, n, 0);
+		s += done * 4;
+		d += done * 5;
+		n -= done;
+	}
+#endif
 	while (n--)
 	{
 		unsigned char c = 255 - s[0];
@@ -375,11 +528,20 @@ static void fast_rgb_to_cmyk(fz_pixmap *dst, fz_pixmap *src)
 	}
 }
 
-static void fast_bgr_to_cmyk(fz_pixmap *dst, fz_pixmap *src)
+static void fast_bgr_to_cmyk(fz_context *ctx, fz_pixmap *dst, fz_pixmap *src)
 {
 	unsigned char *s = src->samples;
 	unsigned char *d = dst->samples;
 	int n = src->w * src->h;
+#ifdef ARCH_X86
+	if (fz_cpu_flags(ctx) & FZ_CPU_SSE2)
+	{
+		int done = fast_rgb_to_cmyk_sse2(d, s, n, 1);
+		s += done * 4;
+		d += done * 5;
+		n -= done;
+	}
+#endif
 	while (n--)
 	{
 		unsigned char c = 255 - s[2];
@@ -613,6 +775,9 @@ static void fast_cmyk_to_rgb(fz_context *ctx, fz_pixmap *dst, fz_pixmap *src)
 	fast_cmyk_to_rgb_ARM(d, s, n);
 #else
 	unsigned int C,M,Y,K,r,g,b;
+#ifdef SLOWCMYK
+	int ref = fz_reference_paths(ctx) & FZ_REF_COLOR;
+#endif
 
 	C = 0;
 	M = 0;
@@ -748,15 +913,26 @@ static void fast_cmyk_to_rgb(fz_context *ctx, fz_pixmap *dst, fz_pixmap *src)
 		d[1] = g;
 		d[2] = b;
 #else
-		float cmyk[4], rgb[3];
-		cmyk[0] = s[0] / 255.0f;
-		cmyk[1] = s[1] / 255.0f;
-		cmyk[2] = s[2] / 255.0f;
-		cmyk[3] = s[3] / 255.0f;
-		cmyk_to_rgb(ctx, NULL, cmyk, rgb);
-		d[0] = rgb[0] * 255;
-		d[1] = rgb[1] * 255;
-		d[2] = rgb[2] * 255;
+		/* Runs of the same color are common, so remember the last one */
+		if (ref || s[0] != C || s[1] != M || s[2] != Y || s[3] != K)
+		{
+			float cmyk[4], rgb[3];
+			cmyk[0] = s[0] / 255.0f;
+			cmyk[1] = s[1] / 255.0f;
+			cmyk[2] = s[2] / 255.0f;
+			cmyk[3] = s[3] / 255.0f;
+			cmyk_to_rgb(ctx, NULL, cmyk, rgb);
+			r = (unsigned char)(rgb[0] * 255);
+			g = (unsigned char)(rgb[1] * 255);
+			b = (unsigned char)(rgb[2] * 255);
+			C = s[0];
+			M = s[1];
+			Y = s[2];
+			K = s[3];
+		}
+		d[0] = r;
+		d[1] = g;
+		d[2] = b;
 #endif
 #else
 		d[0] = 255 - (unsigned char)fz_mini(s[0] + s[3], 255);
@@ -775,18 +951,32 @@ static void fast_cmyk_to_bgr(fz_context *ctx, fz_pixmap *dst, fz_pixmap *src)
 	unsigned char *s = src->samples;
 	unsigned char *d = dst->samples;
 	int n = src->w * src->h;
+#ifdef SLOWCMYK
+	unsigned int C = 0, M = 0, Y = 0, K = 0, r = 255, g = 255, b = 255;
+	int ref = fz_reference_paths(ctx) & FZ_REF_COLOR;
+#endif
 	while (n--)
 	{
 #ifdef SLOWCMYK
-		float cmyk[4], rgb[3];
-		cmyk[0] = s[0] / 255.0f;
-		cmyk[1] = s[1] / 255.0f;
-		cmyk[2] = s[2] / 255.0f;
-		cmyk[3] = s[3] / 255.0f;
-		cmyk_to_rgb(ctx, NULL, cmyk, rgb);
-		d[0] = rgb[2] * 255;
-		d[1] = rgb[1] * 255;
-		d[2] = rgb[0] * 255;
+		if (ref || s[0] != C || s[1] != M || s[2] != Y || s[3] != K)
+		{
+			float cmyk[4], rgb[3];
+			cmyk[0] = s[0] / 255.0f;
+			cmyk[1] = s[1] / 255.0f;
+			cmyk[2] = s[2] / 255.0f;
+			cmyk[3] = s[3] / 255.0f;
+			cmyk_to_rgb(ctx, NULL, cmyk, rgb);
+			r = (unsigned char)(rgb[0] * 255);
+			g = (unsigned char)(rgb[1] * 255);
+			b = (unsigned char)(rgb[2] * 255);
+			C = s[0];
+			M = s[1];
+			Y = s[2];
+			K = s[3];
+		}
+		d[0] = b;
+		d[1] = g;
+		d[2] = r;
 #else
 		d[0] = 255 - (unsigned char)fz_mini(s[2] + s[3], 255);
 		d[1] = 255 - (unsigned char)fz_mini(s[1] + s[3], 255);
@@ -798,11 +988,20 @@ static void fast_cmyk_to_bgr(fz_context *ctx, fz_pixmap *dst, fz_pixmap *src)
 	}
 }
 
-static void fast_rgb_to_bgr(fz_pixmap *dst, fz_pixmap *src)
+static void fast_rgb_to_bgr(fz_context *ctx, fz_pixmap *dst, fz_pixmap *src)
 {
 	unsigned char *s = src->samples;
 	unsigned char *d = dst->samples;
 	int n = src->w * src->h;
+#ifdef ARCH_X86
+	if (fz_cpu_flags(ctx) & FZ_CPU_SSE2)
+	{
+		int done = fast_rgb_to_bgr_sse2(d, s, n);
+		s += done * 4;
+		d += done * 4;
+		n -= done;
+	}
+#endif
 	while (n--)
 	{
 		d[0] = s[2];
@@ -814,6 +1013,177 @@ static void fast_rgb_to_bgr(fz_pixmap *dst, fz_pixmap *src)
 	}
 }
 
+/*
+ * 3-d lookup table for images in 3 component colorspaces converted
+ * through functions (such as DeviceN ones with a tint transform) with
+ * more distinct colors than it takes to build the table: the conversion
+ * is sampled on a grid of LUT_GRID^3 colors, and the colors in between
+ * are interpolated tetrahedrally in fixed point. Grid values are kept
+ * with 8 extra bits, so colors on the grid come out exactly as with
+ * direct conversion. Cells where the conversion clips at some of the
+ * corners but not at all of them, or where the interpolation is off by
+ * more than one level at the center, are converted directly instead.
+ */
+#define LUT_GRID 33
+#define LUT_MIN_PIXELS (LUT_GRID * LUT_GRID * LUT_GRID * 4)
+
+/* Convert a color given in 0..255 byte space */
+static void
+lut_convert(fz_color_converter *cc, float *dstv, float x, float y, float z)
+{
+	float srcv[FZ_MAX_COLORS];
+
+	srcv[0] = x / 255.0f;
+	srcv[1] = y / 255.0f;
+	srcv[2] = z / 255.0f;
+	cc->convert(cc, dstv, srcv);
+}
+
+/* Convert xy pixels from s (in ss) to d (in ds) */
+static void
+fz_lut_conv_samples(fz_context *ctx, fz_colorspace *ds, fz_colorspace *ss, unsigned char *d, unsigned char *s, unsigned int xy)
+{
+	const int cells = LUT_GRID - 1;
+	const float step = 255.0f / cells;
+	float dstv[FZ_MAX_COLORS];
+	int pos[256], frac[256];
+	unsigned short *lut = NULL, *p;
+	unsigned char *exact = NULL;
+	int dstn = ds->n;
+	int sz = dstn, sy = sz * LUT_GRID, sx = sy * LUT_GRID;
+	int d3 = sx + sy + sz;
+	fz_color_converter cc;
+	unsigned char *sold = NULL;
+	int i, j, k, c;
+
+	fz_var(lut);
+	fz_var(exact);
+
+	fz_try(ctx)
+	{
+		lut = fz_malloc_array(ctx, LUT_GRID * LUT_GRID * LUT_GRID * dstn, sizeof(unsigned short));
+		exact = fz_malloc(ctx, cells * cells * cells);
+
+		fz_lookup_color_converter(&cc, ctx, ds, ss);
+		p = lut;
+		for (i = 0; i < LUT_GRID; i++)
+		{
+			for (j = 0; j < LUT_GRID; j++)
+			{
+				for (k = 0; k < LUT_GRID; k++)
+				{
+					lut_convert(&cc, dstv, i * step, j * step, k * step);
+					for (c = 0; c < dstn; c++)
+						*p++ = (unsigned short)(fz_clamp(dstv[c], 0, 1) * 255 * 256);
+				}
+			}
+		}
+
+		for (i = 0; i < cells; i++)
+		{
+			for (j = 0; j < cells; j++)
+			{
+				for (k = 0; k < cells; k++)
+				{
+					unsigned char *e = &exact[(i * cells + j) * cells + k];
+					p = lut + i * sx + j * sy + k * sz;
+					*e = 0;
+					for (c = 0; c < dstn && !*e; c++)
+					{
+						int clipped = 0, n;
+						for (n = 0; n < 8; n++)
+						{
+							int v = p[c + (n & 1 ? sx : 0) + (n & 2 ? sy : 0) + (n & 4 ? sz : 0)];
+							clipped += (v == 0 || v == 255 * 256);
+						}
+						*e = clipped > 0 && clipped < 8;
+					}
+					if (*e)
+						continue;
+					/* At the center, the interpolation is the mean of two opposite corners */
+					lut_convert(&cc, dstv, (i + 0.5f) * step, (j + 0.5f) * step, (k + 0.5f) * step);
+					for (c = 0; c < dstn; c++)
+						if (fabsf((p[c] + p[c + d3]) * 0.5f - fz_clamp(dstv[c], 0, 1) * 255 * 256) > 256)
+							*e = 1;
+				}
+			}
+		}
+
+		/* grid cell and 8 bit position within it for each sample value */
+		for (i = 0; i < 256; i++)
+		{
+			int v = i * (cells << 8) / 255;
+			pos[i] = fz_mini(v >> 8, cells - 1);
+			frac[i] = v - (pos[i] << 8);
+		}
+
+		for (; xy > 0; xy--)
+		{
+			int fx = frac[s[0]], fy = frac[s[1]], fz = frac[s[2]];
+			int d1, d2, f1, f2, f3;
+
+			/* same as the previous pixel? */
+			if (sold && sold[0] == s[0] && sold[1] == s[1] && sold[2] == s[2])
+			{
+				memcpy(d, d - dstn - 1, dstn);
+				d += dstn;
+				s += 3;
+				*d++ = *s++;
+				continue;
+			}
+			sold = s;
+
+			if (exact[(pos[s[0]] * cells + pos[s[1]]) * cells + pos[s[2]]])
+			{
+				lut_convert(&cc, dstv, s[0], s[1], s[2]);
+				for (c = 0; c < dstn; c++)
+					*d++ = dstv[c] * 255;
+				s += 3;
+				*d++ = *s++;
+				continue;
+			}
+
+			p = lut + pos[s[0]] * sx + pos[s[1]] * sy + pos[s[2]] * sz;
+			/* pick the tetrahedron containing the point, as offsets of
+			 * the corners along its path from p[0] to p[d3] */
+			if (fx >= fy)
+			{
+				if (fy >= fz)
+					d1 = sx, d2 = sx + sy, f1 = fx, f2 = fy, f3 = fz;
+				else if (fx >= fz)
+					d1 = sx, d2 = sx + sz, f1 = fx, f2 = fz, f3 = fy;
+				else
+					d1 = sz, d2 = sx + sz, f1 = fz, f2 = fx, f3 = fy;
+			}
+			else
+			{
+				if (fz > fy)
+					d1 = sz, d2 = sy + sz, f1 = fz, f2 = fy, f3 = fx;
+				else if (fz > fx)
+					d1 = sy, d2 = sy + sz, f1 = fy, f2 = fz, f3 = fx;
+				else
+					d1 = sy, d2 = sx + sy, f1 = fy, f2 = fx, f3 = fz;
+			}
+			for (c = 0; c < dstn; c++, p++)
+			{
+				int v = (p[0] << 8) + f1 * (p[d1] - p[0]) + f2 * (p[d2] - p[d1]) + f3 * (p[d3] - p[d2]);
+				*d++ = v >> 16;
+			}
+			s += 3;
+			*d++ = *s++;
+		}
+	}
+	fz_always(ctx)
+	{
+		fz_free(ctx, exact);
+		fz_free(ctx, lut);
+	}
+	fz_catch(ctx)
+	{
+		fz_rethrow(ctx);
+	}
+}
+
 static void
 fz_std_conv_pixmap(fz_context *ctx, fz_pixmap *dst, fz_pixmap *src)
 {
@@ -911,12 +1281,25 @@ fz_std_conv_pixmap(fz_context *ctx, fz_pixmap *dst, fz_pixmap *src)
 		unsigned char dummy = s[0] ^ 255;
 		unsigned char *sold = &dummy;
 		fz_color_converter cc;
+		int misses = 0;
+		int max_misses = -1;
+
+		/* Interpolate the rest of large images from a sampled conversion
+		 * once they've needed as many conversions as building it takes */
+		if (srcn == 3 && xy >= LUT_MIN_PIXELS && !(fz_reference_paths(ctx) & FZ_REF_COLOR))
+			max_misses = LUT_GRID * LUT_GRID * LUT_GRID;
 
 		fz_lookup_color_converter(&cc, ctx, ds, ss);
 		lookup = fz_new_hash_table(ctx, 509, srcn, -1);
 
 		for (; xy > 0; xy--)
 		{
+			if (misses == max_misses)
+			{
+				fz_lut_conv_samples(ctx, ds, ss, d, s, xy);
+				break;
+			}
+
 			if (*s == *sold && memcmp(sold,s,srcn) == 0)
 			{
 				sold = s;
@@ -943,6 +1326,7 @@ fz_std_conv_pixmap(fz_context *ctx, fz_pixmap *dst, fz_pixmap *src)
 					cc.convert(&cc, dstv, srcv);
 					for (k = 0; k < dstn; k++)
 						*d++ = dstv[k] * 255;
+					misses++;
 
 					fz_hash_insert(ctx, lookup, s - srcn, d - dstn);
 
@@ -967,25 +1351,25 @@ fz_convert_pixmap(fz_context *ctx, fz_pixmap *dp, fz_pixmap *sp)
 
 	if (ss == fz_default_gray)
 	{
-		if (ds == fz_default_rgb) fast_gray_to_rgb(dp, sp);
-		else if (ds == fz_default_bgr) fast_gray_to_rgb(dp, sp); /* bgr == rgb here */
+		if (ds == fz_default_rgb) fast_gray_to_rgb(ctx, dp, sp);
+		else if (ds == fz_default_bgr) fast_gray_to_rgb(ctx, dp, sp); /* bgr == rgb here */
 		else if (ds == fz_default_cmyk) fast_gray_to_cmyk(dp, sp);
 		else fz_std_conv_pixmap(ctx, dp, sp);
 	}
 
 	else if (ss == fz_default_rgb)
 	{
-		if (ds == fz_default_gray) fast_rgb_to_gray(dp, sp);
-		else if (ds == fz_default_bgr) fast_rgb_to_bgr(dp, sp);
-		else if (ds == fz_default_cmyk) fast_rgb_to_cmyk(dp, sp);
+		if (ds == fz_default_gray) fast_rgb_to_gray(ctx, dp, sp);
+		else if (ds == fz_default_bgr) fast_rgb_to_bgr(ctx, dp, sp);
+		else if (ds == fz_default_cmyk) fast_rgb_to_cmyk(ctx, dp, sp);
 		else fz_std_conv_pixmap(ctx, dp, sp);
 	}
 
 	else if (ss == fz_default_bgr)
 	{
-		if (ds == fz_default_gray) fast_bgr_to_gray(dp, sp);
-		else if (ds == fz_default_rgb) fast_rgb_to_bgr(dp, sp); /* bgr = rgb here */
-		else if (ds == fz_default_cmyk) fast_bgr_to_cmyk(sp, dp);
+		if (ds == fz_default_gray) fast_bgr_to_gray(ctx, dp, sp);
+		else if (ds == fz_default_rgb) fast_rgb_to_bgr(ctx, dp, sp); /* bgr = rgb here */
+		else if (ds == fz_default_cmyk) fast_bgr_to_cmyk(ctx, dp, sp);
 		else fz_std_conv_pixmap(ctx, dp, sp);
 	}
 
@@ -183,6 +183,7 @@ fz_clone_context_internal(fz_context *ctx)
 
 	/* Inherit AA defaults from old context. */
 	fz_copy_aa_context(new_ctx, ctx);
+	new_ctx->ref_paths = ctx->ref_paths;
 
 	/* Keep thread lock checking happy by copying pointers first and locking under new context */
 	new_ctx->store = ctx->store;
@@ -199,6 +200,18 @@ fz_clone_context_internal(fz_context *ctx)
 	return new_ctx;
 }
 
+int
+fz_reference_paths(fz_context *ctx)
+{
+	return ctx->ref_paths;
+}
+
+void
+fz_set_reference_paths(fz_context *ctx, int paths)
+{
+	ctx->ref_paths = paths;
+}
+
 int
 fz_gen_id(fz_context *ctx)
 {
@@ -700,9 +700,259 @@ fz_paint_affine_color_N_near(byte *dp, byte *sp, int sw, int sh, int u, int v, i
 	}
 }
 
+#ifdef ARCH_X86
+
+/*
+ * SSE2 samplers for the common cases (dst->n of 1, 2 or 4, including gray
+ * images painted into rgb, without a shape plane). Four destination pixels
+ * are handled per iteration: the source samples are gathered with scalar
+ * loads, then interpolated and composited as 16 bit lanes, reproducing
+ * lerp/bilerp and fz_mul255 exactly. Bilinear sampling of plain masks
+ * stays scalar, as there the gathers outweigh the single channel.
+ *
+ * As u and v step linearly, the pixels falling inside the image form a
+ * single run along a span; the kernels skip the leading pixels outside
+ * the image and stop at the first group which is not entirely inside,
+ * leaving the remainder to the scalar code.
+ */
+
+FZ_TARGET_SSE2 static inline __m128i
+fz_affine_mul255_epi16(__m128i a, __m128i b)
+{
+	__m128i x = _mm_add_epi16(_mm_mullo_epi16(a, b), _mm_set1_epi16(128));
+	return _mm_srli_epi16(_mm_add_epi16(x, _mm_srli_epi16(x, 8)), 8);
+}
+
+/* a + (((b - a) * t) >> 16) for 16 bit t, computed from the signed high
+ * product (corrected for t >= 0x8000) */
+FZ_TARGET_SSE2 static inline __m128i
+fz_affine_lerp_epi16(__m128i a, __m128i b, __m128i t)
+{
+	__m128i d = _mm_sub_epi16(b, a);
+	__m128i hi = _mm_mulhi_epi16(d, t);
+	hi = _mm_add_epi16(hi, _mm_and_si128(d, _mm_srai_epi16(t, 15)));
+	return _mm_add_epi16(a, hi);
+}
+
+/* Reads one source pixel in destination layout (gray is expanded to rgb) */
+static inline unsigned int
+fz_affine_load(const byte *s, int sn, int dn)
+{
+	if (sn == 4)
+		return *(const unsigned int *)s;
+	if (sn == 2 && dn == 4)
+		return (s[0] * 0x010101) | ((unsigned int)s[1] << 24);
+	if (sn == 2)
+		return s[0] | (s[1] << 8);
+	return s[0];
+}
+
+/* Packs four pixels into the low dn * 4 bytes */
+FZ_TARGET_SSE2 static inline __m128i
+fz_affine_pack(const unsigned int *p, int dn)
+{
+	if (dn == 4)
+		return _mm_set_epi32(p[3], p[2], p[1], p[0]);
+	if (dn == 2)
+		return _mm_set_epi32(0, 0, p[2] | (p[3] << 16), p[0] | (p[1] << 16));
+	return _mm_cvtsi32_si128(p[0] | (p[1] << 8) | (p[2] << 16) | (p[3] << 24));
+}
+
+/* Whether all four pixels are opaque */
+static inline int
+fz_affine_opaque(const unsigned int *p, int dn)
+{
+	unsigned int a = p[0] & p[1] & p[2] & p[3];
+	if (dn == 4)
+		return (a >> 24) == 255;
+	if (dn == 2)
+		return ((a >> 8) & 255) == 255;
+	return (a & 255) == 255;
+}
+
+/* Spreads the fractional parts of four 16.16 values over the 16 bit
+ * lanes of the components of their pixels */
+FZ_TARGET_SSE2 static inline void
+fz_affine_spread(__m128i f, int dn, __m128i *lo, __m128i *hi)
+{
+	f = _mm_and_si128(f, _mm_set1_epi32(0xffff));
+	f = _mm_or_si128(f, _mm_slli_epi32(f, 16));
+	if (dn == 4)
+	{
+		*lo = _mm_unpacklo_epi32(f, f);
+		*hi = _mm_unpackhi_epi32(f, f);
+	}
+	else
+		*lo = *hi = f;
+}
+
+/* s (premultiplied, 16 bit lanes) over d; when keep is set, pixels with a
+ * zero source alpha leave the destination untouched */
+FZ_TARGET_SSE2 static inline __m128i
+fz_affine_over_epi16(__m128i s, __m128i d, int dn, int alpha, int keep)
+{
+	__m128i a, r;
+	if (alpha != 255)
+		s = fz_affine_mul255_epi16(s, _mm_set1_epi16(alpha));
+	if (dn == 4)
+		a = _mm_shufflehi_epi16(_mm_shufflelo_epi16(s, 0xFF), 0xFF);
+	else if (dn == 2)
+		a = _mm_shufflehi_epi16(_mm_shufflelo_epi16(s, 0xF5), 0xF5);
+	else
+		a = s;
+	r = _mm_add_epi16(s, fz_affine_mul255_epi16(d, _mm_sub_epi16(_mm_set1_epi16(255), a)));
+	r = _mm_and_si128(r, _mm_set1_epi16(255));
+	if (keep)
+	{
+		__m128i z = _mm_cmpeq_epi16(a, _mm_setzero_si128());
+		r = _mm_or_si128(_mm_and_si128(z, d), _mm_andnot_si128(z, r));
+	}
+	return r;
+}
+
+FZ_TARGET_SSE2 static inline int
+fz_paint_affine_sse2(byte *dp, byte *sp, int sw, int sh, int u, int v, int fa, int fb, int w, int dn, int sn, int alpha, int dolerp)
+{
+	__m128i zero = _mm_setzero_si128();
+	unsigned int pa[4], pb[4], pc[4], pd[4];
+	int i, k, opaque;
+
+	for (i = 0; i < w; i++, u += fa, v += fb)
+	{
+		if ((u >> 16) >= 0 && (u >> 16) < sw && (v >> 16) >= 0 && (v >> 16) < sh)
+			break;
+	}
+	dp += i * dn;
+
+	for (; i + 4 <= w; i += 4, dp += 4 * dn)
+	{
+		__m128i s, slo, shi, d, dlo, dhi, ulo, uhi, vlo, vhi;
+		int u3 = (u + 3 * fa) >> 16;
+		int v3 = (v + 3 * fb) >> 16;
+		if ((u >> 16) < 0 || (u >> 16) >= sw || (v >> 16) < 0 || (v >> 16) >= sh)
+			break;
+		if (u3 < 0 || u3 >= sw || v3 < 0 || v3 >= sh)
+			break;
+
+		if (dolerp)
+		{
+			fz_affine_spread(_mm_set_epi32(u + 3 * fa, u + 2 * fa, u + fa, u), dn, &ulo, &uhi);
+			fz_affine_spread(_mm_set_epi32(v + 3 * fb, v + 2 * fb, v + fb, v), dn, &vlo, &vhi);
+		}
+
+		for (k = 0; k < 4; k++, u += fa, v += fb)
+		{
+			int ui = u >> 16;
+			int vi = v >> 16;
+			byte *row = sp + vi * sw * sn;
+			if (dolerp)
+			{
+				byte *row1 = vi + 1 < sh ? row + sw * sn : row;
+				int ui1 = ui + 1 < sw ? ui + 1 : ui;
+				pa[k] = fz_affine_load(row + ui * sn, sn, dn);
+				pb[k] = fz_affine_load(row + ui1 * sn, sn, dn);
+				pc[k] = fz_affine_load(row1 + ui * sn, sn, dn);
+				pd[k] = fz_affine_load(row1 + ui1 * sn, sn, dn);
+			}
+			else
+				pa[k] = fz_affine_load(row + ui * sn, sn, dn);
+		}
+
+		/* opaque pixels painted opaquely replace the destination */
+		opaque = alpha == 255 && fz_affine_opaque(pa, dn);
+		if (dolerp)
+			opaque = opaque && fz_affine_opaque(pb, dn) && fz_affine_opaque(pc, dn) && fz_affine_opaque(pd, dn);
+
+		s = fz_affine_pack(pa, dn);
+		slo = _mm_unpacklo_epi8(s, zero);
+		shi = _mm_unpackhi_epi8(s, zero);
+		if (dolerp)
+		{
+			__m128i b, c, d4, blo, bhi, clo, chi, dlo4, dhi4;
+			b = fz_affine_pack(pb, dn);
+			c = fz_affine_pack(pc, dn);
+			d4 = fz_affine_pack(pd, dn);
+			blo = _mm_unpacklo_epi8(b, zero); bhi = _mm_unpackhi_epi8(b, zero);
+			clo = _mm_unpacklo_epi8(c, zero); chi = _mm_unpackhi_epi8(c, zero);
+			dlo4 = _mm_unpacklo_epi8(d4, zero); dhi4 = _mm_unpackhi_epi8(d4, zero);
+			slo = fz_affine_lerp_epi16(fz_affine_lerp_epi16(slo, blo, ulo), fz_affine_lerp_epi16(clo, dlo4, ulo), vlo);
+			shi = fz_affine_lerp_epi16(fz_affine_lerp_epi16(shi, bhi, uhi), fz_affine_lerp_epi16(chi, dhi4, uhi), vhi);
+			s = _mm_packus_epi16(slo, shi);
+		}
+
+		if (opaque)
+			d = s;
+		else
+		{
+			if (dn == 4)
+				d = _mm_loadu_si128((__m128i *)dp);
+			else if (dn == 2)
+				d = _mm_loadl_epi64((__m128i *)dp);
+			else
+				d = _mm_cvtsi32_si128(*(int *)dp);
+			dlo = _mm_unpacklo_epi8(d, zero);
+			dhi = _mm_unpackhi_epi8(d, zero);
+			dlo = fz_affine_over_epi16(slo, dlo, dn, alpha, !dolerp && alpha == 255);
+			dhi = fz_affine_over_epi16(shi, dhi, dn, alpha, !dolerp && alpha == 255);
+			d = _mm_packus_epi16(dlo, dhi);
+		}
+		if (dn == 4)
+			_mm_storeu_si128((__m128i *)dp, d);
+		else if (dn == 2)
+			_mm_storel_epi64((__m128i *)dp, d);
+		else
+			*(int *)dp = _mm_cvtsi128_si32(d);
+	}
+	return i;
+}
+
+FZ_TARGET_SSE2 static int
+fz_paint_affine_lerp_sse2(byte *dp, byte *sp, int sw, int sh, int u, int v, int fa, int fb, int w, int n, int sn, int alpha)
+{
+	switch (n * 8 + sn)
+	{
+	case 2 * 8 + 2: return fz_paint_affine_sse2(dp, sp, sw, sh, u, v, fa, fb, w, 2, 2, alpha, 1);
+	case 4 * 8 + 2: return fz_paint_affine_sse2(dp, sp, sw, sh, u, v, fa, fb, w, 4, 2, alpha, 1);
+	case 4 * 8 + 4: return fz_paint_affine_sse2(dp, sp, sw, sh, u, v, fa, fb, w, 4, 4, alpha, 1);
+	}
+	return 0;
+}
+
+FZ_TARGET_SSE2 static int
+fz_paint_affine_near_sse2(byte *dp, byte *sp, int sw, int sh, int u, int v, int fa, int fb, int w, int n, int sn, int alpha)
+{
+	/* spans along a row or column of the image are left to the scalar
+	 * code, which reads them without any bounds checks */
+	if (fa == 0 || fb == 0)
+		return 0;
+	switch (n * 8 + sn)
+	{
+	case 1 * 8 + 1: return fz_paint_affine_sse2(dp, sp, sw, sh, u, v, fa, fb, w, 1, 1, alpha, 0);
+	case 2 * 8 + 2: return fz_paint_affine_sse2(dp, sp, sw, sh, u, v, fa, fb, w, 2, 2, alpha, 0);
+	case 4 * 8 + 2: return fz_paint_affine_sse2(dp, sp, sw, sh, u, v, fa, fb, w, 4, 2, alpha, 0);
+	case 4 * 8 + 4: return fz_paint_affine_sse2(dp, sp, sw, sh, u, v, fa, fb, w, 4, 4, alpha, 0);
+	}
+	return 0;
+}
+
+#define FZ_AFFINE_X86(KIND, SN) \
+	if (!hp && alpha > 0 && (fz_cpu_flags(ctx) & FZ_CPU_SSE2)) \
+	{ \
+		int done = fz_paint_affine_##KIND##_sse2(dp, sp, sw, sh, u, v, fa, fb, w, n, SN, alpha); \
+		dp += done * n; \
+		u += done * fa; \
+		v += done * fb; \
+		w -= done; \
+	}
+
+#endif /* ARCH_X86 */
+
 static void
-fz_paint_affine_lerp(byte *dp, byte *sp, int sw, int sh, int u, int v, int fa, int fb, int w, int n, int alpha, byte *color/*unused*/, byte *hp)
+fz_paint_affine_lerp(fz_context *ctx, byte *dp, byte *sp, int sw, int sh, int u, int v, int fa, int fb, int w, int n, int alpha, byte *color/*unused*/, byte *hp)
 {
+#ifdef ARCH_X86
+	FZ_AFFINE_X86(lerp, n)
+#endif
 	if (alpha == 255)
 	{
 		switch (n)
@@ -726,8 +976,11 @@ fz_paint_affine_lerp(byte *dp, byte *sp, int sw, int sh, int u, int v, int fa, i
 }
 
 static void
-fz_paint_affine_g2rgb_lerp(byte *dp, byte *sp, int sw, int sh, int u, int v, int fa, int fb, int w, int n, int alpha, byte *color/*unused*/, byte *hp)
+fz_paint_affine_g2rgb_lerp(fz_context *ctx, byte *dp, byte *sp, int sw, int sh, int u, int v, int fa, int fb, int w, int n, int alpha, byte *color/*unused*/, byte *hp)
 {
+#ifdef ARCH_X86
+	FZ_AFFINE_X86(lerp, 2)
+#endif
 	if (alpha == 255)
 	{
 		fz_paint_affine_solid_g2rgb_lerp(dp, sp, sw, sh, u, v, fa, fb, w, hp);
@@ -739,8 +992,11 @@ fz_paint_affine_g2rgb_lerp(byte *dp, byte *sp, int sw, int sh, int u, int v, int
 }
 
 static void
-fz_paint_affine_near(byte *dp, byte *sp, int sw, int sh, int u, int v, int fa, int fb, int w, int n, int alpha, byte *color/*unused */, byte *hp)
+fz_paint_affine_near(fz_context *ctx, byte *dp, byte *sp, int sw, int sh, int u, int v, int fa, int fb, int w, int n, int alpha, byte *color/*unused */, byte *hp)
 {
+#ifdef ARCH_X86
+	FZ_AFFINE_X86(near, n)
+#endif
 	if (alpha == 255)
 	{
 		switch (n)
@@ -764,8 +1020,11 @@ fz_paint_affine_near(byte *dp, byte *sp, int sw, int sh, int u, int v, int fa, i
 }
 
 static void
-fz_paint_affine_g2rgb_near(byte *dp, byte *sp, int sw, int sh, int u, int v, int fa, int fb, int w, int n, int alpha, byte *color/*unused*/, byte *hp)
+fz_paint_affine_g2rgb_near(fz_context *ctx, byte *dp, byte *sp, int sw, int sh, int u, int v, int fa, int fb, int w, int n, int alpha, byte *color/*unused*/, byte *hp)
 {
+#ifdef ARCH_X86
+	FZ_AFFINE_X86(near, 2)
+#endif
 	if (alpha == 255)
 	{
 		fz_paint_affine_solid_g2rgb_near(dp, sp, sw, sh, u, v, fa, fb, w, hp);
@@ -777,7 +1036,7 @@ fz_paint_affine_g2rgb_near(byte *dp, byte *sp, int sw, int sh, int u, int v, int
 }
 
 static void
-fz_paint_affine_color_lerp(byte *dp, byte *sp, int sw, int sh, int u, int v, int fa, int fb, int w, int n, int alpha/*unused*/, byte *color, byte *hp)
+fz_paint_affine_color_lerp(fz_context *ctx, byte *dp, byte *sp, int sw, int sh, int u, int v, int fa, int fb, int w, int n, int alpha/*unused*/, byte *color, byte *hp)
 {
 	switch (n)
 	{
@@ -788,7 +1047,7 @@ fz_paint_affine_color_lerp(byte *dp, byte *sp, int sw, int sh, int u, int v, int
 }
 
 static void
-fz_paint_affine_color_near(byte *dp, byte *sp, int sw, int sh, int u, int v, int fa, int fb, int w, int n, int alpha/*unused*/, byte *color, byte *hp)
+fz_paint_affine_color_near(fz_context *ctx, byte *dp, byte *sp, int sw, int sh, int u, int v, int fa, int fb, int w, int n, int alpha/*unused*/, byte *color, byte *hp)
 {
 	switch (n)
 	{
@@ -938,10 +1197,12 @@ fz_gridfit_matrix(fz_matrix *m)
 	}
 }
 
-/* Draw an image with an affine transform on destination */
+/* Draw an image with an affine transform on destination. If img is only
+ * a part of the image, whole gives the extent of the whole image in the
+ * pixel coordinates of img, and ctm maps the whole image. */
 
 static void
-fz_paint_image_imp(fz_pixmap *dst, const fz_irect *scissor, fz_pixmap *shape, fz_pixmap *img, const fz_matrix *ctm, byte *color, int alpha)
+fz_paint_image_imp(fz_context *ctx, fz_pixmap *dst, const fz_irect *scissor, fz_pixmap *shape, fz_pixmap *img, const fz_irect *whole, const fz_matrix *ctm, byte *color, int alpha)
 {
 	byte *dp, *sp, *hp;
 	int u, v, fa, fb, fc, fd;
@@ -949,30 +1210,34 @@ fz_paint_image_imp(fz_pixmap *dst, const fz_irect *scissor, fz_pixmap *shape, fz
 	int sw, sh, n, hw;
 	fz_irect bbox;
 	int dolerp;
-	void (*paintfn)(byte *dp, byte *sp, int sw, int sh, int u, int v, int fa, int fb, int w, int n, int alpha, byte *color, byte *hp);
+	void (*paintfn)(fz_context *ctx, byte *dp, byte *sp, int sw, int sh, int u, int v, int fa, int fb, int w, int n, int alpha, byte *color, byte *hp);
 	fz_matrix local_ctm = *ctm;
 	fz_rect rect;
 	int is_rectilinear;
+	int iw = img->w, ih = img->h;
 
-	/* grid fit the image */
-	fz_gridfit_matrix(&local_ctm);
+	if (whole)
+	{
+		iw = whole->x1 - whole->x0;
+		ih = whole->y1 - whole->y0;
+	}
 
 	/* turn on interpolation for upscaled and non-rectilinear transforms */
 	dolerp = 0;
 	is_rectilinear = fz_is_rectilinear(&local_ctm);
 	if (!is_rectilinear)
 		dolerp = 1;
-	if (sqrtf(local_ctm.a * local_ctm.a + local_ctm.b * local_ctm.b) > img->w)
+	if (sqrtf(local_ctm.a * local_ctm.a + local_ctm.b * local_ctm.b) > iw)
 		dolerp = 1;
-	if (sqrtf(local_ctm.c * local_ctm.c + local_ctm.d * local_ctm.d) > img->h)
+	if (sqrtf(local_ctm.c * local_ctm.c + local_ctm.d * local_ctm.d) > ih)
 		dolerp = 1;
 
 	/* except when we shouldn't, at large magnifications */
 	if (!img->interpolate)
 	{
-		if (sqrtf(local_ctm.a * local_ctm.a + local_ctm.b * local_ctm.b) > img->w * 2)
+		if (sqrtf(local_ctm.a * local_ctm.a + local_ctm.b * local_ctm.b) > iw * 2)
 			dolerp = 0;
-		if (sqrtf(local_ctm.c * local_ctm.c + local_ctm.d * local_ctm.d) > img->h * 2)
+		if (sqrtf(local_ctm.c * local_ctm.c + local_ctm.d * local_ctm.d) > ih * 2)
 			dolerp = 0;
 	}
 
@@ -998,7 +1263,7 @@ fz_paint_image_imp(fz_pixmap *dst, const fz_irect *scissor, fz_pixmap *shape, fz
 		return;
 
 	/* map from screen space (x,y) to image space (u,v) */
-	fz_pre_scale(&local_ctm, 1.0f / img->w, 1.0f / img->h);
+	fz_pre_scale(&local_ctm, 1.0f / iw, 1.0f / ih);
 	fz_invert_matrix(&local_ctm, &local_ctm);
 
 	fa = (int)(local_ctm.a *= 65536.0f);
@@ -1030,6 +1295,14 @@ fz_paint_image_imp(fz_pixmap *dst, const fz_irect *scissor, fz_pixmap *shape, fz
 		}
 	}
 
+	/* Move the origin to that of the part of the image we have. Doing this
+	 * last keeps the sample positions the same as for the whole image. */
+	if (whole)
+	{
+		u += whole->x0 * 65536;
+		v += whole->y0 * 65536;
+	}
+
 	dp = dst->samples + (unsigned int)(((y - dst->y) * dst->w + (x - dst->x)) * dst->n);
 	n = dst->n;
 	sp = img->samples;
@@ -1076,7 +1349,7 @@ fz_paint_image_imp(fz_pixmap *dst, const fz_irect *scissor, fz_pixmap *shape, fz
 
 	while (h--)
 	{
-		paintfn(dp, sp, sw, sh, u, v, fa, fb, w, n, alpha, color, hp);
+		paintfn(ctx, dp, sp, sw, sh, u, v, fa, fb, w, n, alpha, color, hp);
 		dp += dst->w * n;
 		hp += hw;
 		u += fc;
@@ -1085,15 +1358,15 @@ fz_paint_image_imp(fz_pixmap *dst, const fz_irect *scissor, fz_pixmap *shape, fz
 }
 
 void
-fz_paint_image_with_color(fz_pixmap *dst, const fz_irect *scissor, fz_pixmap *shape, fz_pixmap *img, const fz_matrix *ctm, byte *color)
+fz_paint_image_with_color(fz_context *ctx, fz_pixmap *dst, const fz_irect *scissor, fz_pixmap *shape, fz_pixmap *img, const fz_irect *whole, const fz_matrix *ctm, byte *color)
 {
 	assert(img->n == 1);
-	fz_paint_image_imp(dst, scissor, shape, img, ctm, color, 255);
+	fz_paint_image_imp(ctx, dst, scissor, shape, img, whole, ctm, color, 255);
 }
 
 void
-fz_paint_image(fz_pixmap *dst, const fz_irect *scissor, fz_pixmap *shape, fz_pixmap *img, const fz_matrix *ctm, int alpha)
+fz_paint_image(fz_context *ctx, fz_pixmap *dst, const fz_irect *scissor, fz_pixmap *shape, fz_pixmap *img, const fz_irect *whole, const fz_matrix *ctm, int alpha)
 {
 	assert(dst->n == img->n || (dst->n == 4 && img->n == 2));
-	fz_paint_image_imp(dst, scissor, shape, img, ctm, NULL, alpha);
+	fz_paint_image_imp(ctx, dst, scissor, shape, img, whole, ctm, NULL, alpha);
 }
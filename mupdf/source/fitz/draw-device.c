@@ -216,15 +216,15 @@ static void fz_knockout_end(fz_draw_device *dev)
 	printf(" (knockout)");
 #endif
 	if ((blendmode == 0) && (state[0].shape == state[1].shape))
-		fz_paint_pixmap(state[0].dest, state[1].dest, 255);
+		fz_paint_pixmap(ctx, state[0].dest, state[1].dest, 255);
 	else
-		fz_blend_pixmap(state[0].dest, state[1].dest, 255, blendmode, isolated, state[1].shape);
+		fz_blend_pixmap(ctx, state[0].dest, state[1].dest, 255, blendmode, isolated, state[1].shape);
 
 	fz_drop_pixmap(dev->ctx, state[1].dest);
 	if (state[0].shape != state[1].shape)
 	{
 		if (state[0].shape)
-			fz_paint_pixmap(state[0].shape, state[1].shape, 255);
+			fz_paint_pixmap(ctx, state[0].shape, state[1].shape, 255);
 		fz_drop_pixmap(dev->ctx, state[1].shape);
 	}
 #ifdef DUMP_GROUP_BLENDS
@@ -306,6 +306,21 @@ fz_draw_stroke_path(fz_device *devp, fz_path *path, fz_stroke_state *stroke, con
 	if (linewidth * expansion < FLT_EPSILON)
 		linewidth = 1 / expansion;
 
+	fz_convert_color(dev->ctx, model, colorfv, colorspace, color);
+	for (i = 0; i < model->n; i++)
+		colorbv[i] = colorfv[i] * 255;
+	colorbv[i] = alpha * 255;
+
+	/* Single hairlines and axis-aligned lines are painted directly with
+	 * exact coverage, which is what the scan converter computes in
+	 * analytic mode. Supersampling only approximates it (and rounds
+	 * thin lines to its subpixel grid), so it keeps the scan converter. */
+	if (!state->shape && !(state->blendmode & FZ_BLEND_KNOCKOUT) &&
+		fz_aa_analytic(dev->ctx) && fz_aa_level(dev->ctx) > 0 &&
+		!(fz_reference_paths(dev->ctx) & FZ_REF_STROKE) &&
+		fz_stroke_path_fast(dev->ctx, path, stroke, ctm, linewidth, &state->scissor, state->dest, colorbv))
+		return;
+
 	fz_reset_gel(dev->gel, &state->scissor);
 	if (stroke->dash_len > 0)
 		fz_flatten_dash_path(dev->gel, path, stroke, ctm, flatness, linewidth);
@@ -321,11 +336,6 @@ fz_draw_stroke_path(fz_device *devp, fz_path *path, fz_stroke_state *stroke, con
 	if (state->blendmode & FZ_BLEND_KNOCKOUT)
 		state = fz_knockout_begin(dev);
 
-	fz_convert_color(dev->ctx, model, colorfv, colorspace, color);
-	for (i = 0; i < model->n; i++)
-		colorbv[i] = colorfv[i] * 255;
-	colorbv[i] = alpha * 255;
-
 	fz_scan_convert(dev->gel, 0, &bbox, state->dest, colorbv);
 	if (state->shape)
 	{
@@ -483,7 +493,7 @@ fz_draw_clip_stroke_path(fz_device *devp, fz_path *path, const fz_rect *rect, fz
 
 
 static void
-draw_glyph(unsigned char *colorbv, fz_pixmap *dst, fz_glyph *glyph,
+draw_glyph(fz_context *ctx, unsigned char *colorbv, fz_pixmap *dst, fz_glyph *glyph,
 	int xorig, int yorig, const fz_irect *scissor)
 {
 	unsigned char *dp;
@@ -520,9 +530,9 @@ draw_glyph(unsigned char *colorbv, fz_pixmap *dst, fz_glyph *glyph,
 		while (h--)
 		{
 			if (dst->colorspace)
-				fz_paint_span_with_color(dp, mp, dst->n, w, colorbv);
+				fz_paint_span_with_color(ctx, dp, mp, dst->n, w, colorbv);
 			else
-				fz_paint_span(dp, mp, 1, w, 255);
+				fz_paint_span(ctx, dp, mp, 1, w, 255);
 			dp += dst->w * dst->n;
 			mp += msk->w;
 		}
@@ -572,14 +582,14 @@ fz_draw_fill_text(fz_device *devp, fz_text *text, const fz_matrix *ctm,
 			int y = (int)trm.f;
 			if (pixmap == NULL || pixmap->n == 1)
 			{
-				draw_glyph(colorbv, state->dest, glyph, x, y, &state->scissor);
+				draw_glyph(dev->ctx, colorbv, state->dest, glyph, x, y, &state->scissor);
 				if (state->shape)
-					draw_glyph(&shapebv, state->shape, glyph, x, y, &state->scissor);
+					draw_glyph(dev->ctx, &shapebv, state->shape, glyph, x, y, &state->scissor);
 			}
 			else
 			{
 				fz_matrix mat = {pixmap->w, 0.0, 0.0, pixmap->h, x + pixmap->x, y + pixmap->y};
-				fz_paint_image(state->dest, &state->scissor, state->shape, pixmap, &mat, alpha * 255);
+				fz_paint_image(dev->ctx, state->dest, &state->scissor, state->shape, pixmap, NULL, &mat, alpha * 255);
 			}
 			fz_drop_glyph(dev->ctx, glyph);
 		}
@@ -641,9 +651,9 @@ fz_draw_stroke_text(fz_device *devp, fz_text *text, fz_stroke_state *stroke,
 		{
 			int x = (int)trm.e;
 			int y = (int)trm.f;
-			draw_glyph(colorbv, state->dest, glyph, x, y, &state->scissor);
+			draw_glyph(dev->ctx, colorbv, state->dest, glyph, x, y, &state->scissor);
 			if (state->shape)
-				draw_glyph(colorbv, state->shape, glyph, x, y, &state->scissor);
+				draw_glyph(dev->ctx, colorbv, state->shape, glyph, x, y, &state->scissor);
 			fz_drop_glyph(dev->ctx, glyph);
 		}
 		else
@@ -749,9 +759,9 @@ fz_draw_clip_text(fz_device *devp, fz_text *text, const fz_matrix *ctm, int accu
 				{
 					int x = (int)trm.e;
 					int y = (int)trm.f;
-					draw_glyph(NULL, mask, glyph, x, y, &bbox);
+					draw_glyph(ctx, NULL, mask, glyph, x, y, &bbox);
 					if (state[1].shape)
-						draw_glyph(NULL, state[1].shape, glyph, x, y, &bbox);
+						draw_glyph(ctx, NULL, state[1].shape, glyph, x, y, &bbox);
 					fz_drop_glyph(dev->ctx, glyph);
 				}
 				else
@@ -854,9 +864,9 @@ fz_draw_clip_stroke_text(fz_device *devp, fz_text *text, fz_stroke_state *stroke
 				{
 					int x = (int)trm.e;
 					int y = (int)trm.f;
-					draw_glyph(NULL, mask, glyph, x, y, &bbox);
+					draw_glyph(ctx, NULL, mask, glyph, x, y, &bbox);
 					if (shape)
-						draw_glyph(NULL, shape, glyph, x, y, &bbox);
+						draw_glyph(ctx, NULL, shape, glyph, x, y, &bbox);
 					fz_drop_glyph(dev->ctx, glyph);
 				}
 				else
@@ -985,11 +995,11 @@ fz_draw_fill_shade(fz_device *devp, fz_shade *shade, const fz_matrix *ctm, float
 
 	if (alpha < 1)
 	{
-		fz_paint_pixmap(state->dest, dest, alpha * 255);
+		fz_paint_pixmap(dev->ctx, state->dest, dest, alpha * 255);
 		fz_drop_pixmap(dev->ctx, dest);
 		if (shape)
 		{
-			fz_paint_pixmap(state->shape, shape, alpha * 255);
+			fz_paint_pixmap(dev->ctx, state->shape, shape, alpha * 255);
 			fz_drop_pixmap(dev->ctx, shape);
 		}
 	}
@@ -1054,6 +1064,47 @@ fz_transform_pixmap(fz_draw_device *dev, fz_pixmap *image, fz_matrix *ctm, int x
 	return NULL;
 }
 
+/* When zoomed in on an image, only decode the part of it that can be
+ * seen through clip. If the pixmap holds just a part, whole is set to the
+ * extent of the whole image in the pixmap's pixel coordinates (see
+ * fz_paint_image), else it is left empty. The part is found through the
+ * matrix used for painting, so ctm is grid fitted beforehand, and *fitted
+ * is set. */
+static fz_pixmap *
+fz_new_pixmap_from_visible_image(fz_context *ctx, fz_image *image, fz_matrix *ctm, const fz_irect *clip, int dx, int dy, int *fitted, fz_irect *whole)
+{
+	fz_matrix inverse;
+	fz_rect rect;
+	fz_irect area;
+	fz_pixmap *pixmap;
+
+	*fitted = 0;
+	*whole = fz_empty_irect;
+	if (dx < image->w || dy < image->h || fz_is_infinite_irect(clip) || fz_is_empty_irect(clip))
+		return fz_new_pixmap_from_image(ctx, image, dx, dy);
+
+	fz_gridfit_matrix(ctm);
+	*fitted = 1;
+
+	fz_rect_from_irect(&rect, clip);
+	fz_transform_rect(&rect, fz_invert_matrix(&inverse, ctm));
+	/* Keep a pixel around the edges for interpolation */
+	area.x0 = (int)floorf(fz_clamp(rect.x0, 0, 1) * image->w) - 1;
+	area.y0 = (int)floorf(fz_clamp(rect.y0, 0, 1) * image->h) - 1;
+	area.x1 = (int)ceilf(fz_clamp(rect.x1, 0, 1) * image->w) + 1;
+	area.y1 = (int)ceilf(fz_clamp(rect.y1, 0, 1) * image->h) + 1;
+
+	pixmap = fz_new_pixmap_from_image_region(ctx, image, &area, dx, dy);
+	if (area.x0 != 0 || area.y0 != 0 || area.x1 != image->w || area.y1 != image->h)
+	{
+		whole->x0 = -area.x0;
+		whole->y0 = -area.y0;
+		whole->x1 = image->w - area.x0;
+		whole->y1 = image->h - area.y0;
+	}
+	return pixmap;
+}
+
 static void
 fz_draw_fill_image(fz_device *devp, fz_image *image, const fz_matrix *ctm, float alpha)
 {
@@ -1063,7 +1114,8 @@ fz_draw_fill_image(fz_device *devp, fz_image *image, const fz_matrix *ctm, float
 	fz_pixmap *pixmap;
 	fz_pixmap *orig_pixmap;
 	int after;
-	int dx, dy;
+	int dx, dy, fitted;
+	fz_irect whole;
 	fz_context *ctx = dev->ctx;
 	fz_draw_state *state = &dev->stack[dev->top];
 	fz_colorspace *model = state->dest->colorspace;
@@ -1086,7 +1138,7 @@ fz_draw_fill_image(fz_device *devp, fz_image *image, const fz_matrix *ctm, float
 	dx = sqrtf(local_ctm.a * local_ctm.a + local_ctm.b * local_ctm.b);
 	dy = sqrtf(local_ctm.c * local_ctm.c + local_ctm.d * local_ctm.d);
 
-	pixmap = fz_new_pixmap_from_image(ctx, image, dx, dy);
+	pixmap = fz_new_pixmap_from_visible_image(ctx, image, &local_ctm, &clip, dx, dy, &fitted, &whole);
 	orig_pixmap = pixmap;
 
 	/* convert images with more components (cmyk->rgb) before scaling */
@@ -1144,7 +1196,9 @@ fz_draw_fill_image(fz_device *devp, fz_image *image, const fz_matrix *ctm, float
 			}
 		}
 
-		fz_paint_image(state->dest, &state->scissor, state->shape, pixmap, &local_ctm, alpha * 255);
+		if (!fitted)
+			fz_gridfit_matrix(&local_ctm);
+		fz_paint_image(ctx, state->dest, &state->scissor, state->shape, pixmap, fz_is_empty_irect(&whole) ? NULL : &whole, &local_ctm, alpha * 255);
 
 		if (state->blendmode & FZ_BLEND_KNOCKOUT)
 			fz_knockout_end(dev);
@@ -1171,7 +1225,8 @@ fz_draw_fill_image_mask(fz_device *devp, fz_image *image, const fz_matrix *ctm,
 	fz_pixmap *scaled = NULL;
 	fz_pixmap *pixmap;
 	fz_pixmap *orig_pixmap;
-	int dx, dy;
+	int dx, dy, fitted;
+	fz_irect whole;
 	int i;
 	fz_context *ctx = dev->ctx;
 	fz_draw_state *state = &dev->stack[dev->top];
@@ -1187,7 +1242,7 @@ fz_draw_fill_image_mask(fz_device *devp, fz_image *image, const fz_matrix *ctm,
 
 	dx = sqrtf(local_ctm.a * local_ctm.a + local_ctm.b * local_ctm.b);
 	dy = sqrtf(local_ctm.c * local_ctm.c + local_ctm.d * local_ctm.d);
-	pixmap = fz_new_pixmap_from_image(ctx, image, dx, dy);
+	pixmap = fz_new_pixmap_from_visible_image(ctx, image, &local_ctm, &clip, dx, dy, &fitted, &whole);
 	orig_pixmap = pixmap;
 
 	fz_try(ctx)
@@ -1216,7 +1271,9 @@ fz_draw_fill_image_mask(fz_device *devp, fz_image *image, const fz_matrix *ctm,
 			colorbv[i] = colorfv[i] * 255;
 		colorbv[i] = alpha * 255;
 
-		fz_paint_image_with_color(state->dest, &state->scissor, state->shape, pixmap, &local_ctm, colorbv);
+		if (!fitted)
+			fz_gridfit_matrix(&local_ctm);
+		fz_paint_image_with_color(ctx, state->dest, &state->scissor, state->shape, pixmap, fz_is_empty_irect(&whole) ? NULL : &whole, &local_ctm, colorbv);
 
 		if (scaled)
 			fz_drop_pixmap(dev->ctx, scaled);
@@ -1246,7 +1303,8 @@ fz_draw_clip_image_mask(fz_device *devp, fz_image *image, const fz_rect *rect, c
 	fz_pixmap *scaled = NULL;
 	fz_pixmap *pixmap = NULL;
 	fz_pixmap *orig_pixmap = NULL;
-	int dx, dy;
+	int dx, dy, fitted;
+	fz_irect whole;
 	fz_draw_state *state = push_stack(dev);
 	fz_colorspace *model = state->dest->colorspace;
 	fz_irect clip;
@@ -1290,7 +1348,7 @@ fz_draw_clip_image_mask(fz_device *devp, fz_image *image, const fz_rect *rect, c
 
 	fz_try(ctx)
 	{
-		pixmap = fz_new_pixmap_from_image(ctx, image, dx, dy);
+		pixmap = fz_new_pixmap_from_visible_image(ctx, image, &local_ctm, &bbox, dx, dy, &fitted, &whole);
 		orig_pixmap = pixmap;
 
 		state[1].mask = mask = fz_new_pixmap_with_bbox(dev->ctx, NULL, &bbox);
@@ -1322,7 +1380,9 @@ fz_draw_clip_image_mask(fz_device *devp, fz_image *image, const fz_rect *rect, c
 			if (scaled)
 				pixmap = scaled;
 		}
-		fz_paint_image(mask, &bbox, state->shape, pixmap, &local_ctm, 255);
+		if (!fitted)
+			fz_gridfit_matrix(&local_ctm);
+		fz_paint_image(ctx, mask, &bbox, state->shape, pixmap, fz_is_empty_irect(&whole) ? NULL : &whole, &local_ctm, 255);
 	}
 	fz_always(ctx)
 	{
@@ -1364,10 +1424,10 @@ fz_draw_pop_clip(fz_device *devp)
 			fz_dump_blend(dev->ctx, state[0].shape, "/");
 		fz_dump_blend(dev->ctx, state[1].mask, " with ");
 #endif
-		fz_paint_pixmap_with_mask(state[0].dest, state[1].dest, state[1].mask);
+		fz_paint_pixmap_with_mask(ctx, state[0].dest, state[1].dest, state[1].mask);
 		if (state[0].shape != state[1].shape)
 		{
-			fz_paint_pixmap_with_mask(state[0].shape, state[1].shape, state[1].mask);
+			fz_paint_pixmap_with_mask(ctx, state[0].shape, state[1].shape, state[1].mask);
 			fz_drop_pixmap(dev->ctx, state[1].shape);
 		}
 		fz_drop_pixmap(dev->ctx, state[1].mask);
@@ -1593,15 +1653,15 @@ fz_draw_end_group(fz_device *devp)
 		printf(" (knockout)");
 #endif
 	if ((blendmode == 0) && (state[0].shape == state[1].shape))
-		fz_paint_pixmap(state[0].dest, state[1].dest, alpha * 255);
+		fz_paint_pixmap(ctx, state[0].dest, state[1].dest, alpha * 255);
 	else
-		fz_blend_pixmap(state[0].dest, state[1].dest, alpha * 255, blendmode, isolated, state[1].shape);
+		fz_blend_pixmap(ctx, state[0].dest, state[1].dest, alpha * 255, blendmode, isolated, state[1].shape);
 
 	fz_drop_pixmap(dev->ctx, state[1].dest);
 	if (state[0].shape != state[1].shape)
 	{
 		if (state[0].shape)
-			fz_paint_pixmap(state[0].shape, state[1].shape, alpha * 255);
+			fz_paint_pixmap(ctx, state[0].shape, state[1].shape, alpha * 255);
 		fz_drop_pixmap(dev->ctx, state[1].shape);
 	}
 #ifdef DUMP_GROUP_BLENDS
@@ -1694,6 +1754,7 @@ static fz_store_type fz_tile_store_type =
 	fz_keep_tile_key,
 	fz_drop_tile_key,
 	fz_cmp_tile_key,
+	FZ_STORE_CLASS_TILE,
 #ifndef NDEBUG
 	fz_debug_tile
 #endif
@@ -1906,14 +1967,14 @@ fz_draw_end_tile(fz_device *devp)
 				continue;
 			if (state[1].dest->y > 0 && state[1].dest->y + state[1].dest->h < 0)
 				continue;
-			fz_paint_pixmap_with_bbox(state[0].dest, state[1].dest, 255, state[0].scissor);
+			fz_paint_pixmap_with_bbox(ctx, state[0].dest, state[1].dest, 255, state[0].scissor);
 			if (state[1].shape)
 			{
 				/* SumatraPDF: dest and shape have the same coordinates during tiling */
 				assert(ctm.e == shapectm.e && ctm.f == shapectm.f);
 				state[1].shape->x = state[1].dest->x;
 				state[1].shape->y = state[1].dest->y;
-				fz_paint_pixmap_with_bbox(state[0].shape, state[1].shape, 255, state[0].scissor);
+				fz_paint_pixmap_with_bbox(ctx, state[0].shape, state[1].shape, 255, state[0].scissor);
 			}
 		}
 	}
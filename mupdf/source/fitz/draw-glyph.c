@@ -2,11 +2,18 @@
 #include "draw-imp.h"
 
 #define MAX_GLYPH_SIZE 256
-#define MAX_CACHE_SIZE (1024*1024)
+#define MAX_CACHE_SIZE (4*1024*1024)
 
-#define GLYPH_HASH_LEN 509
+/* The cache is split into shards, each with its own lock, hash table and
+ * LRU list, so that threads rendering different glyphs rarely wait for
+ * each other. */
+#define GLYPH_CACHE_SHARDS (FZ_LOCK_GLYPHCACHE_LAST - FZ_LOCK_GLYPHCACHE + 1)
+
+/* Initial number of hash buckets per shard; must be a power of 2 */
+#define GLYPH_HASH_LEN 64
 
 typedef struct fz_glyph_cache_entry_s fz_glyph_cache_entry;
+typedef struct fz_glyph_cache_shard_s fz_glyph_cache_shard;
 typedef struct fz_glyph_key_s fz_glyph_key;
 
 struct fz_glyph_key_s
@@ -30,95 +37,143 @@ struct fz_glyph_cache_entry_s
 	fz_glyph *val;
 };
 
-struct fz_glyph_cache_s
+struct fz_glyph_cache_shard_s
 {
-	int refs;
-	int total;
-#ifndef NDEBUG
-	int num_evictions;
-	int evicted;
-#endif
-	fz_glyph_cache_entry *entry[GLYPH_HASH_LEN];
+	int lock;
+	unsigned int total;
+	int count;
+	int hash_len;
+	fz_glyph_cache_entry **entry;
 	fz_glyph_cache_entry *lru_head;
 	fz_glyph_cache_entry *lru_tail;
+	int hits;
+	int misses;
+	int num_evictions;
+	unsigned int evicted;
+};
+
+struct fz_glyph_cache_s
+{
+	int refs;
+	unsigned int max_size;
+	fz_glyph_cache_shard shard[GLYPH_CACHE_SHARDS];
 };
 
 void
 fz_new_glyph_cache_context(fz_context *ctx)
 {
 	fz_glyph_cache *cache;
+	int i;
 
 	cache = fz_malloc_struct(ctx, fz_glyph_cache);
-	cache->total = 0;
 	cache->refs = 1;
+	cache->max_size = MAX_CACHE_SIZE;
+	/* The hash tables are allocated on first use */
+	for (i = 0; i < GLYPH_CACHE_SHARDS; i++)
+		cache->shard[i].lock = FZ_LOCK_GLYPHCACHE + i;
 
 	ctx->glyph_cache = cache;
 }
 
+/* The shard's lock is always held when this function is called. */
 static void
-drop_glyph_cache_entry(fz_context *ctx, fz_glyph_cache_entry *entry)
+drop_glyph_cache_entry(fz_context *ctx, fz_glyph_cache_shard *shard, fz_glyph_cache_entry *entry)
 {
-	fz_glyph_cache *cache = ctx->glyph_cache;
-
 	if (entry->lru_next)
 		entry->lru_next->lru_prev = entry->lru_prev;
 	else
-		cache->lru_tail = entry->lru_prev;
+		shard->lru_tail = entry->lru_prev;
 	if (entry->lru_prev)
 		entry->lru_prev->lru_next = entry->lru_next;
 	else
-		cache->lru_head = entry->lru_next;
-	cache->total -= fz_glyph_size(ctx, entry->val);
+		shard->lru_head = entry->lru_next;
+	shard->total -= fz_glyph_size(ctx, entry->val);
+	shard->count--;
 	if (entry->bucket_next)
 		entry->bucket_next->bucket_prev = entry->bucket_prev;
 	if (entry->bucket_prev)
 		entry->bucket_prev->bucket_next = entry->bucket_next;
 	else
-		cache->entry[entry->hash] = entry->bucket_next;
+		shard->entry[entry->hash & (shard->hash_len - 1)] = entry->bucket_next;
 	fz_drop_font(ctx, entry->key.font);
 	fz_drop_glyph(ctx, entry->val);
 	fz_free(ctx, entry);
 }
 
-/* The glyph cache lock is always held when this function is called. */
+/* The shard's lock is always held when this function is called. */
 static void
-do_purge(fz_context *ctx)
+do_purge(fz_context *ctx, fz_glyph_cache_shard *shard)
+{
+	while (shard->lru_head)
+		drop_glyph_cache_entry(ctx, shard, shard->lru_head);
+	shard->total = 0;
+}
+
+/* The shard's lock is always held when this function is called. */
+static void
+do_trim(fz_context *ctx, fz_glyph_cache_shard *shard, unsigned int max_size)
+{
+	while (shard->total > max_size && shard->lru_tail)
+	{
+		shard->num_evictions++;
+		shard->evicted += fz_glyph_size(ctx, shard->lru_tail->val);
+		drop_glyph_cache_entry(ctx, shard, shard->lru_tail);
+	}
+}
+
+void
+fz_purge_glyph_cache(fz_context *ctx)
 {
 	fz_glyph_cache *cache = ctx->glyph_cache;
 	int i;
 
-	for (i = 0; i < GLYPH_HASH_LEN; i++)
+	for (i = 0; i < GLYPH_CACHE_SHARDS; i++)
 	{
-		while (cache->entry[i])
-			drop_glyph_cache_entry(ctx, cache->entry[i]);
+		fz_lock(ctx, cache->shard[i].lock);
+		do_purge(ctx, &cache->shard[i]);
+		fz_unlock(ctx, cache->shard[i].lock);
 	}
-
-	cache->total = 0;
 }
 
 void
-fz_purge_glyph_cache(fz_context *ctx)
+fz_set_glyph_cache_size(fz_context *ctx, unsigned int max_size)
 {
-	fz_lock(ctx, FZ_LOCK_GLYPHCACHE);
-	do_purge(ctx);
-	fz_unlock(ctx, FZ_LOCK_GLYPHCACHE);
+	fz_glyph_cache *cache = ctx->glyph_cache;
+	int i;
+
+	cache->max_size = max_size;
+	for (i = 0; i < GLYPH_CACHE_SHARDS; i++)
+	{
+		fz_lock(ctx, cache->shard[i].lock);
+		do_trim(ctx, &cache->shard[i], max_size / GLYPH_CACHE_SHARDS);
+		fz_unlock(ctx, cache->shard[i].lock);
+	}
 }
 
 void
 fz_drop_glyph_cache_context(fz_context *ctx)
 {
-	if (!ctx->glyph_cache)
+	fz_glyph_cache *cache = ctx->glyph_cache;
+	int i, refs;
+
+	if (!cache)
 		return;
 
+	/* The first shard's lock also protects the reference count */
 	fz_lock(ctx, FZ_LOCK_GLYPHCACHE);
-	ctx->glyph_cache->refs--;
-	if (ctx->glyph_cache->refs == 0)
+	refs = --cache->refs;
+	fz_unlock(ctx, FZ_LOCK_GLYPHCACHE);
+	ctx->glyph_cache = NULL;
+	if (refs > 0)
+		return;
+
+	/* No other context can see the cache anymore */
+	for (i = 0; i < GLYPH_CACHE_SHARDS; i++)
 	{
-		do_purge(ctx);
-		fz_free(ctx, ctx->glyph_cache);
-		ctx->glyph_cache = NULL;
+		do_purge(ctx, &cache->shard[i]);
+		fz_free(ctx, cache->shard[i].entry);
 	}
-	fz_unlock(ctx, FZ_LOCK_GLYPHCACHE);
+	fz_free(ctx, cache);
 }
 
 fz_glyph_cache *
@@ -221,7 +276,7 @@ static unsigned do_hash(unsigned char *s, int len)
 }
 
 static inline void
-move_to_front(fz_glyph_cache *cache, fz_glyph_cache_entry *entry)
+move_to_front(fz_glyph_cache_shard *shard, fz_glyph_cache_entry *entry)
 {
 	if (entry->lru_prev == NULL)
 		return; /* At front already */
@@ -231,29 +286,106 @@ move_to_front(fz_glyph_cache *cache, fz_glyph_cache_entry *entry)
 	if (entry->lru_next)
 		entry->lru_next->lru_prev = entry->lru_prev;
 	else
-		cache->lru_tail = entry->lru_prev;
+		shard->lru_tail = entry->lru_prev;
 	/* Relink */
-	entry->lru_next = cache->lru_head;
+	entry->lru_next = shard->lru_head;
 	if (entry->lru_next)
 		entry->lru_next->lru_prev = entry;
-	cache->lru_head = entry;
+	shard->lru_head = entry;
 	entry->lru_prev = NULL;
 }
 
+/* The shard's lock is always held when this function is called. */
+static fz_glyph_cache_entry *
+find_glyph_cache_entry(fz_glyph_cache_shard *shard, fz_glyph_key *key, unsigned hash)
+{
+	fz_glyph_cache_entry *entry;
+
+	if (!shard->entry)
+		return NULL;
+	for (entry = shard->entry[hash & (shard->hash_len - 1)]; entry; entry = entry->bucket_next)
+		if (entry->hash == hash && memcmp(&entry->key, key, sizeof(*key)) == 0)
+			return entry;
+	return NULL;
+}
+
+/* Double the number of buckets once the chains get long. If there's not
+ * enough memory for that, the chains just keep getting longer. */
+static void
+grow_glyph_cache_shard(fz_context *ctx, fz_glyph_cache_shard *shard)
+{
+	fz_glyph_cache_entry **entries;
+	fz_glyph_cache_entry *entry;
+	int len = shard->hash_len * 2;
+
+	entries = fz_calloc_no_throw(ctx, len, sizeof(*entries));
+	if (!entries)
+		return;
+	/* Walk the LRU list backwards, so that the most recently used
+	 * entries end up at the front of their chains */
+	for (entry = shard->lru_tail; entry; entry = entry->lru_prev)
+	{
+		fz_glyph_cache_entry **head = &entries[entry->hash & (len - 1)];
+		entry->bucket_prev = NULL;
+		entry->bucket_next = *head;
+		if (*head)
+			(*head)->bucket_prev = entry;
+		*head = entry;
+	}
+	fz_free(ctx, shard->entry);
+	shard->entry = entries;
+	shard->hash_len = len;
+}
+
+/* The shard's lock is always held when this function is called. */
+static void
+insert_glyph_cache_entry(fz_context *ctx, fz_glyph_cache *cache, fz_glyph_cache_shard *shard, fz_glyph_key *key, unsigned hash, fz_glyph *val)
+{
+	fz_glyph_cache_entry *entry;
+
+	if (!shard->entry)
+	{
+		shard->entry = fz_calloc(ctx, GLYPH_HASH_LEN, sizeof(*shard->entry));
+		shard->hash_len = GLYPH_HASH_LEN;
+	}
+	else if (shard->count >= shard->hash_len * 2)
+		grow_glyph_cache_shard(ctx, shard);
+
+	entry = fz_malloc_struct(ctx, fz_glyph_cache_entry);
+	entry->key = *key;
+	entry->hash = hash;
+	entry->bucket_next = shard->entry[hash & (shard->hash_len - 1)];
+	if (entry->bucket_next)
+		entry->bucket_next->bucket_prev = entry;
+	shard->entry[hash & (shard->hash_len - 1)] = entry;
+	entry->val = fz_keep_glyph(ctx, val);
+	fz_keep_font(ctx, key->font);
+
+	entry->lru_next = shard->lru_head;
+	if (entry->lru_next)
+		entry->lru_next->lru_prev = entry;
+	else
+		shard->lru_tail = entry;
+	shard->lru_head = entry;
+
+	shard->count++;
+	shard->total += fz_glyph_size(ctx, val);
+	do_trim(ctx, shard, cache->max_size / GLYPH_CACHE_SHARDS);
+}
+
 fz_glyph *
 fz_render_glyph(fz_context *ctx, fz_font *font, int gid, fz_matrix *ctm, fz_colorspace *model, const fz_irect *scissor)
 {
 	fz_glyph_cache *cache;
+	fz_glyph_cache_shard *shard;
 	fz_glyph_key key;
 	fz_matrix subpix_ctm;
 	float size;
 	fz_glyph *val;
-	int do_cache, locked, caching;
+	int do_cache;
 	fz_glyph_cache_entry *entry;
 	unsigned hash;
 
-	fz_var(locked);
-	fz_var(caching);
 	fz_var(val);
 
 	memset(&key, 0, sizeof key);
@@ -279,123 +411,72 @@ fz_render_glyph(fz_context *ctx, fz_font *font, int gid, fz_matrix *ctm, fz_colo
 	key.b = subpix_ctm.b * 65536;
 	key.c = subpix_ctm.c * 65536;
 	key.d = subpix_ctm.d * 65536;
-	key.aa = fz_aa_level(ctx);
+	/* Type 3 glyphs depend on the scan converter as well */
+	key.aa = fz_aa_level(ctx) | (fz_aa_analytic(ctx) << 8);
 
-	fz_lock(ctx, FZ_LOCK_GLYPHCACHE);
-	hash = do_hash((unsigned char *)&key, sizeof(key)) % GLYPH_HASH_LEN;
-	entry = cache->entry[hash];
-	while (entry)
+	hash = do_hash((unsigned char *)&key, sizeof(key));
+	shard = &cache->shard[hash % GLYPH_CACHE_SHARDS];
+	/* The low bits have picked the shard, use the others for the buckets */
+	hash /= GLYPH_CACHE_SHARDS;
+
+	fz_lock(ctx, shard->lock);
+	entry = find_glyph_cache_entry(shard, &key, hash);
+	if (entry)
 	{
-		if (memcmp(&entry->key, &key, sizeof(key)) == 0)
-		{
-			move_to_front(cache, entry);
-			val = fz_keep_glyph(ctx, entry->val);
-			fz_unlock(ctx, FZ_LOCK_GLYPHCACHE);
-			return val;
-		}
-		entry = entry->bucket_next;
+		shard->hits++;
+		move_to_front(shard, entry);
+		val = fz_keep_glyph(ctx, entry->val);
+		fz_unlock(ctx, shard->lock);
+		return val;
 	}
+	shard->misses++;
+	fz_unlock(ctx, shard->lock);
+
+	/* Render without holding the lock, so that other threads can
+	 * keep using the cache in the meantime. The danger here is that
+	 * another thread will want the same glyph too, in which case
+	 * we'll both render it. We cope with this below, by ensuring
+	 * that only one gets inserted into the cache. */
+	if (font->ft_face)
+	{
+		val = fz_render_ft_glyph(ctx, font, gid, &subpix_ctm, key.aa);
+	}
+	else if (font->t3procs)
+	{
+		val = fz_render_t3_glyph(ctx, font, gid, &subpix_ctm, model, scissor);
+	}
+	else
+	{
+		fz_warn(ctx, "assert: uninitialized font structure");
+		val = NULL;
+	}
+	if (!val || !do_cache || val->w >= MAX_GLYPH_SIZE || val->h >= MAX_GLYPH_SIZE)
+		return val;
 
-	locked = 1;
-	caching = 0;
-	val = NULL;
-
+	fz_lock(ctx, shard->lock);
 	fz_try(ctx)
 	{
-		if (font->ft_face)
-		{
-			val = fz_render_ft_glyph(ctx, font, gid, &subpix_ctm, key.aa);
-		}
-		else if (font->t3procs)
+		/* If we insert ours to find one already there, we
+		 * abandon ours, and use the one there already. */
+		entry = find_glyph_cache_entry(shard, &key, hash);
+		if (entry)
 		{
-			/* We drop the glyphcache here, and execute the t3
-			 * glyph code. The danger here is that some other
-			 * thread will come along, and want the same glyph
-			 * too. If it does, we may both end up rendering
-			 * pixmaps. We cope with this later on, by ensuring
-			 * that only one gets inserted into the cache. If
-			 * we insert ours to find one already there, we
-			 * abandon ours, and use the one there already.
-			 */
-			fz_unlock(ctx, FZ_LOCK_GLYPHCACHE);
-			locked = 0;
-			val = fz_render_t3_glyph(ctx, font, gid, &subpix_ctm, model, scissor);
-			fz_lock(ctx, FZ_LOCK_GLYPHCACHE);
-			locked = 1;
+			fz_drop_glyph(ctx, val);
+			move_to_front(shard, entry);
+			val = fz_keep_glyph(ctx, entry->val);
 		}
 		else
-		{
-			fz_warn(ctx, "assert: uninitialized font structure");
-		}
-		if (val && do_cache)
-		{
-			if (val->w < MAX_GLYPH_SIZE && val->h < MAX_GLYPH_SIZE)
-			{
-				/* If we throw an exception whilst caching,
-				 * just ignore the exception and carry on. */
-				caching = 1;
-				if (!font->ft_face)
-				{
-					/* We had to unlock. Someone else might
-					 * have rendered in the meantime */
-					entry = cache->entry[hash];
-					while (entry)
-					{
-						if (memcmp(&entry->key, &key, sizeof(key)) == 0)
-						{
-							fz_drop_glyph(ctx, val);
-							move_to_front(cache, entry);
-							val = fz_keep_glyph(ctx, entry->val);
-							goto unlock_and_return_val;
-						}
-						entry = entry->bucket_next;
-					}
-				}
-
-				entry = fz_malloc_struct(ctx, fz_glyph_cache_entry);
-				entry->key = key;
-				entry->hash = hash;
-				entry->bucket_next = cache->entry[hash];
-				if (entry->bucket_next)
-					entry->bucket_next->bucket_prev = entry;
-				cache->entry[hash] = entry;
-				entry->val = fz_keep_glyph(ctx, val);
-				fz_keep_font(ctx, key.font);
-
-				entry->lru_next = cache->lru_head;
-				if (entry->lru_next)
-					entry->lru_next->lru_prev = entry;
-				else
-					cache->lru_tail = entry;
-				cache->lru_head = entry;
-
-				cache->total += fz_glyph_size(ctx, val);
-				while (cache->total > MAX_CACHE_SIZE)
-				{
-#ifndef NDEBUG
-					cache->num_evictions++;
-					cache->evicted += fz_glyph_size(ctx, cache->lru_tail->val);
-#endif
-					drop_glyph_cache_entry(ctx, cache->lru_tail);
-				}
-
-			}
-		}
-unlock_and_return_val:
-		{
-		}
+			insert_glyph_cache_entry(ctx, cache, shard, &key, hash, val);
 	}
 	fz_always(ctx)
 	{
-		if (locked)
-			fz_unlock(ctx, FZ_LOCK_GLYPHCACHE);
+		fz_unlock(ctx, shard->lock);
 	}
 	fz_catch(ctx)
 	{
-		if (caching)
-			fz_warn(ctx, "cannot encache glyph; continuing");
-		else
-			fz_rethrow(ctx);
+		/* If we throw an exception whilst caching,
+		 * just ignore the exception and carry on. */
+		fz_warn(ctx, "cannot encache glyph; continuing");
 	}
 
 	return val;
@@ -447,9 +528,24 @@ void
 fz_dump_glyph_cache_stats(fz_context *ctx)
 {
 	fz_glyph_cache *cache = ctx->glyph_cache;
+	unsigned int total = 0, evicted = 0;
+	int count = 0, hits = 0, misses = 0, num_evictions = 0;
+	int i;
+
+	for (i = 0; i < GLYPH_CACHE_SHARDS; i++)
+	{
+		fz_glyph_cache_shard *shard = &cache->shard[i];
+		fz_lock(ctx, shard->lock);
+		total += shard->total;
+		count += shard->count;
+		hits += shard->hits;
+		misses += shard->misses;
+		num_evictions += shard->num_evictions;
+		evicted += shard->evicted;
+		fz_unlock(ctx, shard->lock);
+	}
 
-	printf("Glyph Cache Size: %d\n", cache->total);
-#ifndef NDEBUG
-	printf("Glyph Cache Evictions: %d (%d bytes)\n", cache->num_evictions, cache->evicted);
-#endif
+	printf("Glyph Cache Size: %u of %u (%d glyphs)\n", total, cache->max_size, count);
+	printf("Glyph Cache Lookups: %d hits, %d misses (%.1f%% hits)\n", hits, misses, hits + misses > 0 ? 100.0 * hits / (hits + misses) : 0.0);
+	printf("Glyph Cache Evictions: %d (%u bytes)\n", num_evictions, evicted);
 }
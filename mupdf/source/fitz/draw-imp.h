@@ -20,6 +20,7 @@ void fz_scan_convert(fz_gel *gel, int eofill, const fz_irect *clip, fz_pixmap *p
 void fz_flatten_fill_path(fz_gel *gel, fz_path *path, const fz_matrix *ctm, float flatness);
 void fz_flatten_stroke_path(fz_gel *gel, fz_path *path, const fz_stroke_state *stroke, const fz_matrix *ctm, float flatness, float linewidth);
 void fz_flatten_dash_path(fz_gel *gel, fz_path *path, const fz_stroke_state *stroke, const fz_matrix *ctm, float flatness, float linewidth);
+int fz_stroke_path_fast(fz_context *ctx, fz_path *path, const fz_stroke_state *stroke, const fz_matrix *ctm, float linewidth, const fz_irect *clip, fz_pixmap *dst, unsigned char *colorbv);
 
 fz_irect *fz_bound_path_accurate(fz_context *ctx, fz_irect *bbox, const fz_irect *scissor, fz_path *path, const fz_stroke_state *stroke, const fz_matrix *ctm, float flatness, float linewidth);
 
@@ -28,21 +29,62 @@ fz_irect *fz_bound_path_accurate(fz_context *ctx, fz_irect *bbox, const fz_irect
  */
 
 void fz_paint_solid_alpha(unsigned char * restrict dp, int w, int alpha);
-void fz_paint_solid_color(unsigned char * restrict dp, int n, int w, unsigned char *color);
+void fz_paint_solid_color(fz_context *ctx, unsigned char * restrict dp, int n, int w, unsigned char *color);
 
-void fz_paint_span(unsigned char * restrict dp, unsigned char * restrict sp, int n, int w, int alpha);
-void fz_paint_span_with_color(unsigned char * restrict dp, unsigned char * restrict mp, int n, int w, unsigned char *color);
+void fz_paint_span(fz_context *ctx, unsigned char * restrict dp, unsigned char * restrict sp, int n, int w, int alpha);
+void fz_paint_span_with_color(fz_context *ctx, unsigned char * restrict dp, unsigned char * restrict mp, int n, int w, unsigned char *color);
 
-void fz_paint_image(fz_pixmap *dst, const fz_irect *scissor, fz_pixmap *shape, fz_pixmap *img, const fz_matrix *ctm, int alpha);
-void fz_paint_image_with_color(fz_pixmap *dst, const fz_irect *scissor, fz_pixmap *shape, fz_pixmap *img, const fz_matrix *ctm, unsigned char *colorbv);
+/* The image matrix is expected to be grid fitted (see fz_gridfit_matrix).
+ * If img is only part of the image, whole is the extent of the whole image
+ * in the pixel coordinates of img (and the matrix maps the whole image);
+ * otherwise whole is NULL. */
+void fz_paint_image(fz_context *ctx, fz_pixmap *dst, const fz_irect *scissor, fz_pixmap *shape, fz_pixmap *img, const fz_irect *whole, const fz_matrix *ctm, int alpha);
+void fz_paint_image_with_color(fz_context *ctx, fz_pixmap *dst, const fz_irect *scissor, fz_pixmap *shape, fz_pixmap *img, const fz_irect *whole, const fz_matrix *ctm, unsigned char *colorbv);
 
-void fz_paint_pixmap(fz_pixmap *dst, fz_pixmap *src, int alpha);
-void fz_paint_pixmap_with_mask(fz_pixmap *dst, fz_pixmap *src, fz_pixmap *msk);
-void fz_paint_pixmap_with_bbox(fz_pixmap *dst, fz_pixmap *src, int alpha, fz_irect bbox);
+void fz_paint_pixmap(fz_context *ctx, fz_pixmap *dst, fz_pixmap *src, int alpha);
+void fz_paint_pixmap_with_mask(fz_context *ctx, fz_pixmap *dst, fz_pixmap *src, fz_pixmap *msk);
+void fz_paint_pixmap_with_bbox(fz_context *ctx, fz_pixmap *dst, fz_pixmap *src, int alpha, fz_irect bbox);
 
-void fz_blend_pixmap(fz_pixmap *dst, fz_pixmap *src, int alpha, int blendmode, int isolated, fz_pixmap *shape);
+void fz_blend_pixmap(fz_context *ctx, fz_pixmap *dst, fz_pixmap *src, int alpha, int blendmode, int isolated, fz_pixmap *shape);
 void fz_blend_pixel(unsigned char dp[3], unsigned char bp[3], unsigned char sp[3], int blendmode);
 
 void fz_paint_glyph(unsigned char *colorbv, fz_pixmap *dst, unsigned char *dp, fz_glyph *glyph, int w, int h, int skip_x, int skip_y);
 
+/*
+ * SIMD support (see ARCH_X86 in system.h).
+ *
+ * Functions compiled with FZ_TARGET_SSE2 resp. FZ_TARGET_AVX2 may only
+ * be called if fz_cpu_flags reports support for that instruction set.
+ * The scalar code remains the reference for all SIMD code paths, which
+ * must produce byte-identical results. fz_cpu_flags reports no support
+ * at all for contexts using FZ_REF_SIMD.
+ */
+
+#ifdef ARCH_X86
+
+#include <emmintrin.h>
+#ifdef ARCH_X86_AVX2
+#include <immintrin.h>
+#endif
+
+#ifdef _MSC_VER
+#define FZ_TARGET_SSE2
+#define FZ_TARGET_AVX2
+#else
+#define FZ_TARGET_SSE2 __attribute__((target("sse2")))
+#define FZ_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+enum
+{
+	FZ_CPU_SSE2 = 1,
+	FZ_CPU_SSSE3 = 2,
+	FZ_CPU_SSE41 = 4,
+	FZ_CPU_AVX2 = 8
+};
+
+int fz_cpu_flags(fz_context *ctx);
+
+#endif
+
 #endif
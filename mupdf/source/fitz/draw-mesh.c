@@ -3,7 +3,59 @@
 
 enum { MAXN = 2 + FZ_MAX_COLORS };
 
-static void paint_scan(fz_pixmap *restrict pix, int y, int fx0, int fx1, int cx0, int cx1, const int *restrict v0, const int *restrict v1, int n)
+#ifdef ARCH_X86
+
+/* The SSE2 scan painters reproduce the scalar 16.16 stepping exactly:
+ * every lane holds c + i * dc and the low byte of c >> 16 is stored. */
+
+FZ_TARGET_SSE2 static int
+paint_scan_1_sse2(unsigned char *p, int c, int dc, int w)
+{
+	__m128i cv = _mm_set_epi32(c + 3 * dc, c + 2 * dc, c + dc, c);
+	__m128i step = _mm_set1_epi32(4 * dc);
+	__m128i low = _mm_set1_epi32(0xff);
+	__m128i alpha = _mm_set1_epi16((short)0xff00);
+	int i;
+	for (i = 0; i + 8 <= w; i += 8, p += 16)
+	{
+		__m128i lo = _mm_and_si128(_mm_srai_epi32(cv, 16), low);
+		__m128i hi;
+		cv = _mm_add_epi32(cv, step);
+		hi = _mm_and_si128(_mm_srai_epi32(cv, 16), low);
+		cv = _mm_add_epi32(cv, step);
+		_mm_storeu_si128((__m128i *)p, _mm_or_si128(_mm_packs_epi32(lo, hi), alpha));
+	}
+	return i;
+}
+
+FZ_TARGET_SSE2 static int
+paint_scan_3_sse2(unsigned char *p, const int *c, const int *dc, int w)
+{
+	__m128i cv = _mm_set_epi32(0, c[2], c[1], c[0]);
+	__m128i dv = _mm_set_epi32(0, dc[2], dc[1], dc[0]);
+	__m128i low = _mm_set1_epi32(0xff);
+	__m128i alpha = _mm_set1_epi32(0xff000000);
+	int i;
+	for (i = 0; i + 4 <= w; i += 4, p += 16)
+	{
+		__m128i v0 = _mm_and_si128(_mm_srai_epi32(cv, 16), low);
+		__m128i v1, v2, v3;
+		cv = _mm_add_epi32(cv, dv);
+		v1 = _mm_and_si128(_mm_srai_epi32(cv, 16), low);
+		cv = _mm_add_epi32(cv, dv);
+		v2 = _mm_and_si128(_mm_srai_epi32(cv, 16), low);
+		cv = _mm_add_epi32(cv, dv);
+		v3 = _mm_and_si128(_mm_srai_epi32(cv, 16), low);
+		cv = _mm_add_epi32(cv, dv);
+		v0 = _mm_packus_epi16(_mm_packs_epi32(v0, v1), _mm_packs_epi32(v2, v3));
+		_mm_storeu_si128((__m128i *)p, _mm_or_si128(v0, alpha));
+	}
+	return i;
+}
+
+#endif /* ARCH_X86 */
+
+static void paint_scan(fz_context *ctx, fz_pixmap *restrict pix, int y, int fx0, int fx1, int cx0, int cx1, const int *restrict v0, const int *restrict v1, int n)
 {
 	unsigned char *p;
 	int c[MAXN], dc[MAXN];
@@ -42,6 +94,16 @@ static void paint_scan(fz_pixmap *restrict pix, int y, int fx0, int fx1, int cx0
 	}
 
 	p = pix->samples + ((x0 - pix->x) + (y - pix->y) * pix->w) * pix->n;
+#ifdef ARCH_X86
+	if ((n == 1 || n == 3) && (fz_cpu_flags(ctx) & FZ_CPU_SSE2))
+	{
+		int done = n == 1 ? paint_scan_1_sse2(p, c[0], dc[0], w) : paint_scan_3_sse2(p, c, dc, w);
+		p += done * (n + 1);
+		for (k = 0; k < n; k++)
+			c[k] += dc[k] * done;
+		w -= done;
+	}
+#endif
 	while (w--)
 	{
 		for (k = 0; k < n; k++)
@@ -93,7 +155,7 @@ static inline void step_edge(edge_data *edge, int n)
 }
 
 static void
-fz_paint_triangle(fz_pixmap *pix, float v[3][MAXN], int n, const fz_irect *bbox)
+fz_paint_triangle(fz_context *ctx, fz_pixmap *pix, float v[3][MAXN], int n, const fz_irect *bbox)
 {
 	edge_data e0, e1;
 	int top, mid, bot;
@@ -129,7 +191,7 @@ fz_paint_triangle(fz_pixmap *pix, float v[3][MAXN], int n, const fz_irect *bbox)
 
 		do
 		{
-			paint_scan(pix, y, (int)e0.x, (int)e1.x, minx, maxx, &e0.v[0], &e1.v[0], n);
+			paint_scan(ctx, pix, y, (int)e0.x, (int)e1.x, minx, maxx, &e0.v[0], &e1.v[0], n);
 			step_edge(&e0, n);
 			step_edge(&e1, n);
 			y ++;
@@ -144,7 +206,7 @@ fz_paint_triangle(fz_pixmap *pix, float v[3][MAXN], int n, const fz_irect *bbox)
 
 		do
 		{
-			paint_scan(pix, y, (int)e0.x, (int)e1.x, minx, maxx, &e0.v[0], &e1.v[0], n);
+			paint_scan(ctx, pix, y, (int)e0.x, (int)e1.x, minx, maxx, &e0.v[0], &e1.v[0], n);
 			y ++;
 			if (y >= y1)
 				break;
@@ -198,22 +260,195 @@ do_paint_tri(void *arg, fz_vertex *av, fz_vertex *bv, fz_vertex *cv)
 				ltri[i + 2] *= 255;
 		}
 	}
-	fz_paint_triangle(dest, local, 2 + dest->colorspace->n, ptd->bbox);
+	fz_paint_triangle(ctx, dest, local, 2 + dest->colorspace->n, ptd->bbox);
+}
+
+/* Expands the sampled shading function into a 1D color ramp in the
+ * destination colorspace, premultiplied and indexed by t * 255. */
+static void
+fz_make_shade_ramp(fz_context *ctx, fz_shade *shade, fz_colorspace *cs, unsigned char ramp[256][FZ_MAX_COLORS + 1])
+{
+	fz_color_converter cc;
+	float color[FZ_MAX_COLORS];
+	int i, k, v, a;
+
+	fz_lookup_color_converter(&cc, ctx, cs, shade->colorspace);
+	for (i = 0; i < 256; i++)
+	{
+		cc.convert(&cc, color, shade->function[i]);
+		a = (unsigned char)(shade->function[i][shade->colorspace->n] * 255);
+		for (k = 0; k < cs->n; k++)
+		{
+			v = (unsigned char)(color[k] * 255);
+			ramp[i][k] = fz_mul255(v, a);
+		}
+		ramp[i][k] = a;
+	}
+}
+
+static inline int
+fz_radial_t(float ex, float ey, const float *coef, float r0, float dr, const int *extend, float *t)
+{
+	/* Find the largest s for which the circle interpolated between
+	 * the start and end circles passes through e (relative to the
+	 * start center) with a non-negative radius. */
+	float a = coef[0];
+	float b = ex * coef[1] + ey * coef[2] + r0 * dr;
+	float c = ex * ex + ey * ey - r0 * r0;
+	float s0, s1, d;
+
+	if (a == 0)
+	{
+		if (b == 0)
+			return 0;
+		s0 = s1 = c / (2 * b);
+	}
+	else
+	{
+		d = b * b - a * c;
+		if (d < 0)
+			return 0;
+		d = sqrtf(d);
+		s0 = (b + d) * coef[3];
+		s1 = (b - d) * coef[3];
+		if (s1 > s0)
+		{
+			d = s0; s0 = s1; s1 = d;
+		}
+	}
+
+	if (r0 + s0 * dr >= 0 && (s0 >= 0 || extend[0]) && (s0 <= 1 || extend[1]))
+		*t = s0;
+	else if (r0 + s1 * dr >= 0 && (s1 >= 0 || extend[0]) && (s1 <= 1 || extend[1]))
+		*t = s1;
+	else
+		return 0;
+	return 1;
+}
+
+/* Axial and radial shadings are evaluated directly at every pixel center
+ * (through the inverse transform) and looked up in the color ramp, one row
+ * at a time, instead of being meshed into triangles and converted via an
+ * intermediate pixmap. Returns 0 for degenerate shadings, which are left
+ * to the mesh code. */
+static int
+fz_paint_linear_or_radial(fz_context *ctx, fz_shade *shade, const fz_matrix *ctm, fz_pixmap *dest, const fz_irect *bbox, unsigned char ramp[256][FZ_MAX_COLORS + 1])
+{
+	const int *extend = shade->u.l_or_r.extend;
+	float x0 = shade->u.l_or_r.coords[0][0];
+	float y0 = shade->u.l_or_r.coords[0][1];
+	float r0 = shade->u.l_or_r.coords[0][2];
+	float dx = shade->u.l_or_r.coords[1][0] - x0;
+	float dy = shade->u.l_or_r.coords[1][1] - y0;
+	float dr = shade->u.l_or_r.coords[1][2] - r0;
+	float coef[4], det, px, py, ex, ey, t;
+	unsigned char *buf, *dp;
+	fz_irect area;
+	fz_matrix inv;
+	int x, y, w, n, end;
+	int *idx;
+
+	det = ctm->a * ctm->d - ctm->b * ctm->c;
+	if (fabsf(det) <= FLT_EPSILON)
+		return 0;
+	fz_invert_matrix(&inv, ctm);
+
+	if (shade->type == FZ_LINEAR)
+	{
+		float dd = dx * dx + dy * dy;
+		if (dd <= FLT_EPSILON)
+			return 0;
+		/* t is affine in device space: t = x * coef[0] + y * coef[1] + coef[2] */
+		coef[0] = (inv.a * dx + inv.b * dy) / dd;
+		coef[1] = (inv.c * dx + inv.d * dy) / dd;
+		coef[2] = ((inv.e - x0) * dx + (inv.f - y0) * dy) / dd;
+	}
+	else
+	{
+		if (dx == 0 && dy == 0 && dr == 0)
+			return 0;
+		coef[0] = dx * dx + dy * dy - dr * dr;
+		coef[1] = dx;
+		coef[2] = dy;
+		coef[3] = coef[0] != 0 ? 1 / coef[0] : 0;
+	}
+
+	fz_pixmap_bbox_no_ctx(dest, &area);
+	fz_intersect_irect(&area, bbox);
+	if (area.x1 <= area.x0 || area.y1 <= area.y0)
+		return 1;
+
+	n = dest->n;
+	w = area.x1 - area.x0;
+	idx = fz_malloc(ctx, w * (sizeof(int) + n));
+	buf = (unsigned char *)(idx + w);
+
+	for (y = area.y0; y < area.y1; y++)
+	{
+		/* First map the row to ramp indices (-1 where not covered) */
+		px = area.x0 + 0.5f;
+		py = y + 0.5f;
+		if (shade->type == FZ_LINEAR)
+		{
+			float t0 = px * coef[0] + py * coef[1] + coef[2];
+			for (x = 0; x < w; x++)
+			{
+				t = t0 + x * coef[0];
+				if (t < 0)
+					idx[x] = extend[0] ? 0 : -1;
+				else if (t > 1)
+					idx[x] = extend[1] ? 255 : -1;
+				else
+					idx[x] = (int)(t * 255);
+			}
+		}
+		else
+		{
+			ex = px * inv.a + py * inv.c + inv.e - x0;
+			ey = px * inv.b + py * inv.d + inv.f - y0;
+			for (x = 0; x < w; x++, ex += inv.a, ey += inv.b)
+			{
+				if (fz_radial_t(ex, ey, coef, r0, dr, extend, &t))
+					idx[x] = (int)(fz_clamp(t, 0, 1) * 255);
+				else
+					idx[x] = -1;
+			}
+		}
+
+		/* Then paint the covered runs */
+		dp = dest->samples + (unsigned int)(((area.x0 - dest->x) + (y - dest->y) * dest->w) * n);
+		for (x = 0; x < w; x = end)
+		{
+			while (x < w && idx[x] < 0)
+				x++;
+			for (end = x; end < w && idx[end] >= 0; end++)
+			{
+				if (n == 4)
+					memcpy(buf + (end - x) * 4, ramp[idx[end]], 4);
+				else
+					memcpy(buf + (end - x) * n, ramp[idx[end]], n);
+			}
+			if (end > x)
+				fz_paint_span(ctx, dp + x * n, buf, n, end - x, 255);
+		}
+	}
+
+	fz_free(ctx, idx);
+	return 1;
 }
 
 void
 fz_paint_shade(fz_context *ctx, fz_shade *shade, const fz_matrix *ctm, fz_pixmap *dest, const fz_irect *bbox)
 {
-	unsigned char clut[256][FZ_MAX_COLORS];
+	unsigned char ramp[256][FZ_MAX_COLORS + 1];
 	fz_pixmap *temp = NULL;
-	fz_pixmap *conv = NULL;
-	float color[FZ_MAX_COLORS];
+	unsigned char *buf = NULL;
 	struct paint_tri_data ptd;
-	int i, k;
+	int x, y, n;
 	fz_matrix local_ctm;
 
 	fz_var(temp);
-	fz_var(conv);
+	fz_var(buf);
 
 	fz_try(ctx)
 	{
@@ -221,16 +456,11 @@ fz_paint_shade(fz_context *ctx, fz_shade *shade, const fz_matrix *ctm, fz_pixmap
 
 		if (shade->use_function)
 		{
-			fz_color_converter cc;
-			fz_lookup_color_converter(&cc, ctx, dest->colorspace, shade->colorspace);
-			for (i = 0; i < 256; i++)
-			{
-				cc.convert(&cc, color, shade->function[i]);
-				for (k = 0; k < dest->colorspace->n; k++)
-					clut[i][k] = color[k] * 255;
-				clut[i][k] = shade->function[i][shade->colorspace->n] * 255;
-			}
-			conv = fz_new_pixmap_with_bbox(ctx, dest->colorspace, bbox);
+			fz_make_shade_ramp(ctx, shade, dest->colorspace, ramp);
+			if ((shade->type == FZ_LINEAR || shade->type == FZ_RADIAL) &&
+				!(fz_reference_paths(ctx) & FZ_REF_SHADE) &&
+				fz_paint_linear_or_radial(ctx, shade, &local_ctm, dest, bbox, ramp))
+				break;
 			temp = fz_new_pixmap_with_bbox(ctx, fz_device_gray(ctx), bbox);
 			fz_clear_pixmap(ctx, temp);
 		}
@@ -248,26 +478,46 @@ fz_paint_shade(fz_context *ctx, fz_shade *shade, const fz_matrix *ctm, fz_pixmap
 
 		if (shade->use_function)
 		{
-			unsigned char *s = temp->samples;
-			unsigned char *d = conv->samples;
-			int len = temp->w * temp->h;
-			while (len--)
+			/* Map t through the ramp and composite one row at a time */
+			fz_irect area;
+			unsigned char *s, *d, *dp;
+			int a, k;
+
+			fz_pixmap_bbox_no_ctx(dest, &area);
+			fz_intersect_irect(&area, bbox);
+			if (area.x1 <= area.x0 || area.y1 <= area.y0)
+				break;
+			n = dest->n;
+			buf = fz_malloc(ctx, (area.x1 - area.x0) * n);
+			for (y = area.y0; y < area.y1; y++)
 			{
-				int v = *s++;
-				int a = fz_mul255(*s++, clut[v][conv->n - 1]);
-				for (k = 0; k < conv->n - 1; k++)
-					*d++ = fz_mul255(clut[v][k], a);
-				*d++ = a;
+				s = temp->samples + (unsigned int)(((area.x0 - temp->x) + (y - temp->y) * temp->w) * 2);
+				dp = dest->samples + (unsigned int)(((area.x0 - dest->x) + (y - dest->y) * dest->w) * n);
+				d = buf;
+				for (x = area.x0; x < area.x1; x++, s += 2, d += n)
+				{
+					if (s[1] == 255)
+						memcpy(d, ramp[s[0]], n);
+					else
+					{
+						a = fz_mul255(s[1], ramp[s[0]][n - 1]);
+						for (k = 0; k < n - 1; k++)
+							d[k] = fz_mul255(ramp[s[0]][k], s[1]);
+						d[k] = a;
+					}
+				}
+				fz_paint_span(ctx, dp, buf, n, area.x1 - area.x0, 255);
 			}
-			fz_paint_pixmap(dest, conv, 255);
-			fz_drop_pixmap(ctx, conv);
-			fz_drop_pixmap(ctx, temp);
 		}
 	}
+	fz_always(ctx)
+	{
+		fz_free(ctx, buf);
+		if (shade->use_function)
+			fz_drop_pixmap(ctx, temp);
+	}
 	fz_catch(ctx)
 	{
-		fz_drop_pixmap(ctx, conv);
-		fz_drop_pixmap(ctx, temp);
 		fz_rethrow(ctx);
 	}
 }
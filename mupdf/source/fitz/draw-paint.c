@@ -73,6 +73,356 @@ and stick to using the premultiplied form.
 
 typedef unsigned char byte;
 
+#ifdef ARCH_X86
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+
+/*
+ * Runtime CPU detection for the SIMD code paths.
+ */
+
+static void
+fz_cpuid(int leaf, int regs[4])
+{
+#ifdef _MSC_VER
+#ifdef ARCH_X86_AVX2
+	__cpuidex(regs, leaf, 0);
+#else
+	__cpuid(regs, leaf);
+#endif
+#else
+	__cpuid_count(leaf, 0, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+#ifdef ARCH_X86_AVX2
+/* whether the OS saves the SSE and AVX registers on context switches */
+static int
+fz_os_supports_avx(void)
+{
+#ifdef _MSC_VER
+	return (_xgetbv(0) & 6) == 6;
+#else
+	unsigned int eax, edx;
+	__asm__ (".byte 0x0f, 0x01, 0xd0" : "=a" (eax), "=d" (edx) : "c" (0));
+	return (eax & 6) == 6;
+#endif
+}
+#endif
+
+int
+fz_cpu_flags(fz_context *ctx)
+{
+	/* racing threads will all arrive at the same value */
+	static int flags = -1;
+	if (flags < 0)
+	{
+		int regs[4], max_leaf, f = 0;
+		fz_cpuid(0, regs);
+		max_leaf = regs[0];
+		if (max_leaf >= 1)
+		{
+			fz_cpuid(1, regs);
+			if (regs[3] & (1 << 26))
+				f |= FZ_CPU_SSE2;
+			if (regs[2] & (1 << 9))
+				f |= FZ_CPU_SSSE3;
+			if (regs[2] & (1 << 19))
+				f |= FZ_CPU_SSE41;
+#ifdef ARCH_X86_AVX2
+			/* AVX2 requires OSXSAVE, AVX and OS support for the YMM registers */
+			if ((regs[2] & (1 << 27)) && (regs[2] & (1 << 28)) && max_leaf >= 7 && fz_os_supports_avx())
+			{
+				fz_cpuid(7, regs);
+				if (regs[1] & (1 << 5))
+					f |= FZ_CPU_AVX2;
+			}
+#endif
+		}
+		flags = f;
+	}
+	/* the scalar code is the reference for all SIMD kernels */
+	if (fz_reference_paths(ctx) & FZ_REF_SIMD)
+		return 0;
+	return flags;
+}
+
+/*
+ * SSE2 and AVX2 versions of the span painters for n == 4.
+ *
+ * All pixel values are unpacked to 16 bit lanes, so the FZ_* macros
+ * can be evaluated exactly as in the scalar code: their intermediate
+ * results never exceed 16 bits (or are truncated to the lower 8 bits
+ * just like when the scalar code stores them). Each function returns
+ * the number of pixels painted, leaving the rest to the scalar code.
+ */
+
+#define FZ_EXPAND_EPI16(A) _mm_add_epi16((A), _mm_srli_epi16((A), 7))
+#define FZ_COMBINE_EPI16(A,B) _mm_srli_epi16(_mm_mullo_epi16((A), (B)), 8)
+#define FZ_BLEND_EPI16(SRC,DST,AMOUNT) _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(_mm_sub_epi16((SRC), (DST)), (AMOUNT)), _mm_slli_epi16((DST), 8)), 8)
+/* broadcast each pixel's alpha to all of the pixel's lanes */
+#define FZ_ALPHA_EPI16(A) _mm_shufflehi_epi16(_mm_shufflelo_epi16((A), 0xFF), 0xFF)
+
+/* loads 4 mask values as 32 bit integers */
+#define FZ_LOAD_MASK4_EPI32(MP, ZERO) _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(*(const int *)(MP)), (ZERO)), (ZERO))
+
+FZ_TARGET_SSE2 static int
+fz_paint_solid_color_4_sse2(byte * restrict dp, int w, byte *color, int sa)
+{
+	__m128i zero = _mm_setzero_si128();
+	__m128i c = _mm_set_epi16(255, color[2], color[1], color[0], 255, color[2], color[1], color[0]);
+	__m128i a = _mm_set1_epi16((short)sa);
+	int i;
+	for (i = 0; i + 4 <= w; i += 4, dp += 16)
+	{
+		__m128i d = _mm_loadu_si128((__m128i *)dp);
+		__m128i lo = FZ_BLEND_EPI16(c, _mm_unpacklo_epi8(d, zero), a);
+		__m128i hi = FZ_BLEND_EPI16(c, _mm_unpackhi_epi8(d, zero), a);
+		_mm_storeu_si128((__m128i *)dp, _mm_packus_epi16(lo, hi));
+	}
+	return i;
+}
+
+FZ_TARGET_SSE2 static int
+fz_paint_span_with_color_4_sse2(byte * restrict dp, byte * restrict mp, int w, byte *color, int sa)
+{
+	__m128i zero = _mm_setzero_si128();
+	__m128i c = _mm_set_epi16(255, color[2], color[1], color[0], 255, color[2], color[1], color[0]);
+	__m128i a = _mm_set1_epi16((short)sa);
+	int i;
+	for (i = 0; i + 4 <= w; i += 4, dp += 16, mp += 4)
+	{
+		__m128i d = _mm_loadu_si128((__m128i *)dp);
+		__m128i ma = FZ_EXPAND_EPI16(FZ_LOAD_MASK4_EPI32(mp, zero));
+		__m128i lo, hi;
+		if (sa != 256)
+			ma = FZ_COMBINE_EPI16(ma, a);
+		ma = _mm_or_si128(ma, _mm_slli_epi32(ma, 16));
+		lo = FZ_BLEND_EPI16(c, _mm_unpacklo_epi8(d, zero), _mm_unpacklo_epi32(ma, ma));
+		hi = FZ_BLEND_EPI16(c, _mm_unpackhi_epi8(d, zero), _mm_unpackhi_epi32(ma, ma));
+		_mm_storeu_si128((__m128i *)dp, _mm_packus_epi16(lo, hi));
+	}
+	return i;
+}
+
+FZ_TARGET_SSE2 static int
+fz_paint_span_with_mask_4_sse2(byte * restrict dp, byte * restrict sp, byte * restrict mp, int w)
+{
+	__m128i zero = _mm_setzero_si128();
+	__m128i c255 = _mm_set1_epi16(255);
+	int i;
+	for (i = 0; i + 4 <= w; i += 4, dp += 16, sp += 16, mp += 4)
+	{
+		__m128i d = _mm_loadu_si128((__m128i *)dp);
+		__m128i s = _mm_loadu_si128((__m128i *)sp);
+		__m128i ma = FZ_EXPAND_EPI16(FZ_LOAD_MASK4_EPI32(mp, zero));
+		__m128i slo = _mm_unpacklo_epi8(s, zero), shi = _mm_unpackhi_epi8(s, zero);
+		__m128i malo, mahi, masa, lo, hi;
+		ma = _mm_or_si128(ma, _mm_slli_epi32(ma, 16));
+		malo = _mm_unpacklo_epi32(ma, ma);
+		mahi = _mm_unpackhi_epi32(ma, ma);
+
+		masa = _mm_sub_epi16(c255, FZ_COMBINE_EPI16(FZ_ALPHA_EPI16(slo), malo));
+		masa = FZ_EXPAND_EPI16(masa);
+		lo = _mm_add_epi16(FZ_COMBINE_EPI16(slo, malo), FZ_COMBINE_EPI16(_mm_unpacklo_epi8(d, zero), masa));
+		masa = _mm_sub_epi16(c255, FZ_COMBINE_EPI16(FZ_ALPHA_EPI16(shi), mahi));
+		masa = FZ_EXPAND_EPI16(masa);
+		hi = _mm_add_epi16(FZ_COMBINE_EPI16(shi, mahi), FZ_COMBINE_EPI16(_mm_unpackhi_epi8(d, zero), masa));
+
+		lo = _mm_and_si128(lo, c255);
+		hi = _mm_and_si128(hi, c255);
+		_mm_storeu_si128((__m128i *)dp, _mm_packus_epi16(lo, hi));
+	}
+	return i;
+}
+
+FZ_TARGET_SSE2 static int
+fz_paint_span_4_with_alpha_sse2(byte * restrict dp, byte * restrict sp, int w, int alpha)
+{
+	__m128i zero = _mm_setzero_si128();
+	__m128i a = _mm_set1_epi16((short)alpha);
+	int i;
+	for (i = 0; i + 4 <= w; i += 4, dp += 16, sp += 16)
+	{
+		__m128i d = _mm_loadu_si128((__m128i *)dp);
+		__m128i s = _mm_loadu_si128((__m128i *)sp);
+		__m128i slo = _mm_unpacklo_epi8(s, zero), shi = _mm_unpackhi_epi8(s, zero);
+		__m128i lo = FZ_BLEND_EPI16(slo, _mm_unpacklo_epi8(d, zero), FZ_COMBINE_EPI16(FZ_ALPHA_EPI16(slo), a));
+		__m128i hi = FZ_BLEND_EPI16(shi, _mm_unpackhi_epi8(d, zero), FZ_COMBINE_EPI16(FZ_ALPHA_EPI16(shi), a));
+		_mm_storeu_si128((__m128i *)dp, _mm_packus_epi16(lo, hi));
+	}
+	return i;
+}
+
+FZ_TARGET_SSE2 static int
+fz_paint_span_4_sse2(byte * restrict dp, byte * restrict sp, int w)
+{
+	__m128i zero = _mm_setzero_si128();
+	__m128i c255 = _mm_set1_epi16(255);
+	__m128i c256 = _mm_set1_epi16(256);
+	int i;
+	for (i = 0; i + 4 <= w; i += 4, dp += 16, sp += 16)
+	{
+		__m128i d = _mm_loadu_si128((__m128i *)dp);
+		__m128i s = _mm_loadu_si128((__m128i *)sp);
+		__m128i slo = _mm_unpacklo_epi8(s, zero), shi = _mm_unpackhi_epi8(s, zero);
+		__m128i dlo = _mm_unpacklo_epi8(d, zero), dhi = _mm_unpackhi_epi8(d, zero);
+		__m128i tlo = FZ_EXPAND_EPI16(FZ_ALPHA_EPI16(slo));
+		__m128i thi = FZ_EXPAND_EPI16(FZ_ALPHA_EPI16(shi));
+		__m128i lo = _mm_add_epi16(slo, FZ_COMBINE_EPI16(dlo, _mm_sub_epi16(c256, tlo)));
+		__m128i hi = _mm_add_epi16(shi, FZ_COMBINE_EPI16(dhi, _mm_sub_epi16(c256, thi)));
+		/* fully transparent source pixels leave the destination untouched */
+		__m128i keeplo = _mm_cmpeq_epi16(tlo, zero), keephi = _mm_cmpeq_epi16(thi, zero);
+		lo = _mm_or_si128(_mm_and_si128(keeplo, dlo), _mm_andnot_si128(keeplo, _mm_and_si128(lo, c255)));
+		hi = _mm_or_si128(_mm_and_si128(keephi, dhi), _mm_andnot_si128(keephi, _mm_and_si128(hi, c255)));
+		_mm_storeu_si128((__m128i *)dp, _mm_packus_epi16(lo, hi));
+	}
+	return i;
+}
+
+#ifdef ARCH_X86_AVX2
+
+#define FZ_EXPAND_EPI16_256(A) _mm256_add_epi16((A), _mm256_srli_epi16((A), 7))
+#define FZ_COMBINE_EPI16_256(A,B) _mm256_srli_epi16(_mm256_mullo_epi16((A), (B)), 8)
+#define FZ_BLEND_EPI16_256(SRC,DST,AMOUNT) _mm256_srli_epi16(_mm256_add_epi16(_mm256_mullo_epi16(_mm256_sub_epi16((SRC), (DST)), (AMOUNT)), _mm256_slli_epi16((DST), 8)), 8)
+#define FZ_ALPHA_EPI16_256(A) _mm256_shufflehi_epi16(_mm256_shufflelo_epi16((A), 0xFF), 0xFF)
+
+/* loads 8 mask values as 32 bit integers (in the same 128 bit lanes
+ * as _mm256_unpack*_epi8 puts the corresponding pixels) */
+#define FZ_LOAD_MASK8_EPI32(MP) _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(MP)))
+
+FZ_TARGET_AVX2 static int
+fz_paint_solid_color_4_avx2(byte * restrict dp, int w, byte *color, int sa)
+{
+	__m256i zero = _mm256_setzero_si256();
+	__m256i c = _mm256_set_epi16(255, color[2], color[1], color[0], 255, color[2], color[1], color[0],
+		255, color[2], color[1], color[0], 255, color[2], color[1], color[0]);
+	__m256i a = _mm256_set1_epi16((short)sa);
+	int i;
+	for (i = 0; i + 8 <= w; i += 8, dp += 32)
+	{
+		__m256i d = _mm256_loadu_si256((__m256i *)dp);
+		__m256i lo = FZ_BLEND_EPI16_256(c, _mm256_unpacklo_epi8(d, zero), a);
+		__m256i hi = FZ_BLEND_EPI16_256(c, _mm256_unpackhi_epi8(d, zero), a);
+		_mm256_storeu_si256((__m256i *)dp, _mm256_packus_epi16(lo, hi));
+	}
+	return i;
+}
+
+FZ_TARGET_AVX2 static int
+fz_paint_span_with_color_4_avx2(byte * restrict dp, byte * restrict mp, int w, byte *color, int sa)
+{
+	__m256i zero = _mm256_setzero_si256();
+	__m256i c = _mm256_set_epi16(255, color[2], color[1], color[0], 255, color[2], color[1], color[0],
+		255, color[2], color[1], color[0], 255, color[2], color[1], color[0]);
+	__m256i a = _mm256_set1_epi16((short)sa);
+	int i;
+	for (i = 0; i + 8 <= w; i += 8, dp += 32, mp += 8)
+	{
+		__m256i d = _mm256_loadu_si256((__m256i *)dp);
+		__m256i ma = FZ_EXPAND_EPI16_256(FZ_LOAD_MASK8_EPI32(mp));
+		__m256i lo, hi;
+		if (sa != 256)
+			ma = FZ_COMBINE_EPI16_256(ma, a);
+		ma = _mm256_or_si256(ma, _mm256_slli_epi32(ma, 16));
+		lo = FZ_BLEND_EPI16_256(c, _mm256_unpacklo_epi8(d, zero), _mm256_unpacklo_epi32(ma, ma));
+		hi = FZ_BLEND_EPI16_256(c, _mm256_unpackhi_epi8(d, zero), _mm256_unpackhi_epi32(ma, ma));
+		_mm256_storeu_si256((__m256i *)dp, _mm256_packus_epi16(lo, hi));
+	}
+	return i;
+}
+
+FZ_TARGET_AVX2 static int
+fz_paint_span_with_mask_4_avx2(byte * restrict dp, byte * restrict sp, byte * restrict mp, int w)
+{
+	__m256i zero = _mm256_setzero_si256();
+	__m256i c255 = _mm256_set1_epi16(255);
+	int i;
+	for (i = 0; i + 8 <= w; i += 8, dp += 32, sp += 32, mp += 8)
+	{
+		__m256i d = _mm256_loadu_si256((__m256i *)dp);
+		__m256i s = _mm256_loadu_si256((__m256i *)sp);
+		__m256i ma = FZ_EXPAND_EPI16_256(FZ_LOAD_MASK8_EPI32(mp));
+		__m256i slo = _mm256_unpacklo_epi8(s, zero), shi = _mm256_unpackhi_epi8(s, zero);
+		__m256i malo, mahi, masa, lo, hi;
+		ma = _mm256_or_si256(ma, _mm256_slli_epi32(ma, 16));
+		malo = _mm256_unpacklo_epi32(ma, ma);
+		mahi = _mm256_unpackhi_epi32(ma, ma);
+
+		masa = _mm256_sub_epi16(c255, FZ_COMBINE_EPI16_256(FZ_ALPHA_EPI16_256(slo), malo));
+		masa = FZ_EXPAND_EPI16_256(masa);
+		lo = _mm256_add_epi16(FZ_COMBINE_EPI16_256(slo, malo), FZ_COMBINE_EPI16_256(_mm256_unpacklo_epi8(d, zero), masa));
+		masa = _mm256_sub_epi16(c255, FZ_COMBINE_EPI16_256(FZ_ALPHA_EPI16_256(shi), mahi));
+		masa = FZ_EXPAND_EPI16_256(masa);
+		hi = _mm256_add_epi16(FZ_COMBINE_EPI16_256(shi, mahi), FZ_COMBINE_EPI16_256(_mm256_unpackhi_epi8(d, zero), masa));
+
+		lo = _mm256_and_si256(lo, c255);
+		hi = _mm256_and_si256(hi, c255);
+		_mm256_storeu_si256((__m256i *)dp, _mm256_packus_epi16(lo, hi));
+	}
+	return i;
+}
+
+FZ_TARGET_AVX2 static int
+fz_paint_span_4_with_alpha_avx2(byte * restrict dp, byte * restrict sp, int w, int alpha)
+{
+	__m256i zero = _mm256_setzero_si256();
+	__m256i a = _mm256_set1_epi16((short)alpha);
+	int i;
+	for (i = 0; i + 8 <= w; i += 8, dp += 32, sp += 32)
+	{
+		__m256i d = _mm256_loadu_si256((__m256i *)dp);
+		__m256i s = _mm256_loadu_si256((__m256i *)sp);
+		__m256i slo = _mm256_unpacklo_epi8(s, zero), shi = _mm256_unpackhi_epi8(s, zero);
+		__m256i lo = FZ_BLEND_EPI16_256(slo, _mm256_unpacklo_epi8(d, zero), FZ_COMBINE_EPI16_256(FZ_ALPHA_EPI16_256(slo), a));
+		__m256i hi = FZ_BLEND_EPI16_256(shi, _mm256_unpackhi_epi8(d, zero), FZ_COMBINE_EPI16_256(FZ_ALPHA_EPI16_256(shi), a));
+		_mm256_storeu_si256((__m256i *)dp, _mm256_packus_epi16(lo, hi));
+	}
+	return i;
+}
+
+FZ_TARGET_AVX2 static int
+fz_paint_span_4_avx2(byte * restrict dp, byte * restrict sp, int w)
+{
+	__m256i zero = _mm256_setzero_si256();
+	__m256i c255 = _mm256_set1_epi16(255);
+	__m256i c256 = _mm256_set1_epi16(256);
+	int i;
+	for (i = 0; i + 8 <= w; i += 8, dp += 32, sp += 32)
+	{
+		__m256i d = _mm256_loadu_si256((__m256i *)dp);
+		__m256i s = _mm256_loadu_si256((__m256i *)sp);
+		__m256i slo = _mm256_unpacklo_epi8(s, zero), shi = _mm256_unpackhi_epi8(s, zero);
+		__m256i dlo = _mm256_unpacklo_epi8(d, zero), dhi = _mm256_unpackhi_epi8(d, zero);
+		__m256i tlo = FZ_EXPAND_EPI16_256(FZ_ALPHA_EPI16_256(slo));
+		__m256i thi = FZ_EXPAND_EPI16_256(FZ_ALPHA_EPI16_256(shi));
+		__m256i lo = _mm256_add_epi16(slo, FZ_COMBINE_EPI16_256(dlo, _mm256_sub_epi16(c256, tlo)));
+		__m256i hi = _mm256_add_epi16(shi, FZ_COMBINE_EPI16_256(dhi, _mm256_sub_epi16(c256, thi)));
+		__m256i keeplo = _mm256_cmpeq_epi16(tlo, zero), keephi = _mm256_cmpeq_epi16(thi, zero);
+		lo = _mm256_blendv_epi8(_mm256_and_si256(lo, c255), dlo, keeplo);
+		hi = _mm256_blendv_epi8(_mm256_and_si256(hi, c255), dhi, keephi);
+		_mm256_storeu_si256((__m256i *)dp, _mm256_packus_epi16(lo, hi));
+	}
+	return i;
+}
+
+#endif /* ARCH_X86_AVX2 */
+
+/* CPU is the result of fz_cpu_flags, so that it is only fetched once */
+#ifdef ARCH_X86_AVX2
+#define FZ_PAINT_X86(CPU, NAME, ARGS) \
+	(((CPU) & FZ_CPU_AVX2) ? NAME##_avx2 ARGS : ((CPU) & FZ_CPU_SSE2) ? NAME##_sse2 ARGS : 0)
+#else
+#define FZ_PAINT_X86(CPU, NAME, ARGS) \
+	(((CPU) & FZ_CPU_SSE2) ? NAME##_sse2 ARGS : 0)
+#endif
+
+#endif /* ARCH_X86 */
+
 /* These are used by the non-aa scan converter */
 
 void
@@ -119,7 +469,7 @@ static inline int isbigendian(void)
 }
 
 static inline void
-fz_paint_solid_color_4(byte * restrict dp, int w, byte *color)
+fz_paint_solid_color_4(fz_context *ctx, byte * restrict dp, int w, byte *color)
 {
 	unsigned int rgba = *(int *)color;
 	int sa = FZ_EXPAND(color[3]);
@@ -129,6 +479,14 @@ fz_paint_solid_color_4(byte * restrict dp, int w, byte *color)
 		rgba |= 0x000000FF;
 	else
 		rgba |= 0xFF000000;
+#ifdef ARCH_X86
+	{
+		int cpu = fz_cpu_flags(ctx);
+		int done = FZ_PAINT_X86(cpu, fz_paint_solid_color_4, (dp, w, color, sa));
+		dp += done * 4;
+		w -= done;
+	}
+#endif
 	if (sa == 256)
 	{
 		while (w--)
@@ -188,12 +546,12 @@ fz_paint_solid_color_N(byte * restrict dp, int n, int w, byte *color)
 }
 
 void
-fz_paint_solid_color(byte * restrict dp, int n, int w, byte *color)
+fz_paint_solid_color(fz_context *ctx, byte * restrict dp, int n, int w, byte *color)
 {
 	switch (n)
 	{
 	case 2: fz_paint_solid_color_2(dp, w, color); break;
-	case 4: fz_paint_solid_color_4(dp, w, color); break;
+	case 4: fz_paint_solid_color_4(ctx, dp, w, color); break;
 	default: fz_paint_solid_color_N(dp, n, w, color); break;
 	}
 }
@@ -248,7 +606,7 @@ fz_paint_span_with_color_2(byte * restrict dp, byte * restrict mp, int w, byte *
 }
 
 static inline void
-fz_paint_span_with_color_4(byte * restrict dp, byte * restrict mp, int w, byte *color)
+fz_paint_span_with_color_4(fz_context *ctx, byte * restrict dp, byte * restrict mp, int w, byte *color)
 {
 	unsigned int rgba = *((unsigned int *)color);
 	unsigned int mask, rb, ga;
@@ -262,6 +620,15 @@ fz_paint_span_with_color_4(byte * restrict dp, byte * restrict mp, int w, byte *
 	mask = 0xFF00FF00;
 	rb = rgba & (mask>>8);
 	ga = (rgba & mask)>>8;
+#ifdef ARCH_X86
+	{
+		int cpu = fz_cpu_flags(ctx);
+		int done = FZ_PAINT_X86(cpu, fz_paint_span_with_color_4, (dp, mp, w, color, sa));
+		dp += done * 4;
+		mp += done;
+		w -= done;
+	}
+#endif
 	if (sa == 256)
 	{
 		while (w--)
@@ -358,12 +725,12 @@ fz_paint_span_with_color_N(byte * restrict dp, byte * restrict mp, int n, int w,
 }
 
 void
-fz_paint_span_with_color(byte * restrict dp, byte * restrict mp, int n, int w, byte *color)
+fz_paint_span_with_color(fz_context *ctx, byte * restrict dp, byte * restrict mp, int n, int w, byte *color)
 {
 	switch (n)
 	{
 	case 2: fz_paint_span_with_color_2(dp, mp, w, color); break;
-	case 4: fz_paint_span_with_color_4(dp, mp, w, color); break;
+	case 4: fz_paint_span_with_color_4(ctx, dp, mp, w, color); break;
 	default: fz_paint_span_with_color_N(dp, mp, n, w, color); break;
 	}
 }
@@ -414,10 +781,19 @@ fz_paint_span_with_mask_2(byte * restrict dp, byte * restrict sp, byte * restric
 	}
 }
 
-/* FIXME: There is potential for SWAR optimisation here */
 static inline void
-fz_paint_span_with_mask_4(byte * restrict dp, byte * restrict sp, byte * restrict mp, int w)
+fz_paint_span_with_mask_4(fz_context *ctx, byte * restrict dp, byte * restrict sp, byte * restrict mp, int w)
 {
+#ifdef ARCH_X86
+	{
+		int cpu = fz_cpu_flags(ctx);
+		int done = FZ_PAINT_X86(cpu, fz_paint_span_with_mask_4, (dp, sp, mp, w));
+		dp += done * 4;
+		sp += done * 4;
+		mp += done;
+		w -= done;
+	}
+#endif
 	while (w--)
 	{
 		int masa;
@@ -516,12 +892,12 @@ fz_paint_span_with_mask_N(byte * restrict dp, byte * restrict sp, byte * restric
 }
 
 static void
-fz_paint_span_with_mask(byte * restrict dp, byte * restrict sp, byte * restrict mp, int n, int w)
+fz_paint_span_with_mask(fz_context *ctx, byte * restrict dp, byte * restrict sp, byte * restrict mp, int n, int w)
 {
 	switch (n)
 	{
 	case 2: fz_paint_span_with_mask_2(dp, sp, mp, w); break;
-	case 4: fz_paint_span_with_mask_4(dp, sp, mp, w); break;
+	case 4: fz_paint_span_with_mask_4(ctx, dp, sp, mp, w); break;
 	default: fz_paint_span_with_mask_N(dp, sp, mp, n, w); break;
 	}
 }
@@ -543,9 +919,18 @@ fz_paint_span_2_with_alpha(byte * restrict dp, byte * restrict sp, int w, int al
 }
 
 static inline void
-fz_paint_span_4_with_alpha(byte * restrict dp, byte * restrict sp, int w, int alpha)
+fz_paint_span_4_with_alpha(fz_context *ctx, byte * restrict dp, byte * restrict sp, int w, int alpha)
 {
 	alpha = FZ_EXPAND(alpha);
+#ifdef ARCH_X86
+	{
+		int cpu = fz_cpu_flags(ctx);
+		int done = FZ_PAINT_X86(cpu, fz_paint_span_4_with_alpha, (dp, sp, w, alpha));
+		dp += done * 4;
+		sp += done * 4;
+		w -= done;
+	}
+#endif
 	while (w--)
 	{
 		int masa = FZ_COMBINE(sp[3], alpha);
@@ -619,8 +1004,17 @@ fz_paint_span_2(byte * restrict dp, byte * restrict sp, int w)
 }
 
 static inline void
-fz_paint_span_4(byte * restrict dp, byte * restrict sp, int w)
+fz_paint_span_4(fz_context *ctx, byte * restrict dp, byte * restrict sp, int w)
 {
+#ifdef ARCH_X86
+	{
+		int cpu = fz_cpu_flags(ctx);
+		int done = FZ_PAINT_X86(cpu, fz_paint_span_4, (dp, sp, w));
+		dp += done * 4;
+		sp += done * 4;
+		w -= done;
+	}
+#endif
 	while (w--)
 	{
 		int t = FZ_EXPAND(sp[3]);
@@ -686,7 +1080,7 @@ fz_paint_span_N(byte * restrict dp, byte * restrict sp, int n, int w)
 }
 
 void
-fz_paint_span(byte * restrict dp, byte * restrict sp, int n, int w, int alpha)
+fz_paint_span(fz_context *ctx, byte * restrict dp, byte * restrict sp, int n, int w, int alpha)
 {
 	if (alpha == 255)
 	{
@@ -694,7 +1088,7 @@ fz_paint_span(byte * restrict dp, byte * restrict sp, int n, int w, int alpha)
 		{
 		case 1: fz_paint_span_1(dp, sp, w); break;
 		case 2: fz_paint_span_2(dp, sp, w); break;
-		case 4: fz_paint_span_4(dp, sp, w); break;
+		case 4: fz_paint_span_4(ctx, dp, sp, w); break;
 		default: fz_paint_span_N(dp, sp, n, w); break;
 		}
 	}
@@ -703,7 +1097,7 @@ fz_paint_span(byte * restrict dp, byte * restrict sp, int n, int w, int alpha)
 		switch (n)
 		{
 		case 2: fz_paint_span_2_with_alpha(dp, sp, w, alpha); break;
-		case 4: fz_paint_span_4_with_alpha(dp, sp, w, alpha); break;
+		case 4: fz_paint_span_4_with_alpha(ctx, dp, sp, w, alpha); break;
 		default: fz_paint_span_N_with_alpha(dp, sp, n, w, alpha); break;
 		}
 	}
@@ -714,7 +1108,7 @@ fz_paint_span(byte * restrict dp, byte * restrict sp, int n, int w, int alpha)
  */
 
 void
-fz_paint_pixmap_with_bbox(fz_pixmap *dst, fz_pixmap *src, int alpha, fz_irect bbox)
+fz_paint_pixmap_with_bbox(fz_context *ctx, fz_pixmap *dst, fz_pixmap *src, int alpha, fz_irect bbox)
 {
 	unsigned char *sp, *dp;
 	int x, y, w, h, n;
@@ -740,14 +1134,14 @@ fz_paint_pixmap_with_bbox(fz_pixmap *dst, fz_pixmap *src, int alpha, fz_irect bb
 
 	while (h--)
 	{
-		fz_paint_span(dp, sp, n, w, alpha);
+		fz_paint_span(ctx, dp, sp, n, w, alpha);
 		sp += src->w * n;
 		dp += dst->w * n;
 	}
 }
 
 void
-fz_paint_pixmap(fz_pixmap *dst, fz_pixmap *src, int alpha)
+fz_paint_pixmap(fz_context *ctx, fz_pixmap *dst, fz_pixmap *src, int alpha)
 {
 	unsigned char *sp, *dp;
 	fz_irect bbox;
@@ -773,14 +1167,14 @@ fz_paint_pixmap(fz_pixmap *dst, fz_pixmap *src, int alpha)
 
 	while (h--)
 	{
-		fz_paint_span(dp, sp, n, w, alpha);
+		fz_paint_span(ctx, dp, sp, n, w, alpha);
 		sp += src->w * n;
 		dp += dst->w * n;
 	}
 }
 
 void
-fz_paint_pixmap_with_mask(fz_pixmap *dst, fz_pixmap *src, fz_pixmap *msk)
+fz_paint_pixmap_with_mask(fz_context *ctx, fz_pixmap *dst, fz_pixmap *src, fz_pixmap *msk)
 {
 	unsigned char *sp, *dp, *mp;
 	fz_irect bbox, bbox2;
@@ -809,7 +1203,7 @@ fz_paint_pixmap_with_mask(fz_pixmap *dst, fz_pixmap *src, fz_pixmap *msk)
 
 	while (h--)
 	{
-		fz_paint_span_with_mask(dp, sp, mp, n, w);
+		fz_paint_span_with_mask(ctx, dp, sp, mp, n, w);
 		sp += src->w * n;
 		dp += dst->w * n;
 		mp += msk->w;
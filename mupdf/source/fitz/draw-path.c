@@ -835,3 +835,343 @@ fz_flatten_dash_path(fz_gel *gel, fz_path *path, const fz_stroke_state *stroke,
 
 	fz_stroke_flush(&s, s.cap, stroke->end_cap);
 }
+
+/*
+ * Fast path for strokes of a single straight line segment, which is what
+ * most line art from CAD exports looks like. Instead of stroking into the
+ * gel and scan converting, such segments are painted directly as runs of
+ * solid color with their exact coverage:
+ *
+ * - Segments that are horizontal or vertical in device space are
+ *   rectangles (of any width), painted row by row.
+ * - Other segments that are at most one device pixel wide are painted by
+ *   walking along their major axis and covering, per column (or row), the
+ *   cross section of the line around its center (cf. Xiaolin Wu's
+ *   algorithm, but with the exact width of the line).
+ *
+ * Every pixel is painted at most once. Paths of several segments aren't
+ * handled, as pixels where segments meet or cross would be blended more
+ * than once.
+ */
+
+typedef struct fz_fast_stroke_s
+{
+	fz_context *ctx;
+	fz_pixmap *dst;
+	fz_irect clip;
+	int n;
+	int alpha;
+	unsigned char color[FZ_MAX_COLORS + 1];
+} fz_fast_stroke;
+
+static void
+fast_stroke_span(fz_fast_stroke *fs, int x0, int x1, int y, float cov)
+{
+	fz_pixmap *dst = fs->dst;
+	unsigned char *dp;
+
+	if (y < fs->clip.y0 || y >= fs->clip.y1)
+		return;
+	x0 = fz_maxi(x0, fs->clip.x0);
+	x1 = fz_mini(x1, fs->clip.x1);
+	if (x0 >= x1)
+		return;
+	fs->color[fs->n-1] = (int)(fz_clamp(cov, 0, 1) * fs->alpha + 0.5f);
+	if (fs->color[fs->n-1] == 0)
+		return;
+	dp = dst->samples + (unsigned int)(((y - dst->y) * dst->w + (x0 - dst->x)) * dst->n);
+	fz_paint_solid_color(fs->ctx, dp, fs->n, x1 - x0, fs->color);
+}
+
+/* The integral over an interval of length w of max(0, g), where g goes
+ * linearly from g0 to g1 */
+static float
+fast_stroke_ramp(float g0, float g1, float w)
+{
+	if (g0 >= 0 && g1 >= 0)
+		return (g0 + g1) * 0.5f * w;
+	if (g0 <= 0 && g1 <= 0)
+		return 0;
+	if (g0 > 0)
+		return g0 * g0 / (g0 - g1) * 0.5f * w;
+	return g1 * g1 / (g1 - g0) * 0.5f * w;
+}
+
+/* Cover the slice [a,b) of cell i along the major axis by a band of
+ * thickness t2 whose lower edge goes from la to lb (in the minor axis),
+ * with the exact area covered in each cell */
+static void
+fast_stroke_slice(fz_fast_stroke *fs, int xmajor, int i, float a, float b, float la, float lb, float t2)
+{
+	float w = b - a;
+	float below0, below1;
+	int j, j0, j1;
+
+	j0 = (int)floorf(fz_min(la, lb));
+	j1 = (int)ceilf(fz_max(la, lb) + t2);
+	if (xmajor)
+	{
+		j0 = fz_maxi(j0, fs->clip.y0);
+		j1 = fz_mini(j1, fs->clip.y1);
+	}
+	else
+	{
+		j0 = fz_maxi(j0, fs->clip.x0);
+		j1 = fz_mini(j1, fs->clip.x1);
+	}
+
+	/* the area of the band below j, minus the area below j + 1 */
+	below0 = fast_stroke_ramp(j0 - la, j0 - lb, w) - fast_stroke_ramp(j0 - la - t2, j0 - lb - t2, w);
+	for (j = j0; j < j1; j++, below0 = below1)
+	{
+		below1 = fast_stroke_ramp(j + 1 - la, j + 1 - lb, w) - fast_stroke_ramp(j + 1 - la - t2, j + 1 - lb - t2, w);
+		if (xmajor)
+			fast_stroke_span(fs, i, i + 1, j, below1 - below0);
+		else
+			fast_stroke_span(fs, j, j + 1, i, below1 - below0);
+	}
+}
+
+/* Rectangles are painted a row at a time through a coverage mask (as the
+ * scan converter does), in chunks of at most 256 columns. The mask only
+ * changes for the partially covered rows at the top and bottom. */
+static void
+fast_stroke_rect(fz_fast_stroke *fs, float x0, float y0, float x1, float y1)
+{
+	fz_pixmap *dst = fs->dst;
+	float cover[256];
+	unsigned char mask[256];
+	float cy, last;
+	int x, y, k, w, ix0, ix1, iy0, iy1;
+
+	x0 = fz_max(x0, fs->clip.x0);
+	x1 = fz_min(x1, fs->clip.x1);
+	y0 = fz_max(y0, fs->clip.y0);
+	y1 = fz_min(y1, fs->clip.y1);
+	if (x0 >= x1 || y0 >= y1)
+		return;
+	ix0 = (int)floorf(x0);
+	ix1 = (int)ceilf(x1);
+	iy0 = (int)floorf(y0);
+	iy1 = (int)ceilf(y1);
+	fs->color[fs->n-1] = fs->alpha;
+
+	for (x = ix0; x < ix1; x += w)
+	{
+		w = fz_mini(ix1 - x, nelem(cover));
+		for (k = 0; k < w; k++)
+			cover[k] = fz_min(x + k + 1, x1) - fz_max(x + k, x0);
+		last = -1;
+		for (y = iy0; y < iy1; y++)
+		{
+			cy = fz_min(y + 1, y1) - fz_max(y, y0);
+			if (cy != last)
+			{
+				for (k = 0; k < w; k++)
+					mask[k] = (int)(cover[k] * cy * 255 + 0.5f);
+				last = cy;
+			}
+			fz_paint_span_with_color(fs->ctx, dst->samples + (unsigned int)(((y - dst->y) * dst->w + (x - dst->x)) * dst->n), mask, fs->n, w, fs->color);
+		}
+	}
+}
+
+/* Clip the convex polygon p of n points to x >= c (dir > 0) or x <= c
+ * (dir < 0), or the same for y if k is set. Adds at most one point. */
+static int
+fast_stroke_clip(fz_point *out, const fz_point *p, int n, int k, float c, int dir)
+{
+	int i, m = 0;
+
+	for (i = 0; i < n; i++)
+	{
+		const fz_point *a = &p[i];
+		const fz_point *b = &p[(i + 1) % n];
+		float da = ((k ? a->y : a->x) - c) * dir;
+		float db = ((k ? b->y : b->x) - c) * dir;
+		if (da >= 0)
+			out[m++] = *a;
+		if ((da >= 0) != (db >= 0))
+		{
+			float f = da / (da - db);
+			out[m].x = a->x + (b->x - a->x) * f;
+			out[m].y = a->y + (b->y - a->y) * f;
+			m++;
+		}
+	}
+
+	return m;
+}
+
+/* relative to the first point, as the coordinates are too large for the
+ * products of the shoelace formula to remain precise */
+static float
+fast_stroke_area(const fz_point *p, int n)
+{
+	float area = 0;
+	int i;
+
+	for (i = 1; i + 1 < n; i++)
+		area += (p[i].x - p[0].x) * (p[i+1].y - p[0].y) - (p[i+1].x - p[0].x) * (p[i].y - p[0].y);
+
+	return fabsf(area) * 0.5f;
+}
+
+/* A line of width w <= 1 from (x0,y0) to (x1,y1) */
+static void
+fast_stroke_thin(fz_fast_stroke *fs, float x0, float y0, float x1, float y1, float w)
+{
+	int xmajor = fabsf(x1 - x0) >= fabsf(y1 - y0);
+	int cu0 = xmajor ? fs->clip.x0 : fs->clip.y0;
+	int cu1 = xmajor ? fs->clip.x1 : fs->clip.y1;
+	int cv0 = xmajor ? fs->clip.y0 : fs->clip.x0;
+	int cv1 = xmajor ? fs->clip.y1 : fs->clip.x1;
+	float u0, v0, u1, v1, du, dv, len, pu, pv, nu, s, t, vmin, vmax;
+	fz_point q[4], col[8], cell[8], tmp[8];
+	int i, i0, i1, j, j0, j1, k, n, m;
+
+	/* work along the major axis u (from lower to higher u) and the
+	 * minor axis v */
+	if (xmajor)
+	{
+		u0 = x0; v0 = y0; u1 = x1; v1 = y1;
+	}
+	else
+	{
+		u0 = y0; v0 = x0; u1 = y1; v1 = x1;
+	}
+	if (u1 < u0)
+	{
+		s = u0; u0 = u1; u1 = s;
+		s = v0; v0 = v1; v1 = s;
+	}
+	du = u1 - u0;
+	dv = v1 - v0;
+	len = sqrtf(du * du + dv * dv);
+
+	/* the corners of the line, (pu, pv) being half its width across */
+	pu = -dv / len * w * 0.5f;
+	pv = du / len * w * 0.5f;
+	nu = fabsf(pu);
+	q[0].x = u0 + pu; q[0].y = v0 + pv;
+	q[1].x = u1 + pu; q[1].y = v1 + pv;
+	q[2].x = u1 - pu; q[2].y = v1 - pv;
+	q[3].x = u0 - pu; q[3].y = v0 - pv;
+
+	/* between the ends, the cross section along v is the same everywhere */
+	s = dv / du;
+	t = w * sqrtf(1 + s * s) * 0.5f;
+
+	i0 = fz_maxi((int)floorf(u0 - nu), cu0);
+	i1 = fz_mini((int)ceilf(u1 + nu), cu1);
+	for (i = i0; i < i1; i++)
+	{
+		if (i >= u0 + nu && i + 1 <= u1 - nu)
+		{
+			fast_stroke_slice(fs, xmajor, i, i, i + 1, v0 + (i - u0) * s - t, v0 + (i + 1 - u0) * s - t, 2 * t);
+			continue;
+		}
+
+		/* at the ends, clip the line to every cell */
+		n = fast_stroke_clip(tmp, q, 4, 0, i, 1);
+		n = fast_stroke_clip(col, tmp, n, 0, i + 1, -1);
+		if (n < 3)
+			continue;
+		vmin = vmax = col[0].y;
+		for (k = 1; k < n; k++)
+		{
+			vmin = fz_min(vmin, col[k].y);
+			vmax = fz_max(vmax, col[k].y);
+		}
+		j0 = fz_maxi((int)floorf(vmin), cv0);
+		j1 = fz_mini((int)ceilf(vmax), cv1);
+		for (j = j0; j < j1; j++)
+		{
+			m = fast_stroke_clip(tmp, col, n, 1, j, 1);
+			m = fast_stroke_clip(cell, tmp, m, 1, j + 1, -1);
+			if (m < 3)
+				continue;
+			if (xmajor)
+				fast_stroke_span(fs, i, i + 1, j, fast_stroke_area(cell, m));
+			else
+				fast_stroke_span(fs, j, j + 1, i, fast_stroke_area(cell, m));
+		}
+	}
+}
+
+/* How far a cap extends beyond the end of a line of width w, or -1 if
+ * the cap can't be drawn by the fast path */
+static float
+fast_stroke_cap(fz_linecap cap, float w)
+{
+	if (cap == FZ_LINECAP_BUTT)
+		return 0;
+	if (cap == FZ_LINECAP_SQUARE)
+		return w * 0.5f;
+	return -1;
+}
+
+int
+fz_stroke_path_fast(fz_context *ctx, fz_path *path, const fz_stroke_state *stroke, const fz_matrix *ctm, float linewidth,
+	const fz_irect *clip, fz_pixmap *dst, unsigned char *colorbv)
+{
+	fz_fast_stroke fs;
+	float sx = ctm->a * ctm->a + ctm->b * ctm->b;
+	float w = linewidth * sqrtf(sx);
+	float ext0 = fast_stroke_cap(stroke->start_cap, w);
+	float ext1 = fast_stroke_cap(stroke->end_cap, w);
+	fz_point p0, p1;
+	float dx, dy, ux, uy, len;
+	int axis;
+
+	/* The transformed line width must be the same in all directions */
+	if (stroke->dash_len > 0 || ext0 < 0 || ext1 < 0 || !dst->colorspace ||
+		fabsf(sx - (ctm->c * ctm->c + ctm->d * ctm->d)) > sx * 0.001f ||
+		fabsf(ctm->a * ctm->c + ctm->b * ctm->d) > sx * 0.001f)
+		return 0;
+
+	if (path->cmd_len != 2 || path->cmds[0] != FZ_MOVETO || path->cmds[1] != FZ_LINETO)
+		return 0;
+	p0.x = path->coords[0];
+	p0.y = path->coords[1];
+	p1.x = path->coords[2];
+	p1.y = path->coords[3];
+	fz_transform_point(&p0, ctm);
+	fz_transform_point(&p1, ctm);
+	dx = p1.x - p0.x;
+	dy = p1.y - p0.y;
+	len = sqrtf(dx * dx + dy * dy);
+	axis = fabsf(dx) < 0.001f || fabsf(dy) < 0.001f;
+	/* zero length segments only show as caps */
+	if (len < FLT_EPSILON)
+		return ext0 == 0 && ext1 == 0;
+	if (!axis && w > 1)
+		return 0;
+
+	fs.ctx = ctx;
+	fs.dst = dst;
+	fs.n = dst->n;
+	fs.alpha = colorbv[dst->n-1];
+	memcpy(fs.color, colorbv, dst->n);
+	fz_intersect_irect(fz_pixmap_bbox_no_ctx(dst, &fs.clip), clip);
+	if (fz_is_empty_irect(&fs.clip))
+		return 1;
+
+	/* extend by the caps */
+	ux = dx / len;
+	uy = dy / len;
+	p0.x -= ux * ext0;
+	p0.y -= uy * ext0;
+	p1.x += ux * ext1;
+	p1.y += uy * ext1;
+
+	/* axis-aligned segments get the width added across */
+	if (fabsf(dx) < 0.001f)
+		fast_stroke_rect(&fs, p0.x - w * 0.5f, fz_min(p0.y, p1.y), p0.x + w * 0.5f, fz_max(p0.y, p1.y));
+	else if (fabsf(dy) < 0.001f)
+		fast_stroke_rect(&fs, fz_min(p0.x, p1.x), p0.y - w * 0.5f, fz_max(p0.x, p1.x), p0.y + w * 0.5f);
+	else
+		fast_stroke_thin(&fs, p0.x, p0.y, p1.x, p1.y, w);
+
+	return 1;
+}
@@ -1057,6 +1057,314 @@ scale_row_from_temp(unsigned char *dst, unsigned char *src, fz_weights *weights,
 		src++;
 	}
 }
+
+#ifdef ARCH_X86
+/*
+ * SIMD versions of the row scalers. Pixels and weights are multiplied as
+ * signed 16 bit values with pmaddwd which adds pairs of products into
+ * 32 bit accumulators; these are then rounded, shifted and truncated
+ * exactly as the scalar code does. The horizontal scalers work on one
+ * output pixel at a time (so flipping is free), the vertical scaler on
+ * 16 resp. 32 output pixels at a time.
+ *
+ * The weights are normally in the 0..256 range, but check_weights may
+ * push them a little way outside of it, so weights_fit_epi16 has to be
+ * checked once per table before any of these are used. All of them
+ * require SSE2 support.
+ */
+
+static int
+weights_fit_epi16(fz_weights *weights)
+{
+	int i, j;
+
+	for (i = 0; i < weights->count; i++)
+	{
+		int *contrib = &weights->index[weights->index[i]];
+		int len = contrib[1];
+		contrib += 2;
+		for (j = 0; j < len; j++)
+			if (contrib[j] < -32768 || contrib[j] > 32767)
+				return 0;
+	}
+	return 1;
+}
+
+/* Two weights in the layout expected by pmaddwd */
+#define FZ_WEIGHT_PAIR(w0, w1) ((int)(((unsigned int)(w1) << 16) | ((w0) & 0xFFFF)))
+
+FZ_TARGET_SSE2 static inline void
+store_scaled_pixel_sse2(unsigned char *dst, __m128i acc)
+{
+	int v;
+
+	acc = _mm_and_si128(_mm_srai_epi32(acc, 8), _mm_set1_epi32(0xFF));
+	acc = _mm_packs_epi32(acc, acc);
+	v = _mm_cvtsi128_si32(_mm_packus_epi16(acc, acc));
+	memcpy(dst, &v, 4);
+}
+
+FZ_TARGET_SSE2 static void
+scale_row_to_temp1_sse2(unsigned char *dst, unsigned char *src, fz_weights *weights)
+{
+	int *contrib = &weights->index[weights->index[0]];
+	int len, i, step = 1;
+	unsigned char *min;
+	__m128i zero = _mm_setzero_si128();
+
+	assert(weights->n == 1);
+	if (weights->flip)
+	{
+		dst += weights->count-1;
+		step = -1;
+	}
+	for (i=weights->count; i > 0; i--)
+	{
+		int val = 128;
+		min = &src[*contrib++];
+		len = *contrib++;
+		if (len >= 8)
+		{
+			__m128i acc = _mm_setzero_si128();
+			for (; len >= 8; len -= 8, min += 8, contrib += 8)
+			{
+				__m128i p = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)min), zero);
+				__m128i w = _mm_packs_epi32(_mm_loadu_si128((const __m128i *)contrib), _mm_loadu_si128((const __m128i *)(contrib + 4)));
+				acc = _mm_add_epi32(acc, _mm_madd_epi16(p, w));
+			}
+			acc = _mm_add_epi32(acc, _mm_srli_si128(acc, 8));
+			acc = _mm_add_epi32(acc, _mm_srli_si128(acc, 4));
+			val += _mm_cvtsi128_si32(acc);
+		}
+		while (len-- > 0)
+		{
+			val += *min++ * *contrib++;
+		}
+		*dst = (unsigned char)(val>>8);
+		dst += step;
+	}
+}
+
+FZ_TARGET_SSE2 static void
+scale_row_to_temp2_sse2(unsigned char *dst, unsigned char *src, fz_weights *weights)
+{
+	int *contrib = &weights->index[weights->index[0]];
+	int len, i, v, step = 2;
+	unsigned char *min;
+	__m128i zero = _mm_setzero_si128();
+
+	assert(weights->n == 2);
+	if (weights->flip)
+	{
+		dst += 2*(weights->count-1);
+		step = -2;
+	}
+	for (i=weights->count; i > 0; i--)
+	{
+		__m128i acc = _mm_set1_epi32(128);
+		min = &src[2 * *contrib++];
+		len = *contrib++;
+		for (; len >= 2; len -= 2, min += 4, contrib += 2)
+		{
+			/* g0 a0 g1 a1 -> g0 g1 a0 a1 */
+			__m128i p;
+			memcpy(&v, min, 4);
+			p = _mm_unpacklo_epi8(_mm_cvtsi32_si128(v), zero);
+			p = _mm_shufflelo_epi16(p, _MM_SHUFFLE(3, 1, 2, 0));
+			acc = _mm_add_epi32(acc, _mm_madd_epi16(p, _mm_set1_epi32(FZ_WEIGHT_PAIR(contrib[0], contrib[1]))));
+		}
+		if (len > 0)
+		{
+			__m128i p = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(min[0] | (min[1] << 8)), zero), zero);
+			acc = _mm_add_epi32(acc, _mm_madd_epi16(p, _mm_set1_epi32(FZ_WEIGHT_PAIR(contrib[0], 0))));
+			contrib++;
+		}
+		acc = _mm_and_si128(_mm_srai_epi32(acc, 8), _mm_set1_epi32(0xFF));
+		acc = _mm_packs_epi32(acc, acc);
+		v = _mm_cvtsi128_si32(_mm_packus_epi16(acc, acc));
+		dst[0] = (unsigned char)v;
+		dst[1] = (unsigned char)(v>>8);
+		dst += step;
+	}
+}
+
+FZ_TARGET_SSE2 static void
+scale_row_to_temp4_sse2(unsigned char *dst, unsigned char *src, fz_weights *weights)
+{
+	int *contrib = &weights->index[weights->index[0]];
+	int len, i, v, step = 4;
+	unsigned char *min;
+	__m128i zero = _mm_setzero_si128();
+
+	assert(weights->n == 4);
+	if (weights->flip)
+	{
+		dst += 4*(weights->count-1);
+		step = -4;
+	}
+	for (i=weights->count; i > 0; i--)
+	{
+		__m128i acc = _mm_set1_epi32(128);
+		min = &src[4 * *contrib++];
+		len = *contrib++;
+		for (; len >= 2; len -= 2, min += 8, contrib += 2)
+		{
+			/* r0 g0 b0 a0 r1 g1 b1 a1 -> r0 r1 g0 g1 b0 b1 a0 a1 */
+			__m128i p = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)min), zero);
+			p = _mm_unpacklo_epi16(p, _mm_srli_si128(p, 8));
+			acc = _mm_add_epi32(acc, _mm_madd_epi16(p, _mm_set1_epi32(FZ_WEIGHT_PAIR(contrib[0], contrib[1]))));
+		}
+		if (len > 0)
+		{
+			__m128i p;
+			memcpy(&v, min, 4);
+			p = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(v), zero), zero);
+			acc = _mm_add_epi32(acc, _mm_madd_epi16(p, _mm_set1_epi32(FZ_WEIGHT_PAIR(contrib[0], 0))));
+			contrib++;
+		}
+		store_scaled_pixel_sse2(dst, acc);
+		dst += step;
+	}
+}
+
+/* Returns the number of output bytes done (a multiple of 16) */
+FZ_TARGET_SSE2 static int
+scale_row_from_temp_sse2(unsigned char *dst, unsigned char *src, int *contrib, int len, int width)
+{
+	__m128i zero = _mm_setzero_si128();
+	__m128i round = _mm_set1_epi32(128);
+	__m128i mask = _mm_set1_epi32(0xFF);
+	int x, k;
+
+	for (x = 0; x + 16 <= width; x += 16, src += 16, dst += 16)
+	{
+		__m128i a0 = round, a1 = round, a2 = round, a3 = round;
+		unsigned char *min = src;
+
+		for (k = 0; k < len; k += 2, min += 2*width)
+		{
+			/* Interleave two source rows so that pmaddwd gets
+			 * (row k, row k+1) pairs for every pixel. */
+			__m128i r0 = _mm_loadu_si128((const __m128i *)min);
+			__m128i r1 = zero;
+			__m128i w, lo, hi;
+			if (k+1 < len)
+			{
+				r1 = _mm_loadu_si128((const __m128i *)(min + width));
+				w = _mm_set1_epi32(FZ_WEIGHT_PAIR(contrib[k], contrib[k+1]));
+			}
+			else
+				w = _mm_set1_epi32(FZ_WEIGHT_PAIR(contrib[k], 0));
+			lo = _mm_unpacklo_epi8(r0, r1);
+			hi = _mm_unpackhi_epi8(r0, r1);
+			a0 = _mm_add_epi32(a0, _mm_madd_epi16(_mm_unpacklo_epi8(lo, zero), w));
+			a1 = _mm_add_epi32(a1, _mm_madd_epi16(_mm_unpackhi_epi8(lo, zero), w));
+			a2 = _mm_add_epi32(a2, _mm_madd_epi16(_mm_unpacklo_epi8(hi, zero), w));
+			a3 = _mm_add_epi32(a3, _mm_madd_epi16(_mm_unpackhi_epi8(hi, zero), w));
+		}
+		a0 = _mm_and_si128(_mm_srai_epi32(a0, 8), mask);
+		a1 = _mm_and_si128(_mm_srai_epi32(a1, 8), mask);
+		a2 = _mm_and_si128(_mm_srai_epi32(a2, 8), mask);
+		a3 = _mm_and_si128(_mm_srai_epi32(a3, 8), mask);
+		_mm_storeu_si128((__m128i *)dst, _mm_packus_epi16(_mm_packs_epi32(a0, a1), _mm_packs_epi32(a2, a3)));
+	}
+	return x;
+}
+
+#ifdef ARCH_X86_AVX2
+/* As scale_row_from_temp_sse2; the in-lane unpacks are undone by the
+ * in-lane packs, so the output comes out in order. */
+FZ_TARGET_AVX2 static int
+scale_row_from_temp_avx2(unsigned char *dst, unsigned char *src, int *contrib, int len, int width)
+{
+	__m256i zero = _mm256_setzero_si256();
+	__m256i round = _mm256_set1_epi32(128);
+	__m256i mask = _mm256_set1_epi32(0xFF);
+	int x, k;
+
+	for (x = 0; x + 32 <= width; x += 32, src += 32, dst += 32)
+	{
+		__m256i a0 = round, a1 = round, a2 = round, a3 = round;
+		unsigned char *min = src;
+
+		for (k = 0; k < len; k += 2, min += 2*width)
+		{
+			__m256i r0 = _mm256_loadu_si256((const __m256i *)min);
+			__m256i r1 = zero;
+			__m256i w, lo, hi;
+			if (k+1 < len)
+			{
+				r1 = _mm256_loadu_si256((const __m256i *)(min + width));
+				w = _mm256_set1_epi32(FZ_WEIGHT_PAIR(contrib[k], contrib[k+1]));
+			}
+			else
+				w = _mm256_set1_epi32(FZ_WEIGHT_PAIR(contrib[k], 0));
+			lo = _mm256_unpacklo_epi8(r0, r1);
+			hi = _mm256_unpackhi_epi8(r0, r1);
+			a0 = _mm256_add_epi32(a0, _mm256_madd_epi16(_mm256_unpacklo_epi8(lo, zero), w));
+			a1 = _mm256_add_epi32(a1, _mm256_madd_epi16(_mm256_unpackhi_epi8(lo, zero), w));
+			a2 = _mm256_add_epi32(a2, _mm256_madd_epi16(_mm256_unpacklo_epi8(hi, zero), w));
+			a3 = _mm256_add_epi32(a3, _mm256_madd_epi16(_mm256_unpackhi_epi8(hi, zero), w));
+		}
+		a0 = _mm256_and_si256(_mm256_srai_epi32(a0, 8), mask);
+		a1 = _mm256_and_si256(_mm256_srai_epi32(a1, 8), mask);
+		a2 = _mm256_and_si256(_mm256_srai_epi32(a2, 8), mask);
+		a3 = _mm256_and_si256(_mm256_srai_epi32(a3, 8), mask);
+		_mm256_storeu_si256((__m256i *)dst, _mm256_packus_epi16(_mm256_packs_epi32(a0, a1), _mm256_packs_epi32(a2, a3)));
+	}
+	return x;
+}
+#endif
+
+static inline void
+scale_row_from_temp_x86(unsigned char *dst, unsigned char *src, fz_weights *weights, int width, int row, int avx2)
+{
+	int *contrib = &weights->index[weights->index[row]];
+	int len, x, done;
+
+	contrib++; /* Skip min */
+	len = *contrib++;
+#ifdef ARCH_X86_AVX2
+	if (avx2)
+		done = scale_row_from_temp_avx2(dst, src, contrib, len, width);
+	else
+#endif
+		done = scale_row_from_temp_sse2(dst, src, contrib, len, width);
+	dst += done;
+	src += done;
+	for (x=width-done; x > 0; x--)
+	{
+		unsigned char *min = src;
+		int val = 128;
+		int len2 = len;
+		int *contrib2 = contrib;
+
+		while (len2-- > 0)
+		{
+			val += *min * *contrib2++;
+			min += width;
+		}
+		*dst++ = (unsigned char)(val>>8);
+		src++;
+	}
+}
+
+static void
+scale_row_from_temp_with_sse2(unsigned char *dst, unsigned char *src, fz_weights *weights, int width, int row)
+{
+	scale_row_from_temp_x86(dst, src, weights, width, row, 0);
+}
+
+#ifdef ARCH_X86_AVX2
+static void
+scale_row_from_temp_with_avx2(unsigned char *dst, unsigned char *src, fz_weights *weights, int width, int row)
+{
+	scale_row_from_temp_x86(dst, src, weights, width, row, 1);
+}
+#endif
+
+#undef FZ_WEIGHT_PAIR
+#endif /* ARCH_X86 */
 #endif
 
 #ifdef SINGLE_PIXEL_SPECIALS
@@ -1426,6 +1734,7 @@ fz_scale_pixmap_cached(fz_context *ctx, fz_pixmap *src, float x, float y, float
 #endif /* SINGLE_PIXEL_SPECIALS */
 	{
 		void (*row_scale)(unsigned char *dst, unsigned char *src, fz_weights *weights);
+		void (*row_scale_from)(unsigned char *dst, unsigned char *src, fz_weights *weights, int width, int row) = scale_row_from_temp;
 
 		temp_span = contrib_cols->count * src->n;
 		temp_rows = contrib_rows->max_len;
@@ -1459,6 +1768,29 @@ fz_scale_pixmap_cached(fz_context *ctx, fz_pixmap *src, float x, float y, float
 			row_scale = scale_row_to_temp4;
 			break;
 		}
+#ifdef ARCH_X86
+		int cpu = fz_cpu_flags(ctx);
+		if ((cpu & FZ_CPU_SSE2) && weights_fit_epi16(contrib_cols) && weights_fit_epi16(contrib_rows))
+		{
+			switch (src->n)
+			{
+			case 1:
+				row_scale = scale_row_to_temp1_sse2;
+				break;
+			case 2:
+				row_scale = scale_row_to_temp2_sse2;
+				break;
+			case 4:
+				row_scale = scale_row_to_temp4_sse2;
+				break;
+			}
+			row_scale_from = scale_row_from_temp_with_sse2;
+#ifdef ARCH_X86_AVX2
+			if (cpu & FZ_CPU_AVX2)
+				row_scale_from = scale_row_from_temp_with_avx2;
+#endif
+		}
+#endif
 		max_row = contrib_rows->index[contrib_rows->index[0]];
 		for (row = 0; row < contrib_rows->count; row++)
 		{
@@ -1480,7 +1812,7 @@ fz_scale_pixmap_cached(fz_context *ctx, fz_pixmap *src, float x, float y, float
 			}
 
 			DBUG(("scaling row %d from temp\n", row));
-			scale_row_from_temp(&output->samples[row*output->w*output->n], temp, contrib_rows, temp_span, row);
+			(*row_scale_from)(&output->samples[row*output->w*output->n], temp, contrib_rows, temp_span, row);
 		}
 		fz_free(ctx, temp);
 	}
@@ -13,6 +13,7 @@ static unsigned char get1_tab_1[256][8];
 static unsigned char get1_tab_1p[256][16];
 static unsigned char get1_tab_255[256][8];
 static unsigned char get1_tab_255p[256][16];
+static unsigned char get1_tab_count[256];
 
 static void
 init_get1_tables(void)
@@ -40,6 +41,8 @@ init_get1_tables(void)
 			get1_tab_255[i][k] = x * 255;
 			get1_tab_255p[i][k * 2] = x * 255;
 			get1_tab_255p[i][k * 2 + 1] = 255;
+
+			get1_tab_count[i] += x;
 		}
 	}
 
@@ -172,6 +175,69 @@ fz_unpack_tile(fz_pixmap *dst, unsigned char * restrict src, int n, int depth, i
 	}
 }
 
+/*
+ * Unpack 1-bit samples (w by h, with 1 being 255) straight into the 8-bit
+ * pixmap that fz_unpack_tile followed by fz_subsample_pixmap would give,
+ * counting the set bits of each block instead of expanding every pixel.
+ */
+void
+fz_unpack_tile_subsampled(fz_context *ctx, fz_pixmap *dst, unsigned char * restrict src, int w, int h, int stride, int factor)
+{
+	int f = 1 << factor;
+	int dw = dst->w;
+	int pad = dst->n > 1;
+	int bw = 8 >> fz_mini(factor, 3);
+	int last = (w + 7) >> 3;
+	unsigned char last_mask = 0xFF << (last * 8 - w);
+	int *sum;
+	int x, y, yy, k;
+
+	init_get1_tables();
+
+	dst->has_alpha = !pad; /* SumatraPDF: allow optimizing non-alpha pixmaps */
+	dst->single_bit = 0; /* SumatraPDF: allow optimizing 1-bit pixmaps */
+
+	/* room for the (empty) blocks past w in the last byte */
+	sum = fz_malloc_array(ctx, fz_maxi(dw, last * bw), sizeof(int));
+
+	for (y = 0; y < dst->h; y++)
+	{
+		int fh = fz_mini(f, h - y * f);
+		unsigned char *dp = dst->samples + (unsigned int)(y * dw * dst->n);
+
+		memset(sum, 0, dw * sizeof(int));
+		for (yy = 0; yy < fh; yy++)
+		{
+			unsigned char *sp = src + (unsigned int)((y * f + yy) * stride);
+
+			for (x = 0; x < last; x++)
+			{
+				int b = sp[x];
+				if (x == last - 1)
+					b &= last_mask;
+				if (factor >= 3)
+					sum[x >> (factor - 3)] += get1_tab_count[b];
+				else
+				{
+					/* 8 / f blocks per byte */
+					for (k = 0; k < bw; k++)
+						sum[x * bw + k] += get1_tab_count[(b << (k * f)) & 0xFF & ~(0xFF >> f)];
+				}
+			}
+		}
+
+		for (x = 0; x < dw; x++)
+		{
+			int fw = fz_mini(f, w - x * f);
+			*dp++ = sum[x] * 255 / (fw * fh);
+			if (pad)
+				*dp++ = 255;
+		}
+	}
+
+	fz_free(ctx, sum);
+}
+
 /* Apply decode array */
 
 void
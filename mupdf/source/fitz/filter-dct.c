@@ -223,7 +223,9 @@ close_dctd(fz_context *ctx, void *state_)
 		goto skip;
 	}
 
-	if (state->init)
+	/* Streams closed before the last scanline (such as those for a part
+	 * of an image) are just aborted */
+	if (state->init && state->cinfo.output_scanline >= state->cinfo.output_height)
 		jpeg_finish_decompress(&state->cinfo);
 
 skip:
@@ -170,15 +170,6 @@ static const cfd_node cf_uncompressed_decode[] = {
 
 /* bit magic */
 
-static inline int getbit(const unsigned char *buf, int x)
-{
-	return ( buf[x >> 3] >> ( 7 - (x & 7) ) ) & 1;
-}
-
-static const unsigned char mask[8] = {
-	0x7F, 0x3F, 0x1F, 0x0F, 0x07, 0x03, 0x01, 0
-};
-
 static const unsigned char clz[256] = {
 	8, 7, 6, 6, 5, 5, 5, 5, 4, 4, 4, 4, 4, 4, 4, 4,
 	3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3,
@@ -198,77 +189,30 @@ static const unsigned char clz[256] = {
 	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0
 };
 
-static inline int
-find_changing(const unsigned char *line, int x, int w)
+/* Store the positions of all changing elements of line (pixels with a
+ * different color than the one before them, starting from an imaginary
+ * white pixel at -1) in changes. Changes at even indices are to black and
+ * those at odd indices to white. */
+static int
+find_changes(const unsigned char *line, int w, int *changes)
 {
-	int a, b, m, W;
-
-	if (!line)
-		return w;
+	int W = (w + 7) >> 3;
+	int x, n = 0, last = 0;
 
-	/* We assume w > 0, -1 <= x < w */
-	if (x < 0)
-	{
-		x = 0;
-		m = 0xFF;
-	}
-	else
+	for (x = 0; x < W; x++)
 	{
-		/* Mask out the bits we've already used (including the one
-		 * we started from) */
-		m = mask[x & 7];
-	}
-	/* We have 'w' pixels (bits) in line. The last pixel that can be
-	 * safely accessed is the (w-1)th bit of line.
-	 * By taking W = w>>3, we know that the first W bytes of line are
-	 * full, with w&7 stray bits following. */
-	W = w>>3;
-	x >>= 3;
-	a = line[x]; /* Safe as x < w => x <= w-1 => x>>3 <= (w-1)>>3 */
-	b = a ^ (a>>1);
-	b &= m;
-	if (x >= W)
-	{
-		/* Within the last byte already */
-		x = (x<<3) + clz[b];
-		if (x > w)
-			x = w;
-		return x;
-	}
-	while (b == 0)
-	{
-		if (++x >= W)
-			goto nearend;
-		b = a & 1;
-		a = line[x];
-		b = (b<<7) ^ a ^ (a>>1);
+		int a = line[x];
+		int b = a ^ ((a >> 1) | (last << 7));
+		last = a & 1;
+		while (b)
+		{
+			int k = clz[b];
+			changes[n++] = (x << 3) + k;
+			b &= 0x7F >> k;
+		}
 	}
-	return (x<<3) + clz[b];
-nearend:
-	/* We have less than a byte to go. If no stray bits, exit now. */
-	if ((x<<3) == w)
-		return w;
-	b = a&1;
-	a = line[x];
-	b = (b<<7) ^ a ^ (a>>1);
-	x = (x<<3) + clz[b];
-	if (x > w)
-		x = w;
-	return x;
-}
-
-static inline int
-find_changing_color(const unsigned char *line, int x, int w, int color)
-{
-	if (!line || x >= w)
-		return w;
-
-	x = find_changing(line, (x > 0 || !color) ? x : -1, w);
-
-	if (x < w && getbit(line, x) != color)
-		x = find_changing(line, x, w);
 
-	return x;
+	return n;
 }
 
 static const unsigned char lm[8] = {
@@ -343,9 +287,90 @@ struct fz_faxd_s
 	int a, c, dim, eolc;
 	unsigned char *ref;
 	unsigned char *dst;
+	int *ref_changes, *dst_changes;
+	int cidx, nchanges, dirty;
 	unsigned char *rp, *wp;
 };
 
+/* Find b1: the first changing element on the reference line to the right
+ * of x (or at 0 for the start of a row) with the given color. The search
+ * continues from the previous one, as x only moves forwards for valid data. */
+static inline int
+find_changing_color(fz_faxd *fax, int x, int color)
+{
+	const int *changes = fax->ref_changes;
+	int i = fax->cidx;
+	int w = fax->columns;
+
+	if (x >= w)
+		return w;
+	if (x <= 0 && color)
+		x = -1;
+
+	while (i > 0 && changes[i - 1] > x)
+		i--;
+	while (changes[i] <= x)
+		i++;
+	/* even indices change to black (color 1) */
+	if ((i & 1) == color)
+		i++;
+
+	fax->cidx = i;
+	return changes[i];
+}
+
+/* Find b2: the changing element following the last b1 */
+static inline int
+find_next_changing(fz_faxd *fax)
+{
+	return fax->ref_changes[fax->cidx + 1];
+}
+
+/* Record a change of color at x on the row being decoded, which has been
+ * decoded up to a. Runs of length zero cancel out. Should decoding ever
+ * move backwards (which only happens for broken data), the changes are
+ * found from the row itself once it is done instead. */
+static inline void
+add_change(fz_faxd *fax, int a, int x)
+{
+	int n = fax->nchanges;
+
+	if (x < a)
+		fax->dirty = 1;
+	if (fax->dirty)
+		return;
+
+	if (n > 0 && fax->dst_changes[n - 1] == x)
+		fax->nchanges = n - 1;
+	else
+	{
+		fax->dst_changes[n] = x;
+		fax->nchanges = n + 1;
+	}
+}
+
+/* Terminate the changes of the row just decoded by two entries of
+ * columns, so that lookups never run off the end of the list. */
+static void
+end_changes(fz_faxd *fax)
+{
+	int *changes = fax->dst_changes;
+	int n;
+
+	/* pixels past a are white, even if the row stopped in a black run */
+	if (fax->c)
+		add_change(fax, fax->a, fax->a);
+
+	n = fax->nchanges;
+	if (fax->dirty)
+		n = find_changes(fax->dst, fax->columns, changes);
+
+	/* a run may end exactly at the last column */
+	while (n > 0 && changes[n - 1] >= fax->columns)
+		n--;
+	changes[n] = changes[n + 1] = fax->columns;
+}
+
 static inline void eat_bits(fz_faxd *fax, int nbits)
 {
 	fax->word <<= nbits;
@@ -366,10 +391,10 @@ fill_bits(fz_faxd *fax)
 	return 0;
 }
 
-static int
-get_code(fz_faxd *fax, const cfd_node *table, int initialbits)
+/* look up the code at the start of word, without consuming it */
+static inline int
+peek_code(unsigned int word, const cfd_node *table, int initialbits, int *nbitsp)
 {
-	unsigned int word = fax->word;
 	int tidx = word >> (32 - initialbits);
 	int val = table[tidx].val;
 	int nbits = table[tidx].nbits;
@@ -382,6 +407,16 @@ get_code(fz_faxd *fax, const cfd_node *table, int initialbits)
 		nbits = initialbits + table[tidx].nbits;
 	}
 
+	*nbitsp = nbits;
+	return val;
+}
+
+static int
+get_code(fz_faxd *fax, const cfd_node *table, int initialbits)
+{
+	int nbits;
+	int val = peek_code(fax->word, table, initialbits, &nbits);
+
 	eat_bits(fax, nbits);
 
 	return val;
@@ -417,6 +452,7 @@ dec1d(fz_context *ctx, fz_faxd *fax)
 
 	if (code < 64)
 	{
+		add_change(fax, fax->a, fax->a);
 		fax->c = !fax->c;
 		fax->stage = STATE_NORMAL;
 	}
@@ -456,6 +492,7 @@ dec2d(fz_context *ctx, fz_faxd *fax)
 
 		if (code < 64)
 		{
+			add_change(fax, fax->a, fax->a);
 			fax->c = !fax->c;
 			if (fax->stage == STATE_H1)
 				fax->stage = STATE_H2;
@@ -475,66 +512,73 @@ dec2d(fz_context *ctx, fz_faxd *fax)
 		break;
 
 	case P:
-		b1 = find_changing_color(fax->ref, fax->a, fax->columns, !fax->c);
+		b1 = find_changing_color(fax, fax->a, !fax->c);
 		if (b1 >= fax->columns)
 			b2 = fax->columns;
 		else
-			b2 = find_changing(fax->ref, b1, fax->columns);
+			b2 = find_next_changing(fax);
 		if (fax->c) setbits(fax->dst, fax->a, b2);
 		fax->a = b2;
 		break;
 
 	case V0:
-		b1 = find_changing_color(fax->ref, fax->a, fax->columns, !fax->c);
+		b1 = find_changing_color(fax, fax->a, !fax->c);
 		if (fax->c) setbits(fax->dst, fax->a, b1);
+		add_change(fax, fax->a, b1);
 		fax->a = b1;
 		fax->c = !fax->c;
 		break;
 
 	case VR1:
-		b1 = 1 + find_changing_color(fax->ref, fax->a, fax->columns, !fax->c);
+		b1 = 1 + find_changing_color(fax, fax->a, !fax->c);
 		if (b1 >= fax->columns) b1 = fax->columns;
 		if (fax->c) setbits(fax->dst, fax->a, b1);
+		add_change(fax, fax->a, b1);
 		fax->a = b1;
 		fax->c = !fax->c;
 		break;
 
 	case VR2:
-		b1 = 2 + find_changing_color(fax->ref, fax->a, fax->columns, !fax->c);
+		b1 = 2 + find_changing_color(fax, fax->a, !fax->c);
 		if (b1 >= fax->columns) b1 = fax->columns;
 		if (fax->c) setbits(fax->dst, fax->a, b1);
+		add_change(fax, fax->a, b1);
 		fax->a = b1;
 		fax->c = !fax->c;
 		break;
 
 	case VR3:
-		b1 = 3 + find_changing_color(fax->ref, fax->a, fax->columns, !fax->c);
+		b1 = 3 + find_changing_color(fax, fax->a, !fax->c);
 		if (b1 >= fax->columns) b1 = fax->columns;
 		if (fax->c) setbits(fax->dst, fax->a, b1);
+		add_change(fax, fax->a, b1);
 		fax->a = b1;
 		fax->c = !fax->c;
 		break;
 
 	case VL1:
-		b1 = -1 + find_changing_color(fax->ref, fax->a, fax->columns, !fax->c);
+		b1 = -1 + find_changing_color(fax, fax->a, !fax->c);
 		if (b1 < 0) b1 = 0;
 		if (fax->c) setbits(fax->dst, fax->a, b1);
+		add_change(fax, fax->a, b1);
 		fax->a = b1;
 		fax->c = !fax->c;
 		break;
 
 	case VL2:
-		b1 = -2 + find_changing_color(fax->ref, fax->a, fax->columns, !fax->c);
+		b1 = -2 + find_changing_color(fax, fax->a, !fax->c);
 		if (b1 < 0) b1 = 0;
 		if (fax->c) setbits(fax->dst, fax->a, b1);
+		add_change(fax, fax->a, b1);
 		fax->a = b1;
 		fax->c = !fax->c;
 		break;
 
 	case VL3:
-		b1 = -3 + find_changing_color(fax->ref, fax->a, fax->columns, !fax->c);
+		b1 = -3 + find_changing_color(fax, fax->a, !fax->c);
 		if (b1 < 0) b1 = 0;
 		if (fax->c) setbits(fax->dst, fax->a, b1);
+		add_change(fax, fax->a, b1);
 		fax->a = b1;
 		fax->c = !fax->c;
 		break;
@@ -550,6 +594,123 @@ dec2d(fz_context *ctx, fz_faxd *fax)
 	}
 }
 
+/*
+ * Decode the rest of a row of 2d codes with the bit buffer kept in locals
+ * and refilled straight from the buffer of the underlying stream. Anything
+ * out of the ordinary (EOL codes, the end of the buffered data, invalid
+ * codes) is left unconsumed for dec2d and read_faxd to deal with.
+ */
+static void
+dec2d_row(fz_faxd *fax)
+{
+	fz_stream *chain = fax->chain;
+	unsigned char *rp = chain->rp;
+	unsigned char *wp = chain->wp;
+	unsigned char *dst = fax->dst;
+	unsigned int word = fax->word;
+	int bidx = fax->bidx;
+	int columns = fax->columns;
+	int stage = fax->stage;
+	int a = fax->a;
+	int c = fax->c;
+	int code, nbits, b1;
+
+	while (1)
+	{
+		while (bidx >= 8)
+		{
+			if (rp == wp)
+				goto done;
+			bidx -= 8;
+			word |= *rp++ << bidx;
+		}
+
+		/* EOL or fill bits */
+		if ((word >> (32 - 12)) <= 1)
+			break;
+
+		if (stage == STATE_H1 || stage == STATE_H2)
+		{
+			if (c)
+				code = peek_code(word, cf_black_decode, cfd_black_initial_bits, &nbits);
+			else
+				code = peek_code(word, cf_white_decode, cfd_white_initial_bits, &nbits);
+			if (a == -1)
+				a = 0;
+			if (code < 0 || a + code > columns)
+				break;
+			word <<= nbits;
+			bidx += nbits;
+
+			if (c)
+				setbits(dst, a, a + code);
+			a += code;
+
+			if (code < 64)
+			{
+				add_change(fax, a, a);
+				c = !c;
+				if (stage == STATE_H1)
+					stage = STATE_H2;
+				else
+				{
+					stage = STATE_NORMAL;
+					if (a >= columns)
+						break;
+				}
+			}
+			continue;
+		}
+
+		code = peek_code(word, cf_2d_decode, cfd_2d_initial_bits, &nbits);
+		if (code < 0 && code != H && code != P)
+			break;
+		word <<= nbits;
+		bidx += nbits;
+
+		if (code == H)
+		{
+			stage = STATE_H1;
+			continue;
+		}
+
+		b1 = find_changing_color(fax, a, !c);
+		if (code == P)
+		{
+			if (b1 < columns)
+				b1 = find_next_changing(fax);
+			if (c)
+				setbits(dst, a, b1);
+			a = b1;
+		}
+		else
+		{
+			/* VR3 to VL3 are 0 to 6 */
+			b1 += V0 - code;
+			if (b1 > columns)
+				b1 = columns;
+			if (b1 < 0)
+				b1 = 0;
+			if (c)
+				setbits(dst, a, b1);
+			add_change(fax, a, b1);
+			a = b1;
+			c = !c;
+		}
+
+		if (a >= columns)
+			break;
+	}
+
+done:
+	chain->rp = rp;
+	fax->word = word;
+	fax->bidx = bidx;
+	fax->stage = stage;
+	fax->a = a;
+	fax->c = c;
+}
+
 static int
 read_faxd(fz_stream *stm, unsigned char *buf, int len)
 {
@@ -557,6 +718,7 @@ read_faxd(fz_stream *stm, unsigned char *buf, int len)
 	unsigned char *p = buf;
 	unsigned char *ep = buf + len;
 	unsigned char *tmp;
+	int *ctmp;
 
 	if (fax->stage == STATE_INIT && fax->end_of_line)
 	{
@@ -632,6 +794,8 @@ loop:
 	{
 		fax->eolc = 0;
 		dec2d(stm->ctx, fax);
+		if (fax->a < fax->columns)
+			dec2d_row(fax);
 	}
 
 	/* no eol check after makeup codes nor in the middle of an H code */
@@ -666,6 +830,15 @@ eol:
 	if (fax->rp < fax->wp)
 		return p - buf;
 
+	/* 2d codes refer to the changing elements of the row just decoded */
+	end_changes(fax);
+	ctmp = fax->ref_changes;
+	fax->ref_changes = fax->dst_changes;
+	fax->dst_changes = ctmp;
+	fax->nchanges = 0;
+	fax->dirty = 0;
+	fax->cidx = 0;
+
 	tmp = fax->ref;
 	fax->ref = fax->dst;
 	fax->dst = tmp;
@@ -728,6 +901,8 @@ close_faxd(fz_context *ctx, void *state_)
 	fz_close(fax->chain);
 	fz_free(ctx, fax->ref);
 	fz_free(ctx, fax->dst);
+	fz_free(ctx, fax->ref_changes);
+	fz_free(ctx, fax->dst_changes);
 	fz_free(ctx, fax);
 }
 
@@ -749,6 +924,8 @@ fz_open_faxd(fz_stream *chain,
 
 		fax->ref = NULL;
 		fax->dst = NULL;
+		fax->ref_changes = NULL;
+		fax->dst_changes = NULL;
 
 		fax->k = k;
 		fax->end_of_line = end_of_line;
@@ -771,6 +948,12 @@ fz_open_faxd(fz_stream *chain,
 
 		fax->ref = fz_malloc(ctx, fax->stride);
 		fax->dst = fz_malloc(ctx, fax->stride);
+		fax->ref_changes = fz_malloc_array(ctx, fz_maxi(fax->columns, 0) + 3, sizeof(int));
+		fax->dst_changes = fz_malloc_array(ctx, fz_maxi(fax->columns, 0) + 3, sizeof(int));
+		fax->ref_changes[0] = fax->ref_changes[1] = fax->columns;
+		fax->cidx = 0;
+		fax->nchanges = 0;
+			fax->dirty = 0;
 		fax->rp = fax->dst;
 		fax->wp = fax->dst + fax->stride;
 
@@ -781,6 +964,8 @@ fz_open_faxd(fz_stream *chain,
 	{
 		if (fax)
 		{
+			fz_free(ctx, fax->dst_changes);
+			fz_free(ctx, fax->ref_changes);
 			fz_free(ctx, fax->dst);
 			fz_free(ctx, fax->ref);
 		}
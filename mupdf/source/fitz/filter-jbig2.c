@@ -4,11 +4,19 @@
 
 typedef struct fz_jbig2d_s fz_jbig2d;
 
+/* SumatraPDF: count the memory held by the decoded symbol dictionaries */
+typedef struct fz_jbig2_alloc_s
+{
+	Jbig2Allocator super;
+	unsigned int size;
+} fz_jbig2_alloc;
+
 /* SumatraPDF: reuse JBIG2Globals */
 struct fz_jbig2_globals_s
 {
 	fz_storable storable;
 	Jbig2GlobalCtx *gctx;
+	fz_jbig2_alloc alloc;
 };
 
 static void
@@ -32,9 +40,10 @@ close_jbig2d(fz_context *ctx, void *state_)
 	fz_jbig2d *state = (fz_jbig2d *)state_;
 	if (state->page)
 		jbig2_release_page(state->ctx, state->page);
+	/* SumatraPDF: release the cloned symbols before the globals */
+	jbig2_ctx_free(state->ctx);
 	if (state->gctx)
 		fz_drop_jbig2_globals(ctx, state->gctx);
-	jbig2_ctx_free(state->ctx);
 	fz_close(state->chain);
 	fz_free(ctx, state);
 }
@@ -88,13 +97,69 @@ error_callback(void *data, const char *msg, Jbig2Severity severity, int32_t seg_
 	return 0;
 }
 
+/* SumatraPDF: count the memory held by the decoded symbol dictionaries */
+/* Every block is prefixed with its size so that the transient buffers freed
+ * during decoding aren't charged. This relies on page contexts being freed
+ * before the globals, so that all symbol images cloned from the global
+ * context are eventually freed by it. */
+typedef union
+{
+	size_t size;
+	double align;
+} fz_jbig2_alloc_header;
+
+static void *
+globals_alloc(Jbig2Allocator *allocator, size_t size)
+{
+	fz_jbig2_alloc_header *h = malloc(sizeof(fz_jbig2_alloc_header) + size);
+	if (!h)
+		return NULL;
+	h->size = size;
+	((fz_jbig2_alloc *)allocator)->size += size;
+	return h + 1;
+}
+
+static void
+globals_free(Jbig2Allocator *allocator, void *p)
+{
+	fz_jbig2_alloc_header *h = p;
+	if (!h)
+		return;
+	h--;
+	((fz_jbig2_alloc *)allocator)->size -= h->size;
+	free(h);
+}
+
+static void *
+globals_realloc(Jbig2Allocator *allocator, void *p, size_t size)
+{
+	fz_jbig2_alloc_header *h = p;
+	size_t old;
+	if (!h)
+		return globals_alloc(allocator, size);
+	h--;
+	old = h->size;
+	h = realloc(h, sizeof(fz_jbig2_alloc_header) + size);
+	if (!h)
+		return NULL;
+	h->size = size;
+	((fz_jbig2_alloc *)allocator)->size += size - old;
+	return h + 1;
+}
+
 /* SumatraPDF: reuse JBIG2Globals */
 fz_jbig2_globals *
 fz_load_jbig2_globals(fz_context *ctx, unsigned char *data, int size)
 {
 	fz_jbig2_globals *globals = fz_malloc_struct(ctx, fz_jbig2_globals);
+	Jbig2Ctx *jctx;
+
+	globals->alloc.super.alloc = globals_alloc;
+	globals->alloc.super.free = globals_free;
+	globals->alloc.super.realloc = globals_realloc;
+	globals->alloc.size = sizeof(fz_jbig2_globals);
 
-	Jbig2Ctx *jctx = jbig2_ctx_new(NULL, JBIG2_OPTIONS_EMBEDDED, NULL, error_callback, ctx);
+	jctx = jbig2_ctx_new(&globals->alloc.super, JBIG2_OPTIONS_EMBEDDED, NULL, error_callback, ctx);
 	jbig2_data_in(jctx, data, size);
 
 	FZ_INIT_STORABLE(globals, 1, fz_free_jbig2_globals_imp);
@@ -103,6 +168,13 @@ fz_load_jbig2_globals(fz_context *ctx, unsigned char *data, int size)
 	return globals;
 }
 
+/* Approximate size of the decoded globals (for charging the store) */
+unsigned int
+fz_jbig2_globals_size(fz_jbig2_globals *globals)
+{
+	return globals->alloc.size;
+}
+
 void
 fz_free_jbig2_globals_imp(fz_context *ctx, fz_storable *globals_)
 {
@@ -134,10 +206,10 @@ fz_open_jbig2d(fz_stream *chain, fz_jbig2_globals *globals)
 	{
 		if (state)
 		{
-			if (state->gctx)
-				fz_drop_jbig2_globals(ctx, state->gctx);
 			if (state->ctx)
 				jbig2_ctx_free(state->ctx);
+			if (state->gctx)
+				fz_drop_jbig2_globals(ctx, state->gctx);
 		}
 		fz_free(ctx, state);
 		fz_close(chain);
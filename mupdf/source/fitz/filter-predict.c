@@ -1,8 +1,11 @@
 #include "mupdf/fitz.h"
+#include "draw-imp.h"
 
 /* TODO: check if this works with 16bpp images */
 
-enum { MAXC = 32 };
+/* SumatraPDF: input is read in chunks of at least PREDICT_CHUNK bytes,
+ * so that the chained filter decodes straight into our buffer */
+enum { MAXC = 32, PREDICT_CHUNK = 16384 };
 
 typedef struct fz_predict_s fz_predict;
 
@@ -21,6 +24,9 @@ struct fz_predict_s
 	unsigned char *out;
 	unsigned char *ref;
 	unsigned char *rp, *wp;
+	/* SumatraPDF: unconsumed input */
+	int insize;
+	unsigned char *inrp, *inwp;
 };
 
 static inline int getcomponent(unsigned char *line, int x, int bpc)
@@ -55,7 +61,10 @@ static inline int paeth(int a, int b, int c)
 	int pa = fz_absi(ac);
 	int pb = fz_absi(bc);
 	int pc = fz_absi(abcc);
-	return pa <= pb && pa <= pc ? a : pb <= pc ? b : c;
+	/* written to compile to conditional moves: the choice is unpredictable */
+	int bc_min = pb <= pc ? pb : pc;
+	int b_or_c = pb <= pc ? b : c;
+	return pa <= bc_min ? a : b_or_c;
 }
 
 static void
@@ -65,6 +74,16 @@ fz_predict_tiff(fz_predict *state, unsigned char *out, unsigned char *in, int le
 	int i, k;
 	const int mask = (1 << state->bpc)-1;
 
+	if (state->bpc == 8)
+	{
+		int n = state->colors;
+		for (i = 0; i < n && i < len; i++)
+			out[i] = in[i];
+		for (; i < len; i++)
+			out[i] = in[i] + out[i - n];
+		return;
+	}
+
 	for (k = 0; k < state->colors; k++)
 		left[k] = 0;
 	memset(out, 0, state->stride);
@@ -82,100 +101,252 @@ fz_predict_tiff(fz_predict *state, unsigned char *out, unsigned char *in, int le
 	}
 }
 
-static void
-fz_predict_png(fz_predict *state, unsigned char *out, unsigned char *in, int len, int predictor)
+#ifdef ARCH_X86
+
+/*
+ * SSE2 versions of the PNG predictors (cf. libpng's filter_sse2_intrinsics.c).
+ * Up works on 16 bytes at a time for any bpp; Sub, Average and Paeth
+ * decode one pixel at a time for 3 and 4 bytes per pixel. The number
+ * of bytes done is returned, leaving the rest to the scalar code.
+ */
+
+/* 3 byte pixels are assembled in registers, as partial stores to memory
+ * followed by a full load would stall store forwarding */
+FZ_TARGET_SSE2 static inline __m128i
+load_pixel(const unsigned char *p, int bpp)
 {
-	int bpp = state->bpp;
-	int i;
-	unsigned char *ref = state->ref;
+	int v;
+	if (bpp == 4)
+		memcpy(&v, p, 4);
+	else
+		v = p[0] | (p[1] << 8) | (p[2] << 16);
+	return _mm_cvtsi32_si128(v);
+}
+
+FZ_TARGET_SSE2 static inline void
+store_pixel(unsigned char *p, __m128i v, int bpp)
+{
+	int x = _mm_cvtsi128_si32(v);
+	if (bpp == 4)
+		memcpy(p, &x, 4);
+	else
+	{
+		p[0] = x;
+		p[1] = x >> 8;
+		p[2] = x >> 16;
+	}
+}
+
+FZ_TARGET_SSE2 static inline __m128i
+abs_epi16(__m128i x)
+{
+	return _mm_max_epi16(x, _mm_sub_epi16(_mm_setzero_si128(), x));
+}
+
+FZ_TARGET_SSE2 static inline __m128i
+select_si128(__m128i mask, __m128i a, __m128i b)
+{
+	return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+
+/* inlined with a constant bpp of 3 or 4 */
+FZ_TARGET_SSE2 static inline int
+predict_pixels_sse2(unsigned char *out, unsigned char *in, unsigned char *ref, int len, const int bpp, int predictor)
+{
+	__m128i zero = _mm_setzero_si128();
+	__m128i a = zero, b, c = zero, d;
+	int i = 0;
 
 	switch (predictor)
 	{
-	case 0:
-		memcpy(out, in, len);
-		break;
 	case 1:
-		for (i = bpp; i > 0; i--)
+		for (; i + bpp <= len; i += bpp)
 		{
-			*out++ = *in++;
+			a = _mm_add_epi8(a, load_pixel(in + i, bpp));
+			store_pixel(out + i, a, bpp);
 		}
-		for (i = len - bpp; i > 0; i--)
+		break;
+	case 3:
+		for (; i + bpp <= len; i += bpp)
 		{
-			*out = *in++ + out[-bpp];
-			out++;
+			/* _mm_avg_epu8 rounds up, (a + b) / 2 rounds down */
+			b = load_pixel(ref + i, bpp);
+			d = _mm_avg_epu8(a, b);
+			d = _mm_sub_epi8(d, _mm_and_si128(_mm_xor_si128(a, b), _mm_set1_epi8(1)));
+			a = _mm_add_epi8(load_pixel(in + i, bpp), d);
+			store_pixel(out + i, a, bpp);
 		}
 		break;
-	case 2:
-		for (i = bpp; i > 0; i--)
+	case 4:
+		/* in 16 bit lanes, as abs(a + b - 2c) needs 10 bits */
+		for (; i + bpp <= len; i += bpp)
 		{
-			*out++ = *in++ + *ref++;
+			__m128i pa, pb, pc, smallest, nearest;
+			b = _mm_unpacklo_epi8(load_pixel(ref + i, bpp), zero);
+			d = _mm_unpacklo_epi8(load_pixel(in + i, bpp), zero);
+			pa = _mm_sub_epi16(b, c);
+			pb = _mm_sub_epi16(a, c);
+			pc = _mm_add_epi16(pa, pb);
+			pa = abs_epi16(pa);
+			pb = abs_epi16(pb);
+			pc = abs_epi16(pc);
+			smallest = _mm_min_epi16(pc, _mm_min_epi16(pa, pb));
+			/* same tie breaking as paeth: a before b before c */
+			nearest = select_si128(_mm_cmpeq_epi16(smallest, pa), a,
+				select_si128(_mm_cmpeq_epi16(smallest, pb), b, c));
+			/* adding bytes keeps the high byte of each lane zero */
+			a = _mm_add_epi8(d, nearest);
+			store_pixel(out + i, _mm_packus_epi16(a, a), bpp);
+			c = b;
 		}
-		for (i = len - bpp; i > 0; i--)
+		break;
+	}
+
+	return i;
+}
+
+FZ_TARGET_SSE2 static int
+fz_predict_png_sse2(unsigned char *out, unsigned char *in, unsigned char *ref, int len, int bpp, int predictor)
+{
+	int i = 0;
+
+	if (predictor == 2)
+	{
+		for (; i + 16 <= len; i += 16)
 		{
-			*out++ = *in++ + *ref++;
+			__m128i d = _mm_loadu_si128((const __m128i *)(in + i));
+			__m128i b = _mm_loadu_si128((const __m128i *)(ref + i));
+			_mm_storeu_si128((__m128i *)(out + i), _mm_add_epi8(d, b));
 		}
+		return i;
+	}
+
+	if (bpp == 3)
+		return predict_pixels_sse2(out, in, ref, len, 3, predictor);
+	if (bpp == 4)
+		return predict_pixels_sse2(out, in, ref, len, 4, predictor);
+	return 0;
+}
+
+#endif
+
+static void
+fz_predict_png(fz_context *ctx, fz_predict *state, unsigned char *out, unsigned char *in, unsigned char *ref, int len, int predictor)
+{
+	int bpp = state->bpp;
+	int i = 0;
+
+#ifdef ARCH_X86
+	if (fz_cpu_flags(ctx) & FZ_CPU_SSE2)
+		i = fz_predict_png_sse2(out, in, ref, len, bpp, predictor);
+#endif
+
+	switch (predictor)
+	{
+	case 0:
+		memcpy(out, in, len);
+		break;
+	case 1:
+		for (; i < bpp && i < len; i++)
+			out[i] = in[i];
+		for (; i < len; i++)
+			out[i] = in[i] + out[i - bpp];
+		break;
+	case 2:
+		for (; i < len; i++)
+			out[i] = in[i] + ref[i];
 		break;
 	case 3:
-		for (i = bpp; i > 0; i--)
-		{
-			*out++ = *in++ + (*ref++) / 2;
-		}
-		for (i = len - bpp; i > 0; i--)
-		{
-			*out = *in++ + (out[-bpp] + *ref++) / 2;
-			out++;
-		}
+		for (; i < bpp && i < len; i++)
+			out[i] = in[i] + ref[i] / 2;
+		for (; i < len; i++)
+			out[i] = in[i] + (out[i - bpp] + ref[i]) / 2;
 		break;
 	case 4:
-		for (i = bpp; i > 0; i--)
-		{
-			*out++ = *in++ + paeth(0, *ref++, 0);
-		}
-		for (i = len - bpp; i > 0; i --)
-		{
-			*out = *in++ + paeth(out[-bpp], *ref, ref[-bpp]);
-			ref++;
-			out++;
-		}
+		for (; i < bpp && i < len; i++)
+			out[i] = in[i] + paeth(0, ref[i], 0);
+		for (; i < len; i++)
+			out[i] = in[i] + paeth(out[i - bpp], ref[i], ref[i - bpp]);
+		break;
+	default:
+		/* unknown filter type: repeat the previous row */
+		memcpy(out, ref, len);
 		break;
 	}
 }
 
+/* SumatraPDF: decode rows straight into the caller's buffer when they fit */
 static int
 read_predict(fz_stream *stm, unsigned char *buf, int len)
 {
 	fz_predict *state = stm->state;
 	unsigned char *p = buf;
 	unsigned char *ep = buf + len;
+	unsigned char *ref = state->ref;
 	int ispng = state->predictor >= 10;
+	int rowlen = state->stride + ispng;
 	int n;
 
-	while (state->rp < state->wp && p < ep)
-		*p++ = *state->rp++;
+	n = fz_mini(ep - p, state->wp - state->rp);
+	memcpy(p, state->rp, n);
+	p += n;
+	state->rp += n;
 
 	while (p < ep)
 	{
-		n = fz_read(state->chain, state->in, state->stride + ispng);
-		if (n == 0)
-			return p - buf;
+		unsigned char *in, *out;
+
+		/* get a complete row of input (or whatever is left of the last one) */
+		n = state->inwp - state->inrp;
+		if (n < rowlen)
+		{
+			memmove(state->in, state->inrp, n);
+			state->inrp = state->in;
+			state->inwp = state->in + n;
+			while (n < rowlen)
+			{
+				int k = fz_read(state->chain, state->inwp, state->in + state->insize - state->inwp);
+				if (k == 0)
+					break;
+				state->inwp += k;
+				n += k;
+			}
+			if (n == 0)
+				break;
+		}
+		n = fz_mini(n, rowlen);
+		in = state->inrp;
+		state->inrp += n;
+
+		out = ep - p >= state->stride ? p : state->out;
 
 		if (state->predictor == 1)
-			memcpy(state->out, state->in, n);
+			memcpy(out, in, n);
 		else if (state->predictor == 2)
-			fz_predict_tiff(state, state->out, state->in, n);
+			fz_predict_tiff(state, out, in, n);
 		else
 		{
-			fz_predict_png(state, state->out, state->in + 1, n - 1, state->in[0]);
-			memcpy(state->ref, state->out, state->stride);
+			fz_predict_png(stm->ctx, state, out, in + 1, ref, n - 1, in[0]);
+			ref = out;
 		}
 
-		state->rp = state->out;
-		state->wp = state->out + n - ispng;
-
-		while (state->rp < state->wp && p < ep)
-			*p++ = *state->rp++;
+		if (out == p)
+			p += n - ispng;
+		else
+		{
+			state->rp = out;
+			state->wp = out + n - ispng;
+			n = fz_mini(ep - p, state->wp - state->rp);
+			memcpy(p, state->rp, n);
+			p += n;
+			state->rp += n;
+		}
 	}
 
+	/* the last row may be in the caller's buffer */
+	if (ref != state->ref)
+		memcpy(state->ref, ref, state->stride);
+
 	return p - buf;
 }
 
@@ -232,11 +403,14 @@ fz_open_predict(fz_stream *chain, int predictor, int columns, int colors, int bp
 		state->stride = (state->bpc * state->colors * state->columns + 7) / 8;
 		state->bpp = (state->bpc * state->colors + 7) / 8;
 
-		state->in = fz_malloc(ctx, state->stride + 1);
+		state->insize = state->stride + 1 + PREDICT_CHUNK;
+		state->in = fz_malloc(ctx, state->insize);
 		state->out = fz_malloc(ctx, state->stride);
 		state->ref = fz_malloc(ctx, state->stride);
 		state->rp = state->out;
 		state->wp = state->out;
+		state->inrp = state->in;
+		state->inwp = state->in;
 
 		memset(state->ref, 0, state->stride);
 	}
@@ -1,4 +1,5 @@
 #include "mupdf/fitz.h"
+#include "draw-imp.h"
 
 fz_halftone *
 fz_new_halftone(fz_context *ctx, int comps)
@@ -63,20 +64,31 @@ static unsigned char mono_ht[] =
 fz_halftone *fz_default_halftone(fz_context *ctx, int num_comps)
 {
 	fz_halftone *ht = fz_new_halftone(ctx, num_comps);
-	assert(num_comps == 1); /* Only support 1 component for now */
-	ht->comp[0] = fz_new_pixmap_with_data(ctx, NULL, 16, 16, mono_ht);
+	int i;
+	fz_try(ctx)
+	{
+		/* Use the mono tile for all components */
+		for (i = 0; i < num_comps; i++)
+			ht->comp[i] = fz_new_pixmap_with_data(ctx, NULL, 16, 16, mono_ht);
+	}
+	fz_catch(ctx)
+	{
+		fz_drop_halftone(ctx, ht);
+		fz_rethrow(ctx);
+	}
 	return ht;
 }
 
 /* Finally, code to actually perform halftoning. */
-static void make_ht_line(unsigned char *buf, fz_halftone *ht, int x, int y, int w)
+/* Form the thresholds for the first n components (the halftone may have
+ * more) of a line of w pixels. */
+static void make_ht_line(unsigned char *buf, fz_halftone *ht, int n, int x, int y, int w)
 {
 	/* FIXME: There is a potential optimisation here; in the case where
 	 * the LCM of the halftone tile widths is smaller than w, we could
 	 * form just one 'LCM' run, then copy it repeatedly.
 	 */
-	int k, n;
-	n = ht->n;
+	int k;
 	for (k = 0; k < n; k++)
 	{
 		fz_pixmap *tile = ht->comp[k];
@@ -137,7 +149,7 @@ static void make_ht_line(unsigned char *buf, fz_halftone *ht, int x, int y, int
 }
 
 /* Inner mono thresholding code */
-static void do_threshold_1(unsigned char *ht_line, unsigned char *pixmap, unsigned char *out, int w)
+static void do_threshold_1(const unsigned char *ht_line, const unsigned char *pixmap, unsigned char *out, int w)
 {
 	int bit = 0x80;
 	int h = 0;
@@ -161,42 +173,299 @@ static void do_threshold_1(unsigned char *ht_line, unsigned char *pixmap, unsign
 		*out = h;
 }
 
+/* Inner thresholding code for lines of components without alpha */
+static void do_threshold_n(const unsigned char *ht_line, const unsigned char *line, unsigned char *out, int len)
+{
+	int bit = 0x80;
+	int h = 0;
+
+	do
+	{
+		if (*line++ < *ht_line++)
+			h |= bit;
+		bit >>= 1;
+		if (bit == 0)
+		{
+			*out++ = h;
+			h = 0;
+			bit = 0x80;
+		}
+	}
+	while (--len);
+	if (bit != 0x80)
+		*out = h;
+}
+
+#ifdef ARCH_X86
+
+/*
+ * SIMD thresholding: 16 (SSE2) resp. 32 (AVX2) components are compared
+ * at once and their results are collected with movemask. As movemask puts
+ * the first component into the lowest bit while bitmaps start with the
+ * highest bit, the comparison results are first reversed in groups of 8.
+ * Returns the number of components processed (always a multiple of 8).
+ */
+
+FZ_TARGET_SSE2 static inline __m128i
+ht_reverse_bytes_in_qwords_sse2(__m128i v)
+{
+	v = _mm_shufflehi_epi16(_mm_shufflelo_epi16(v, 0x1B), 0x1B);
+	return _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+}
+
+/* unsigned a < b */
+FZ_TARGET_SSE2 static inline __m128i
+ht_cmplt_epu8_sse2(__m128i a, __m128i b)
+{
+	__m128i bias = _mm_set1_epi8((char)0x80);
+	return _mm_cmplt_epi8(_mm_xor_si128(a, bias), _mm_xor_si128(b, bias));
+}
+
+FZ_TARGET_SSE2 static int
+do_threshold_1_sse2(const unsigned char *ht_line, const unsigned char *pixmap, unsigned char *out, int w)
+{
+	__m128i lomask = _mm_set1_epi16(0xFF);
+	int i;
+	for (i = 0; i + 16 <= w; i += 16, pixmap += 32, out += 2)
+	{
+		/* drop the alpha */
+		__m128i p0 = _mm_and_si128(_mm_loadu_si128((const __m128i *)pixmap), lomask);
+		__m128i p1 = _mm_and_si128(_mm_loadu_si128((const __m128i *)(pixmap + 16)), lomask);
+		__m128i p = _mm_packus_epi16(p0, p1);
+		__m128i lt = ht_cmplt_epu8_sse2(p, _mm_loadu_si128((const __m128i *)(ht_line + i)));
+		int bits = _mm_movemask_epi8(ht_reverse_bytes_in_qwords_sse2(lt));
+		out[0] = bits;
+		out[1] = bits >> 8;
+	}
+	return i;
+}
+
+FZ_TARGET_SSE2 static int
+do_threshold_n_sse2(const unsigned char *ht_line, const unsigned char *line, unsigned char *out, int len)
+{
+	int i;
+	for (i = 0; i + 16 <= len; i += 16, out += 2)
+	{
+		__m128i p = _mm_loadu_si128((const __m128i *)(line + i));
+		__m128i lt = ht_cmplt_epu8_sse2(p, _mm_loadu_si128((const __m128i *)(ht_line + i)));
+		int bits = _mm_movemask_epi8(ht_reverse_bytes_in_qwords_sse2(lt));
+		out[0] = bits;
+		out[1] = bits >> 8;
+	}
+	return i;
+}
+
+#ifdef ARCH_X86_AVX2
+
+FZ_TARGET_AVX2 static inline __m256i
+ht_reverse_bytes_in_qwords_avx2(__m256i v)
+{
+	v = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(v, 0x1B), 0x1B);
+	return _mm256_or_si256(_mm256_slli_epi16(v, 8), _mm256_srli_epi16(v, 8));
+}
+
+FZ_TARGET_AVX2 static inline __m256i
+ht_cmplt_epu8_avx2(__m256i a, __m256i b)
+{
+	__m256i bias = _mm256_set1_epi8((char)0x80);
+	return _mm256_cmpgt_epi8(_mm256_xor_si256(b, bias), _mm256_xor_si256(a, bias));
+}
+
+FZ_TARGET_AVX2 static inline void
+ht_store_bits_avx2(unsigned char *out, unsigned int bits)
+{
+	out[0] = bits;
+	out[1] = bits >> 8;
+	out[2] = bits >> 16;
+	out[3] = bits >> 24;
+}
+
+FZ_TARGET_AVX2 static int
+do_threshold_1_avx2(const unsigned char *ht_line, const unsigned char *pixmap, unsigned char *out, int w)
+{
+	__m256i lomask = _mm256_set1_epi16(0xFF);
+	int i;
+	for (i = 0; i + 32 <= w; i += 32, pixmap += 64, out += 4)
+	{
+		__m256i p0 = _mm256_and_si256(_mm256_loadu_si256((const __m256i *)pixmap), lomask);
+		__m256i p1 = _mm256_and_si256(_mm256_loadu_si256((const __m256i *)(pixmap + 32)), lomask);
+		/* packing works per 128 bit lane, so restore the pixel order afterwards */
+		__m256i p = _mm256_permute4x64_epi64(_mm256_packus_epi16(p0, p1), 0xD8);
+		__m256i lt = ht_cmplt_epu8_avx2(p, _mm256_loadu_si256((const __m256i *)(ht_line + i)));
+		ht_store_bits_avx2(out, (unsigned int)_mm256_movemask_epi8(ht_reverse_bytes_in_qwords_avx2(lt)));
+	}
+	return i;
+}
+
+FZ_TARGET_AVX2 static int
+do_threshold_n_avx2(const unsigned char *ht_line, const unsigned char *line, unsigned char *out, int len)
+{
+	int i;
+	for (i = 0; i + 32 <= len; i += 32, out += 4)
+	{
+		__m256i p = _mm256_loadu_si256((const __m256i *)(line + i));
+		__m256i lt = ht_cmplt_epu8_avx2(p, _mm256_loadu_si256((const __m256i *)(ht_line + i)));
+		ht_store_bits_avx2(out, (unsigned int)_mm256_movemask_epi8(ht_reverse_bytes_in_qwords_avx2(lt)));
+	}
+	return i;
+}
+
+#endif /* ARCH_X86_AVX2 */
+
+#endif /* ARCH_X86 */
+
+static void threshold_1(fz_context *ctx, const unsigned char *ht_line, const unsigned char *pixmap, unsigned char *out, int w)
+{
+#ifdef ARCH_X86
+	int cpu = fz_cpu_flags(ctx);
+	int done = 0;
+#ifdef ARCH_X86_AVX2
+	if (cpu & FZ_CPU_AVX2)
+		done = do_threshold_1_avx2(ht_line, pixmap, out, w);
+	else
+#endif
+	if (cpu & FZ_CPU_SSE2)
+		done = do_threshold_1_sse2(ht_line, pixmap, out, w);
+	if (done == w)
+		return;
+	ht_line += done;
+	pixmap += done * 2;
+	out += done / 8;
+	w -= done;
+#endif
+	do_threshold_1(ht_line, pixmap, out, w);
+}
+
+static void threshold_n(fz_context *ctx, const unsigned char *ht_line, const unsigned char *line, unsigned char *out, int len)
+{
+#ifdef ARCH_X86
+	int cpu = fz_cpu_flags(ctx);
+	int done = 0;
+#ifdef ARCH_X86_AVX2
+	if (cpu & FZ_CPU_AVX2)
+		done = do_threshold_n_avx2(ht_line, line, out, len);
+	else
+#endif
+	if (cpu & FZ_CPU_SSE2)
+		done = do_threshold_n_sse2(ht_line, line, out, len);
+	if (done == len)
+		return;
+	ht_line += done;
+	line += done;
+	out += done / 8;
+	len -= done;
+#endif
+	do_threshold_n(ht_line, line, out, len);
+}
+
+/* Copy the color components of a line of pixels, dropping the alpha.
+ * Subtractive components are inverted, so that for all colorspaces a
+ * set bit stands for a dark dot. */
+static void copy_ht_components(unsigned char *line, const unsigned char *pixmap, int n, int w, int invert)
+{
+	int k;
+	while (w--)
+	{
+		for (k = 0; k < n; k++)
+			*line++ = invert ? 255 - pixmap[k] : pixmap[k];
+		pixmap += n + 1;
+	}
+}
+
+static int gcd(int a, int b)
+{
+	while (b)
+	{
+		int t = a % b;
+		a = b;
+		b = t;
+	}
+	return a;
+}
+
+/* Threshold lines repeat after as many rows as the least common multiple
+ * of all tile heights. Up to this much memory is used for caching them. */
+#define MAX_HT_CACHE (4 << 20)
+
 fz_bitmap *fz_halftone_pixmap(fz_context *ctx, fz_pixmap *pix, fz_halftone *ht)
 {
-	fz_bitmap *out;
-	unsigned char *ht_line, *o, *p;
-	int w, h, x, y, n, pstride, ostride;
+	fz_bitmap *out = NULL;
+	unsigned char *ht_lines = NULL, *line = NULL, *o, *p;
+	int w, h, x, y, n, k, pstride, ostride, period, invert;
 	fz_halftone *ht_orig = ht;
 
 	if (!pix)
 		return NULL;
 
-	assert(pix->n == 2); /* Mono + Alpha */
-
 	n = pix->n-1; /* Remove alpha */
-	if (ht == NULL)
-	{
-		ht = fz_default_halftone(ctx, n);
-	}
-	ht_line = fz_malloc(ctx, pix->w * n);
-	out = fz_new_bitmap(ctx, pix->w, pix->h, n, pix->xres, pix->yres);
-	o = out->samples;
-	p = pix->samples;
+	if (ht && ht->n < n)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "halftone has fewer components (%d) than the pixmap (%d)", ht->n, n);
+	invert = pix->colorspace == fz_device_cmyk(ctx);
 
 	h = pix->h;
 	x = pix->x;
 	y = pix->y;
 	w = pix->w;
-	ostride = out->stride;
-	pstride = pix->w * pix->n;
-	while (h--)
+
+	fz_var(ht);
+	fz_var(ht_lines);
+	fz_var(line);
+
+	fz_try(ctx)
+	{
+		if (ht == NULL)
+			ht = fz_default_halftone(ctx, n);
+
+		period = 1;
+		for (k = 0; k < n; k++)
+		{
+			int th = ht->comp[k]->h;
+			period = period / gcd(period, th) * th;
+			if (period > h || (size_t)period * w * n > MAX_HT_CACHE)
+				break;
+		}
+		if (k < n || (fz_reference_paths(ctx) & FZ_REF_HALFTONE))
+			period = 0; /* rebuild the threshold line for every row */
+
+		ht_lines = fz_malloc(ctx, (size_t)w * n * (period ? period : 1));
+		for (k = 0; k < period; k++)
+			make_ht_line(ht_lines + (size_t)k * w * n, ht, n, x, y + k, w);
+		if (n > 1)
+			line = fz_malloc(ctx, w * n);
+
+		out = fz_new_bitmap(ctx, w, h, n, pix->xres, pix->yres);
+		o = out->samples;
+		p = pix->samples;
+		ostride = out->stride;
+		pstride = pix->w * pix->n;
+		for (k = 0; k < h; k++)
+		{
+			unsigned char *ht_line = ht_lines;
+			if (period)
+				ht_line += (size_t)(k % period) * w * n;
+			else
+				make_ht_line(ht_line, ht, n, x, y + k, w);
+			if (n == 1)
+				threshold_1(ctx, ht_line, p, o, w);
+			else
+			{
+				copy_ht_components(line, p, n, w, invert);
+				threshold_n(ctx, ht_line, line, o, w * n);
+			}
+			o += ostride;
+			p += pstride;
+		}
+	}
+	fz_always(ctx)
 	{
-		make_ht_line(ht_line, ht, x, y++, w);
-		do_threshold_1(ht_line, p, o, w);
-		o += ostride;
-		p += pstride;
+		fz_free(ctx, ht_lines);
+		fz_free(ctx, line);
+		if (!ht_orig)
+			fz_drop_halftone(ctx, ht);
+	}
+	fz_catch(ctx)
+	{
+		fz_rethrow(ctx);
 	}
-	if (!ht_orig)
-		fz_drop_halftone(ctx, ht);
 	return out;
 }
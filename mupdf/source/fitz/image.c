@@ -32,15 +32,21 @@ struct fz_image_key_s {
 	int refs;
 	fz_image *image;
 	int l2factor;
+	int tile; /* 0 for the whole image, else 1 + index of the tile */
 };
 
+/* Partial pixmaps are decoded and stored in tiles of this many pixels
+ * square (after subsampling) */
+#define FZ_IMAGE_TILE_SIZE 512
+
 static int
 fz_make_hash_image_key(fz_store_hash *hash, void *key_)
 {
 	fz_image_key *key = (fz_image_key *)key_;
 
 	hash->u.pi.ptr = key->image;
-	hash->u.pi.i = key->l2factor;
+	/* l2factor is at most 8 */
+	hash->u.pi.i = key->l2factor | (key->tile << 4);
 	return 1;
 }
 
@@ -80,7 +86,7 @@ fz_cmp_image_key(void *k0_, void *k1_)
 	fz_image_key *k0 = (fz_image_key *)k0_;
 	fz_image_key *k1 = (fz_image_key *)k1_;
 
-	return k0->image == k1->image && k0->l2factor == k1->l2factor;
+	return k0->image == k1->image && k0->l2factor == k1->l2factor && k0->tile == k1->tile;
 }
 
 #ifndef NDEBUG
@@ -89,7 +95,7 @@ fz_debug_image(FILE *out, void *key_)
 {
 	fz_image_key *key = (fz_image_key *)key_;
 
-	fprintf(out, "(image %d x %d sf=%d) ", key->image->w, key->image->h, key->l2factor);
+	fprintf(out, "(image %d x %d sf=%d tile=%d) ", key->image->w, key->image->h, key->l2factor, key->tile);
 }
 #endif
 
@@ -99,6 +105,7 @@ static fz_store_type fz_image_store_type =
 	fz_keep_image_key,
 	fz_drop_image_key,
 	fz_cmp_image_key,
+	FZ_STORE_CLASS_PIXMAP,
 #ifndef NDEBUG
 	fz_debug_image
 #endif
@@ -207,8 +214,63 @@ decomp_image_banded(fz_context *ctx, fz_stream *stm, fz_image *image, int indexe
 }
 
 
-fz_pixmap *
-fz_decomp_image_from_stream(fz_context *ctx, fz_stream *stm, fz_image *image, int in_line, int indexed, int l2factor, int native_l2factor)
+/* Read the rows and columns of subarea (in decoded pixels, with x0 a
+ * multiple of 8) out of the stream, without keeping the rest. Rows below
+ * the area are never decoded. */
+static int
+read_image_area(fz_context *ctx, fz_stream *stm, unsigned char *samples, int full_stride, int n, int bpc, const fz_irect *subarea)
+{
+	int skip = subarea->x0 * n * bpc / 8;
+	int stride = ((subarea->x1 - subarea->x0) * n * bpc + 7) / 8;
+	int y, len, total = 0;
+	unsigned char *row;
+
+	row = fz_malloc(ctx, full_stride);
+	fz_try(ctx)
+	{
+		for (y = 0; y < subarea->y1; y++)
+		{
+			len = fz_read(stm, row, full_stride);
+			if (len < 0)
+				fz_throw(ctx, FZ_ERROR_GENERIC, "cannot read image data");
+			if (y >= subarea->y0 && len > skip)
+			{
+				memcpy(samples, row + skip, fz_mini(len - skip, stride));
+				samples += stride;
+				total += fz_mini(len - skip, stride);
+			}
+			if (len < full_stride)
+				break;
+		}
+	}
+	fz_always(ctx)
+	{
+		fz_free(ctx, row);
+	}
+	fz_catch(ctx)
+	{
+		fz_rethrow(ctx);
+	}
+	return total;
+}
+
+/* Can 1-bit samples be subsampled without unpacking them first? Only if
+ * the decode array maps them to 0 and 255 (in either order). Returns 1 for
+ * [0 1], -1 for [1 0] and 0 otherwise. */
+static int
+bilevel_decode(fz_image *image, int indexed)
+{
+	if (image->bpc != 1 || image->n != 1 || indexed || image->usecolorkey)
+		return 0;
+	if (image->decode[0] == 0 && image->decode[1] == 1)
+		return 1;
+	if (image->decode[0] == 1 && image->decode[1] == 0)
+		return -1;
+	return 0;
+}
+
+static fz_pixmap *
+decomp_image(fz_context *ctx, fz_stream *stm, fz_image *image, int in_line, int indexed, int l2factor, int native_l2factor, const fz_irect *subarea)
 {
 	fz_pixmap *tile = NULL;
 	int stride, len, i;
@@ -216,24 +278,42 @@ fz_decomp_image_from_stream(fz_context *ctx, fz_stream *stm, fz_image *image, in
 	int f = 1<<native_l2factor;
 	int w = (image->w + f-1) >> native_l2factor;
 	int h = (image->h + f-1) >> native_l2factor;
+	int factor = fz_mini(l2factor - native_l2factor, 8);
+	int bilevel = factor > 0 ? bilevel_decode(image, indexed) : 0;
 
 	fz_var(tile);
 	fz_var(samples);
 
 	/* cf. http://code.google.com/p/sumatrapdf/issues/detail?id=1333 */
-	if (l2factor - native_l2factor > 0 && image->w > (1 << 8) && in_line != -1)
+	if (l2factor - native_l2factor > 0 && image->w > (1 << 8) && in_line != -1 && !subarea)
 		return decomp_image_banded(ctx, stm, image, indexed, l2factor, native_l2factor);
 
 	fz_try(ctx)
 	{
-		tile = fz_new_pixmap(ctx, image->colorspace, w, h);
+		int full_stride = (w * image->n * image->bpc + 7) / 8;
+
+		if (subarea)
+		{
+			assert(subarea->x1 <= w && subarea->y1 <= h);
+			w = subarea->x1 - subarea->x0;
+			h = subarea->y1 - subarea->y0;
+		}
+
+		/* Bilevel images are subsampled straight from the packed bits */
+		if (bilevel)
+			tile = fz_new_pixmap(ctx, image->colorspace, (w + (1<<factor) - 1) >> factor, (h + (1<<factor) - 1) >> factor);
+		else
+			tile = fz_new_pixmap(ctx, image->colorspace, w, h);
 		tile->interpolate = image->interpolate;
 
 		stride = (w * image->n * image->bpc + 7) / 8;
 
 		samples = fz_malloc_array(ctx, h, stride);
 
-		len = fz_read(stm, samples, h * stride);
+		if (subarea)
+			len = read_image_area(ctx, stm, samples, full_stride, image->n, image->bpc, subarea);
+		else
+			len = fz_read(stm, samples, h * stride);
 		if (len < 0)
 		{
 			fz_throw(ctx, FZ_ERROR_GENERIC, "cannot read image data");
@@ -264,8 +344,9 @@ fz_decomp_image_from_stream(fz_context *ctx, fz_stream *stm, fz_image *image, in
 			memset(samples + len, 0, stride * h - len);
 		}
 
-		/* Invert 1-bit image masks */
-		if (image->imagemask)
+		/* Invert 1-bit image masks, and bilevel images with a Decode
+		 * array of [1 0] (which fz_decode_tile won't see) */
+		if (image->imagemask != (bilevel < 0))
 		{
 			/* 0=opaque and 1=transparent so we need to invert */
 			unsigned char *p = samples;
@@ -274,7 +355,10 @@ fz_decomp_image_from_stream(fz_context *ctx, fz_stream *stm, fz_image *image, in
 				p[i] = ~p[i];
 		}
 
-		fz_unpack_tile(tile, samples, image->n, image->bpc, stride, indexed);
+		if (bilevel)
+			fz_unpack_tile_subsampled(ctx, tile, samples, w, h, stride, factor);
+		else
+			fz_unpack_tile(tile, samples, image->n, image->bpc, stride, indexed);
 
 		fz_free(ctx, samples);
 		samples = NULL;
@@ -290,7 +374,7 @@ fz_decomp_image_from_stream(fz_context *ctx, fz_stream *stm, fz_image *image, in
 			fz_drop_pixmap(ctx, tile);
 			tile = conv;
 		}
-		else
+		else if (!bilevel)
 		{
 			fz_decode_tile(tile, image->decode);
 		}
@@ -313,16 +397,18 @@ fz_decomp_image_from_stream(fz_context *ctx, fz_stream *stm, fz_image *image, in
 	}
 
 	/* Now apply any extra subsampling required */
-	if (l2factor - native_l2factor > 0)
-	{
-		if (l2factor - native_l2factor > 8)
-			l2factor = native_l2factor + 8;
-		fz_subsample_pixmap(ctx, tile, l2factor - native_l2factor);
-	}
+	if (factor > 0 && !bilevel)
+		fz_subsample_pixmap(ctx, tile, factor);
 
 	return tile;
 }
 
+fz_pixmap *
+fz_decomp_image_from_stream(fz_context *ctx, fz_stream *stm, fz_image *image, int in_line, int indexed, int l2factor, int native_l2factor)
+{
+	return decomp_image(ctx, stm, image, in_line, indexed, l2factor, native_l2factor, NULL);
+}
+
 void
 fz_free_image(fz_context *ctx, fz_storable *image_)
 {
@@ -337,16 +423,116 @@ fz_free_image(fz_context *ctx, fz_storable *image_)
 	fz_free(ctx, image);
 }
 
+/* What is our ideal subsampling factor for a w x h rendering? */
+static int
+image_l2factor(fz_image *image, int w, int h)
+{
+	int l2factor;
+
+	/* Ensure our expectations for tile size are reasonable */
+	if (w > image->w)
+		w = image->w;
+	if (h > image->h)
+		h = image->h;
+
+	if (w == 0 || h == 0)
+		return 0;
+	for (l2factor=0; image->w>>(l2factor+1) >= w && image->h>>(l2factor+1) >= h && l2factor < 8; l2factor++);
+	return l2factor;
+}
+
+static fz_pixmap *
+find_image_tile(fz_context *ctx, fz_image *image, int l2factor, int tile)
+{
+	fz_image_key key;
+
+	key.refs = 1;
+	key.image = image;
+	key.l2factor = l2factor;
+	key.tile = tile;
+	return fz_find_item(ctx, fz_free_pixmap_imp, &key, &fz_image_store_type);
+}
+
+/* Try to cache the pixmap, returning either it or an equivalent one that
+ * is already cached. Any failure here will just result in us not caching. */
+static fz_pixmap *
+store_image_tile(fz_context *ctx, fz_image *image, int l2factor, int tile_idx, fz_pixmap *tile)
+{
+	fz_image_key *keyp = NULL;
+
+	fz_var(keyp);
+	fz_try(ctx)
+	{
+		fz_pixmap *existing_tile;
+
+		keyp = fz_malloc_struct(ctx, fz_image_key);
+		keyp->refs = 1;
+		keyp->image = fz_keep_image(ctx, image);
+		keyp->l2factor = l2factor;
+		keyp->tile = tile_idx;
+		existing_tile = fz_store_item(ctx, keyp, tile, fz_pixmap_size(ctx, tile), &fz_image_store_type);
+		if (existing_tile)
+		{
+			/* We already have a tile. This must have been produced by a
+			 * racing thread. We'll throw away ours and use that one. */
+			fz_drop_pixmap(ctx, tile);
+			tile = existing_tile;
+		}
+	}
+	fz_always(ctx)
+	{
+		fz_drop_image_key(ctx, keyp);
+	}
+	fz_catch(ctx)
+	{
+		/* Do nothing */
+	}
+
+	return tile;
+}
+
+static fz_pixmap *
+decomp_image_from_buffer(fz_context *ctx, fz_image *image, int l2factor, const fz_irect *subarea)
+{
+	fz_pixmap *tile;
+	fz_stream *stm;
+	int native_l2factor = l2factor;
+	int indexed = fz_colorspace_is_indexed(image->colorspace);
+	fz_irect native_area;
+
+	stm = fz_open_image_decomp_stream(ctx, image->buffer, &native_l2factor);
+
+	if (subarea)
+	{
+		/* The subarea is aligned to tiles; scale it to the pixels
+		 * decoded by the stream */
+		int f = 1 << native_l2factor;
+		native_area.x0 = subarea->x0 >> native_l2factor;
+		native_area.y0 = subarea->y0 >> native_l2factor;
+		native_area.x1 = (subarea->x1 + f-1) >> native_l2factor;
+		native_area.y1 = (subarea->y1 + f-1) >> native_l2factor;
+		subarea = &native_area;
+	}
+
+	tile = decomp_image(ctx, stm, image, 0, indexed, l2factor, native_l2factor, subarea);
+
+	/* CMYK JPEGs in XPS documents have to be inverted */
+	if (image->invert_cmyk_jpeg &&
+		image->buffer->params.type == FZ_IMAGE_JPEG &&
+		image->colorspace == fz_device_cmyk(ctx) &&
+		image->buffer->params.u.jpeg.color_transform)
+	{
+		fz_invert_pixmap(ctx, tile);
+	}
+
+	return tile;
+}
+
 fz_pixmap *
 fz_image_get_pixmap(fz_context *ctx, fz_image *image, int w, int h)
 {
 	fz_pixmap *tile;
-	fz_stream *stm;
-	int l2factor;
-	fz_image_key key;
-	int native_l2factor;
-	int indexed;
-	fz_image_key *keyp;
+	int l2factor, l2;
 
 	/* Check for 'simple' images which are just pixmaps */
 	if (image->buffer == NULL)
@@ -357,30 +543,15 @@ fz_image_get_pixmap(fz_context *ctx, fz_image *image, int w, int h)
 		return fz_keep_pixmap(ctx, tile); /* That's all we can give you! */
 	}
 
-	/* Ensure our expectations for tile size are reasonable */
-	if (w > image->w)
-		w = image->w;
-	if (h > image->h)
-		h = image->h;
-
-	/* What is our ideal factor? */
-	if (w == 0 || h == 0)
-		l2factor = 0;
-	else
-		for (l2factor=0; image->w>>(l2factor+1) >= w && image->h>>(l2factor+1) >= h && l2factor < 8; l2factor++);
+	l2factor = image_l2factor(image, w, h);
 
 	/* Can we find any suitable tiles in the cache? */
-	key.refs = 1;
-	key.image = image;
-	key.l2factor = l2factor;
-	do
+	for (l2 = l2factor; l2 >= 0; l2--)
 	{
-		tile = fz_find_item(ctx, fz_free_pixmap_imp, &key, &fz_image_store_type);
+		tile = find_image_tile(ctx, image, l2, 0);
 		if (tile)
 			return tile;
-		key.l2factor--;
 	}
-	while (key.l2factor >= 0);
 
 	/* We need to make a new one. */
 	/* First check for ones that we can't decode using streams */
@@ -397,54 +568,184 @@ fz_image_get_pixmap(fz_context *ctx, fz_image *image, int w, int h)
 		tile = fz_load_jxr(ctx, image->buffer->buffer->data, image->buffer->buffer->len);
 		break;
 	default:
-		native_l2factor = l2factor;
-		stm = fz_open_image_decomp_stream(ctx, image->buffer, &native_l2factor);
+		tile = decomp_image_from_buffer(ctx, image, l2factor, NULL);
+		break;
+	}
+
+	return store_image_tile(ctx, image, l2factor, 0, tile);
+}
 
-		indexed = fz_colorspace_is_indexed(image->colorspace);
-		tile = fz_decomp_image_from_stream(ctx, stm, image, 0, indexed, l2factor, native_l2factor);
+fz_pixmap *
+fz_new_pixmap_from_image_region(fz_context *ctx, fz_image *image, fz_irect *area, int w, int h)
+{
+	fz_irect whole, tiles, todo, bbox;
+	fz_pixmap **parts = NULL;
+	fz_pixmap *decoded = NULL;
+	fz_pixmap *region = NULL;
+	fz_pixmap *tile;
+	int l2factor, size, across, x, y, i, count;
+
+	whole.x0 = whole.y0 = 0;
+	whole.x1 = image->w;
+	whole.y1 = image->h;
+	fz_intersect_irect(area, &whole);
+
+	/* Only images decoded from streams can be decoded in part, and only
+	 * if the part doesn't depend on the rest (as unblending a /Matte does) */
+	if (image->get_pixmap != fz_image_get_pixmap || !image->buffer ||
+		image->buffer->params.type == FZ_IMAGE_PNG ||
+		image->buffer->params.type == FZ_IMAGE_TIFF ||
+		image->buffer->params.type == FZ_IMAGE_JXR ||
+		(image->usecolorkey && image->mask) || fz_is_empty_irect(area))
+	{
+		*area = whole;
+		return fz_new_pixmap_from_image(ctx, image, w, h);
+	}
 
-		/* CMYK JPEGs in XPS documents have to be inverted */
-		if (image->invert_cmyk_jpeg &&
-			image->buffer->params.type == FZ_IMAGE_JPEG &&
-			image->colorspace == fz_device_cmyk(ctx) &&
-			image->buffer->params.u.jpeg.color_transform)
+	l2factor = image_l2factor(image, w, h);
+
+	/* Round out to whole tiles */
+	size = FZ_IMAGE_TILE_SIZE << l2factor;
+	across = (image->w + size - 1) / size;
+	tiles.x0 = area->x0 / size;
+	tiles.y0 = area->y0 / size;
+	tiles.x1 = (area->x1 + size - 1) / size;
+	tiles.y1 = (area->y1 + size - 1) / size;
+	area->x0 = tiles.x0 * size;
+	area->y0 = tiles.y0 * size;
+	area->x1 = fz_mini(tiles.x1 * size, image->w);
+	area->y1 = fz_mini(tiles.y1 * size, image->h);
+
+	/* If more than half of the image is wanted, we might as well have
+	 * (and keep) all of it */
+	if ((double)(area->x1 - area->x0) * (area->y1 - area->y0) * 2 > (double)image->w * image->h)
+	{
+		*area = whole;
+		return fz_new_pixmap_from_image(ctx, image, w, h);
+	}
+	/* The whole image might be in the cache already */
+	for (i = l2factor; i >= 0; i--)
+	{
+		tile = find_image_tile(ctx, image, i, 0);
+		if (tile)
 		{
-			fz_invert_pixmap(ctx, tile);
+			*area = whole;
+			return tile;
 		}
-
-		break;
 	}
 
-	/* Now we try to cache the pixmap. Any failure here will just result
-	 * in us not caching. */
-	fz_var(keyp);
+	count = (tiles.x1 - tiles.x0) * (tiles.y1 - tiles.y0);
+
+	fz_var(parts);
+	fz_var(decoded);
+	fz_var(region);
+
 	fz_try(ctx)
 	{
-		fz_pixmap *existing_tile;
+		parts = fz_malloc_array(ctx, count, sizeof(fz_pixmap *));
+		memset(parts, 0, count * sizeof(fz_pixmap *));
+
+		/* Find the tiles we already have, and the area covering the
+		 * ones we don't */
+		todo.x0 = tiles.x1;
+		todo.y0 = tiles.y1;
+		todo.x1 = tiles.x0;
+		todo.y1 = tiles.y0;
+		for (i = 0, y = tiles.y0; y < tiles.y1; y++)
+		{
+			for (x = tiles.x0; x < tiles.x1; x++, i++)
+			{
+				parts[i] = find_image_tile(ctx, image, l2factor, 1 + y * across + x);
+				if (!parts[i])
+				{
+					todo.x0 = fz_mini(todo.x0, x);
+					todo.y0 = fz_mini(todo.y0, y);
+					todo.x1 = fz_maxi(todo.x1, x + 1);
+					todo.y1 = fz_maxi(todo.y1, y + 1);
+				}
+			}
+		}
 
-		keyp = fz_malloc_struct(ctx, fz_image_key);
-		keyp->refs = 1;
-		keyp->image = fz_keep_image(ctx, image);
-		keyp->l2factor = l2factor;
-		existing_tile = fz_store_item(ctx, keyp, tile, fz_pixmap_size(ctx, tile), &fz_image_store_type);
-		if (existing_tile)
+		/* Decode the missing ones in a single pass, and cut them out */
+		if (todo.x0 < todo.x1)
 		{
-			/* We already have a tile. This must have been produced by a
-			 * racing thread. We'll throw away ours and use that one. */
-			fz_drop_pixmap(ctx, tile);
-			tile = existing_tile;
+			fz_irect subarea;
+
+			subarea.x0 = todo.x0 * size;
+			subarea.y0 = todo.y0 * size;
+			subarea.x1 = fz_mini(todo.x1 * size, image->w);
+			subarea.y1 = fz_mini(todo.y1 * size, image->h);
+			decoded = decomp_image_from_buffer(ctx, image, l2factor, &subarea);
+
+			for (i = 0, y = tiles.y0; y < tiles.y1; y++)
+			{
+				for (x = tiles.x0; x < tiles.x1; x++, i++)
+				{
+					int tx = (x - todo.x0) * FZ_IMAGE_TILE_SIZE;
+					int ty = (y - todo.y0) * FZ_IMAGE_TILE_SIZE;
+
+					if (parts[i])
+						continue;
+					tile = fz_new_pixmap(ctx, decoded->colorspace,
+						fz_mini(FZ_IMAGE_TILE_SIZE, decoded->w - tx),
+						fz_mini(FZ_IMAGE_TILE_SIZE, decoded->h - ty));
+					tile->interpolate = decoded->interpolate;
+					tile->has_alpha = decoded->has_alpha; /* SumatraPDF: allow optimizing non-alpha pixmaps */
+					tile->single_bit = decoded->single_bit; /* SumatraPDF: allow optimizing 1-bit pixmaps */
+					decoded->x = -tx;
+					decoded->y = -ty;
+					fz_copy_pixmap_rect(ctx, tile, decoded, fz_pixmap_bbox(ctx, tile, &bbox));
+					parts[i] = store_image_tile(ctx, image, l2factor, 1 + y * across + x, tile);
+				}
+			}
+		}
+
+		if (count == 1)
+		{
+			region = parts[0];
+			parts[0] = NULL;
+		}
+		else
+		{
+			/* Stitch the tiles together */
+			int rw = 0, rh = 0;
+			for (i = 0; i < tiles.x1 - tiles.x0; i++)
+				rw += parts[i]->w;
+			for (i = 0; i < count; i += tiles.x1 - tiles.x0)
+				rh += parts[i]->h;
+			region = fz_new_pixmap(ctx, parts[0]->colorspace, rw, rh);
+			region->interpolate = parts[0]->interpolate;
+			region->has_alpha = 0; /* SumatraPDF: allow optimizing non-alpha pixmaps */
+			region->single_bit = 1; /* SumatraPDF: allow optimizing 1-bit pixmaps */
+			for (i = 0, y = tiles.y0; y < tiles.y1; y++)
+			{
+				for (x = tiles.x0; x < tiles.x1; x++, i++)
+				{
+					/* Move the origin of the region to the tile's */
+					region->x = (tiles.x0 - x) * FZ_IMAGE_TILE_SIZE;
+					region->y = (tiles.y0 - y) * FZ_IMAGE_TILE_SIZE;
+					fz_copy_pixmap_rect(ctx, region, parts[i], fz_pixmap_bbox(ctx, parts[i], &bbox));
+					region->has_alpha |= parts[i]->has_alpha;
+					region->single_bit &= parts[i]->single_bit;
+				}
+			}
+			region->x = region->y = 0;
 		}
 	}
 	fz_always(ctx)
 	{
-		fz_drop_image_key(ctx, keyp);
+		fz_drop_pixmap(ctx, decoded);
+		for (i = 0; parts && i < count; i++)
+			fz_drop_pixmap(ctx, parts[i]);
+		fz_free(ctx, parts);
 	}
 	fz_catch(ctx)
 	{
-		/* Do nothing */
+		fz_drop_pixmap(ctx, region);
+		fz_rethrow(ctx);
 	}
 
-	return tile;
+	return region;
 }
 
 fz_image *
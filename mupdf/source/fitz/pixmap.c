@@ -1,4 +1,5 @@
 #include "mupdf/fitz.h"
+#include "draw-imp.h"
 
 fz_pixmap *
 fz_keep_pixmap(fz_context *ctx, fz_pixmap *pix)
@@ -1070,6 +1071,108 @@ fz_subsample_pixmap_ARM(unsigned char *ptr, int w, int h, int f, int factor,
 
 #endif
 
+#ifdef ARCH_X86
+/*
+ * SSE2 version of the full block rows of fz_subsample_pixmap: the f rows
+ * of a block row are summed vertically into 16 bit values (which can't
+ * overflow for f <= 16), then f of these sums are added up horizontally
+ * per component. Works in place as the destination never overtakes the
+ * source. Returns the number of block rows done.
+ */
+FZ_TARGET_SSE2 static int
+subsample_rows_sse2(unsigned char *s, unsigned char *d, int w, int h, int f, int factor, int n)
+{
+	unsigned short sum[2048];
+	__m128i zero = _mm_setzero_si128();
+	__m128i shift = _mm_cvtsi32_si128(2*factor);
+	int fwd = w*n;
+	int full_w = w>>factor;
+	int chunk = (sizeof(sum)/sizeof(*sum)) / (f*n);
+	int rows = h>>factor;
+	int y, x, i, k, nn, xx, yy, cw, len;
+
+	if (f > 16 || chunk == 0)
+		return 0;
+
+	for (y = 0; y < rows; y++)
+	{
+		for (x = 0; x < full_w; x += cw)
+		{
+			cw = fz_mini(chunk, full_w - x);
+			len = cw*f*n;
+			for (i = 0; i + 16 <= len; i += 16)
+			{
+				__m128i lo = zero, hi = zero;
+				for (k = 0; k < f; k++)
+				{
+					__m128i v = _mm_loadu_si128((const __m128i *)(s + k*fwd + i));
+					lo = _mm_add_epi16(lo, _mm_unpacklo_epi8(v, zero));
+					hi = _mm_add_epi16(hi, _mm_unpackhi_epi8(v, zero));
+				}
+				_mm_storeu_si128((__m128i *)(sum + i), lo);
+				_mm_storeu_si128((__m128i *)(sum + i + 8), hi);
+			}
+			for (; i < len; i++)
+			{
+				int v = 0;
+				for (k = 0; k < f; k++)
+					v += s[k*fwd + i];
+				sum[i] = v;
+			}
+			s += len;
+
+			if (n == 4)
+			{
+				unsigned short *p = sum;
+				for (i = 0; i < cw; i++)
+				{
+					__m128i v = zero;
+					int px;
+					for (xx = f; xx > 0; xx--, p += 4)
+						v = _mm_add_epi16(v, _mm_loadl_epi64((const __m128i *)p));
+					v = _mm_srl_epi16(v, shift);
+					px = _mm_cvtsi128_si32(_mm_packus_epi16(v, v));
+					memcpy(d, &px, 4);
+					d += 4;
+				}
+			}
+			else
+			{
+				unsigned short *p = sum;
+				for (i = 0; i < cw; i++)
+				{
+					for (nn = 0; nn < n; nn++)
+					{
+						int v = 0;
+						for (xx = 0; xx < f; xx++)
+							v += p[xx*n + nn];
+						*d++ = v >> (2*factor);
+					}
+					p += f*n;
+				}
+			}
+		}
+		/* Do any strays */
+		x = w - (full_w<<factor);
+		if (x > 0)
+		{
+			int div = x * f;
+			for (nn = 0; nn < n; nn++)
+			{
+				int v = 0;
+				for (xx = 0; xx < x; xx++)
+					for (yy = 0; yy < f; yy++)
+						v += s[yy*fwd + xx*n + nn];
+				*d++ = v / div;
+			}
+			s += x*n;
+		}
+		s += (f-1)*fwd;
+	}
+	return rows;
+}
+#endif
+
 void
 fz_subsample_pixmap(fz_context *ctx, fz_pixmap *tile, int factor)
 {
@@ -1106,7 +1209,17 @@ fz_subsample_pixmap(fz_context *ctx, fz_pixmap *tile, int factor)
 					divY, back5, divXY);
 	}
 #else
-	for (y = h - f; y >= 0; y -= f)
+	y = h - f;
+#ifdef ARCH_X86
+	if (fz_cpu_flags(ctx) & FZ_CPU_SSE2)
+	{
+		int done = subsample_rows_sse2(s, d, w, h, f, factor/2, n);
+		s += done*f*fwd;
+		d += done*dst_w*n;
+		y -= done*f;
+	}
+#endif
+	for (; y >= 0; y -= f)
 	{
 		for (x = w - f; x >= 0; x -= f)
 		{
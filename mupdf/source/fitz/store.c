@@ -11,6 +11,7 @@ struct fz_item_s
 	fz_item *prev;
 	fz_store *store;
 	fz_store_type *type;
+	int protected;
 };
 
 struct fz_store_s
@@ -29,12 +30,29 @@ struct fz_store_s
 	/* We keep track of the size of the store, and keep it below max. */
 	unsigned int max;
 	unsigned int size;
+
+	/* Resources which have been found again after being stored are
+	 * 'protected': eviction only takes them once there are no
+	 * unprotected items left to take, so that a run of items which are
+	 * only used once (such as the images of a long scan) can't push out
+	 * the fonts and colorspaces needed by every page. Decoded pixmaps
+	 * and tiles are never protected; they are large, and cheap to make
+	 * again for their size. Protected items may only take up 3/4 of the
+	 * store; beyond that, the least recently used of them lose their
+	 * protection again. This trades pixmap reuse for resource reuse
+	 * whenever the store is too small for both, so callers that mind
+	 * should cap FZ_STORE_CLASS_RESOURCE with fz_set_store_class_max. */
+	unsigned int protected_size;
+
+	/* Sizes, budgets and counters for each class of items */
+	fz_store_stats stats[FZ_STORE_CLASS_COUNT];
 };
 
 void
 fz_new_store_context(fz_context *ctx, unsigned int max)
 {
 	fz_store *store;
+	int i;
 	store = fz_malloc_struct(ctx, fz_store);
 	fz_try(ctx)
 	{
@@ -50,6 +68,8 @@ fz_new_store_context(fz_context *ctx, unsigned int max)
 	store->tail = NULL;
 	store->size = 0;
 	store->max = max;
+	for (i = 0; i < FZ_STORE_CLASS_COUNT; i++)
+		store->stats[i].max = FZ_STORE_UNLIMITED;
 	ctx->store = store;
 }
 
@@ -95,9 +115,14 @@ static void
 evict(fz_context *ctx, fz_item *item)
 {
 	fz_store *store = ctx->store;
+	fz_store_stats *stats = &store->stats[item->type->store_class];
 	int drop;
 
 	store->size -= item->size;
+	stats->size -= item->size;
+	stats->count--;
+	if (item->protected)
+		store->protected_size -= item->size;
 	/* Unlink from the linked list */
 	if (item->next)
 		item->next->prev = item->prev;
@@ -126,12 +151,21 @@ evict(fz_context *ctx, fz_item *item)
 	fz_lock(ctx, FZ_LOCK_ALLOC);
 }
 
+/* Can the item be evicted when looking for space for store_class
+ * (or any class, if store_class < 0)? */
+static inline int
+evictable(fz_item *item, int store_class)
+{
+	return item->val->refs == 1 && (store_class < 0 || item->type->store_class == store_class);
+}
+
 static int
-ensure_space(fz_context *ctx, unsigned int tofree)
+ensure_space(fz_context *ctx, unsigned int tofree, int store_class)
 {
 	fz_item *item, *prev;
 	unsigned int count;
 	fz_store *store = ctx->store;
+	int pass;
 
 	fz_assert_lock_held(ctx, FZ_LOCK_ALLOC);
 
@@ -140,7 +174,7 @@ ensure_space(fz_context *ctx, unsigned int tofree)
 	count = 0;
 	for (item = store->tail; item; item = item->prev)
 	{
-		if (item->val->refs == 1)
+		if (evictable(item, store_class))
 		{
 			count += item->size;
 			if (count >= tofree)
@@ -154,12 +188,13 @@ ensure_space(fz_context *ctx, unsigned int tofree)
 		return 0;
 	}
 
-	/* Actually free the items */
+	/* Actually free the items, unprotected ones first */
 	count = 0;
+	for (pass = 0; pass < 2; pass++)
 	for (item = store->tail; item; item = prev)
 	{
 		prev = item->prev;
-		if (item->val->refs == 1)
+		if (evictable(item, store_class) && (pass || !item->protected))
 		{
 			/* Free this item. Evict has to drop the lock to
 			 * manage that, which could cause prev to be removed
@@ -170,6 +205,7 @@ ensure_space(fz_context *ctx, unsigned int tofree)
 			 * the limit anyway, and it will only cause something to
 			 * not be cached. */
 			count += item->size;
+			store->stats[item->type->store_class].evictions++;
 			if (prev)
 				prev->val->refs++;
 			evict(ctx, item); /* Drops then retakes lock */
@@ -213,13 +249,52 @@ touch(fz_store *store, fz_item *item)
 	item->prev = NULL;
 }
 
+/* Protect a resource that has just been found again */
+static void
+protect(fz_store *store, fz_item *item)
+{
+	fz_item *other;
+
+	if (item->protected || item->type->store_class != FZ_STORE_CLASS_RESOURCE)
+		return;
+	item->protected = 1;
+	store->protected_size += item->size;
+
+	if (store->max == FZ_STORE_UNLIMITED)
+		return;
+	for (other = store->tail; other && store->protected_size > store->max / 4 * 3; other = other->prev)
+	{
+		if (other->protected && other != item)
+		{
+			other->protected = 0;
+			store->protected_size -= other->size;
+		}
+	}
+}
+
+/* Make space for itemsize more bytes in *used, evicting items of the given
+ * class (or any class if store_class < 0) as required. */
+static int
+make_space(fz_context *ctx, unsigned int *used, unsigned int max, unsigned int itemsize, int store_class)
+{
+	if (max == FZ_STORE_UNLIMITED)
+		return 1;
+	while (*used + itemsize > max)
+	{
+		/* ensure_space may drop, then retake the lock */
+		if (ensure_space(ctx, *used + itemsize - max, store_class) == 0)
+			return 0;
+	}
+	return 1;
+}
+
 void *
 fz_store_item(fz_context *ctx, void *key, void *val_, unsigned int itemsize, fz_store_type *type)
 {
 	fz_item *item = NULL;
-	unsigned int size;
 	fz_storable *val = (fz_storable *)val_;
 	fz_store *store = ctx->store;
+	fz_store_stats *stats;
 	fz_store_hash hash = { NULL };
 	int use_hash = 0;
 	unsigned pos;
@@ -229,7 +304,9 @@ fz_store_item(fz_context *ctx, void *key, void *val_, unsigned int itemsize, fz_
 
 	fz_var(item);
 
-	if (store->max != FZ_STORE_UNLIMITED && store->max < itemsize)
+	stats = &store->stats[type->store_class];
+	if ((store->max != FZ_STORE_UNLIMITED && store->max < itemsize) ||
+		(stats->max != FZ_STORE_UNLIMITED && stats->max < itemsize))
 	{
 		/* Our item would take up more room than we can ever
 		 * possibly have in the store. Just give up now. */
@@ -267,6 +344,7 @@ fz_store_item(fz_context *ctx, void *key, void *val_, unsigned int itemsize, fz_
 	item->next = item;
 	item->prev = item;
 	item->type = type;
+	item->protected = 0;
 
 	/* If we can index it fast, put it into the hash table. This serves
 	 * to check whether we have one there already. */
@@ -293,6 +371,7 @@ fz_store_item(fz_context *ctx, void *key, void *val_, unsigned int itemsize, fz_
 			/* There was one there already! Take a new reference
 			 * to the existing one, and drop our current one. */
 			touch(store, existing);
+			protect(store, existing);
 			if (existing->val->refs > 0)
 				existing->val->refs++;
 			fz_unlock(ctx, FZ_LOCK_ALLOC);
@@ -304,40 +383,32 @@ fz_store_item(fz_context *ctx, void *key, void *val_, unsigned int itemsize, fz_
 	/* Now bump the ref */
 	if (val->refs > 0)
 		val->refs++;
-	/* If we haven't got an infinite store, check for space within it */
-	if (store->max != FZ_STORE_UNLIMITED)
+	/* Check for space within the store, and within the item's class */
+	if (!make_space(ctx, &store->size, store->max, itemsize, -1) ||
+		!make_space(ctx, &stats->size, stats->max, itemsize, type->store_class))
 	{
-		size = store->size + itemsize;
-		while (size > store->max)
+		/* Failed to free enough space. */
+		/* If someone else has already picked up a reference to item
+		 * (through the hash table), then we cannot remove it. Leave it
+		 * in the store, and we'll live with being over budget. We know
+		 * this is the case, if it's in the linked list. */
+		if (!use_hash || item->next == item)
 		{
-			/* ensure_space may drop, then retake the lock */
-			int saved = ensure_space(ctx, size - store->max);
-			if (saved == 0)
-			{
-				/* Failed to free any space. */
-				/* If we are using the hash table, then we've already
-				 * inserted item - remove it. */
-				if (use_hash)
-				{
-					/* If someone else has already picked up a reference
-					 * to item, then we cannot remove it. Leave it in the
-					 * store, and we'll live with being over budget. We
-					 * know this is the case, if it's in the linked list. */
-					if (item->next != item)
-						break;
-					fz_hash_remove_fast(ctx, store->hash, &hash, pos);
-				}
-				fz_unlock(ctx, FZ_LOCK_ALLOC);
-				fz_free(ctx, item);
-				type->drop_key(ctx, key);
-				if (val->refs > 0)
-					val->refs--;
-				return NULL;
-			}
-			size -= saved;
+			/* If we are using the hash table, then we've already
+			 * inserted item - remove it. */
+			if (use_hash)
+				fz_hash_remove_fast(ctx, store->hash, &hash, pos);
+			fz_unlock(ctx, FZ_LOCK_ALLOC);
+			fz_free(ctx, item);
+			type->drop_key(ctx, key);
+			if (val->refs > 0)
+				val->refs--;
+			return NULL;
 		}
 	}
 	store->size += itemsize;
+	stats->size += itemsize;
+	stats->count++;
 
 	/* Regardless of whether it's indexed, it goes into the linked list */
 	touch(store, item);
@@ -388,12 +459,15 @@ fz_find_item(fz_context *ctx, fz_store_free_fn *free, void *key, fz_store_type *
 		 * linked list does not get whipped out again due to the
 		 * store being full. */
 		touch(store, item);
+		protect(store, item);
+		store->stats[type->store_class].hits++;
 		/* And bump the refcount before returning */
 		if (item->val->refs > 0)
 			item->val->refs++;
 		fz_unlock(ctx, FZ_LOCK_ALLOC);
 		return (void *)item->val;
 	}
+	store->stats[type->store_class].misses++;
 	fz_unlock(ctx, FZ_LOCK_ALLOC);
 
 	return NULL;
@@ -436,6 +510,7 @@ fz_remove_item(fz_context *ctx, fz_store_free_fn *free, void *key, fz_store_type
 		 * such items by setting item->next == item. */
 		if (item->next != item)
 		{
+			fz_store_stats *stats = &store->stats[item->type->store_class];
 			if (item->next)
 				item->next->prev = item->prev;
 			else
@@ -444,6 +519,11 @@ fz_remove_item(fz_context *ctx, fz_store_free_fn *free, void *key, fz_store_type
 				item->prev->next = item->next;
 			else
 				store->head = item->next;
+			store->size -= item->size;
+			stats->size -= item->size;
+			stats->count--;
+			if (item->protected)
+				store->protected_size -= item->size;
 		}
 		drop = (item->val->refs > 0 && --item->val->refs == 0);
 		fz_unlock(ctx, FZ_LOCK_ALLOC);
@@ -456,6 +536,27 @@ fz_remove_item(fz_context *ctx, fz_store_free_fn *free, void *key, fz_store_type
 		fz_unlock(ctx, FZ_LOCK_ALLOC);
 }
 
+void
+fz_set_store_class_max(fz_context *ctx, int store_class, unsigned int max)
+{
+	if (ctx->store == NULL || store_class < 0 || store_class >= FZ_STORE_CLASS_COUNT)
+		return;
+	fz_lock(ctx, FZ_LOCK_ALLOC);
+	ctx->store->stats[store_class].max = max;
+	fz_unlock(ctx, FZ_LOCK_ALLOC);
+}
+
+void
+fz_get_store_stats(fz_context *ctx, int store_class, fz_store_stats *stats)
+{
+	memset(stats, 0, sizeof(*stats));
+	if (ctx->store == NULL || store_class < 0 || store_class >= FZ_STORE_CLASS_COUNT)
+		return;
+	fz_lock(ctx, FZ_LOCK_ALLOC);
+	*stats = ctx->store->stats[store_class];
+	fz_unlock(ctx, FZ_LOCK_ALLOC);
+}
+
 void
 fz_empty_store(fz_context *ctx)
 {
@@ -516,8 +617,14 @@ fz_print_store_locked(fz_context *ctx, FILE *out)
 {
 	fz_item *item, *next;
 	fz_store *store = ctx->store;
+	int i;
 
 	fprintf(out, "-- resource store contents --\n");
+	for (i = 0; i < FZ_STORE_CLASS_COUNT; i++)
+	{
+		fz_store_stats *stats = &store->stats[i];
+		fprintf(out, "class[%d][size=%u][count=%d] hits=%d misses=%d evictions=%d\n", i, stats->size, stats->count, stats->hits, stats->misses, stats->evictions);
+	}
 	fflush(out);
 
 	for (item = store->head; item; item = next)
@@ -525,7 +632,7 @@ fz_print_store_locked(fz_context *ctx, FILE *out)
 		next = item->next;
 		if (next)
 			next->val->refs++;
-		fprintf(out, "store[*][refs=%d][size=%d] ", item->val->refs, item->size);
+		fprintf(out, "store[%c][refs=%d][size=%d] ", item->protected ? 'p' : '*', item->val->refs, item->size);
 		fz_unlock(ctx, FZ_LOCK_ALLOC);
 		item->type->debug(out, item->key);
 		fprintf(out, " = %p\n", item->val);
@@ -557,15 +664,18 @@ scavenge(fz_context *ctx, unsigned int tofree)
 	fz_store *store = ctx->store;
 	unsigned int count = 0;
 	fz_item *item, *prev;
+	int pass;
 
-	/* Free the items */
+	/* Free the items, unprotected ones first */
+	for (pass = 0; pass < 2 && count < tofree; pass++)
 	for (item = store->tail; item; item = prev)
 	{
 		prev = item->prev;
-		if (item->val->refs == 1)
+		if (item->val->refs == 1 && (pass || !item->protected))
 		{
 			/* Free this item */
 			count += item->size;
+			store->stats[item->type->store_class].evictions++;
 			evict(ctx, item); /* Drops then retakes lock */
 
 			if (count >= tofree)
@@ -944,6 +944,7 @@ static fz_store_type hail_mary_store_type =
 	hail_mary_keep_key,
 	hail_mary_drop_key,
 	hail_mary_cmp_key,
+	FZ_STORE_CLASS_RESOURCE,
 #ifndef NDEBUG
 	hail_mary_debug_key
 #endif
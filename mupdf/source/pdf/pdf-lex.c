@@ -22,6 +22,31 @@
 #define RANGE_A_F \
 	'A':case'B':case'C':case'D':case'E':case'F'
 
+/* Character classes for the fast paths, which scan the stream's buffer
+ * directly and only fall back to reading byte by byte at its end */
+enum
+{
+	LEX_WHITE = 1,
+	LEX_DELIM = 2,
+	LEX_DIGIT = 4,
+	LEX_EOL = 8,
+	LEX_STRING = 16, /* ( ) and \ are special inside strings */
+	LEX_HASH = 32,
+	LEX_HEX = 64
+};
+
+static const unsigned char lex_class[256] =
+{
+	1,0,0,0,0,0,0,0,0,1,9,0,1,9,0,0, /* \000 \t \n \f \r */
+	0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+	1,0,0,32,0,2,0,0,18,18,0,0,0,0,0,2, /* space # % ( ) / */
+	68,68,68,68,68,68,68,68,68,68,0,0,2,0,2,0, /* 0-9 < > */
+	0,64,64,64,64,64,64,0,0,0,0,0,0,0,0,0, /* A-F */
+	0,0,0,0,0,0,0,0,0,0,0,2,16,2,0,0, /* [ \ ] */
+	0,64,64,64,64,64,64,0,0,0,0,0,0,0,0,0, /* a-f */
+	0,0,0,0,0,0,0,0,0,0,0,2,0,2,0,0, /* { } */
+};
+
 static inline int iswhite(int ch)
 {
 	return
@@ -41,15 +66,37 @@ static inline int unhex(int ch)
 	return 0;
 }
 
+/* The end of the bytes the fast paths may scan. With FZ_REF_LEX they see
+ * none, so that everything is read byte by byte. */
+static inline unsigned char *
+lex_buffer_end(fz_stream *f)
+{
+	return (fz_reference_paths(f->ctx) & FZ_REF_LEX) ? f->rp : f->wp;
+}
+
 static void
 lex_white(fz_stream *f)
 {
 	int c;
+
+	if (fz_reference_paths(f->ctx) & FZ_REF_LEX)
+	{
+		do {
+			c = fz_read_byte(f);
+		} while ((c <= 32) && (iswhite(c)));
+		if (c != EOF)
+			fz_unread_byte(f);
+		return;
+	}
+
 	do {
-		c = fz_read_byte(f);
-	} while ((c <= 32) && (iswhite(c)));
-	if (c != EOF)
-		fz_unread_byte(f);
+		unsigned char *p = f->rp, *e = f->wp;
+		while (p < e && (lex_class[*p] & LEX_WHITE))
+			p++;
+		f->rp = p;
+		if (p < e)
+			return;
+	} while (fz_peek_byte(f) != EOF);
 }
 
 static void
@@ -57,10 +104,61 @@ lex_comment(fz_stream *f)
 {
 	int c;
 	do {
+		unsigned char *p = f->rp, *e = lex_buffer_end(f);
+		while (p < e && !(lex_class[*p] & LEX_EOL))
+			p++;
+		f->rp = p;
 		c = fz_read_byte(f);
 	} while ((c != '\012') && (c != '\015') && (c != EOF));
 }
 
+/* Parses the rest of a number if it ends within the stream's buffer,
+ * exactly as lex_number would. */
+static int
+lex_number_fast(fz_stream *f, pdf_lexbuf *buf, int c)
+{
+	unsigned char *p = f->rp, *e = lex_buffer_end(f);
+	int neg = (c == '-');
+	int i = 0;
+	int n = 0;
+	int d = 1;
+	float v;
+
+	if (c != '.')
+	{
+		if (c >= '0' && c <= '9')
+			i = c - '0';
+		while (p < e && (lex_class[*p] & LEX_DIGIT))
+			i = 10*i + *p++ - '0';
+		if (p == e)
+			return PDF_TOK_ERROR;
+		if (*p != '.')
+		{
+			f->rp = p;
+			buf->i = neg ? -i : i;
+			return PDF_TOK_INT;
+		}
+		p++;
+	}
+
+	for (; p < e && (lex_class[*p] & LEX_DIGIT); p++)
+	{
+		/* ignore digits that are too small to matter */
+		if (d < INT_MAX/10)
+		{
+			n = n*10 + (*p - '0');
+			d *= 10;
+		}
+	}
+	if (p == e)
+		return PDF_TOK_ERROR;
+	f->rp = p;
+
+	v = (float)i + ((float)n / (float)d);
+	buf->f = neg ? -v : v;
+	return PDF_TOK_REAL;
+}
+
 static int
 lex_number(fz_stream *f, pdf_lexbuf *buf, int c)
 {
@@ -70,6 +168,10 @@ lex_number(fz_stream *f, pdf_lexbuf *buf, int c)
 	int d;
 	float v;
 
+	n = lex_number_fast(f, buf, c);
+	if (n != PDF_TOK_ERROR)
+		return n;
+
 	/* Initially we might have +, -, . or a digit */
 	switch (c)
 	{
@@ -164,7 +266,20 @@ lex_name(fz_stream *f, pdf_lexbuf *buf)
 
 	while (n > 1)
 	{
-		int c = fz_read_byte(f);
+		unsigned char *p = f->rp, *e = lex_buffer_end(f);
+		int c;
+
+		/* copy regular characters straight from the buffer */
+		if (e - p > n - 1)
+			e = p + n - 1;
+		while (p < e && !(lex_class[*p] & (LEX_WHITE | LEX_DELIM | LEX_HASH)))
+			*s++ = *p++;
+		n -= p - f->rp;
+		f->rp = p;
+		if (n <= 1)
+			break;
+
+		c = fz_read_byte(f);
 		switch (c)
 		{
 		case IS_WHITE:
@@ -246,11 +361,25 @@ lex_string(fz_stream *f, pdf_lexbuf *lb)
 
 	while (1)
 	{
+		unsigned char *p, *pe;
+
 		if (s == e)
 		{
 			s += pdf_lexbuf_grow(lb);
 			e = lb->scratch + lb->size;
 		}
+
+		/* copy plain characters straight from the buffer */
+		p = f->rp;
+		pe = lex_buffer_end(f);
+		if (pe - p > e - s)
+			pe = p + (e - s);
+		while (p < pe && !(lex_class[*p] & LEX_STRING))
+			*s++ = *p++;
+		f->rp = p;
+		if (s == e)
+			continue;
+
 		c = fz_read_byte(f);
 		switch (c)
 		{
@@ -343,11 +472,29 @@ lex_hex_string(fz_stream *f, pdf_lexbuf *lb)
 
 	while (1)
 	{
+		unsigned char *p, *pe;
+
 		if (s == e)
 		{
 			s += pdf_lexbuf_grow(lb);
 			e = lb->scratch + lb->size;
 		}
+
+		/* decode pairs of hex digits straight from the buffer */
+		p = f->rp;
+		pe = lex_buffer_end(f);
+		if (!x)
+		{
+			while (p + 1 < pe && s < e && (lex_class[p[0]] & lex_class[p[1]] & LEX_HEX))
+			{
+				*s++ = unhex(p[0]) * 16 + unhex(p[1]);
+				p += 2;
+			}
+			f->rp = p;
+			if (s == e)
+				continue;
+		}
+
 		c = fz_read_byte(f);
 		switch (c)
 		{
@@ -59,34 +59,119 @@ struct pdf_obj_s
 			int num;
 			int gen;
 		} r;
+		pdf_obj *next; /* free list link */
 	} u;
 };
 
-pdf_obj *
-pdf_new_null(pdf_document *doc)
+/* All objects but strings and names have the same size. Those are carved
+ * out of per document slabs and recycled through a free list instead of
+ * being allocated one by one; the slabs are only released together with
+ * the document. Memento builds allocate each object separately, so that
+ * leaked objects can still be told apart.
+ *
+ * The pool is guarded by FZ_LOCK_PDF, just like the name table. It also
+ * counts the objects in use, which must all have been dropped when the
+ * document is closed. */
+
+#define PDF_OBJ_SLAB_SIZE 512
+
+typedef struct pdf_obj_slab_s pdf_obj_slab;
+
+struct pdf_obj_slab_s
+{
+	pdf_obj_slab *next;
+	pdf_obj objs[PDF_OBJ_SLAB_SIZE];
+};
+
+static pdf_obj *
+pdf_alloc_obj(pdf_document *doc, int kind, const char *label)
 {
-	pdf_obj *obj;
 	fz_context *ctx = doc->ctx;
-	obj = Memento_label(fz_malloc(ctx, sizeof(pdf_obj)), "pdf_obj(null)");
+	pdf_obj *obj;
+#ifdef MEMENTO
+	obj = Memento_label(fz_malloc(ctx, sizeof(pdf_obj)), label);
+	fz_lock(ctx, FZ_LOCK_PDF);
+#else
+	fz_lock(ctx, FZ_LOCK_PDF);
+	if (doc->free_objs)
+	{
+		obj = doc->free_objs;
+		doc->free_objs = obj->u.next;
+	}
+	else
+	{
+		if (!doc->obj_slabs || doc->obj_slab_used == PDF_OBJ_SLAB_SIZE)
+		{
+			pdf_obj_slab *slab = fz_malloc_no_throw(ctx, sizeof(pdf_obj_slab));
+			if (!slab)
+			{
+				fz_unlock(ctx, FZ_LOCK_PDF);
+				fz_throw(ctx, FZ_ERROR_GENERIC, "cannot allocate object slab");
+			}
+			slab->next = doc->obj_slabs;
+			doc->obj_slabs = slab;
+			doc->obj_slab_used = 0;
+		}
+		obj = &doc->obj_slabs->objs[doc->obj_slab_used++];
+	}
+#endif
+	doc->live_objs++;
+	fz_unlock(ctx, FZ_LOCK_PDF);
 	obj->doc = doc;
 	obj->refs = 1;
-	obj->kind = PDF_NULL;
+	obj->kind = kind;
 	obj->flags = 0;
 	obj->parent_num = 0;
 	return obj;
 }
 
+static void
+pdf_free_obj(pdf_obj *obj)
+{
+	pdf_document *doc = obj->doc;
+	fz_context *ctx = doc->ctx;
+	if (obj->kind == PDF_STRING || obj->kind == PDF_NAME)
+		fz_free(ctx, obj);
+	else
+	{
+		fz_lock(ctx, FZ_LOCK_PDF);
+		doc->live_objs--;
+#ifdef MEMENTO
+		fz_unlock(ctx, FZ_LOCK_PDF);
+		fz_free(ctx, obj);
+#else
+		obj->u.next = doc->free_objs;
+		doc->free_objs = obj;
+		fz_unlock(ctx, FZ_LOCK_PDF);
+#endif
+	}
+}
+
+void
+pdf_drop_obj_pool(pdf_document *doc)
+{
+	/* the slabs must no longer be in use */
+	assert(doc->live_objs == 0);
+	while (doc->obj_slabs)
+	{
+		pdf_obj_slab *next = doc->obj_slabs->next;
+		fz_free(doc->ctx, doc->obj_slabs);
+		doc->obj_slabs = next;
+	}
+	doc->obj_slab_used = 0;
+	doc->free_objs = NULL;
+}
+
+pdf_obj *
+pdf_new_null(pdf_document *doc)
+{
+	return pdf_alloc_obj(doc, PDF_NULL, "pdf_obj(null)");
+}
+
 pdf_obj *
 pdf_new_bool(pdf_document *doc, int b)
 {
-	pdf_obj *obj;
-	fz_context *ctx = doc->ctx;
-	obj = Memento_label(fz_malloc(ctx, sizeof(pdf_obj)), "pdf_obj(bool)");
-	obj->doc = doc;
-	obj->refs = 1;
-	obj->kind = PDF_BOOL;
-	obj->flags = 0;
-	obj->parent_num = 0;
+	pdf_obj *obj = pdf_alloc_obj(doc, PDF_BOOL, "pdf_obj(bool)");
 	obj->u.b = b;
 	return obj;
 }
@@ -94,14 +179,7 @@ pdf_new_bool(pdf_document *doc, int b)
 pdf_obj *
 pdf_new_int(pdf_document *doc, int i)
 {
-	pdf_obj *obj;
-	fz_context *ctx = doc->ctx;
-	obj = Memento_label(fz_malloc(ctx, sizeof(pdf_obj)), "pdf_obj(int)");
-	obj->doc = doc;
-	obj->refs = 1;
-	obj->kind = PDF_INT;
-	obj->flags = 0;
-	obj->parent_num = 0;
+	pdf_obj *obj = pdf_alloc_obj(doc, PDF_INT, "pdf_obj(int)");
 	obj->u.i = i;
 	return obj;
 }
@@ -109,14 +187,7 @@ pdf_new_int(pdf_document *doc, int i)
 pdf_obj *
 pdf_new_real(pdf_document *doc, float f)
 {
-	pdf_obj *obj;
-	fz_context *ctx = doc->ctx;
-	obj = Memento_label(fz_malloc(ctx, sizeof(pdf_obj)), "pdf_obj(real)");
-	obj->doc = doc;
-	obj->refs = 1;
-	obj->kind = PDF_REAL;
-	obj->flags = 0;
-	obj->parent_num = 0;
+	pdf_obj *obj = pdf_alloc_obj(doc, PDF_REAL, "pdf_obj(real)");
 	obj->u.f = f;
 	return obj;
 }
@@ -138,32 +209,166 @@ pdf_new_string(pdf_document *doc, const char *str, int len)
 	return obj;
 }
 
+/* Names are interned in a per document hash table (with linear probing).
+ * As a consequence all the keys of a document's dictionaries are that
+ * document's name objects, so that lookups only compare keys by pointer.
+ *
+ * The table doesn't hold references of its own: a name is removed from it
+ * when its last reference is dropped, so that it only contains the names
+ * which are in use. Since a name object is shared by all the objects of
+ * a document using it, the table and the reference counts of names are
+ * guarded by FZ_LOCK_PDF (and thus safe to use from several threads at
+ * once, as long as they share the document's locks). */
+
+static unsigned int
+pdf_name_hash(const char *s)
+{
+	unsigned int h = 2166136261U;
+	while (*s)
+		h = (h ^ (unsigned char)*s++) * 16777619U;
+	return h;
+}
+
+static pdf_obj **
+pdf_find_name_slot(pdf_obj **names, int cap, const char *str)
+{
+	unsigned int mask = cap - 1;
+	unsigned int pos = pdf_name_hash(str) & mask;
+	while (names[pos] && strcmp(names[pos]->u.n, str))
+		pos = (pos + 1) & mask;
+	return &names[pos];
+}
+
+/* Returns the document's (borrowed) name object for str, if there is one */
+static pdf_obj *
+pdf_find_name(pdf_document *doc, const char *str)
+{
+	pdf_obj *obj = NULL;
+
+	fz_lock(doc->ctx, FZ_LOCK_PDF);
+	if (doc->name_cap > 0)
+		obj = *pdf_find_name_slot(doc->names, doc->name_cap, str);
+	fz_unlock(doc->ctx, FZ_LOCK_PDF);
+	return obj;
+}
+
+/* Removes the name in slot, moving the names after it which would no
+ * longer be found back into the gap. Called with FZ_LOCK_PDF held. */
+static void
+pdf_remove_name_slot(pdf_obj **names, int cap, pdf_obj **slot)
+{
+	unsigned int mask = cap - 1;
+	unsigned int gap = slot - names;
+	unsigned int pos = gap;
+	unsigned int home;
+
+	names[gap] = NULL;
+	while (names[pos = (pos + 1) & mask])
+	{
+		/* a name can fill the gap unless its home slot lies within (gap, pos] */
+		home = pdf_name_hash(names[pos]->u.n) & mask;
+		if (((pos - home) & mask) >= ((pos - gap) & mask))
+		{
+			names[gap] = names[pos];
+			names[pos] = NULL;
+			gap = pos;
+		}
+	}
+}
+
+/* Called with FZ_LOCK_PDF held */
+static int
+pdf_grow_name_table(pdf_document *doc)
+{
+	int new_cap = doc->name_cap ? doc->name_cap * 2 : 512;
+	pdf_obj **names = fz_calloc_no_throw(doc->ctx, new_cap, sizeof(pdf_obj *));
+	int i;
+
+	if (!names)
+		return 0;
+
+	for (i = 0; i < doc->name_cap; i++)
+		if (doc->names[i])
+			*pdf_find_name_slot(names, new_cap, doc->names[i]->u.n) = doc->names[i];
+
+	fz_free(doc->ctx, doc->names);
+	doc->names = names;
+	doc->name_cap = new_cap;
+	return 1;
+}
+
+void
+pdf_drop_name_table(pdf_document *doc)
+{
+	/* all names must have been dropped together with the objects using them */
+	assert(doc->name_count == 0);
+	fz_free(doc->ctx, doc->names);
+	doc->names = NULL;
+	doc->name_count = doc->name_cap = 0;
+}
+
 pdf_obj *
 pdf_new_name(pdf_document *doc, const char *str)
 {
-	pdf_obj *obj;
+	pdf_obj *obj, **slot;
 	fz_context *ctx = doc->ctx;
-	obj = Memento_label(fz_malloc(ctx, offsetof(pdf_obj, u.n) + strlen(str) + 1), "pdf_obj(name)");
+
+	fz_lock(ctx, FZ_LOCK_PDF);
+	if (doc->name_count * 2 >= doc->name_cap && !pdf_grow_name_table(doc))
+	{
+		fz_unlock(ctx, FZ_LOCK_PDF);
+		fz_throw(ctx, FZ_ERROR_GENERIC, "cannot grow name table");
+	}
+	slot = pdf_find_name_slot(doc->names, doc->name_cap, str);
+	if (*slot)
+	{
+		obj = *slot;
+		obj->refs++;
+		fz_unlock(ctx, FZ_LOCK_PDF);
+		return obj;
+	}
+
+	obj = Memento_label(fz_malloc_no_throw(ctx, offsetof(pdf_obj, u.n) + strlen(str) + 1), "pdf_obj(name)");
+	if (!obj)
+	{
+		fz_unlock(ctx, FZ_LOCK_PDF);
+		fz_throw(ctx, FZ_ERROR_GENERIC, "cannot allocate name object");
+	}
 	obj->doc = doc;
 	obj->refs = 1;
 	obj->kind = PDF_NAME;
 	obj->flags = 0;
 	obj->parent_num = 0;
 	strcpy(obj->u.n, str);
+	*slot = obj;
+	doc->name_count++;
+	fz_unlock(ctx, FZ_LOCK_PDF);
 	return obj;
 }
 
+/* Drops a reference to a name, removing the name from the table (and
+ * returning 1) if it was the last one */
+static int
+pdf_drop_name_ref(pdf_obj *obj)
+{
+	pdf_document *doc = obj->doc;
+	int last;
+
+	fz_lock(doc->ctx, FZ_LOCK_PDF);
+	last = --obj->refs == 0;
+	if (last)
+	{
+		pdf_remove_name_slot(doc->names, doc->name_cap, pdf_find_name_slot(doc->names, doc->name_cap, obj->u.n));
+		doc->name_count--;
+	}
+	fz_unlock(doc->ctx, FZ_LOCK_PDF);
+	return last;
+}
+
 pdf_obj *
 pdf_new_indirect(pdf_document *doc, int num, int gen)
 {
-	pdf_obj *obj;
-	fz_context *ctx = doc->ctx;
-	obj = Memento_label(fz_malloc(ctx, sizeof(pdf_obj)), "pdf_obj(indirect)");
-	obj->doc = doc;
-	obj->refs = 1;
-	obj->kind = PDF_INDIRECT;
-	obj->flags = 0;
-	obj->parent_num = 0;
+	pdf_obj *obj = pdf_alloc_obj(doc, PDF_INDIRECT, "pdf_obj(indirect)");
 	obj->u.r.num = num;
 	obj->u.r.gen = gen;
 	return obj;
@@ -172,7 +377,16 @@ pdf_new_indirect(pdf_document *doc, int num, int gen)
 pdf_obj *
 pdf_keep_obj(pdf_obj *obj)
 {
-	if (obj)
+	if (!obj)
+		return NULL;
+	if (obj->kind == PDF_NAME)
+	{
+		fz_context *ctx = obj->doc->ctx;
+		fz_lock(ctx, FZ_LOCK_PDF);
+		obj->refs ++;
+		fz_unlock(ctx, FZ_LOCK_PDF);
+	}
+	else
 		obj->refs ++;
 	return obj;
 }
@@ -445,12 +659,7 @@ pdf_new_array(pdf_document *doc, int initialcap)
 	int i;
 	fz_context *ctx = doc->ctx;
 
-	obj = Memento_label(fz_malloc(ctx, sizeof(pdf_obj)), "pdf_obj(array)");
-	obj->doc = doc;
-	obj->refs = 1;
-	obj->kind = PDF_ARRAY;
-	obj->flags = 0;
-	obj->parent_num = 0;
+	obj = pdf_alloc_obj(doc, PDF_ARRAY, "pdf_obj(array)");
 
 	obj->u.a.len = 0;
 	obj->u.a.cap = initialcap > 1 ? initialcap : 6;
@@ -461,7 +670,7 @@ pdf_new_array(pdf_document *doc, int initialcap)
 	}
 	fz_catch(ctx)
 	{
-		fz_free(ctx, obj);
+		pdf_free_obj(obj);
 		fz_rethrow(ctx);
 	}
 	for (i = 0; i < obj->u.a.cap; i++)
@@ -787,12 +996,7 @@ pdf_new_dict(pdf_document *doc, int initialcap)
 	int i;
 	fz_context *ctx = doc->ctx;
 
-	obj = Memento_label(fz_malloc(ctx, sizeof(pdf_obj)), "pdf_obj(dict)");
-	obj->doc = doc;
-	obj->refs = 1;
-	obj->kind = PDF_DICT;
-	obj->flags = 0;
-	obj->parent_num = 0;
+	obj = pdf_alloc_obj(doc, PDF_DICT, "pdf_obj(dict)");
 
 	obj->u.d.len = 0;
 	obj->u.d.cap = initialcap > 1 ? initialcap : 10;
@@ -803,7 +1007,7 @@ pdf_new_dict(pdf_document *doc, int initialcap)
 	}
 	fz_catch(ctx)
 	{
-		fz_free(ctx, obj);
+		pdf_free_obj(obj);
 		fz_rethrow(ctx);
 	}
 	for (i = 0; i < obj->u.d.cap; i++)
@@ -890,15 +1094,16 @@ pdf_dict_get_val(pdf_obj *obj, int i)
 	return obj->u.d.items[i].v;
 }
 
+/* key must be one of obj's document's name objects */
 static int
-pdf_dict_finds(pdf_obj *obj, const char *key, int *location)
+pdf_dict_find(pdf_obj *obj, pdf_obj *key, int *location)
 {
 	if ((obj->flags & PDF_FLAGS_SORTED) && obj->u.d.len > 0)
 	{
 		int l = 0;
 		int r = obj->u.d.len - 1;
 
-		if (strcmp(pdf_to_name(obj->u.d.items[r].k), key) < 0)
+		if (obj->u.d.items[r].k != key && strcmp(obj->u.d.items[r].k->u.n, key->u.n) < 0)
 		{
 			if (location)
 				*location = r + 1;
@@ -908,7 +1113,7 @@ pdf_dict_finds(pdf_obj *obj, const char *key, int *location)
 		while (l <= r)
 		{
 			int m = (l + r) >> 1;
-			int c = -strcmp(pdf_to_name(obj->u.d.items[m].k), key);
+			int c = obj->u.d.items[m].k == key ? 0 : -strcmp(obj->u.d.items[m].k->u.n, key->u.n);
 			if (c < 0)
 				r = m - 1;
 			else if (c > 0)
@@ -925,7 +1130,7 @@ pdf_dict_finds(pdf_obj *obj, const char *key, int *location)
 	{
 		int i;
 		for (i = 0; i < obj->u.d.len; i++)
-			if (strcmp(pdf_to_name(obj->u.d.items[i].k), key) == 0)
+			if (obj->u.d.items[i].k == key)
 				return i;
 
 		if (location)
@@ -935,22 +1140,31 @@ pdf_dict_finds(pdf_obj *obj, const char *key, int *location)
 	return -1;
 }
 
-pdf_obj *
-pdf_dict_gets(pdf_obj *obj, const char *key)
+static pdf_obj *
+pdf_dict_get_atom(pdf_obj *obj, pdf_obj *key)
 {
 	int i;
 
-	RESOLVE(obj);
-	if (!obj || obj->kind != PDF_DICT)
+	if (!key)
 		return NULL;
-
-	i = pdf_dict_finds(obj, key, NULL);
+	i = pdf_dict_find(obj, key, NULL);
 	if (i >= 0)
 		return obj->u.d.items[i].v;
 
 	return NULL;
 }
 
+pdf_obj *
+pdf_dict_gets(pdf_obj *obj, const char *key)
+{
+	RESOLVE(obj);
+	if (!obj || obj->kind != PDF_DICT)
+		return NULL;
+
+	/* A name the document has never seen can't be a key */
+	return pdf_dict_get_atom(obj, pdf_find_name(obj->doc, key));
+}
+
 pdf_obj *
 pdf_dict_getp(pdf_obj *obj, const char *keys)
 {
@@ -986,7 +1200,12 @@ pdf_dict_get(pdf_obj *obj, pdf_obj *key)
 {
 	if (!key || key->kind != PDF_NAME)
 		return NULL;
-	return pdf_dict_gets(obj, pdf_to_name(key));
+	RESOLVE(obj);
+	if (!obj || obj->kind != PDF_DICT)
+		return NULL;
+	if (key->doc != obj->doc)
+		key = pdf_find_name(obj->doc, key->u.n);
+	return pdf_dict_get_atom(obj, key);
 }
 
 pdf_obj *
@@ -1030,10 +1249,17 @@ pdf_dict_put(pdf_obj *obj, pdf_obj *key, pdf_obj *val)
 		return;
 	}
 
+	/* Keys must be the document's own name objects */
+	if (key->doc != obj->doc)
+	{
+		key = pdf_new_name(obj->doc, s);
+		pdf_drop_obj(key); /* still held by the name table */
+	}
+
 	if (obj->u.d.len > 100 && !(obj->flags & PDF_FLAGS_SORTED))
 		pdf_sort_dict(obj);
 
-	i = pdf_dict_finds(obj, s, &location);
+	i = pdf_dict_find(obj, key, &location);
 	if (i >= 0 && i < obj->u.d.len)
 	{
 		if (obj->u.d.items[i].v != val)
@@ -1198,7 +1424,10 @@ pdf_dict_dels(pdf_obj *obj, const char *key)
 		fz_warn(obj->doc->ctx, "assert: not a dict (%s)", pdf_objkindstr(obj));
 	else
 	{
-		int i = pdf_dict_finds(obj, key, NULL);
+		int i = -1;
+		pdf_obj *atom = pdf_find_name(obj->doc, key);
+		if (atom)
+			i = pdf_dict_find(obj, atom, NULL);
 		if (i >= 0)
 		{
 			pdf_drop_obj(obj->u.d.items[i].k);
@@ -1317,7 +1546,7 @@ pdf_free_array(pdf_obj *obj)
 		pdf_drop_obj(obj->u.a.items[i]);
 
 	fz_free(ctx, obj->u.a.items);
-	fz_free(ctx, obj);
+	pdf_free_obj(obj);
 }
 
 static void
@@ -1332,7 +1561,7 @@ pdf_free_dict(pdf_obj *obj)
 	}
 
 	fz_free(ctx, obj->u.d.items);
-	fz_free(ctx, obj);
+	pdf_free_obj(obj);
 }
 
 void
@@ -1340,6 +1569,12 @@ pdf_drop_obj(pdf_obj *obj)
 {
 	if (!obj)
 		return;
+	if (obj->kind == PDF_NAME)
+	{
+		if (pdf_drop_name_ref(obj))
+			pdf_free_obj(obj);
+		return;
+	}
 	if (--obj->refs)
 		return;
 	if (obj->kind == PDF_ARRAY)
@@ -1347,7 +1582,7 @@ pdf_drop_obj(pdf_obj *obj)
 	else if (obj->kind == PDF_DICT)
 		pdf_free_dict(obj);
 	else
-		fz_free(obj->doc->ctx, obj);
+		pdf_free_obj(obj);
 }
 
 void
@@ -50,6 +50,7 @@ static fz_store_type pdf_obj_store_type =
 	pdf_keep_key,
 	pdf_drop_key,
 	pdf_cmp_key,
+	FZ_STORE_CLASS_RESOURCE,
 #ifndef NDEBUG
 	pdf_debug_key
 #endif
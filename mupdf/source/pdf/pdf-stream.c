@@ -63,7 +63,7 @@ pdf_load_jbig2_globals(pdf_document *doc, pdf_obj *dict)
 	{
 		buf = pdf_load_stream(doc, pdf_to_num(dict), pdf_to_gen(dict));
 		globals = fz_load_jbig2_globals(doc->ctx, buf->data, buf->len);
-		pdf_store_item(doc->ctx, dict, globals, buf->len);
+		pdf_store_item(doc->ctx, dict, globals, fz_jbig2_globals_size(globals));
 	}
 	fz_always(doc->ctx)
 	{
@@ -8,6 +8,8 @@
 #define DEBUGMESS(A) do { } while (0)
 #endif
 
+static void pdf_drop_obj_stms(fz_context *ctx, struct pdf_obj_stm_s *stms, int len);
+
 static inline int iswhite(int ch)
 {
 	return
@@ -1242,10 +1244,16 @@ pdf_close_document(pdf_document *doc)
 
 	pdf_free_ocg(ctx, doc->ocg);
 
+	pdf_drop_obj_stms(ctx, doc->obj_stms, doc->obj_stm_count);
+
 	fz_empty_store(ctx);
 
+	pdf_drop_name_table(doc);
+
 	pdf_lexbuf_fin(&doc->lexbuf.base);
 
+	pdf_drop_obj_pool(doc);
+
 	fz_free(ctx, doc);
 }
 
@@ -1271,25 +1279,74 @@ pdf_print_xref(pdf_document *doc)
  * compressed object streams
  */
 
+/* Caches the objects of object stream num from the decoded stream, given
+ * the number and offset of each object (index) */
+static void
+pdf_cache_obj_stm_objs(pdf_document *doc, int num, fz_stream *stm, int first, int count, int *index, pdf_lexbuf *buf)
+{
+	fz_context *ctx = doc->ctx;
+	pdf_obj *obj;
+	int i;
+
+	for (i = 0; i < count; i++)
+	{
+		int xref_len = pdf_xref_len(doc);
+		int objnum = index[i * 2];
+		pdf_xref_entry *entry;
+		fz_seek(stm, first + index[i * 2 + 1], SEEK_SET);
+
+		obj = pdf_parse_stm_obj(doc, stm, buf);
+
+		if (objnum < 1 || objnum >= xref_len)
+		{
+			pdf_drop_obj(obj);
+			fz_throw(ctx, FZ_ERROR_GENERIC, "object id (%d 0 R) out of range (0..%d)", objnum, xref_len - 1);
+		}
+
+		entry = pdf_get_xref_entry(doc, objnum);
+
+		pdf_set_obj_parent(obj, objnum);
+
+		if (entry->type == 'o' && entry->ofs == num)
+		{
+			/* If we already have an entry for this object,
+			 * we'd like to drop it and use the new one -
+			 * but this means that anyone currently holding
+			 * a pointer to the old one will be left with a
+			 * stale pointer. Instead, we drop the new one
+			 * and trust that the old one is correct. */
+			if (entry->obj) {
+				if (pdf_objcmp(entry->obj, obj))
+					fz_warn(ctx, "Encountered new definition for object %d - keeping the original one", objnum);
+				pdf_drop_obj(obj);
+			} else
+				entry->obj = obj;
+		}
+		else
+		{
+			pdf_drop_obj(obj);
+		}
+	}
+}
+
 static void
 pdf_load_obj_stm(pdf_document *doc, int num, int gen, pdf_lexbuf *buf)
 {
 	fz_stream *stm = NULL;
+	fz_buffer *data = NULL;
 	pdf_obj *objstm = NULL;
-	int *numbuf = NULL;
-	int *ofsbuf = NULL;
+	int *index = NULL;
 
-	pdf_obj *obj;
 	int first;
 	int count;
 	int i;
 	pdf_token tok;
 	fz_context *ctx = doc->ctx;
 
-	fz_var(numbuf);
-	fz_var(ofsbuf);
+	fz_var(index);
 	fz_var(objstm);
 	fz_var(stm);
+	fz_var(data);
 
 	fz_try(ctx)
 	{
@@ -1303,74 +1360,344 @@ pdf_load_obj_stm(pdf_document *doc, int num, int gen, pdf_lexbuf *buf)
 		if (first < 0)
 			fz_throw(ctx, FZ_ERROR_GENERIC, "first object in object stream resides outside stream");
 
-		numbuf = fz_calloc(ctx, count, sizeof(int));
-		ofsbuf = fz_calloc(ctx, count, sizeof(int));
+		index = fz_calloc(ctx, count, 2 * sizeof(int));
 
-		stm = pdf_open_stream(doc, num, gen);
-		for (i = 0; i < count; i++)
+		/* Decode the whole stream up front, so that seeking to the
+		 * objects is cheap and works in whatever order they're stored */
+		data = pdf_load_stream(doc, num, gen);
+		stm = fz_open_buffer(ctx, data);
+		for (i = 0; i < count * 2; i++)
 		{
 			tok = pdf_lex(stm, buf);
 			if (tok != PDF_TOK_INT)
 				fz_throw(ctx, FZ_ERROR_GENERIC, "corrupt object stream (%d %d R)", num, gen);
-			numbuf[i] = buf->i;
-
-			tok = pdf_lex(stm, buf);
-			if (tok != PDF_TOK_INT)
-				fz_throw(ctx, FZ_ERROR_GENERIC, "corrupt object stream (%d %d R)", num, gen);
-			ofsbuf[i] = buf->i;
+			index[i] = buf->i;
 		}
 
-		fz_seek(stm, first, SEEK_SET);
+		pdf_cache_obj_stm_objs(doc, num, stm, first, count, index, buf);
+	}
+	fz_always(ctx)
+	{
+		fz_close(stm);
+		fz_drop_buffer(ctx, data);
+		fz_free(ctx, index);
+		pdf_drop_obj(objstm);
+	}
+	fz_catch(ctx)
+	{
+		fz_rethrow_message(ctx, "cannot open object stream (%d %d R)", num, gen);
+	}
+}
 
-		for (i = 0; i < count; i++)
-		{
-			int xref_len = pdf_xref_len(doc);
-			pdf_xref_entry *entry;
-			fz_seek(stm, first + ofsbuf[i], SEEK_SET);
+/*
+ * decoding all object streams at once
+ */
+
+struct pdf_obj_stm_s
+{
+	int num;	/* object number of the stream */
+	int ofs;	/* file offset of the stream */
+	int count;	/* number of objects in the stream */
+	int first;	/* offset of the first object */
+	pdf_obj *dict;	/* stream dictionary (until loaded) */
+	fz_buffer *raw;	/* compressed data (until decoded) */
+	fz_buffer *data;	/* decoded data (until the objects are cached) */
+	int *index;	/* number and offset of each object */
+};
+
+struct pdf_obj_stm_batch_s
+{
+	pdf_document *doc;
+	int len;
+	struct pdf_obj_stm_s *stms;
+};
+
+static int obj_stm_ofs_cmp(const void *a, const void *b)
+{
+	return ((const struct pdf_obj_stm_s *)a)->ofs - ((const struct pdf_obj_stm_s *)b)->ofs;
+}
+
+static int obj_stm_num_cmp(const void *a, const void *b)
+{
+	return ((const struct pdf_obj_stm_s *)a)->num - ((const struct pdf_obj_stm_s *)b)->num;
+}
+
+static void
+pdf_drop_obj_stm(fz_context *ctx, struct pdf_obj_stm_s *stm)
+{
+	pdf_drop_obj(stm->dict);
+	fz_drop_buffer(ctx, stm->raw);
+	fz_drop_buffer(ctx, stm->data);
+	fz_free(ctx, stm->index);
+}
+
+static void
+pdf_drop_obj_stms(fz_context *ctx, struct pdf_obj_stm_s *stms, int len)
+{
+	int i;
+	for (i = 0; i < len; i++)
+		pdf_drop_obj_stm(ctx, &stms[i]);
+	fz_free(ctx, stms);
+}
 
-			obj = pdf_parse_stm_obj(doc, stm, buf);
+/* Whether obj can be read without loading any other object */
+static int
+pdf_is_direct_tree(pdf_obj *obj)
+{
+	int i, n;
 
-			if (numbuf[i] < 1 || numbuf[i] >= xref_len)
+	if (pdf_is_indirect(obj))
+		return 0;
+	if (pdf_is_array(obj))
+	{
+		n = pdf_array_len(obj);
+		for (i = 0; i < n; i++)
+			if (!pdf_is_direct_tree(pdf_array_get(obj, i)))
+				return 0;
+	}
+	else if (pdf_is_dict(obj))
+	{
+		n = pdf_dict_len(obj);
+		for (i = 0; i < n; i++)
+			if (!pdf_is_direct_tree(pdf_dict_get_val(obj, i)))
+				return 0;
+	}
+	return 1;
+}
+
+/* Whether the stream's filters can be set up from another thread: they
+ * may neither load objects nor use the document's context (as the
+ * JBIG2Decode and Crypt filters do) */
+static int
+pdf_can_decode_obj_stm_alone(pdf_obj *dict)
+{
+	pdf_obj *filters = pdf_dict_getsa(dict, "Filter", "F");
+	pdf_obj *f;
+	int i, n;
+
+	if (!pdf_is_direct_tree(filters) || !pdf_is_direct_tree(pdf_dict_getsa(dict, "DecodeParms", "DP")))
+		return 0;
+
+	n = pdf_is_array(filters) ? pdf_array_len(filters) : 1;
+	for (i = 0; i < n; i++)
+	{
+		f = pdf_is_array(filters) ? pdf_array_get(filters, i) : filters;
+		if (pdf_is_name(f) && (!strcmp(pdf_to_name(f), "JBIG2Decode") || !strcmp(pdf_to_name(f), "Crypt")))
+			return 0;
+	}
+	return 1;
+}
+
+pdf_obj_stm_batch *
+pdf_read_obj_stms(pdf_document *doc)
+{
+	fz_context *ctx = doc->ctx;
+	int xref_len = pdf_xref_len(doc);
+	pdf_obj_stm_batch *batch;
+	unsigned char *seen = NULL;
+	struct pdf_obj_stm_s *stm;
+	int i, len;
+
+	fz_var(seen);
+
+	batch = fz_malloc_struct(ctx, pdf_obj_stm_batch);
+	batch->doc = doc;
+
+	fz_try(ctx)
+	{
+		seen = fz_calloc(ctx, xref_len, 1);
+		for (i = 0; i < xref_len; i++)
+		{
+			pdf_xref_entry *entry = pdf_get_xref_entry(doc, i);
+			if (entry->type == 'o' && !entry->obj && entry->ofs > 0 && entry->ofs < xref_len)
+				seen[entry->ofs] = 1;
+		}
+		for (len = i = 0; i < xref_len; i++)
+			len += seen[i];
+
+		batch->stms = fz_calloc(ctx, len, sizeof(*batch->stms));
+		for (i = 0; i < xref_len; i++)
+		{
+			if (seen[i])
 			{
-				pdf_drop_obj(obj);
-				fz_throw(ctx, FZ_ERROR_GENERIC, "object id (%d 0 R) out of range (0..%d)", numbuf[i], xref_len - 1);
+				stm = &batch->stms[batch->len++];
+				stm->num = i;
+				stm->ofs = pdf_get_xref_entry(doc, i)->ofs;
 			}
+		}
 
-			entry = pdf_get_xref_entry(doc, numbuf[i]);
-
-			pdf_set_obj_parent(obj, numbuf[i]);
+		/* read the object streams in file order */
+		qsort(batch->stms, batch->len, sizeof(*batch->stms), obj_stm_ofs_cmp);
 
-			if (entry->type == 'o' && entry->ofs == num)
+		for (i = 0; i < batch->len; i++)
+		{
+			stm = &batch->stms[i];
+			fz_try(ctx)
 			{
-				/* If we already have an entry for this object,
-				 * we'd like to drop it and use the new one -
-				 * but this means that anyone currently holding
-				 * a pointer to the old one will be left with a
-				 * stale pointer. Instead, we drop the new one
-				 * and trust that the old one is correct. */
-				if (entry->obj) {
-					if (pdf_objcmp(entry->obj, obj))
-						fz_warn(ctx, "Encountered new definition for object %d - keeping the original one", numbuf[i]);
-					pdf_drop_obj(obj);
-				} else
-					entry->obj = obj;
+				stm->dict = pdf_load_object(doc, stm->num, 0);
+				stm->count = pdf_to_int(pdf_dict_gets(stm->dict, "N"));
+				stm->first = pdf_to_int(pdf_dict_gets(stm->dict, "First"));
+				/* leave everything unusual to pdf_load_obj_stm */
+				if (stm->count > 0 && stm->first >= 0 && pdf_can_decode_obj_stm_alone(stm->dict))
+					stm->raw = pdf_load_raw_stream(doc, stm->num, 0);
 			}
-			else
+			fz_catch(ctx)
 			{
-				pdf_drop_obj(obj);
+				fz_rethrow_if(ctx, FZ_ERROR_TRYLATER);
+				/* objects from broken streams get reported when they're used */
+				fz_warn(ctx, "cannot read object stream (%d 0 R)", stm->num);
 			}
 		}
 	}
 	fz_always(ctx)
 	{
-		fz_close(stm);
-		fz_free(ctx, ofsbuf);
-		fz_free(ctx, numbuf);
-		pdf_drop_obj(objstm);
+		fz_free(ctx, seen);
 	}
 	fz_catch(ctx)
 	{
-		fz_rethrow_message(ctx, "cannot open object stream (%d %d R)", num, gen);
+		pdf_drop_obj_stms(ctx, batch->stms, batch->len);
+		fz_free(ctx, batch);
+		fz_rethrow(ctx);
+	}
+
+	return batch;
+}
+
+void
+pdf_decode_obj_stms(fz_context *ctx, pdf_obj_stm_batch *batch, int thread, int threads)
+{
+	struct pdf_obj_stm_s *stm;
+	fz_stream *raw = NULL;
+	fz_stream *file = NULL;
+	pdf_lexbuf buf;
+	int i, k;
+
+	fz_var(raw);
+	fz_var(file);
+
+	pdf_lexbuf_init(ctx, &buf, PDF_LEXBUF_SMALL);
+
+	for (i = thread; i < batch->len; i += threads)
+	{
+		stm = &batch->stms[i];
+		if (!stm->raw)
+			continue;
+
+		fz_try(ctx)
+		{
+			raw = fz_open_buffer(ctx, stm->raw);
+			file = pdf_open_inline_stream(batch->doc, stm->dict, stm->raw->len, raw, NULL);
+			stm->data = fz_read_all(file, stm->raw->len);
+			fz_close(file);
+			file = NULL;
+			file = fz_open_buffer(ctx, stm->data);
+
+			stm->index = fz_malloc_array(ctx, stm->count, 2 * sizeof(int));
+			for (k = 0; k < stm->count * 2; k++)
+			{
+				if (pdf_lex(file, &buf) != PDF_TOK_INT)
+					fz_throw(ctx, FZ_ERROR_GENERIC, "corrupt object stream (%d 0 R)", stm->num);
+				stm->index[k] = buf.i;
+			}
+		}
+		fz_always(ctx)
+		{
+			fz_close(file);
+			file = NULL;
+			fz_close(raw);
+			raw = NULL;
+			fz_drop_buffer(ctx, stm->raw);
+			stm->raw = NULL;
+		}
+		fz_catch(ctx)
+		{
+			fz_drop_buffer(ctx, stm->data);
+			stm->data = NULL;
+			fz_warn(ctx, "cannot decode object stream (%d 0 R)", stm->num);
+		}
+	}
+
+	pdf_lexbuf_fin(&buf);
+}
+
+void
+pdf_load_obj_stms(pdf_document *doc, pdf_obj_stm_batch *batch)
+{
+	fz_context *ctx = doc->ctx;
+	int i, len = 0;
+
+	/* keep the streams which have been decoded */
+	for (i = 0; i < batch->len; i++)
+	{
+		struct pdf_obj_stm_s *stm = &batch->stms[i];
+		pdf_drop_obj(stm->dict);
+		stm->dict = NULL;
+		if (stm->data)
+			batch->stms[len++] = *stm;
+		else
+			pdf_drop_obj_stm(ctx, stm);
+	}
+	qsort(batch->stms, len, sizeof(*batch->stms), obj_stm_num_cmp);
+
+	pdf_drop_obj_stms(ctx, doc->obj_stms, doc->obj_stm_count);
+	doc->obj_stms = batch->stms;
+	doc->obj_stm_count = len;
+
+	fz_free(ctx, batch);
+}
+
+static struct pdf_obj_stm_s *
+pdf_find_obj_stm(pdf_document *doc, int num)
+{
+	struct pdf_obj_stm_s key;
+	key.num = num;
+	if (doc->obj_stm_count == 0)
+		return NULL;
+	return bsearch(&key, doc->obj_stms, doc->obj_stm_count, sizeof(key), obj_stm_num_cmp);
+}
+
+/* Caches the objects of object stream num from the data decoded by
+ * pdf_load_obj_stms. Returns 0 if there is no such data, so that the
+ * caller has to decode the stream itself. */
+static int
+pdf_cache_decoded_obj_stm(pdf_document *doc, int num)
+{
+	fz_context *ctx = doc->ctx;
+	struct pdf_obj_stm_s *stm = pdf_find_obj_stm(doc, num);
+	fz_stream *file;
+
+	if (!stm || !stm->data)
+		return 0;
+
+	file = fz_open_buffer(ctx, stm->data);
+	fz_try(ctx)
+	{
+		pdf_cache_obj_stm_objs(doc, num, file, stm->first, stm->count, stm->index, &doc->lexbuf.base);
+	}
+	fz_always(ctx)
+	{
+		fz_close(file);
+		/* all of the stream's objects have been cached now */
+		fz_drop_buffer(ctx, stm->data);
+		stm->data = NULL;
+	}
+	fz_catch(ctx)
+	{
+		fz_rethrow_message(ctx, "cannot open object stream (%d 0 R)", num);
+	}
+	return 1;
+}
+
+/* Forgets the decoded data of object stream num (if any), once the
+ * stream has been replaced */
+static void
+pdf_forget_obj_stm(pdf_document *doc, int num)
+{
+	struct pdf_obj_stm_s *stm = pdf_find_obj_stm(doc, num);
+	if (stm && stm->data)
+	{
+		fz_drop_buffer(doc->ctx, stm->data);
+		stm->data = NULL;
 	}
 }
 
@@ -1660,7 +1987,8 @@ object_updated:
 		{
 			fz_try(ctx)
 			{
-				pdf_load_obj_stm(doc, x->ofs, 0, &doc->lexbuf.base);
+				if (!pdf_cache_decoded_obj_stm(doc, x->ofs))
+					pdf_load_obj_stm(doc, x->ofs, 0, &doc->lexbuf.base);
 			}
 			fz_catch(ctx)
 			{
@@ -1810,6 +2138,7 @@ pdf_update_object(pdf_document *doc, int num, pdf_obj *newobj)
 	x = pdf_get_incremental_xref_entry(doc, num);
 
 	pdf_drop_obj(x->obj);
+	pdf_forget_obj_stm(doc, num);
 
 	x->type = 'n';
 	x->ofs = 0;
@@ -1833,6 +2162,7 @@ pdf_update_stream(pdf_document *doc, int num, fz_buffer *newbuf)
 
 	fz_drop_buffer(doc->ctx, x->stm_buf);
 	x->stm_buf = fz_keep_buffer(doc->ctx, newbuf);
+	pdf_forget_obj_stm(doc, num);
 }
 
 int
@@ -2377,6 +2707,7 @@ pdf_document *pdf_create_document(fz_context *ctx)
 		pdf_dict_puts_drop(pages, "Count", pdf_new_int(doc, 0));
 		pdf_dict_puts_drop(pages, "Kids", pdf_new_array(doc, 1));
 		pdf_set_populating_xref_trailer(doc, trailer);
+		pdf_drop_obj(trailer);
 	}
 	fz_catch(ctx)
 	{
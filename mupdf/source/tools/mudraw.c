@@ -14,6 +14,7 @@
 #define GDI_PLUS_BMP_RENDERER
 #else
 #include <sys/time.h>
+#include <pthread.h>
 #endif
 
 enum { TEXT_PLAIN = 1, TEXT_HTML = 2, TEXT_XML = 3 };
@@ -67,6 +68,23 @@ static const cs_name_t cs_name_table[] =
 	{ "rgbalpha", CS_RGBA }
 };
 
+typedef struct
+{
+	char *name;
+	int paths;
+} refpaths_name_t;
+
+static const refpaths_name_t refpaths_name_table[] =
+{
+	{ "simd", FZ_REF_SIMD },
+	{ "halftone", FZ_REF_HALFTONE },
+	{ "stroke", FZ_REF_STROKE },
+	{ "color", FZ_REF_COLOR },
+	{ "shade", FZ_REF_SHADE },
+	{ "lex", FZ_REF_LEX },
+	{ "all", ~0 }
+};
+
 typedef struct
 {
 	int format;
@@ -155,6 +173,9 @@ static pdf_document *pdfout = NULL;
 static int showoutline = 0;
 static int uselist = 1;
 static int alphabits = 8;
+static int analytic = 0;
+static int showaadiff = 0;
+static int refpaths = 0;
 static float gamma_value = 1;
 static int invert = 0;
 static int width = 0;
@@ -174,6 +195,13 @@ static fz_text_sheet *sheet = NULL;
 static fz_colorspace *colorspace;
 static char *filename;
 static int files = 0;
+static int threads = 0;
+static char *jsonfilename = NULL;
+static FILE *jsonfile = NULL;
+static int jsonfiles = 0;
+static int jsonpages = -1; /* pages in the current file, -1 outside of files */
+static int jsonpagecount = 0;
+static fz_store_stats storestats[FZ_STORE_CLASS_COUNT];
 fz_output *out = NULL;
 
 static char *mujstest_filename = NULL;
@@ -207,6 +235,11 @@ static void usage(void)
 		"\t-f -\tfit width and/or height exactly (ignore aspect)\n"
 		"\t-c -\tcolorspace {mono,gray,grayalpha,rgb,rgba}\n"
 		"\t-b -\tnumber of bits of antialiasing (0 to 8)\n"
+		"\t-A\tuse analytic coverage instead of supersampling for antialiasing\n"
+		"\t-D\tshow the difference to (and the time of) rendering with the other\n"
+		"\t\tantialiasing method\n"
+		"\t-X -\tshow the difference to (and the time of) rendering through the\n"
+		"\t\treference code paths instead of optimized ones {simd,halftone,stroke,color,shade,lex,all}\n"
 		"\t-B -\tmaximum bandheight (pgm, ppm, pam output only)\n"
 		"\t-g\trender in grayscale\n"
 		"\t-m\tshow timing information\n"
@@ -221,11 +254,17 @@ static void usage(void)
 		"\t-l\tprint outline\n"
 		"\t-j -\tOutput mujstest file\n"
 		"\t-i\tignore errors and continue with the next file\n"
+		"\t-T -\tnumber of threads to render pages with\n"
+		"\t-J -\twrite timing information as JSON to file ('-' for stdout)\n"
+		"\tinput\tdocument file or test:name for a built-in test document\n"
+		"\t\t{spans,halftone,scale,lineart,text,color,blend,shade,affine,syntax}\n"
 		"\tpages\tcomma separated list of ranges\n");
 	exit(1);
 }
 
-static int gettime(void)
+/* milliseconds since the first call (which must happen before any
+ * threads are started) */
+static double gettime(void)
 {
 	static struct timeval first;
 	static int once = 1;
@@ -236,7 +275,7 @@ static int gettime(void)
 		once = 0;
 	}
 	gettimeofday(&now, NULL);
-	return (now.tv_sec - first.tv_sec) * 1000 + (now.tv_usec - first.tv_usec) / 1000;
+	return (now.tv_sec - first.tv_sec) * 1000.0 + (now.tv_usec - first.tv_usec) / 1000.0;
 }
 
 static int isrange(char *s)
@@ -275,8 +314,586 @@ static void escape_string(FILE *out, int len, const char *string)
 	}
 }
 
+static void json_string(FILE *out, const char *string)
+{
+	fputc('"', out);
+	for (; *string; string++)
+	{
+		unsigned char c = *string;
+		if (c == '"' || c == '\\')
+			fprintf(out, "\\%c", c);
+		else if (c < 0x20)
+			fprintf(out, "\\u%04x", c);
+		else
+			fputc(c, out);
+	}
+	fputc('"', out);
+}
+
+/*
+	SumatraPDF: built-in test documents
+
+	Documents named "test:NAME" are generated in memory, so that the
+	optimized code paths can be exercised (and compared to the reference
+	paths with -X) without depending on files which happen to contain the
+	right kind of content. The content is pseudo-random but the same for
+	every run.
+*/
+
+#define TESTPDF_MAX_OBJS 256
+#define TESTPDF_MAX_PAGES 32
+
+typedef struct
+{
+	fz_buffer *buf;
+	int ofs[TESTPDF_MAX_OBJS];
+	int next; /* 1 and 2 are the catalog and the page tree */
+	int kids[TESTPDF_MAX_PAGES];
+	int pages;
+	unsigned int seed;
+} testpdf;
+
+static int testpdf_random(testpdf *pdf, int max)
+{
+	pdf->seed = pdf->seed * 1103515245 + 12345;
+	return (pdf->seed >> 16) % max;
+}
+
+static int testpdf_obj(fz_context *ctx, testpdf *pdf, int num)
+{
+	if (!num)
+		num = pdf->next++;
+	if (num >= TESTPDF_MAX_OBJS)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "too many objects in test document");
+	pdf->ofs[num] = pdf->buf->len;
+	fz_buffer_printf(ctx, pdf->buf, "%d 0 obj\n", num);
+	return num;
+}
+
+static int testpdf_stream(fz_context *ctx, testpdf *pdf, const char *dict, fz_buffer *data)
+{
+	int num = testpdf_obj(ctx, pdf, 0);
+	fz_buffer_printf(ctx, pdf->buf, "<<%s/Length %d>>\nstream\n", dict, data->len);
+	fz_write_buffer(ctx, pdf->buf, data->data, data->len);
+	fz_buffer_printf(ctx, pdf->buf, "\nendstream\nendobj\n");
+	return num;
+}
+
+/* adds a Letter sized page; contents is dropped */
+static void testpdf_page(fz_context *ctx, testpdf *pdf, const char *resources, fz_buffer *contents)
+{
+	int num;
+
+	fz_try(ctx)
+	{
+		if (pdf->pages >= TESTPDF_MAX_PAGES)
+			fz_throw(ctx, FZ_ERROR_GENERIC, "too many pages in test document");
+		num = testpdf_stream(ctx, pdf, "", contents);
+		pdf->kids[pdf->pages++] = testpdf_obj(ctx, pdf, 0);
+		fz_buffer_printf(ctx, pdf->buf, "<</Type/Page/Parent 2 0 R/MediaBox[0 0 612 792]/Resources<<%s>>/Contents %d 0 R>>\nendobj\n", resources, num);
+	}
+	fz_always(ctx)
+	{
+		fz_drop_buffer(ctx, contents);
+	}
+	fz_catch(ctx)
+	{
+		fz_rethrow(ctx);
+	}
+}
+
+static void testpdf_finish(fz_context *ctx, testpdf *pdf)
+{
+	int i, xref;
+
+	testpdf_obj(ctx, pdf, 1);
+	fz_buffer_printf(ctx, pdf->buf, "<</Type/Catalog/Pages 2 0 R>>\nendobj\n");
+	testpdf_obj(ctx, pdf, 2);
+	fz_buffer_printf(ctx, pdf->buf, "<</Type/Pages/Count %d/Kids[", pdf->pages);
+	for (i = 0; i < pdf->pages; i++)
+		fz_buffer_printf(ctx, pdf->buf, "%d 0 R ", pdf->kids[i]);
+	fz_buffer_printf(ctx, pdf->buf, "]>>\nendobj\n");
+
+	xref = pdf->buf->len;
+	fz_buffer_printf(ctx, pdf->buf, "xref\n0 %d\n0000000000 65535 f \n", pdf->next);
+	for (i = 1; i < pdf->next; i++)
+		fz_buffer_printf(ctx, pdf->buf, "%010d 00000 n \n", pdf->ofs[i]);
+	fz_buffer_printf(ctx, pdf->buf, "trailer\n<</Size %d/Root 1 0 R>>\nstartxref\n%d\n%%%%EOF\n", pdf->next, xref);
+}
+
+/* an image with n components (in the given colorspace, or gray, RGB or
+ * CMYK) of thin rings and noise, or of wide rings of a single color */
+static int testpdf_image(fz_context *ctx, testpdf *pdf, int w, int h, int n, const char *colorspace, int noise)
+{
+	static const char *cs[] = { "/DeviceGray", "", "/DeviceRGB", "/DeviceCMYK" };
+	unsigned char *row = fz_malloc(ctx, w * n);
+	int num, x, y, k;
+
+	fz_try(ctx)
+	{
+		num = testpdf_obj(ctx, pdf, 0);
+		fz_buffer_printf(ctx, pdf->buf, "<</Type/XObject/Subtype/Image/Width %d/Height %d/ColorSpace%s/BitsPerComponent 8/Length %d>>\nstream\n",
+			w, h, colorspace ? colorspace : cs[n - 1], w * h * n);
+		for (y = 0; y < h; y++)
+		{
+			for (x = 0; x < w; x++)
+			{
+				int d = (x - w / 2) * (x - w / 2) + (y - h / 2) * (y - h / 2);
+				for (k = 0; k < n; k++)
+					row[x * n + k] = noise ? d / (16 + 8 * k) + testpdf_random(pdf, 32) : (int)sqrtf(d) / 8 * (40 + 24 * k);
+			}
+			fz_write_buffer(ctx, pdf->buf, row, w * n);
+		}
+		fz_buffer_printf(ctx, pdf->buf, "\nendstream\nendobj\n");
+	}
+	fz_always(ctx)
+	{
+		fz_free(ctx, row);
+	}
+	fz_catch(ctx)
+	{
+		fz_rethrow(ctx);
+	}
+
+	return num;
+}
+
+/* Random values are only ever drawn one per statement, as the order in
+ * which function arguments are evaluated differs between compilers. */
+
+/* a random color (and opacity) */
+static void testpdf_color(fz_context *ctx, testpdf *pdf, fz_buffer *buf, int translucent)
+{
+	int r, g, b;
+
+	if (translucent)
+		fz_buffer_printf(ctx, buf, "/GS%d gs ", testpdf_random(pdf, 4));
+	r = testpdf_random(pdf, 256);
+	g = testpdf_random(pdf, 256);
+	b = testpdf_random(pdf, 256);
+	fz_buffer_printf(ctx, buf, "%g %g %g rg ", r / 255.0, g / 255.0, b / 255.0);
+}
+
+/* random rectangles in random colors */
+static fz_buffer *testpdf_rects(fz_context *ctx, testpdf *pdf, int count, int translucent)
+{
+	fz_buffer *buf = fz_new_buffer(ctx, 32 * count);
+	int i, x, y, w, h;
+
+	for (i = 0; i < count; i++)
+	{
+		testpdf_color(ctx, pdf, buf, translucent);
+		x = testpdf_random(pdf, 600);
+		y = testpdf_random(pdf, 780);
+		w = 1 + testpdf_random(pdf, 300);
+		h = 1 + testpdf_random(pdf, 300);
+		fz_buffer_printf(ctx, buf, "%d %d %d %d re f\n", x, y, w, h);
+	}
+
+	return buf;
+}
+
+/* lines of text in random sizes and colors (and in random multiples of
+ * 15 degrees, if rotated) */
+static fz_buffer *testpdf_text(fz_context *ctx, testpdf *pdf, int lines, int translucent, int rotated)
+{
+	fz_buffer *buf = fz_new_buffer(ctx, 100 * lines);
+	char *text = lorem;
+	int i, j, size, x, y, angle;
+	float c, s;
+
+	for (i = 0; i < lines; i++)
+	{
+		size = 4 + testpdf_random(pdf, 20);
+		testpdf_color(ctx, pdf, buf, translucent);
+		x = testpdf_random(pdf, 100) - 50;
+		y = testpdf_random(pdf, 792);
+		if (rotated)
+		{
+			angle = testpdf_random(pdf, 24) * 15;
+			c = cosf(angle * (float)M_PI / 180);
+			s = sinf(angle * (float)M_PI / 180);
+			fz_buffer_printf(ctx, buf, "BT /F1 %d Tf %.4f %.4f %.4f %.4f %d %d Tm (", size, c, s, -s, c, x + 300, y);
+		}
+		else
+			fz_buffer_printf(ctx, buf, "BT /F1 %d Tf %d %d Td (", size, x, y);
+		for (j = 0; j < 80; j++)
+		{
+			/* skip the line breaks, and start over after the last one */
+			if (*text == '\n')
+				text++;
+			if (!*text)
+				text = lorem;
+			fz_buffer_printf(ctx, buf, "%c", *text++);
+		}
+		fz_buffer_printf(ctx, buf, ") Tj ET\n");
+	}
+
+	return buf;
+}
+
+static const char testpdf_alphas[] = "/ExtGState<</GS0<</ca 1>>/GS1<</ca 0.75>>/GS2<</ca 0.5>>/GS3<</ca 0.25>>";
+static const char testpdf_font[] = "/Font<</F1<</Type/Font/Subtype/Type1/BaseFont/Helvetica>>>>";
+
+/* gray levels and colors for halftoning */
+static void testdoc_halftone(fz_context *ctx, testpdf *pdf)
+{
+	fz_buffer *buf;
+	int i;
+
+	buf = fz_new_buffer(ctx, 256 * 40);
+	for (i = 0; i < 256; i++)
+		fz_buffer_printf(ctx, buf, "%g g %d %d 36 48 re f\n", i / 255.0, 18 + i % 16 * 36, 12 + i / 16 * 48);
+	testpdf_page(ctx, pdf, "", buf);
+
+	testpdf_page(ctx, pdf, "", testpdf_rects(ctx, pdf, 300, 0));
+}
+
+/* images scaled down: the first two by more than 2 (so that they are
+ * subsampled while decoding) at up to 300 dpi, the third one only by
+ * less than 2 at 150 dpi (so that it is only scaled) */
+static void testdoc_scale(fz_context *ctx, testpdf *pdf)
+{
+	static const int sizes[][5] = {
+		{ 2480, 3508, 3, 612, 792 },
+		{ 3000, 4000, 1, 612, 792 },
+		{ 1600, 1200, 3, 400, 300 },
+	};
+	char res[64];
+	fz_buffer *buf;
+	int i;
+
+	for (i = 0; i < nelem(sizes); i++)
+	{
+		sprintf(res, "/XObject<</Im0 %d 0 R>>", testpdf_image(ctx, pdf, sizes[i][0], sizes[i][1], sizes[i][2], NULL, 1));
+		buf = fz_new_buffer(ctx, 64);
+		fz_buffer_printf(ctx, buf, "q %d 0 0 %d 0 0 cm /Im0 Do Q\n", sizes[i][3], sizes[i][4]);
+		testpdf_page(ctx, pdf, res, buf);
+	}
+}
+
+/* line art: thin lines, curves and (for FZ_REF_STROKE) axis-aligned
+ * lines with all kinds of caps */
+static void testdoc_lineart(fz_context *ctx, testpdf *pdf)
+{
+	fz_buffer *buf;
+	int i, k, w, p[8];
+
+	buf = fz_new_buffer(ctx, 40 << 10);
+	for (i = 0; i < 20000; i++)
+	{
+		p[0] = testpdf_random(pdf, 612);
+		p[1] = testpdf_random(pdf, 792);
+		w = testpdf_random(pdf, 100);
+		p[2] = p[0] + testpdf_random(pdf, 100) - 50;
+		p[3] = p[1] + testpdf_random(pdf, 100) - 50;
+		fz_buffer_printf(ctx, buf, "%g w %d %d m %d %d l S\n", w / 100.0, p[0], p[1], p[2], p[3]);
+	}
+	testpdf_page(ctx, pdf, "", buf);
+
+	buf = fz_new_buffer(ctx, 40 << 10);
+	for (i = 0; i < 3000; i++)
+	{
+		p[0] = testpdf_random(pdf, 612);
+		p[1] = testpdf_random(pdf, 792);
+		w = testpdf_random(pdf, 100);
+		for (k = 2; k < 8; k++)
+			p[k] = p[k & 1] + testpdf_random(pdf, 200) - 100;
+		fz_buffer_printf(ctx, buf, "%g w %d %d m %d %d %d %d %d %d c S\n", w / 200.0,
+			p[0], p[1], p[2], p[3], p[4], p[5], p[6], p[7]);
+	}
+	testpdf_page(ctx, pdf, "", buf);
+
+	buf = fz_new_buffer(ctx, 40 << 10);
+	for (i = 0; i < 20000; i++)
+	{
+		p[0] = testpdf_random(pdf, 3);
+		p[1] = testpdf_random(pdf, 612);
+		p[2] = testpdf_random(pdf, 792);
+		w = testpdf_random(pdf, 300);
+		p[3] = testpdf_random(pdf, 200) - 100;
+		if (i & 1)
+			fz_buffer_printf(ctx, buf, "%d J %g w %g %d m %g %d l S\n", p[0], w / 100.0, p[1] + 0.5, p[2], p[1] + 0.5, p[2] + p[3]);
+		else
+			fz_buffer_printf(ctx, buf, "%d J %g w %d %g m %d %g l S\n", p[0], w / 100.0, p[1], p[2] + 0.5, p[1] + p[3], p[2] + 0.5);
+	}
+	testpdf_page(ctx, pdf, "", buf);
+}
+
+/* images in colorspaces that need converting (for FZ_REF_COLOR): CMYK,
+ * Lab and a DeviceN colorspace with a tint transform, each with few
+ * colors (in runs) and with noise */
+static void testdoc_color(fz_context *ctx, testpdf *pdf)
+{
+	static const char *cs[] = {
+		"/DeviceCMYK",
+		"[/Lab<</WhitePoint[0.9505 1 1.089]/Range[-128 127 -128 127]>>]",
+		"[/DeviceN[/A/B/C]/DeviceRGB %d 0 R]",
+	};
+	char res[256], space[256];
+	fz_buffer *buf;
+	int i, func;
+
+	buf = fz_new_buffer(ctx, 64);
+	fz_buffer_printf(ctx, buf, "{ 3 1 roll dup mul 3 1 roll }");
+	func = testpdf_stream(ctx, pdf, "/FunctionType 4/Domain[0 1 0 1 0 1]/Range[0 1 0 1 0 1]", buf);
+	fz_drop_buffer(ctx, buf);
+
+	for (i = 0; i < 6; i++)
+	{
+		sprintf(space, cs[i / 2], func);
+		sprintf(res, "/XObject<</Im0 %d 0 R>>", testpdf_image(ctx, pdf, 800, 600, i < 2 ? 4 : 3, space, i & 1));
+		buf = fz_new_buffer(ctx, 64);
+		fz_buffer_printf(ctx, buf, "q 612 0 0 792 0 0 cm /Im0 Do Q\n");
+		testpdf_page(ctx, pdf, res, buf);
+	}
+}
+
+/* a translucent isolated group over translucent rectangles in each of
+ * the separable blend modes */
+static void testdoc_blend(fz_context *ctx, testpdf *pdf)
+{
+	static const char *modes[] = {
+		"Multiply", "Screen", "Overlay", "Darken", "Lighten", "ColorDodge",
+		"ColorBurn", "HardLight", "SoftLight", "Difference", "Exclusion"
+	};
+	char res[512];
+	fz_buffer *buf;
+	int i, group;
+
+	for (i = 0; i < nelem(modes); i++)
+	{
+		sprintf(res, "/Type/XObject/Subtype/Form/BBox[0 0 612 792]/Group<</S/Transparency/I true>>/Resources<<%s>>>>", testpdf_alphas);
+		buf = testpdf_rects(ctx, pdf, 200, 1);
+		group = testpdf_stream(ctx, pdf, res, buf);
+		fz_drop_buffer(ctx, buf);
+		sprintf(res, "%s/GB<</BM/%s/ca 0.75>>>>/XObject<</X0 %d 0 R>>", testpdf_alphas, modes[i], group);
+		buf = testpdf_rects(ctx, pdf, 200, 1);
+		fz_buffer_printf(ctx, buf, "q /GB gs /X0 Do Q\n");
+		testpdf_page(ctx, pdf, res, buf);
+	}
+}
+
+/* full page axial and radial shadings (for FZ_REF_SHADE) */
+static void testdoc_shade(fz_context *ctx, testpdf *pdf)
+{
+	static const char *shadings[] = {
+		"/ShadingType 2/Coords[0 0 612 0]/Function %d 0 R",
+		"/ShadingType 2/Coords[100 100 500 700]/Function %d 0 R/Extend[true true]",
+		"/ShadingType 3/Coords[306 396 0 306 396 500]/Function %d 0 R",
+		"/ShadingType 3/Coords[150 150 20 450 600 250]/Function %d 0 R/Extend[true true]",
+	};
+	char res[512], dict[256];
+	fz_buffer *buf;
+	int i, func, shade;
+
+	func = testpdf_obj(ctx, pdf, 0);
+	fz_buffer_printf(ctx, pdf->buf, "<</FunctionType 3/Domain[0 1]/Bounds[0.4]/Encode[0 1 0 1]/Functions["
+		"<</FunctionType 2/Domain[0 1]/C0[1 0.9 0.2]/C1[0.8 0.1 0.3]/N 1>>"
+		"<</FunctionType 2/Domain[0 1]/C0[0.8 0.1 0.3]/C1[0.1 0.2 0.7]/N 2>>]>>\nendobj\n");
+
+	for (i = 0; i < nelem(shadings); i++)
+	{
+		sprintf(dict, shadings[i], func);
+		shade = testpdf_obj(ctx, pdf, 0);
+		fz_buffer_printf(ctx, pdf->buf, "<</ColorSpace/DeviceRGB%s>>\nendobj\n", dict);
+		sprintf(res, "/Shading<</Sh0 %d 0 R>>", shade);
+		buf = fz_new_buffer(ctx, 64);
+		fz_buffer_printf(ctx, buf, "/Sh0 sh\n");
+		testpdf_page(ctx, pdf, res, buf);
+	}
+}
+
+/* images painted through draw-affine.c: scans rotated by 3 degrees at
+ * several sizes (full page, reduced and at half opacity), in RGB and in
+ * gray, and a small image magnified upright and rotated */
+static void testdoc_affine(fz_context *ctx, testpdf *pdf)
+{
+	static const struct { int w, h, n; const char *cm; } pages[] = {
+		{ 1200, 1600, 3, "0.9986 0.0523 -0.0523 0.9986 20 0 cm 580 0 0 770 0 0 cm" },
+		{ 1200, 1600, 1, "0.9986 0.0523 -0.0523 0.9986 20 0 cm 580 0 0 770 0 0 cm" },
+		{ 1200, 1600, 3, "0.9986 0.0523 -0.0523 0.9986 100 100 cm 290 0 0 385 0 0 cm" },
+		{ 1200, 1600, 3, "/GS2 gs 0.9986 0.0523 -0.0523 0.9986 20 0 cm 580 0 0 770 0 0 cm" },
+		{ 160, 120, 3, "612 0 0 792 0 0 cm" },
+		{ 160, 120, 3, "0.9986 0.0523 -0.0523 0.9986 20 0 cm 580 0 0 770 0 0 cm" },
+	};
+	char res[512];
+	fz_buffer *buf;
+	int i;
+
+	for (i = 0; i < nelem(pages); i++)
+	{
+		sprintf(res, "%s>>/XObject<</Im0 %d 0 R>>", testpdf_alphas, testpdf_image(ctx, pdf, pages[i].w, pages[i].h, pages[i].n, NULL, 1));
+		buf = fz_new_buffer(ctx, 128);
+		fz_buffer_printf(ctx, buf, "q %s /Im0 Do Q\n", pages[i].cm);
+		testpdf_page(ctx, pdf, res, buf);
+	}
+}
+
+/* content streams that are expensive to lex but cheap to draw (for
+ * FZ_REF_LEX, best with -d): paths that aren't painted, with integers,
+ * reals and comments, and marked content with names, strings and hex
+ * strings */
+static void testdoc_syntax(fz_context *ctx, testpdf *pdf)
+{
+	fz_buffer *buf;
+	int i, k, p[4];
+
+	buf = fz_new_buffer(ctx, 1 << 20);
+	for (i = 0; i < 20000; i++)
+	{
+		for (k = 0; k < 4; k++)
+			p[k] = testpdf_random(pdf, 60000);
+		fz_buffer_printf(ctx, buf, "%d.%02d %d.%02d m %d %d l %d.%d %d.%d %d %d %d %d c h n %% path %d\n",
+			p[0] / 100, p[0] % 100, p[1] / 100, p[1] % 100, p[2] / 100, p[3] / 100,
+			p[1] / 100, p[2] % 100, p[2] / 100, p[3] % 10, p[3] / 100, p[0] / 100, p[1] / 100, p[2] / 100, i);
+	}
+	testpdf_page(ctx, pdf, "", buf);
+
+	buf = fz_new_buffer(ctx, 1 << 20);
+	for (i = 0; i < 10000; i++)
+	{
+		k = testpdf_random(pdf, 1000000);
+		fz_buffer_printf(ctx, buf, "/Span <</MCID %d /ActualText (Lorem ipsum dolor sit amet %d) /Alt <%08x%08x> /Lang /en#2DUS>> BDC EMC\n",
+			i, k, k, i);
+	}
+	testpdf_page(ctx, pdf, "", buf);
+}
+
+/* the span and glyph painters of draw-paint.c */
+static void testdoc_spans(fz_context *ctx, testpdf *pdf)
+{
+	char res[256];
+	fz_buffer *buf;
+	int group, mask;
+
+	/* solid and translucent color spans */
+	sprintf(res, "%s>>", testpdf_alphas);
+	testpdf_page(ctx, pdf, res, testpdf_rects(ctx, pdf, 500, 1));
+
+	/* pixmap spans: a knockout group painted with constant alpha and
+	 * then once more through a luminosity soft mask */
+	group = testpdf_stream(ctx, pdf, "/Type/XObject/Subtype/Form/BBox[0 0 612 792]/Group<</S/Transparency>>", testpdf_rects(ctx, pdf, 200, 0));
+	buf = fz_new_buffer(ctx, 256);
+	fz_buffer_printf(ctx, buf, "1 g 0 0 612 792 re f\n0 0 0 rg 100 100 412 592 re f\n");
+	mask = testpdf_stream(ctx, pdf, "/Type/XObject/Subtype/Form/BBox[0 0 612 792]/Group<</S/Transparency/CS/DeviceGray>>", buf);
+	fz_drop_buffer(ctx, buf);
+	sprintf(res, "%s/GSM<</SMask<</S/Luminosity/G %d 0 R>>>>>>/XObject<</X0 %d 0 R>>", testpdf_alphas, mask, group);
+	buf = fz_new_buffer(ctx, 256);
+	fz_buffer_printf(ctx, buf, "q /GS2 gs /X0 Do Q\nq /GSM gs 1 0 0 1 20 -30 cm /X0 Do Q\n");
+	testpdf_page(ctx, pdf, res, buf);
+
+	/* glyphs */
+	sprintf(res, "%s>>%s", testpdf_alphas, testpdf_font);
+	testpdf_page(ctx, pdf, res, testpdf_text(ctx, pdf, 300, 1, 0));
+}
+
+/* text dense pages, upright and rotated, for the glyph cache (try -T) */
+static void testdoc_text(fz_context *ctx, testpdf *pdf)
+{
+	int i;
+
+	for (i = 0; i < 8; i++)
+		testpdf_page(ctx, pdf, testpdf_font, testpdf_text(ctx, pdf, 600, 0, i & 1));
+}
+
+static const struct {
+	const char *name;
+	void (*create)(fz_context *ctx, testpdf *pdf);
+} testdocs[] = {
+	{ "spans", testdoc_spans },
+	{ "halftone", testdoc_halftone },
+	{ "scale", testdoc_scale },
+	{ "lineart", testdoc_lineart },
+	{ "text", testdoc_text },
+	{ "color", testdoc_color },
+	{ "blend", testdoc_blend },
+	{ "shade", testdoc_shade },
+	{ "affine", testdoc_affine },
+	{ "syntax", testdoc_syntax },
+};
+
+static fz_document *opendocument(fz_context *ctx, const char *name)
+{
+	testpdf pdf = { 0 };
+	fz_stream *stm = NULL;
+	fz_document *doc = NULL;
+	int i;
+
+	if (strncmp(name, "test:", 5) != 0)
+		return fz_open_document(ctx, name);
+
+	for (i = 0; i < nelem(testdocs); i++)
+		if (!strcmp(name + 5, testdocs[i].name))
+			break;
+	if (i == nelem(testdocs))
+		fz_throw(ctx, FZ_ERROR_GENERIC, "unknown test document: %s", name);
+
+	fz_var(stm);
+
+	pdf.buf = fz_new_buffer(ctx, 64 << 10);
+	pdf.next = 3;
+	pdf.seed = 1;
+	fz_try(ctx)
+	{
+		fz_buffer_printf(ctx, pdf.buf, "%%PDF-1.4\n");
+		testdocs[i].create(ctx, &pdf);
+		testpdf_finish(ctx, &pdf);
+		stm = fz_open_buffer(ctx, pdf.buf);
+		doc = fz_open_document_with_stream(ctx, "pdf", stm);
+	}
+	fz_always(ctx)
+	{
+		fz_close(stm);
+		fz_drop_buffer(ctx, pdf.buf);
+	}
+	fz_catch(ctx)
+	{
+		fz_rethrow(ctx);
+	}
+
+	return doc;
+}
+
+/* how much a rendering differs from a second one with other settings
+ * (and how long the second one took). As the first one might have been
+ * slowed down by reading resources, it is repeated after the second one
+ * and timed again. */
+struct pixdiff
+{
+	int max;
+	double total;
+	int differing;
+	int count;
+	double time;
+	double first;
+};
+
+static struct pixdiff aasummary;
+static struct pixdiff refsummary;
+static struct pixdiff htsummary;
+
+/* What drawing a page produced; reported in page order by reportpage.
+ * Times are in milliseconds: interpret is loading the page and creating
+ * its display list (without a display list, pages are interpreted while
+ * rasterizing), raster is drawing and post-processing the pixmap and
+ * encode is writing the image file. */
+typedef struct
+{
+	int pagenum;
+	int thread;
+	int done;
+	int errors;
+	double interpret, raster, encode, total;
+	int md5;
+	unsigned char digest[16];
+	struct pixdiff aadiff;
+	struct pixdiff refdiff;
+	struct pixdiff htdiff;
+} pagestat;
+
 #ifdef GDI_PLUS_BMP_RENDERER
-static void drawbmp(fz_context *ctx, fz_document *doc, fz_page *page, fz_display_list *list, int pagenum, fz_cookie *cookie)
+static void drawbmp(fz_context *ctx, fz_document *doc, fz_page *page, fz_display_list *list, int pagenum, fz_cookie *cookie, pagestat *stat)
 {
 	float zoom;
 	fz_matrix ctm;
@@ -401,13 +1018,9 @@ static void drawbmp(fz_context *ctx, fz_document *doc, fz_page *page, fz_display
 	if (showmd5)
 	{
 		fz_pixmap *pix = fz_new_pixmap_with_data(ctx, fz_device_bgr(ctx), bmp_data_len / 4 / h, h, bmp_data);
-		unsigned char digest[16];
-		int i;
 
-		fz_md5_pixmap(pix, digest);
-		printf(" ");
-		for (i = 0; i < 16; i++)
-			printf("%02x", digest[i]);
+		fz_md5_pixmap(pix, stat->digest);
+		stat->md5 = 1;
 
 		fz_drop_pixmap(ctx, pix);
 	}
@@ -416,22 +1029,189 @@ static void drawbmp(fz_context *ctx, fz_document *doc, fz_page *page, fz_display
 }
 #endif
 
-static void drawpage(fz_context *ctx, fz_document *doc, int pagenum)
+/* Render a page (band) once more into a new pixmap like pix and add
+ * the time this took to *time. */
+static fz_pixmap *redraw(fz_context *ctx, fz_document *doc, fz_page *page, fz_display_list *list,
+	const fz_matrix *ctm, const fz_rect *tbounds, fz_cookie *cookie,
+	fz_pixmap *pix, int savealpha, double *time)
+{
+	fz_pixmap *pix2;
+	fz_device *dev = NULL;
+	fz_irect bbox;
+	double start = gettime();
+
+	pix2 = fz_new_pixmap_with_bbox(ctx, pix->colorspace, fz_pixmap_bbox(ctx, pix, &bbox));
+	fz_try(ctx)
+	{
+		if (savealpha)
+			fz_clear_pixmap(ctx, pix2);
+		else
+			fz_clear_pixmap_with_value(ctx, pix2, 255);
+		dev = fz_new_draw_device(ctx, pix2);
+		if (list)
+			fz_run_display_list(list, dev, ctm, tbounds, cookie);
+		else
+			fz_run_page(doc, page, dev, ctm, cookie);
+	}
+	fz_always(ctx)
+	{
+		fz_free_device(dev);
+	}
+	fz_catch(ctx)
+	{
+		fz_drop_pixmap(ctx, pix2);
+		fz_rethrow(ctx);
+	}
+	*time += gettime() - start;
+
+	return pix2;
+}
+
+static void diffpix(fz_pixmap *pix, fz_pixmap *pix2, struct pixdiff *diff)
+{
+	int i, n = pix->w * pix->h * pix->n;
+
+	for (i = 0; i < n; i++)
+	{
+		int d = abs(pix->samples[i] - pix2->samples[i]);
+		if (d > diff->max)
+			diff->max = d;
+		if (d)
+			diff->differing++;
+		diff->total += d;
+	}
+	diff->count += n;
+}
+
+/* Render a page (band) again with the other antialiasing method and
+ * record how much the result differs from pix, then time the first
+ * method once more. */
+static void diffaa(fz_context *ctx, fz_document *doc, fz_page *page, fz_display_list *list,
+	const fz_matrix *ctm, const fz_rect *tbounds, fz_cookie *cookie,
+	fz_pixmap *pix, int savealpha, struct pixdiff *diff)
+{
+	fz_pixmap *pix2 = NULL;
+
+	fz_var(pix2);
+
+	fz_set_aa_analytic(ctx, !analytic);
+	fz_try(ctx)
+	{
+		pix2 = redraw(ctx, doc, page, list, ctm, tbounds, cookie, pix, savealpha, &diff->time);
+		diffpix(pix, pix2, diff);
+	}
+	fz_always(ctx)
+	{
+		fz_drop_pixmap(ctx, pix2);
+		fz_set_aa_analytic(ctx, analytic);
+	}
+	fz_catch(ctx)
+	{
+		fz_rethrow(ctx);
+	}
+
+	fz_drop_pixmap(ctx, redraw(ctx, doc, page, list, ctm, tbounds, cookie, pix, savealpha, &diff->first));
+}
+
+/* Halftone pix through the reference and the optimized code paths and
+ * record how much the resulting bitmaps differ (counting bytes). */
+static void diffhalftone(fz_context *ctx, fz_pixmap *pix, struct pixdiff *diff)
+{
+	fz_bitmap *bit = NULL, *bit2 = NULL;
+	double start;
+	int x, y, n;
+
+	fz_var(bit);
+	fz_var(bit2);
+
+	fz_try(ctx)
+	{
+		fz_set_reference_paths(ctx, refpaths);
+		start = gettime();
+		bit2 = fz_halftone_pixmap(ctx, pix, NULL);
+		diff->time += gettime() - start;
+		fz_set_reference_paths(ctx, 0);
+
+		start = gettime();
+		bit = fz_halftone_pixmap(ctx, pix, NULL);
+		diff->first += gettime() - start;
+
+		/* the padding at the end of the rows is left uninitialized */
+		n = (bit->w * bit->n + 7) >> 3;
+		for (y = 0; y < bit->h; y++)
+		{
+			for (x = 0; x < n; x++)
+			{
+				int d = abs(bit->samples[y * bit->stride + x] - bit2->samples[y * bit->stride + x]);
+				if (d > diff->max)
+					diff->max = d;
+				if (d)
+					diff->differing++;
+				diff->total += d;
+			}
+		}
+		diff->count += n * bit->h;
+	}
+	fz_always(ctx)
+	{
+		fz_set_reference_paths(ctx, 0);
+		fz_drop_bitmap(ctx, bit);
+		fz_drop_bitmap(ctx, bit2);
+	}
+	fz_catch(ctx)
+	{
+		fz_rethrow(ctx);
+	}
+}
+
+/* Render a page (band) again through the reference code paths and
+ * record how much the result differs from pix. Afterwards the optimized
+ * code paths are timed once more, as the first rendering might have
+ * been slowed down by reading resources (or sped up by cached ones).
+ * The store is emptied before both, so that images are decoded again. */
+static void diffref(fz_context *ctx, fz_document *doc, fz_page *page, fz_display_list *list,
+	const fz_matrix *ctm, const fz_rect *tbounds, fz_cookie *cookie,
+	fz_pixmap *pix, int savealpha, struct pixdiff *diff)
+{
+	fz_pixmap *pix2 = NULL;
+
+	fz_var(pix2);
+
+	fz_empty_store(ctx);
+	fz_set_reference_paths(ctx, refpaths);
+	fz_try(ctx)
+	{
+		pix2 = redraw(ctx, doc, page, list, ctm, tbounds, cookie, pix, savealpha, &diff->time);
+		diffpix(pix, pix2, diff);
+	}
+	fz_always(ctx)
+	{
+		fz_drop_pixmap(ctx, pix2);
+		fz_set_reference_paths(ctx, 0);
+	}
+	fz_catch(ctx)
+	{
+		fz_rethrow(ctx);
+	}
+
+	fz_empty_store(ctx);
+	fz_drop_pixmap(ctx, redraw(ctx, doc, page, list, ctm, tbounds, cookie, pix, savealpha, &diff->first));
+}
+
+static void drawpage(fz_context *ctx, fz_document *doc, int pagenum, pagestat *stat)
 {
 	fz_page *page;
 	fz_display_list *list = NULL;
 	fz_device *dev = NULL;
-	int start;
+	double start;
 	fz_cookie cookie = { 0 };
 	int needshot = 0;
 
 	fz_var(list);
 	fz_var(dev);
 
-	if (showtime)
-	{
-		start = gettime();
-	}
+	start = gettime();
+	stat->pagenum = pagenum;
 
 	fz_try(ctx)
 	{
@@ -568,6 +1348,8 @@ static void drawpage(fz_context *ctx, fz_document *doc, int pagenum)
 		}
 	}
 
+	stat->interpret = gettime() - start;
+
 	if (showxml)
 	{
 		fz_try(ctx)
@@ -638,9 +1420,6 @@ static void drawpage(fz_context *ctx, fz_document *doc, int pagenum)
 		}
 	}
 
-	if (showmd5 || showtime)
-		printf("page %s %d", filename, pagenum);
-
 	if (pdfout)
 	{
 		fz_matrix ctm;
@@ -735,10 +1514,10 @@ static void drawpage(fz_context *ctx, fz_document *doc, int pagenum)
 #ifdef GDI_PLUS_BMP_RENDERER
 	// hack: use -G0 to "enable GDI+" when saving as TGA
 	if (output_format == OUT_BMP || output_format == OUT_TGA && !gamma_value)
-		drawbmp(ctx, doc, page, list, pagenum, &cookie);
+		drawbmp(ctx, doc, page, list, pagenum, &cookie, stat);
 	else
 #endif
-	if ((output && output_format != OUT_SVG && !pdfout)|| showmd5 || showtime)
+	if ((output && output_format != OUT_SVG && !pdfout)|| showmd5 || showtime || showaadiff || refpaths || jsonfile)
 	{
 		float zoom;
 		fz_matrix ctm;
@@ -820,6 +1599,7 @@ static void drawpage(fz_context *ctx, fz_document *doc, int pagenum)
 			char filename_buf[512];
 			int totalheight = ibounds.y1 - ibounds.y0;
 			int drawheight = totalheight;
+			double t = gettime();
 
 			if (bandheight != 0)
 			{
@@ -852,9 +1632,11 @@ static void drawpage(fz_context *ctx, fz_document *doc, int pagenum)
 				else if (output_format == OUT_PNG)
 					poc = fz_output_png_header(output_file, pix->w, totalheight, pix->n, savealpha);
 			}
+			stat->encode += gettime() - t;
 
 			for (band = 0; band < bands; band++)
 			{
+				t = gettime();
 				if (savealpha)
 					fz_clear_pixmap(ctx, pix);
 				else
@@ -868,6 +1650,23 @@ static void drawpage(fz_context *ctx, fz_document *doc, int pagenum)
 				fz_free_device(dev);
 				dev = NULL;
 
+				if (showaadiff)
+				{
+					stat->raster += gettime() - t;
+					diffaa(ctx, doc, page, list, &ctm, &tbounds, &cookie, pix, savealpha, &stat->aadiff);
+					t = gettime();
+				}
+
+				if (refpaths)
+				{
+					stat->raster += gettime() - t;
+					diffref(ctx, doc, page, list, &ctm, &tbounds, &cookie, pix, savealpha, &stat->refdiff);
+					/* halftoned output (and any output for -X halftone) */
+					if (out_cs == CS_MONO || refpaths == FZ_REF_HALFTONE)
+						diffhalftone(ctx, pix, &stat->htdiff);
+					t = gettime();
+				}
+
 				if (invert)
 					fz_invert_pixmap(ctx, pix);
 				if (gamma_value != 1)
@@ -876,6 +1675,9 @@ static void drawpage(fz_context *ctx, fz_document *doc, int pagenum)
 				if (savealpha)
 					fz_unmultiply_pixmap(ctx, pix);
 
+				stat->raster += gettime() - t;
+				t = gettime();
+
 				if (output)
 				{
 					if (output_format == OUT_PGM || output_format == OUT_PPM || output_format == OUT_PNM)
@@ -925,22 +1727,20 @@ static void drawpage(fz_context *ctx, fz_document *doc, int pagenum)
 					else if (output_format == OUT_TGA)
 						fz_write_tga(ctx, pix, filename_buf, savealpha);
 				}
+				stat->encode += gettime() - t;
 				ctm.f -= drawheight;
 			}
 
 			if (showmd5)
 			{
-				unsigned char digest[16];
-				int i;
-
-				fz_md5_pixmap(pix, digest);
-				printf(" ");
-				for (i = 0; i < 16; i++)
-					printf("%02x", digest[i]);
+				fz_md5_pixmap(pix, stat->digest);
+				stat->md5 = 1;
 			}
 		}
 		fz_always(ctx)
 		{
+			double t = gettime();
+
 			if (output)
 			{
 				if (output_format == OUT_PNG)
@@ -952,6 +1752,7 @@ static void drawpage(fz_context *ctx, fz_document *doc, int pagenum)
 			fz_drop_pixmap(ctx, pix);
 			if (output_file)
 				fz_close_output(output_file);
+			stat->encode += gettime() - t;
 		}
 		fz_catch(ctx)
 		{
@@ -966,21 +1767,85 @@ static void drawpage(fz_context *ctx, fz_document *doc, int pagenum)
 
 	fz_free_page(doc, page);
 
+	stat->total = gettime() - start;
+	stat->errors = cookie.errors;
+	stat->done = 1;
+
+	if (showmemory)
+	{
+		fz_dump_glyph_cache_stats(ctx);
+	}
+
+	fz_flush_warnings(ctx);
+
+	if (mujstest_file && needshot)
+	{
+		fprintf(mujstest_file, "SCREENSHOT\n");
+	}
+}
+
+/* print the differences to the second rendering and add them to sum */
+static void reportdiff(const char *name, struct pixdiff *diff, struct pixdiff *sum)
+{
+	printf(" %s max %d mean %.3f differing %.2f%% %.1fms/%.1fms", name, diff->max,
+		diff->count ? diff->total / diff->count : 0,
+		diff->count ? 100.0 * diff->differing / diff->count : 0,
+		diff->first, diff->time);
+
+	if (diff->max > sum->max)
+		sum->max = diff->max;
+	sum->total += diff->total;
+	sum->differing += diff->differing;
+	sum->count += diff->count;
+	sum->time += diff->time;
+	sum->first += diff->first;
+}
+
+static void reportsummary(const char *what, struct pixdiff *sum, const char *first, const char *second)
+{
+	printf("%s: max difference %d, %d of %d samples differing\n", what, sum->max, sum->differing, sum->count);
+	printf("%s: %dms %s / %dms %s (%.2fx)\n", what, (int)sum->first, first, (int)sum->time, second,
+		sum->first > 0 ? sum->time / sum->first : 0);
+}
+
+static void reportpage(pagestat *stat)
+{
+	if (showmd5 || showtime || showaadiff || refpaths)
+		printf("page %s %d", filename, stat->pagenum);
+
+	if (stat->md5)
+	{
+		int i;
+
+		printf(" ");
+		for (i = 0; i < 16; i++)
+			printf("%02x", stat->digest[i]);
+	}
+
+	if (showaadiff)
+		reportdiff("aadiff", &stat->aadiff, &aasummary);
+
+	if (refpaths)
+	{
+		reportdiff("refdiff", &stat->refdiff, &refsummary);
+		if (stat->htdiff.count)
+			reportdiff("htdiff", &stat->htdiff, &htsummary);
+	}
+
 	if (showtime)
 	{
-		int end = gettime();
-		int diff = end - start;
+		int diff = (int)stat->total;
 
 		if (diff < timing.min)
 		{
 			timing.min = diff;
-			timing.minpage = pagenum;
+			timing.minpage = stat->pagenum;
 			timing.minfilename = filename;
 		}
 		if (diff > timing.max)
 		{
 			timing.max = diff;
-			timing.maxpage = pagenum;
+			timing.maxpage = stat->pagenum;
 			timing.maxfilename = filename;
 		}
 		timing.total += diff;
@@ -989,60 +1854,313 @@ static void drawpage(fz_context *ctx, fz_document *doc, int pagenum)
 		printf(" %dms", diff);
 	}
 
-	if (showmd5 || showtime)
+	if (showmd5 || showtime || showaadiff || refpaths)
 		printf("\n");
 
-	if (showmemory)
+	if (jsonfile)
 	{
-		fz_dump_glyph_cache_stats(ctx);
+		fprintf(jsonfile, "%s\n\t\t\t\t{ \"page\": %d, \"thread\": %d, \"interpret\": %.3f, \"raster\": %.3f, \"encode\": %.3f, \"total\": %.3f",
+			jsonpages ? "," : "", stat->pagenum, stat->thread,
+			stat->interpret, stat->raster, stat->encode, stat->total);
+		if (refpaths)
+			fprintf(jsonfile, ", \"raster_optimized\": %.3f, \"raster_reference\": %.3f, \"refdiff_max\": %d, \"refdiff_differing\": %d",
+				stat->refdiff.first, stat->refdiff.time, stat->refdiff.max, stat->refdiff.differing);
+		if (refpaths && stat->htdiff.count)
+			fprintf(jsonfile, ", \"halftone_optimized\": %.3f, \"halftone_reference\": %.3f, \"htdiff_differing\": %d",
+				stat->htdiff.first, stat->htdiff.time, stat->htdiff.differing);
+		fprintf(jsonfile, " }");
+		jsonpages++;
+		jsonpagecount++;
 	}
 
-	fz_flush_warnings(ctx);
+	if (stat->errors)
+		errored = 1;
+}
 
-	if (mujstest_file && needshot)
+static void addstorestats(fz_context *ctx)
+{
+	int i;
+
+	for (i = 0; i < FZ_STORE_CLASS_COUNT; i++)
 	{
-		fprintf(mujstest_file, "SCREENSHOT\n");
+		fz_store_stats stats;
+
+		fz_get_store_stats(ctx, i, &stats);
+		storestats[i].hits += stats.hits;
+		storestats[i].misses += stats.misses;
+		storestats[i].evictions += stats.evictions;
 	}
+}
 
-	if (cookie.errors)
-		errored = 1;
+/*
+	SumatraPDF: parallel rendering (-T)
+
+	Every thread gets its own context and opens its own instance of the
+	document. The contexts are created with fz_new_context rather than
+	fz_clone_context, so that they don't share a store: store keys for
+	PDF objects don't tell documents apart and are dropped on eviction
+	without holding a lock. They do share the allocator and the locks
+	that guard it (and the memory tracing). Contexts are created and
+	freed on the main thread, as that isn't done under a lock.
+*/
+
+#ifdef _WIN32
+typedef CRITICAL_SECTION mu_mutex;
+typedef HANDLE mu_thread;
+
+static void mu_mutex_init(mu_mutex *m) { InitializeCriticalSection(m); }
+static void mu_mutex_fin(mu_mutex *m) { DeleteCriticalSection(m); }
+static void mu_mutex_lock(mu_mutex *m) { EnterCriticalSection(m); }
+static void mu_mutex_unlock(mu_mutex *m) { LeaveCriticalSection(m); }
+#else
+typedef pthread_mutex_t mu_mutex;
+typedef pthread_t mu_thread;
+
+static void mu_mutex_init(mu_mutex *m) { pthread_mutex_init(m, NULL); }
+static void mu_mutex_fin(mu_mutex *m) { pthread_mutex_destroy(m); }
+static void mu_mutex_lock(mu_mutex *m) { pthread_mutex_lock(m); }
+static void mu_mutex_unlock(mu_mutex *m) { pthread_mutex_unlock(m); }
+#endif
+
+static mu_mutex mutexes[FZ_LOCK_MAX];
+
+static void lock_mutex(void *user, int lock)
+{
+	mu_mutex_lock(&((mu_mutex *)user)[lock]);
+}
+
+static void unlock_mutex(void *user, int lock)
+{
+	mu_mutex_unlock(&((mu_mutex *)user)[lock]);
+}
+
+static fz_locks_context locks = { mutexes, lock_mutex, unlock_mutex };
+
+typedef struct
+{
+	char *password;
+	int *pages;
+	pagestat *stats;
+	int count;
+	mu_mutex mutex; /* guards next and failed */
+	int next;
+	int failed;
+} drawjob;
+
+typedef struct
+{
+	drawjob *job;
+	int id;
+	fz_context *ctx;
+	mu_thread thread;
+} drawthread;
+
+static int nextpage(drawjob *job)
+{
+	int i = -1;
+
+	mu_mutex_lock(&job->mutex);
+	if (!job->failed && job->next < job->count)
+		i = job->next++;
+	mu_mutex_unlock(&job->mutex);
+
+	return i;
+}
+
+static void drawworker(drawthread *me)
+{
+	drawjob *job = me->job;
+	fz_context *ctx = me->ctx;
+	fz_document *doc = NULL;
+	int i;
+
+	fz_var(doc);
+
+	fz_try(ctx)
+	{
+		doc = opendocument(ctx, filename);
+		if (fz_needs_password(doc) && !fz_authenticate_password(doc, job->password))
+			fz_throw(ctx, FZ_ERROR_GENERIC, "cannot authenticate password: %s", filename);
+
+		while ((i = nextpage(job)) >= 0)
+		{
+			job->stats[i].thread = me->id;
+			drawpage(ctx, doc, job->pages[i], &job->stats[i]);
+		}
+	}
+	fz_always(ctx)
+	{
+		fz_close_document(doc);
+	}
+	fz_catch(ctx)
+	{
+		mu_mutex_lock(&job->mutex);
+		job->failed = 1;
+		mu_mutex_unlock(&job->mutex);
+	}
+}
+
+#ifdef _WIN32
+static DWORD WINAPI drawthread_start(LPVOID me)
+{
+	drawworker(me);
+	return 0;
+}
+
+static int mu_thread_start(drawthread *me)
+{
+	me->thread = CreateThread(NULL, 0, drawthread_start, me, 0, NULL);
+	return me->thread != NULL;
+}
+
+static void mu_thread_join(drawthread *me)
+{
+	WaitForSingleObject(me->thread, INFINITE);
+	CloseHandle(me->thread);
+}
+#else
+static void *drawthread_start(void *me)
+{
+	drawworker(me);
+	return NULL;
+}
+
+static int mu_thread_start(drawthread *me)
+{
+	return pthread_create(&me->thread, NULL, drawthread_start, me) == 0;
+}
+
+static void mu_thread_join(drawthread *me)
+{
+	pthread_join(me->thread, NULL);
+}
+#endif
+
+static void drawthreaded(fz_context *ctx, int *pages, int count, char *password)
+{
+	drawjob job = { 0 };
+	drawthread *workers = NULL;
+	int i, n, started;
+
+	fz_var(workers);
+
+	job.password = password;
+	job.pages = pages;
+	job.count = count;
+
+	fz_try(ctx)
+	{
+		job.stats = fz_calloc(ctx, count, sizeof(pagestat));
+		workers = fz_calloc(ctx, threads, sizeof(drawthread));
+	}
+	fz_catch(ctx)
+	{
+		fz_free(ctx, job.stats);
+		fz_rethrow(ctx);
+	}
+
+	for (n = 0; n < threads && n < count; n++)
+	{
+		workers[n].job = &job;
+		workers[n].id = n;
+		workers[n].ctx = fz_new_context(ctx->alloc, ctx->locks, FZ_STORE_DEFAULT);
+		if (!workers[n].ctx)
+			break;
+		fz_set_aa_level(workers[n].ctx, alphabits);
+		fz_set_aa_analytic(workers[n].ctx, analytic);
+	}
+
+	mu_mutex_init(&job.mutex);
+	for (started = 0; started < n; started++)
+		if (!mu_thread_start(&workers[started]))
+			break;
+	for (i = 0; i < started; i++)
+		mu_thread_join(&workers[i]);
+	mu_mutex_fin(&job.mutex);
+
+	for (i = 0; i < n; i++)
+	{
+		addstorestats(workers[i].ctx);
+		fz_free_context(workers[i].ctx);
+	}
+
+	/* report the pages in order, up to the first one that failed */
+	for (i = 0; i < count && job.stats[i].done; i++)
+		reportpage(&job.stats[i]);
+
+	fz_free(ctx, job.stats);
+	fz_free(ctx, workers);
+
+	if (started == 0)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "cannot create threads");
+	if (job.failed)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "cannot draw page %d in file '%s'", pages[i < count ? i : count - 1], filename);
 }
 
-static void drawrange(fz_context *ctx, fz_document *doc, char *range)
+static void drawrange(fz_context *ctx, fz_document *doc, char *range, char *password)
 {
 	int page, spage, epage, pagecount;
 	char *spec, *dash;
+	int *pages = NULL;
+	int count = 0, i;
+
+	fz_var(pages);
 
 	pagecount = fz_count_pages(doc);
-	spec = fz_strsep(&range, ",");
-	while (spec)
+
+	fz_try(ctx)
 	{
-		dash = strchr(spec, '-');
+		spec = fz_strsep(&range, ",");
+		while (spec)
+		{
+			dash = strchr(spec, '-');
 
-		if (dash == spec)
-			spage = epage = pagecount;
-		else
-			spage = epage = atoi(spec);
+			if (dash == spec)
+				spage = epage = pagecount;
+			else
+				spage = epage = atoi(spec);
 
-		if (dash)
-		{
-			if (strlen(dash) > 1)
-				epage = atoi(dash + 1);
+			if (dash)
+			{
+				if (strlen(dash) > 1)
+					epage = atoi(dash + 1);
+				else
+					epage = pagecount;
+			}
+
+			spage = fz_clampi(spage, 1, pagecount);
+			epage = fz_clampi(epage, 1, pagecount);
+
+			pages = fz_resize_array(ctx, pages, count + fz_absi(epage - spage) + 1, sizeof(int));
+			if (spage < epage)
+				for (page = spage; page <= epage; page++)
+					pages[count++] = page;
 			else
-				epage = pagecount;
-		}
+				for (page = spage; page >= epage; page--)
+					pages[count++] = page;
 
-		spage = fz_clampi(spage, 1, pagecount);
-		epage = fz_clampi(epage, 1, pagecount);
+			spec = fz_strsep(&range, ",");
+		}
 
-		if (spage < epage)
-			for (page = spage; page <= epage; page++)
-				drawpage(ctx, doc, page);
+		if (threads > 1)
+			drawthreaded(ctx, pages, count, password);
 		else
-			for (page = spage; page >= epage; page--)
-				drawpage(ctx, doc, page);
-
-		spec = fz_strsep(&range, ",");
+		{
+			for (i = 0; i < count; i++)
+			{
+				pagestat stat = { 0 };
+				drawpage(ctx, doc, pages[i], &stat);
+				reportpage(&stat);
+			}
+		}
+	}
+	fz_always(ctx)
+	{
+		fz_free(ctx, pages);
+	}
+	fz_catch(ctx)
+	{
+		fz_rethrow(ctx);
 	}
 }
 
@@ -1086,6 +2204,21 @@ parse_colorspace(const char *name)
 	return -1;
 }
 
+static int
+parse_refpaths(const char *name)
+{
+	int i;
+
+	for (i = 0; i < nelem(refpaths_name_table); i++)
+	{
+		if (!strcmp(name, refpaths_name_table[i].name))
+			return refpaths_name_table[i].paths;
+	}
+	fprintf(stderr, "Unknown reference code paths \"%s\"\n", name);
+	exit(1);
+	return 0;
+}
+
 static void *
 trace_malloc(void *arg, unsigned int size)
 {
@@ -1147,10 +2280,11 @@ int main(int argc, char **argv)
 	int c;
 	fz_context *ctx;
 	fz_alloc_context alloc_ctx = { NULL, trace_malloc, trace_realloc, trace_free };
+	double start;
 
 	fz_var(doc);
 
-	while ((c = fz_getopt(argc, argv, "lo:F:p:r:R:b:c:dgmtx5G:Iw:h:fij:MB:")) != -1)
+	while ((c = fz_getopt(argc, argv, "lo:F:p:r:R:b:ADX:c:dgmtx5G:Iw:h:fij:MB:T:J:")) != -1)
 	{
 		switch (c)
 		{
@@ -1160,6 +2294,9 @@ int main(int argc, char **argv)
 		case 'r': resolution = atof(fz_optarg); res_specified = 1; break;
 		case 'R': rotation = atof(fz_optarg); break;
 		case 'b': alphabits = atoi(fz_optarg); break;
+		case 'A': analytic = 1; break;
+		case 'D': showaadiff++; break;
+		case 'X': refpaths = parse_refpaths(fz_optarg); break;
 		case 'B': bandheight = atoi(fz_optarg); break;
 		case 'l': showoutline++; break;
 		case 'm': showtime++; break;
@@ -1177,6 +2314,8 @@ int main(int argc, char **argv)
 		case 'I': invert++; break;
 		case 'j': mujstest_filename = fz_optarg; break;
 		case 'i': ignore_errors = 1; break;
+		case 'T': threads = atoi(fz_optarg); break;
+		case 'J': jsonfilename = fz_optarg; break;
 		default: usage(); break;
 		}
 	}
@@ -1184,7 +2323,7 @@ int main(int argc, char **argv)
 	if (fz_optind == argc)
 		usage();
 
-	if (!showtext && !showxml && !showtime && !showmd5 && !showoutline && !output && !mujstest_filename)
+	if (!showtext && !showxml && !showtime && !showmd5 && !showaadiff && !refpaths && !showoutline && !output && !mujstest_filename && !jsonfilename)
 	{
 		printf("nothing to do\n");
 		exit(0);
@@ -1198,7 +2337,30 @@ int main(int argc, char **argv)
 			mujstest_file = fopen(mujstest_filename, "wb");
 	}
 
-	ctx = fz_new_context((showmemory == 0 ? NULL : &alloc_ctx), NULL, FZ_STORE_DEFAULT);
+	if (jsonfilename)
+	{
+		if (strcmp(jsonfilename, "-") == 0)
+			jsonfile = stdout;
+		else
+			jsonfile = fopen(jsonfilename, "w");
+		if (!jsonfile)
+		{
+			fprintf(stderr, "cannot open file '%s': %s\n", jsonfilename, strerror(errno));
+			exit(1);
+		}
+	}
+
+	/* the worker threads share the allocator and its locks */
+	if (threads > 1)
+	{
+		int i;
+		for (i = 0; i < FZ_LOCK_MAX; i++)
+			mu_mutex_init(&mutexes[i]);
+	}
+
+	start = gettime();
+
+	ctx = fz_new_context((showmemory == 0 && !jsonfile ? NULL : &alloc_ctx), (threads > 1 ? &locks : NULL), FZ_STORE_DEFAULT);
 	if (!ctx)
 	{
 		fprintf(stderr, "cannot initialise context\n");
@@ -1206,6 +2368,7 @@ int main(int argc, char **argv)
 	}
 
 	fz_set_aa_level(ctx, alphabits);
+	fz_set_aa_analytic(ctx, analytic);
 
 	/* Determine output type */
 	if (bandheight < 0)
@@ -1266,6 +2429,32 @@ int main(int argc, char **argv)
 
 	}
 
+	if (threads > 1)
+	{
+		if (showtext || showxml || mujstest_filename || output_format == OUT_PDF || output_format == OUT_PWG || output_format == OUT_PCL)
+		{
+			fprintf(stderr, "Parallel rendering only possible with image and SVG outputs\n");
+			exit(1);
+		}
+#ifdef GDI_PLUS_BMP_RENDERER
+		if (output_format == OUT_BMP || output_format == OUT_TGA && !gamma_value)
+		{
+			fprintf(stderr, "Parallel rendering not compatible with GDI+\n");
+			exit(1);
+		}
+#endif
+		if (output && (!strcmp(output, "-") || !strstr(output, "%d")))
+		{
+			fprintf(stderr, "Parallel rendering needs the page number (%%d) in the output filename\n");
+			exit(1);
+		}
+		if (refpaths)
+		{
+			fprintf(stderr, "Parallel rendering not compatible with reference code paths\n");
+			exit(1);
+		}
+	}
+
 	{
 		int i, j;
 
@@ -1320,6 +2509,9 @@ int main(int argc, char **argv)
 	timing.minfilename = "";
 	timing.maxfilename = "";
 
+	if (jsonfile)
+		fprintf(jsonfile, "{\n\t\"threads\": %d,\n\t\"files\": [", threads > 1 ? threads : 1);
+
 	if (showxml || showtext)
 		out = fz_new_output_with_file(ctx, stdout);
 
@@ -1354,7 +2546,7 @@ int main(int argc, char **argv)
 
 				fz_try(ctx)
 				{
-					doc = fz_open_document(ctx, filename);
+					doc = opendocument(ctx, filename);
 				}
 				fz_catch(ctx)
 				{
@@ -1380,12 +2572,27 @@ int main(int argc, char **argv)
 				if (showoutline)
 					drawoutline(ctx, doc);
 
-				if (showtext || showxml || showtime || showmd5 || output || mujstest_file)
+				if (jsonfile)
+				{
+					fprintf(jsonfile, "%s\n\t\t{\n\t\t\t\"name\": ", jsonfiles ? "," : "");
+					json_string(jsonfile, filename);
+					fprintf(jsonfile, ",\n\t\t\t\"pages\": [");
+					jsonfiles++;
+					jsonpages = 0;
+				}
+
+				if (showtext || showxml || showtime || showmd5 || showaadiff || refpaths || output || mujstest_file || jsonfile)
 				{
 					if (fz_optind == argc || !isrange(argv[fz_optind]))
-						drawrange(ctx, doc, "1-");
+						drawrange(ctx, doc, "1-", password);
 					if (fz_optind < argc && isrange(argv[fz_optind]))
-						drawrange(ctx, doc, argv[fz_optind++]);
+						drawrange(ctx, doc, argv[fz_optind++], password);
+				}
+
+				if (jsonfile)
+				{
+					fprintf(jsonfile, "\n\t\t\t]\n\t\t}");
+					jsonpages = -1;
 				}
 
 				if (showxml || showtext == TEXT_XML)
@@ -1402,6 +2609,12 @@ int main(int argc, char **argv)
 				fz_close_document(doc);
 				doc = NULL;
 				fz_warn(ctx, "ignoring error in '%s'", filename);
+
+				if (jsonfile && jsonpages >= 0)
+				{
+					fprintf(jsonfile, "\n\t\t\t]\n\t\t}");
+					jsonpages = -1;
+				}
 			}
 		}
 	}
@@ -1453,6 +2666,48 @@ int main(int argc, char **argv)
 			printf("fastest page %d: %dms (%s)\n", timing.minpage, timing.min, timing.minfilename);
 			printf("slowest page %d: %dms (%s)\n", timing.maxpage, timing.max, timing.maxfilename);
 		}
+		if (threads > 1)
+			printf("elapsed %dms using %d threads\n", (int)(gettime() - start), threads);
+	}
+
+	if (aasummary.count > 0)
+		reportsummary("antialiasing", &aasummary, analytic ? "analytic" : "supersampled", analytic ? "supersampled" : "analytic");
+	if (refsummary.count > 0)
+		reportsummary("rasterizing", &refsummary, "optimized", "reference");
+	if (htsummary.count > 0)
+		reportsummary("halftoning", &htsummary, "optimized", "reference");
+
+	if (jsonfile)
+	{
+		static const char *class_names[FZ_STORE_CLASS_COUNT] = { "resource", "pixmap", "tile" };
+		int hits = 0, misses = 0, i;
+		double elapsed = gettime() - start;
+
+		addstorestats(ctx);
+		for (i = 0; i < FZ_STORE_CLASS_COUNT; i++)
+		{
+			hits += storestats[i].hits;
+			misses += storestats[i].misses;
+		}
+
+		if (jsonpages >= 0)
+			fprintf(jsonfile, "\n\t\t\t]\n\t\t}");
+		fprintf(jsonfile, "\n\t],\n");
+		fprintf(jsonfile, "\t\"pages\": %d,\n", jsonpagecount);
+		fprintf(jsonfile, "\t\"time\": %.3f,\n", elapsed);
+		fprintf(jsonfile, "\t\"pages_per_second\": %.3f,\n", elapsed > 0 ? jsonpagecount * 1000 / elapsed : 0);
+		fprintf(jsonfile, "\t\"peak_memory\": %d,\n", memtrace_peak);
+		fprintf(jsonfile, "\t\"store\": {\n");
+		fprintf(jsonfile, "\t\t\"hits\": %d, \"misses\": %d, \"hit_rate\": %.3f,\n",
+			hits, misses, hits + misses ? (double)hits / (hits + misses) : 0);
+		for (i = 0; i < FZ_STORE_CLASS_COUNT; i++)
+			fprintf(jsonfile, "\t\t\"%s\": { \"hits\": %d, \"misses\": %d, \"evictions\": %d }%s\n",
+				class_names[i], storestats[i].hits, storestats[i].misses, storestats[i].evictions,
+				i + 1 < FZ_STORE_CLASS_COUNT ? "," : "");
+		fprintf(jsonfile, "\t}\n}\n");
+
+		if (jsonfile != stdout)
+			fclose(jsonfile);
 	}
 
 	if (mujstest_file && mujstest_file != stdout)
@@ -1460,6 +2715,13 @@ int main(int argc, char **argv)
 
 	fz_free_context(ctx);
 
+	if (threads > 1)
+	{
+		int i;
+		for (i = 0; i < FZ_LOCK_MAX; i++)
+			mu_mutex_fin(&mutexes[i]);
+	}
+
 	if (showmemory)
 	{
 		printf("Total memory use = %d bytes\n", memtrace_total);
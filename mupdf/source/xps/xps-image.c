@@ -131,6 +131,7 @@ static fz_store_type xps_image_store_type =
 	fz_keep_storable,
 	fz_drop_storable,
 	xps_cmp_image_key,
+	FZ_STORE_CLASS_RESOURCE,
 #ifndef NDEBUG
 	xps_debug_image
 #endif
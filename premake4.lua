@@ -129,6 +129,7 @@ solution "all_tests"
       "src/utils/StrFormat*",
       "src/utils/StrUtil*",
       "src/utils/SquareTreeParser*",
+      "src/utils/ThumbnailCache*",
       "src/utils/TrivialHtmlParser*",
       "src/utils/UtAssert*",
       "src/utils/VarintGob*",
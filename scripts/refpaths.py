@@ -0,0 +1,84 @@
+"""
+Checks MuPDF's optimized code paths against their reference implementation.
+
+Renders mudraw's built-in test documents with mudraw -X, which draws every
+page through both the optimized and the reference code paths (see
+FZ_REF_* in fitz/context.h), and fails if any page differs by more than
+the tolerance given for that code path below.
+
+Usage:
+refpaths.py [path/to/mudraw.exe]
+
+The exit code is 0 if all pages are within tolerance and 1 otherwise.
+"""
+
+import os, sys, re
+from subprocess import Popen, PIPE, STDOUT
+
+TEST_DOCS = ["spans", "halftone", "scale", "lineart", "text", "color", "blend", "shade", "affine", "syntax"]
+
+# (-X argument, additional mudraw arguments, maximum difference of a sample,
+#  maximum mean difference of a page)
+CHECKS = [
+    # these must produce identical output
+    ("simd", [], 0, 0),
+    ("halftone", [], 0, 0),
+    ("lex", [], 0, 0),
+    # single line segments are only painted directly with analytic
+    # antialiasing, which computes the same coverage up to rounding
+    ("stroke", [], 0, 0),
+    ("stroke", ["-A"], 4, 0.5),
+    # large images are interpolated from a sampled conversion
+    ("color", [], 1, 0.5),
+    # meshes only approximate circles and don't antialias their edges,
+    # so single samples along the edges may differ completely
+    ("shade", [], 255, 0.5),
+]
+
+PAGE_RE = re.compile(r"^page (\S+) (\d+) (.*)$")
+DIFF_RE = re.compile(r"(refdiff|htdiff) max (\d+) mean ([0-9.]+)")
+
+def check_name(refpaths, args):
+    return " ".join(["-X", refpaths] + args)
+
+def default_mudraw():
+    for cfg in ["obj-rel", "obj-dbg"]:
+        p = os.path.join(cfg, "mudraw.exe")
+        if os.path.exists(p):
+            return p
+    return "mudraw"
+
+# returns a list of error strings (empty if all pages are within tolerance)
+def run_check(mudraw, refpaths, args, max_diff, max_mean):
+    cmd = [mudraw, "-X", refpaths, "-o", os.devnull] + args + ["test:" + doc for doc in TEST_DOCS]
+    proc = Popen(cmd, stdout=PIPE, stderr=STDOUT, universal_newlines=True)
+    out, _ = proc.communicate()
+    if proc.returncode != 0:
+        return ["%s failed with exit code %d:\n%s" % (" ".join(cmd), proc.returncode, out)]
+    errors, pages = [], 0
+    for line in out.splitlines():
+        m = PAGE_RE.match(line)
+        if not m:
+            continue
+        for kind, diff, mean in DIFF_RE.findall(m.group(3)):
+            pages += 1
+            if int(diff) > max_diff or float(mean) > max_mean:
+                errors.append("%s: page %s %s: %s max %s mean %s (allowed: max %d mean %g)" % (check_name(refpaths, args), m.group(1), m.group(2), kind, diff, mean, max_diff, max_mean))
+    if pages == 0:
+        errors.append("%s: no page comparisons in output:\n%s" % (check_name(refpaths, args), out))
+    return errors
+
+def main():
+    mudraw = sys.argv[1] if len(sys.argv) > 1 else default_mudraw()
+    errors = []
+    for (refpaths, args, max_diff, max_mean) in CHECKS:
+        res = run_check(mudraw, refpaths, args, max_diff, max_mean)
+        print("%s: %s" % (check_name(refpaths, args), "failed" if res else "ok"))
+        errors += res
+    if errors:
+        sys.stderr.write("\n".join(errors) + "\n")
+        sys.exit(1)
+    print("All reference path checks passed!")
+
+if __name__ == "__main__":
+    main()
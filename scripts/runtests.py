@@ -11,6 +11,8 @@ The conventions are:
    one or more tests failed. Additionally, stderr might contain
    an error message pin-pointing the problem. stderr is used by
    buildbot. stdout can be used for interactive use
+ - finally, mudraw.exe is built and scripts/refpaths.py compares
+   MuPDF's optimized code paths against their reference implementation
 """
 import os, util
 
@@ -90,10 +92,24 @@ def run_tests2():
             return "%s failed to run" % f
     return None
 
+# returns None if MuPDF's optimized code paths match their reference
+# implementation (see scripts/refpaths.py) or an error string otherwise
+def run_refpaths():
+    try:
+        (out, err, errcode) = util.run_cmd("nmake", "-f", "makefile.msvc", "CFG=rel", "refpaths")
+        if errcode != 0:
+            return "reference path check failed:\n" + fmt_out_err(out, err)
+    except:
+        return "nmake.exe not found"
+    print(fmt_out_err(out, err))
+    return None
+
 def run_tests():
     d = os.getcwd()
     res = run_tests2()
     os.chdir(d)
+    if res == None:
+        res = run_refpaths()
     return res
 
 def main():
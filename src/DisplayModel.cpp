@@ -33,8 +33,10 @@
   We calculate the canvas size and position of each page we display on the
   canvas.
 
-  Changing zoom level or rotation requires recalculation of canvas size and
-  position of pages in it.
+  Changing rotation or the pages to display requires recalculation of the
+  rows and columns the pages are laid out in. Changing zoom level only
+  requires scaling these rows to recalculate the canvas size (the position
+  of a page in it is derived from its row and column when needed).
 
   We keep the offset of view port relative to canvas. The offset changes
   due to scrolling (with keys or using scrollbars).
@@ -190,10 +192,13 @@ DisplayModel::DisplayModel(BaseEngine *engine, DocType engineType, DisplayModelC
     rotation(0), dpiFactor(1.0f), displayR2L(false),
     presentationMode(false), presZoomVirtual(INVALID_ZOOM),
     presDisplayMode(DM_AUTOMATIC), navHistoryIx(0),
-    dontRenderFlag(false)
+    layoutRows(0), layoutRotation(0), dontRenderFlag(false)
 {
     CrashIf(!engine || engine->PageCount() <= 0);
 
+    columnMaxDx[0] = columnMaxDx[1] = 0;
+    columnMaxWidth[0] = columnMaxWidth[1] = 0;
+
     if (!engine->IsImageCollection()) {
         windowMargin = gGlobalPrefs->fixedPageUI.windowMargin;
         pageSpacing = gGlobalPrefs->fixedPageUI.pageSpacing;
@@ -236,6 +241,52 @@ PageInfo *DisplayModel::GetPageInfo(int pageNo) const
     return &(pagesInfo[pageNo-1]);
 }
 
+RectI DisplayModel::PagePos(int pageNo) const
+{
+    PageInfo *pageInfo = GetPageInfo(pageNo);
+    // pages don't have a position before the first layout
+    if (!pageInfo || INVALID_ZOOM == zoomReal)
+        return RectI();
+
+    SizeD pageSize = engine->Transform(pageInfo->page, pageNo, 1.0, rotation).Size();
+    RectI pos;
+    // don't add the full 0.5 for rounding to account for precision errors
+    pos.dx = (int)(pageSize.dx * zoomReal + 0.499);
+    pos.dy = (int)(pageSize.dy * zoomReal + 0.499);
+    if (!PageShown(pageNo) || 0 == layoutRuns.Count())
+        return pos;
+
+    DisplayMode mode = GetDisplayMode();
+    int columns = ColumnsFromDisplayMode(mode);
+    int row = (pageNo - LayoutStartPage()) / columns;
+    int column = (pageNo - LayoutStartPage()) % columns;
+    const LayoutRun& run = layoutRuns.At(FindLayoutRun(row));
+    pos.y = layoutOffset.y + run.y + (row - run.firstRow) * (run.dy + pageSpacing.dy);
+
+    // center pages in a single column but right/left align them when using two columns
+    if (1 == columns)
+        pos.x = layoutOffset.x + (columnMaxWidth[0] - pos.dx) / 2;
+    else if (0 == column)
+        pos.x = layoutOffset.x + columnMaxWidth[0] - pos.dx;
+    else
+        pos.x = layoutOffset.x + columnMaxWidth[0] + pageSpacing.dx;
+    // center the cover page over the first two spots in non-continuous mode
+    if (DisplayModeShowCover(mode) && pageNo == 1 && !IsContinuous(mode))
+        pos.x = layoutOffset.x + (columnMaxWidth[0] + pageSpacing.dx + columnMaxWidth[1] - pos.dx) / 2;
+    // mirror the page layout when displaying a Right-to-Left document
+    if (displayR2L && columns > 1)
+        pos.x = canvasSize.dx - pos.x - pos.dx;
+
+    return pos;
+}
+
+RectI DisplayModel::PageOnScreen(int pageNo) const
+{
+    RectI pageOnScreen = PagePos(pageNo);
+    pageOnScreen.Offset(-viewPort.x, -viewPort.y);
+    return pageOnScreen;
+}
+
 // Call this before the first Relayout
 void DisplayModel::SetInitialViewSettings(DisplayMode newDisplayMode, int newStartPage, SizeI viewPort, int screenDPI)
 {
@@ -261,8 +312,10 @@ void DisplayModel::SetInitialViewSettings(DisplayMode newDisplayMode, int newSta
         }
     }
     displayR2L = (layout & Layout_R2L) != 0;
-    if (!AsChmEngine())
+    if (!AsChmEngine()) {
         BuildPagesInfo();
+        BuildLayout();
+    }
 }
 
 void DisplayModel::BuildPagesInfo()
@@ -279,10 +332,6 @@ void DisplayModel::BuildPagesInfo()
     else // imperial letter size
         defaultRect = RectD(0, 0, 8.5 * engine->GetFileDPI(), 11 * engine->GetFileDPI());
 
-    int columns = ColumnsFromDisplayMode(displayMode);
-    int newStartPage = startPage;
-    if (DisplayModeShowCover(displayMode) && newStartPage == 1 && columns > 1)
-        newStartPage--;
     for (int pageNo = 1; pageNo <= pageCount; pageNo++) {
         PageInfo *pageInfo = GetPageInfo(pageNo);
         pageInfo->page = engine->PageMediabox(pageNo);
@@ -290,22 +339,37 @@ void DisplayModel::BuildPagesInfo()
         if (pageInfo->page.IsEmpty())
             pageInfo->page = defaultRect;
         pageInfo->visibleRatio = 0.0;
-        pageInfo->shown = false;
-        if (IsContinuous(displayMode))
-            pageInfo->shown = true;
-        else if (newStartPage <= pageNo && pageNo < newStartPage + columns)
-            pageInfo->shown = true;
     }
 }
 
+/* Return the number of the page in the first column of the first row of shown
+   pages (0 for the empty spot left of the cover page in show cover mode).
+   In continuous mode all pages are shown, else a single row starting at startPage. */
+int DisplayModel::LayoutStartPage() const
+{
+    DisplayMode mode = GetDisplayMode();
+    int firstPageNo = IsContinuous(mode) ? 1 : startPage;
+    if (DisplayModeShowCover(mode) && firstPageNo == 1 && ColumnsFromDisplayMode(mode) > 1)
+        firstPageNo--;
+    return firstPageNo;
+}
+
+int DisplayModel::LastShownPageNo() const
+{
+    DisplayMode mode = GetDisplayMode();
+    if (IsContinuous(mode))
+        return PageCount();
+    return min(LayoutStartPage() + ColumnsFromDisplayMode(mode) - 1, PageCount());
+}
+
 // TODO: a better name e.g. ShouldShow() to better distinguish between
 // before-layout info and after-layout visibility checks
-bool DisplayModel::PageShown(int pageNo)
+bool DisplayModel::PageShown(int pageNo) const
 {
     PageInfo *pageInfo = GetPageInfo(pageNo);
     if (!pageInfo)
         return false;
-    return pageInfo->shown;
+    return LayoutStartPage() <= pageNo && pageNo <= LastShownPageNo();
 }
 
 bool DisplayModel::PageVisible(int pageNo)
@@ -397,6 +461,16 @@ float DisplayModel::ZoomRealFromVirtualForPage(float zoomVirtual, int pageNo)
         row.dx *= columns;
     }
 
+    return ZoomRealToFit(zoomVirtual, row);
+}
+
+/* Calculate the absolute zoom level at which a row of pages of the given size
+   (in document units) fits the view port for ZOOM_FIT_WIDTH resp. fits the view
+   port in both directions for ZOOM_FIT_PAGE and ZOOM_FIT_CONTENT */
+float DisplayModel::ZoomRealToFit(float zoomVirtual, SizeD row)
+{
+    int columns = ColumnsFromDisplayMode(GetDisplayMode());
+
     assert(!RectD(PointD(), row).IsEmpty());
     if (RectD(PointD(), row).IsEmpty())
         return 0;
@@ -421,11 +495,8 @@ int DisplayModel::FirstVisiblePageNo() const
     assert(pagesInfo);
     if (!pagesInfo) return INVALID_PAGE_NO;
 
-    for (int pageNo = 1; pageNo <= PageCount(); ++pageNo) {
-        PageInfo *pageInfo = GetPageInfo(pageNo);
-        if (pageInfo->visibleRatio > 0.0)
-            return pageNo;
-    }
+    if (visiblePages.Count() > 0)
+        return visiblePages.At(0);
 
     /* If no pages are visible */
     return INVALID_PAGE_NO;
@@ -447,7 +518,8 @@ int DisplayModel::CurrentPageNo() const
     int mostVisiblePage = INVALID_PAGE_NO;
     float ratio = 0;
 
-    for (int pageNo = 1; pageNo <= PageCount(); pageNo++) {
+    for (size_t i = 0; i < visiblePages.Count(); i++) {
+        int pageNo = visiblePages.At(i);
         PageInfo *pageInfo = GetPageInfo(pageNo);
         if (pageInfo->visibleRatio > ratio) {
             mostVisiblePage = pageNo;
@@ -458,7 +530,8 @@ int DisplayModel::CurrentPageNo() const
     /* if no page is visible, default to either the first or the last one */
     if (INVALID_PAGE_NO == mostVisiblePage) {
         PageInfo *pageInfo = GetPageInfo(1);
-        if (pageInfo && viewPort.y > pageInfo->pos.y + pageInfo->pos.dy)
+        RectI pos = PagePos(1);
+        if (pageInfo && viewPort.y > pos.y + pos.dy)
             mostVisiblePage = PageCount();
         else
             mostVisiblePage = 1;
@@ -484,16 +557,9 @@ void DisplayModel::SetZoomVirtual(float newZoomVirtual)
         /* we want the same zoom for all pages, so use the smallest zoom
            across the pages so that the largest page fits. In most documents
            all pages are the same size anyway */
-        float minZoom = (float)HUGE_VAL;
-        for (int pageNo = 1; pageNo <= PageCount(); pageNo++) {
-            if (PageShown(pageNo)) {
-                float thisPageZoom = ZoomRealFromVirtualForPage(newZoomVirtual, pageNo);
-                if (minZoom > thisPageZoom)
-                    minZoom = thisPageZoom;
-            }
-        }
-        assert(minZoom != (float)HUGE_VAL);
-        zoomReal = minZoom;
+        SizeD row = maxPageSize;
+        row.dx *= ColumnsFromDisplayMode(GetDisplayMode());
+        zoomReal = ZoomRealToFit(newZoomVirtual, row);
     } else if (ZOOM_FIT_CONTENT == newZoomVirtual) {
         float newZoom = ZoomRealFromVirtualForPage(newZoomVirtual, CurrentPageNo());
         // limit zooming in to 800% on almost empty pages
@@ -521,12 +587,15 @@ float DisplayModel::ZoomReal(int pageNo)
     return min(ZoomRealFromVirtualForPage(zoomVirtual, pageNo), ZoomRealFromVirtualForPage(zoomVirtual, pageNo + 1));
 }
 
-/* Given zoom and rotation, calculate the position of each page on a
-   large sheet that is continous view. Needs to be recalculated when:
+/* Given zoom and rotation, calculate the size of the large sheet that is
+   continous view and the position of each row of pages on it. Needs to be
+   recalculated when:
      * zoom changes
      * rotation changes
      * switching between display modes
-     * navigating to another page in non-continuous mode */
+     * navigating to another page in non-continuous mode
+   (the latter three also require BuildLayout, which Relayout calls itself
+   for rotation changes) */
 void DisplayModel::Relayout(float newZoomVirtual, int newRotation)
 {
     // an optimization: the code below doesn't make sense for chm
@@ -541,6 +610,8 @@ void DisplayModel::Relayout(float newZoomVirtual, int newRotation)
         return;
 
     rotation = NormalizeRotation(newRotation);
+    if (rotation != layoutRotation)
+        BuildLayout();
 
     bool needHScroll = false;
     bool needVScroll = false;
@@ -555,66 +626,41 @@ RestartLayout:
     if (0 != currZoomReal && INVALID_ZOOM != currZoomReal)
         newViewPortOffsetX = (int)(viewPort.x * zoomReal / currZoomReal);
     viewPort.x = newViewPortOffsetX;
-    /* calculate the position of each page on the canvas, given current zoom,
-       rotation, columns parameters. You can think of it as a simple
-       table layout i.e. rows with a fixed number of columns. */
+    /* calculate the position of each row of pages on the canvas, given current
+       zoom. You can think of it as a simple table layout i.e. rows with a fixed
+       number of columns, where all rows of a run have the same height. */
     int columns = ColumnsFromDisplayMode(GetDisplayMode());
-    int columnMaxWidth[2] = { 0, 0 };
-    int pageInARow = 0;
-    int rowMaxPageDy = 0;
-    for (int pageNo = 1; pageNo <= PageCount(); ++pageNo) {
-        PageInfo *pageInfo = GetPageInfo(pageNo);
-        if (!pageInfo->shown) {
-            assert(0.0 == pageInfo->visibleRatio);
-            continue;
-        }
-        SizeD pageSize = PageSizeAfterRotation(pageNo);
-        RectI pos;
+    for (size_t i = 0; i < layoutRuns.Count(); i++) {
+        LayoutRun& run = layoutRuns.At(i);
+        int rows = (i + 1 < layoutRuns.Count() ? layoutRuns.At(i + 1).firstRow : layoutRows) - run.firstRow;
         // don't add the full 0.5 for rounding to account for precision errors
-        pos.dx = (int)(pageSize.dx * zoomReal + 0.499);
-        pos.dy = (int)(pageSize.dy * zoomReal + 0.499);
-
-        if (rowMaxPageDy < pos.dy)
-            rowMaxPageDy = pos.dy;
-        pos.y = currPosY;
-
-        // restart the layout if we detect we need to show scrollbars
-        if (!needVScroll && viewPort.dy < currPosY + rowMaxPageDy) {
-            needVScroll = true;
-            viewPort.dx -= GetSystemMetrics(SM_CXVSCROLL);
-            goto RestartLayout;
-        }
-
-        if (DisplayModeShowCover(GetDisplayMode()) && pageNo == 1 && columns - pageInARow > 1)
-            pageInARow++;
-        CrashIf(pageInARow >= dimof(columnMaxWidth));
-        if (columnMaxWidth[pageInARow] < pos.dx)
-            columnMaxWidth[pageInARow] = pos.dx;
-
-        if (!needHScroll && viewPort.dx < windowMargin.left + columnMaxWidth[0] + (columns == 2 ? pageSpacing.dx + columnMaxWidth[1] : 0) + windowMargin.right) {
-            needHScroll = true;
-            viewPort.dy -= GetSystemMetrics(SM_CYHSCROLL);
-            goto RestartLayout;
-        }
-
-        pageInfo->pos = pos;
-
-        pageInARow++;
-        assert(pageInARow <= columns);
-        if (pageInARow == columns) {
-            /* starting next row */
-            currPosY += rowMaxPageDy + pageSpacing.dy;
-            rowMaxPageDy = 0;
-            pageInARow = 0;
-        }
+        run.dy = (int)(run.rowDy * zoomReal + 0.499);
+        run.y = currPosY;
+        currPosY += rows * (run.dy + pageSpacing.dy);
+    }
+    for (size_t i = 0; i < dimof(columnMaxWidth); i++) {
+        columnMaxWidth[i] = (int)(columnMaxDx[i] * zoomReal + 0.499);
     }
+    layoutOffset = PointI();
 
-    if (pageInARow != 0) {
-        /* this is a partial row */
-        currPosY += rowMaxPageDy + pageSpacing.dy;
+    // restart the layout if we detect we need to show scrollbars
+    // (for whichever scrollbar is needed first in layout order)
+    int noPageNo = LastShownPageNo() + 1;
+    int vScrollPageNo = needVScroll ? noPageNo : FindShownPageNo(viewPort.dy);
+    int hScrollPageNo = needHScroll ? noPageNo : FindWidePageNo(viewPort.dx);
+    if (vScrollPageNo < noPageNo && vScrollPageNo <= hScrollPageNo) {
+        needVScroll = true;
+        viewPort.dx -= GetSystemMetrics(SM_CXVSCROLL);
+        goto RestartLayout;
+    }
+    if (hScrollPageNo < noPageNo) {
+        needHScroll = true;
+        viewPort.dy -= GetSystemMetrics(SM_CYHSCROLL);
+        goto RestartLayout;
     }
+
     // restart the layout if we detect we need to show scrollbars
-    // (there are some edge cases we can't catch in the above loop)
+    // (there are some edge cases we can't catch above)
     const int canvasDy = currPosY + windowMargin.bottom - pageSpacing.dy;
     if (!needVScroll && canvasDy > viewPort.dy) {
         needVScroll = true;
@@ -631,7 +677,7 @@ RestartLayout:
     }
 
     // restart the layout if we detect we need to show scrollbars
-    // (there are some edge cases we can't catch in the above loop)
+    // (there are some edge cases we can't catch above)
     int canvasDx = windowMargin.left + columnMaxWidth[0] + (columns == 2 ? pageSpacing.dx + columnMaxWidth[1] : 0) + windowMargin.right;
     if (!needHScroll && canvasDx > viewPort.dx) {
         needHScroll = true;
@@ -646,48 +692,8 @@ RestartLayout:
         offX = (viewPort.dx - canvasDx) / 2;
         canvasDx = viewPort.dx;
     }
-
     assert(offX >= 0);
-    pageInARow = 0;
-    int pageOffX = offX + windowMargin.left;
-    for (int pageNo = 1; pageNo <= PageCount(); ++pageNo) {
-        PageInfo *pageInfo = GetPageInfo(pageNo);
-        if (!pageInfo->shown) {
-            assert(0.0 == pageInfo->visibleRatio);
-            continue;
-        }
-        // leave first spot empty in cover page mode
-        if (DisplayModeShowCover(GetDisplayMode()) && pageNo == 1) {
-            CrashIf(pageInARow >= dimof(columnMaxWidth));
-            pageOffX += columnMaxWidth[pageInARow] + pageSpacing.dx;
-            ++pageInARow;
-        }
-        CrashIf(pageInARow >= dimof(columnMaxWidth));
-        // center pages in a single column but right/left align them when using two columns
-        if (1 == columns)
-            pageInfo->pos.x = pageOffX + (columnMaxWidth[0] - pageInfo->pos.dx) / 2;
-        else if (0 == pageInARow)
-            pageInfo->pos.x = pageOffX + columnMaxWidth[0] - pageInfo->pos.dx;
-        else
-            pageInfo->pos.x = pageOffX;
-        // center the cover page over the first two spots in non-continuous mode
-        if (DisplayModeShowCover(GetDisplayMode()) && pageNo == 1 && !IsContinuous(GetDisplayMode())) {
-            pageInfo->pos.x = offX + windowMargin.left + (columnMaxWidth[0] + pageSpacing.dx + columnMaxWidth[1] - pageInfo->pos.dx) / 2;
-        }
-        // mirror the page layout when displaying a Right-to-Left document
-        if (displayR2L && columns > 1)
-            pageInfo->pos.x = canvasDx - pageInfo->pos.x - pageInfo->pos.dx;
-
-        CrashIf(pageInARow >= dimof(columnMaxWidth));
-        pageOffX += columnMaxWidth[pageInARow] + pageSpacing.dx;
-        ++pageInARow;
-        assert(pageOffX >= 0 && pageInfo->pos.x >= 0);
-
-        if (pageInARow == columns) {
-            pageOffX = offX + windowMargin.left;
-            pageInARow = 0;
-        }
-    }
+    layoutOffset.x = offX + windowMargin.left;
 
     /* if after resizing we would have blank space on the right due to x offset
        being too much, make x offset smaller so that there's no blank space */
@@ -695,20 +701,115 @@ RestartLayout:
         viewPort.x = canvasDx - viewPort.dx;
 
     /* if a page is smaller than drawing area in y axis, y-center the page */
+    layoutOffset.y = 0;
     if (canvasDy < viewPort.dy) {
-        int offY = windowMargin.top + (viewPort.dy - canvasDy) / 2;
-        assert(offY >= 0.0);
-        for (int pageNo = 1; pageNo <= PageCount(); ++pageNo) {
-            PageInfo *pageInfo = GetPageInfo(pageNo);
-            if (!pageInfo->shown) {
-                assert(0.0 == pageInfo->visibleRatio);
-                continue;
+        layoutOffset.y = windowMargin.top + (viewPort.dy - canvasDy) / 2;
+        assert(layoutOffset.y >= 0.0);
+    }
+
+    canvasSize = SizeI(max(canvasDx, viewPort.dx), max(canvasDy, viewPort.dy));
+}
+
+/* Given rotation, calculate the row and column of each shown page and the
+   size of each row and column in document units. Needs to be recalculated when:
+     * rotation changes
+     * switching between display modes
+     * navigating to another page in non-continuous mode */
+void DisplayModel::BuildLayout()
+{
+    layoutRuns.Reset();
+    widerPages.Reset();
+    layoutRows = 0;
+    layoutRotation = rotation;
+    columnMaxDx[0] = columnMaxDx[1] = 0;
+    maxPageSize = SizeD();
+
+    int columns = ColumnsFromDisplayMode(GetDisplayMode());
+    int firstPageNo = LayoutStartPage();
+    int lastPageNo = LastShownPageNo();
+    double rowMaxPageDy = 0;
+    for (int pageNo = max(firstPageNo, 1); pageNo <= lastPageNo; ++pageNo) {
+        SizeD pageSize = PageSizeAfterRotation(pageNo);
+        int column = (pageNo - firstPageNo) % columns;
+        CrashIf(column >= dimof(columnMaxDx));
+        if (pageNo - firstPageNo < columns || columnMaxDx[column] < pageSize.dx)
+            widerPages.Append(pageNo);
+        columnMaxDx[column] = max(columnMaxDx[column], pageSize.dx);
+        maxPageSize.dx = max(maxPageSize.dx, pageSize.dx);
+        maxPageSize.dy = max(maxPageSize.dy, pageSize.dy);
+        rowMaxPageDy = max(rowMaxPageDy, pageSize.dy);
+
+        if (column == columns - 1 || pageNo == lastPageNo) {
+            /* starting next row (which starts a new run, if its height differs) */
+            if (0 == layoutRuns.Count() || layoutRuns.Last().rowDy != rowMaxPageDy) {
+                LayoutRun run = { layoutRows, rowMaxPageDy, 0, 0 };
+                layoutRuns.Append(run);
             }
-            pageInfo->pos.y += offY;
+            layoutRows++;
+            rowMaxPageDy = 0;
         }
     }
+}
 
-    canvasSize = SizeI(max(canvasDx, viewPort.dx), max(canvasDy, viewPort.dy));
+// returns the index into layoutRuns of the run containing the given row
+size_t DisplayModel::FindLayoutRun(int row) const
+{
+    size_t lo = 0, hi = layoutRuns.Count();
+    while (hi - lo > 1) {
+        size_t mid = (lo + hi) / 2;
+        if (layoutRuns.At(mid).firstRow <= row)
+            lo = mid;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+// returns the number of the first shown page at which the pages laid out so far
+// are wider than viewPortDx (or LastShownPageNo() + 1 if they all fit)
+int DisplayModel::FindWidePageNo(int viewPortDx) const
+{
+    int columns = ColumnsFromDisplayMode(GetDisplayMode());
+    int maxWidth[2] = { 0, 0 };
+    for (size_t i = 0; i < widerPages.Count(); i++) {
+        int pageNo = widerPages.At(i);
+        int column = (pageNo - LayoutStartPage()) % columns;
+        CrashIf(column >= dimof(maxWidth));
+        maxWidth[column] = max(maxWidth[column], (int)(PageSizeAfterRotation(pageNo).dx * zoomReal + 0.499));
+        if (viewPortDx < windowMargin.left + maxWidth[0] + (columns == 2 ? pageSpacing.dx + maxWidth[1] : 0) + windowMargin.right)
+            return pageNo;
+    }
+    return LastShownPageNo() + 1;
+}
+
+// returns the number of the first shown page extending below y
+// (or LastShownPageNo() + 1 if all pages end above y)
+int DisplayModel::FindShownPageNo(int y) const
+{
+    // pages are laid out in rows, so the bottom of a run's last row never decreases
+    int runY = y - layoutOffset.y;
+    size_t lo = 0, hi = layoutRuns.Count();
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        const LayoutRun& run = layoutRuns.At(mid);
+        int rows = (mid + 1 < layoutRuns.Count() ? layoutRuns.At(mid + 1).firstRow : layoutRows) - run.firstRow;
+        if (run.y + (rows - 1) * (run.dy + pageSpacing.dy) + run.dy <= runY)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo == layoutRuns.Count())
+        return LastShownPageNo() + 1;
+
+    const LayoutRun& run = layoutRuns.At(lo);
+    int row = run.firstRow;
+    if (runY >= run.y + run.dy && run.dy + pageSpacing.dy > 0)
+        row += (runY - run.y - run.dy) / (run.dy + pageSpacing.dy) + 1;
+    int pageNo = max(LayoutStartPage() + row * ColumnsFromDisplayMode(GetDisplayMode()), 1);
+    // skip smaller pages at the start of the row (the row's highest page extends below y)
+    while (pageNo < LastShownPageNo() && PagePos(pageNo).BR().y <= y)
+        pageNo++;
+    return pageNo;
 }
 
 void DisplayModel::ChangeStartPage(int newStartPage)
@@ -716,24 +817,21 @@ void DisplayModel::ChangeStartPage(int newStartPage)
     assert(ValidPageNo(newStartPage));
     assert(!IsContinuous(GetDisplayMode()));
 
-    int columns = ColumnsFromDisplayMode(GetDisplayMode());
     startPage = newStartPage;
-    if (DisplayModeShowCover(GetDisplayMode()) && newStartPage == 1 && columns > 1)
-        newStartPage--;
-    for (int pageNo = 1; pageNo <= PageCount(); pageNo++) {
-        PageInfo *pageInfo = GetPageInfo(pageNo);
-        if (IsContinuous(GetDisplayMode()))
-            pageInfo->shown = true;
-        else if (pageNo >= newStartPage && pageNo < newStartPage + columns) {
-            //lf("DisplayModel::changeStartPage() set page %d as shown", pageNo);
-            pageInfo->shown = true;
-        } else
-            pageInfo->shown = false;
-        pageInfo->visibleRatio = 0.0;
-    }
+    ResetVisibleParts();
+    BuildLayout();
     Relayout(zoomVirtual, rotation);
 }
 
+// only the pages visible so far have to be reset
+void DisplayModel::ResetVisibleParts()
+{
+    for (size_t i = 0; i < visiblePages.Count(); i++) {
+        GetPageInfo(visiblePages.At(i))->visibleRatio = 0.0;
+    }
+    visiblePages.Reset();
+}
+
 /* Given positions of each page in a large sheet that is continous view and
    coordinates of a current view into that large sheet, calculate which
    parts of each page is visible on the screen.
@@ -744,24 +842,23 @@ void DisplayModel::RecalcVisibleParts()
     if (!pagesInfo)
         return;
 
-    for (int pageNo = 1; pageNo <= PageCount(); ++pageNo) {
+    ResetVisibleParts();
+
+    for (int pageNo = FindShownPageNo(viewPort.y); pageNo <= LastShownPageNo(); pageNo++) {
         PageInfo *pageInfo = GetPageInfo(pageNo);
-        if (!pageInfo->shown) {
-            assert(0.0 == pageInfo->visibleRatio);
-            continue;
-        }
+        assert(PageShown(pageNo));
 
-        RectI pageRect = pageInfo->pos;
+        RectI pageRect = PagePos(pageNo);
+        if (pageRect.y >= viewPort.y + viewPort.dy)
+            break;
         RectI visiblePart = pageRect.Intersect(viewPort);
 
-        pageInfo->visibleRatio = 0.0;
         if (!visiblePart.IsEmpty()) {
             assert(pageRect.dx > 0 && pageRect.dy > 0);
             // calculate with floating point precision to prevent an integer overflow
             pageInfo->visibleRatio = 1.0f * visiblePart.dx * visiblePart.dy / ((float)pageRect.dx * pageRect.dy);
+            visiblePages.Append(pageNo);
         }
-        pageInfo->pageOnScreen = pageRect;
-        pageInfo->pageOnScreen.Offset(-viewPort.x, -viewPort.y);
     }
 }
 
@@ -771,13 +868,13 @@ int DisplayModel::GetPageNoByPoint(PointI pt)
     if (zoomReal <= 0)
         return -1;
 
-    for (int pageNo = 1; pageNo <= PageCount(); ++pageNo) {
-        PageInfo *pageInfo = GetPageInfo(pageNo);
-        assert(0.0 == pageInfo->visibleRatio || pageInfo->shown);
-        if (!pageInfo->shown)
-            continue;
+    int y = pt.y + viewPort.y;
+    for (int pageNo = FindShownPageNo(y); pageNo <= LastShownPageNo(); pageNo++) {
+        RectI pageOnScreen = PageOnScreen(pageNo);
+        if (pageOnScreen.y > pt.y)
+            break;
 
-        if (pageInfo->pageOnScreen.Contains(pt))
+        if (pageOnScreen.Contains(pt))
             return pageNo;
     }
 
@@ -786,23 +883,30 @@ int DisplayModel::GetPageNoByPoint(PointI pt)
 
 int DisplayModel::GetPageNextToPoint(PointI pt)
 {
-    if (zoomReal <= 0)
+    if (zoomReal <= 0 || 0 == layoutRuns.Count())
         return startPage;
 
     unsigned int maxDist = UINT_MAX;
     int closest = startPage;
 
-    for (int pageNo = 1; pageNo <= PageCount(); ++pageNo) {
-        PageInfo *pageInfo = GetPageInfo(pageNo);
-        assert(0.0 == pageInfo->visibleRatio || pageInfo->shown);
-        if (!pageInfo->shown)
-            continue;
+    // the closest page is either in the row(s) at pt's height or in the rows
+    // right above or below (rows consist of at most two pages)
+    int y = pt.y + viewPort.y;
+    int first = FindShownPageNo(y);
+    int last = first;
+    while (last <= LastShownPageNo() && PagePos(last).y <= y)
+        last++;
+    first = max(first - 2, max(LayoutStartPage(), 1));
+    last = min(last + 2, LastShownPageNo() + 1);
 
-        if (pageInfo->pageOnScreen.Contains(pt))
+    for (int pageNo = first; pageNo < last; pageNo++) {
+        RectI pageOnScreen = PageOnScreen(pageNo);
+
+        if (pageOnScreen.Contains(pt))
             return pageNo;
 
-        unsigned int dist = distSq(pt.x - pageInfo->pageOnScreen.x - pageInfo->pageOnScreen.dx / 2,
-                                   pt.y - pageInfo->pageOnScreen.y - pageInfo->pageOnScreen.dy / 2);
+        unsigned int dist = distSq(pt.x - pageOnScreen.x - pageOnScreen.dx / 2,
+                                   pt.y - pageOnScreen.y - pageOnScreen.dy / 2);
         if (dist < maxDist) {
             closest = pageNo;
             maxDist = dist;
@@ -821,8 +925,9 @@ PointI DisplayModel::CvtToScreen(int pageNo, PointD pt)
 
     PointD p = engine->Transform(pt, pageNo, zoomReal, rotation);
     // don't add the full 0.5 for rounding to account for precision errors
-    p.x += 0.499 + pageInfo->pageOnScreen.x;
-    p.y += 0.499 + pageInfo->pageOnScreen.y;
+    RectI pageOnScreen = PageOnScreen(pageNo);
+    p.x += 0.499 + pageOnScreen.x;
+    p.y += 0.499 + pageOnScreen.y;
 
     return p.Convert<int>();
 }
@@ -845,8 +950,9 @@ PointD DisplayModel::CvtFromScreen(PointI pt, int pageNo)
         return PointD();
 
     // don't add the full 0.5 for rounding to account for precision errors
-    PointD p = PointD(pt.x - 0.499 - pageInfo->pageOnScreen.x,
-                      pt.y - 0.499 - pageInfo->pageOnScreen.y);
+    RectI pageOnScreen = PageOnScreen(pageNo);
+    PointD p = PointD(pt.x - 0.499 - pageOnScreen.x,
+                      pt.y - 0.499 - pageOnScreen.y);
     return engine->Transform(p, pageNo, zoomReal, rotation, true);
 }
 
@@ -890,22 +996,12 @@ bool DisplayModel::IsOverText(PointI pt)
 
 void DisplayModel::RenderVisibleParts()
 {
-    int firstVisiblePage = 0;
-    int lastVisiblePage = 0;
-
-    for (int pageNo = 1; pageNo <= PageCount(); ++pageNo) {
-        PageInfo *pageInfo = GetPageInfo(pageNo);
-        if (pageInfo->visibleRatio > 0.0) {
-            assert(pageInfo->shown);
-            if (0 == firstVisiblePage)
-                firstVisiblePage = pageNo;
-            lastVisiblePage = pageNo;
-        }
-    }
     // no page is visible if e.g. the window is resized
     // vertically until only the title bar remains visible
-    if (0 == firstVisiblePage)
+    if (0 == visiblePages.Count())
         return;
+    int firstVisiblePage = visiblePages.At(0);
+    int lastVisiblePage = visiblePages.Last();
 
     // rendering happens LIFO except if the queue is currently
     // empty, so request the visible pages first and last to
@@ -1014,12 +1110,13 @@ void DisplayModel::GoToPage(int pageNo, int scrollY, bool addNavPt, int scrollX)
     } else if (ZOOM_FIT_CONTENT == zoomVirtual) {
         // make sure that setZoomVirtual uses the correct page to calculate
         // the zoom level for (visibility will be recalculated below anyway)
-        for (int i =  PageCount(); i > 0; i--)
-            GetPageInfo(i)->visibleRatio = (i == pageNo ? 1.0f : 0);
+        ResetVisibleParts();
+        GetPageInfo(pageNo)->visibleRatio = 1.0f;
+        visiblePages.Append(pageNo);
         Relayout(zoomVirtual, rotation);
     }
     //lf("DisplayModel::GoToPage(pageNo=%d, scrollY=%d)", pageNo, scrollY);
-    PageInfo * pageInfo = GetPageInfo(pageNo);
+    RectI pos = PagePos(pageNo);
 
     // intentionally ignore scrollX and scrollY when fitting to content
     if (ZOOM_FIT_CONTENT == zoomVirtual) {
@@ -1032,16 +1129,16 @@ void DisplayModel::GoToPage(int pageNo, int scrollY, bool addNavPt, int scrollX)
             PointI second = GetContentStart(lastPageNo);
             scrollY = min(scrollY, second.y);
         }
-        viewPort.x = scrollX + pageInfo->pos.x - windowMargin.left;
+        viewPort.x = scrollX + pos.x - windowMargin.left;
     }
     else if (-1 != scrollX)
         viewPort.x = scrollX;
     // make sure to not display the blank space beside the first page in cover mode
     else if (-1 == scrollX && 1 == pageNo && DisplayModeShowCover(GetDisplayMode()))
-        viewPort.x = pageInfo->pos.x - windowMargin.left;
+        viewPort.x = pos.x - windowMargin.left;
     // make sure that at least part of the page is visible
-    else if (viewPort.x >= pageInfo->pos.x + pageInfo->pos.dx)
-        viewPort.x = pageInfo->pos.x;
+    else if (viewPort.x >= pos.x + pos.dx)
+        viewPort.x = pos.x;
 
     /* Hack: if an image is smaller in Y axis than the draw area, then we center
        the image by setting pageInfo->currPos.y in RecalcPagesInfo. So we shouldn't
@@ -1050,7 +1147,7 @@ void DisplayModel::GoToPage(int pageNo, int scrollY, bool addNavPt, int scrollX)
     viewPort.y = scrollY;
     // Move the next page to the top (unless the remaining pages fit onto a single screen)
     if (IsContinuous(GetDisplayMode()))
-        viewPort.y = pageInfo->pos.y - windowMargin.top + scrollY;
+        viewPort.y = pos.y - windowMargin.top + scrollY;
 
     viewPort.x = limitValue(viewPort.x, 0, canvasSize.dx - viewPort.dx);
     viewPort.y = limitValue(viewPort.y, 0, canvasSize.dy - viewPort.dy);
@@ -1074,14 +1171,11 @@ void DisplayModel::ChangeDisplayMode(DisplayMode newDisplayMode)
         currPageNo++;
     displayMode = newDisplayMode;
     if (IsContinuous(newDisplayMode)) {
-        /* mark all pages as shown but not yet visible. The equivalent code
-           for non-continuous mode is in DisplayModel::changeStartPage() called
+        /* all pages are now shown but not yet visible. The equivalent code
+           for non-continuous mode is in DisplayModel::ChangeStartPage() called
            from DisplayModel::GoToPage() */
-        for (int pageNo = 1; pageNo <= PageCount(); pageNo++) {
-            PageInfo *pageInfo = &(pagesInfo[pageNo-1]);
-            pageInfo->shown = true;
-            pageInfo->visibleRatio = 0.0;
-        }
+        ResetVisibleParts();
+        BuildLayout();
         Relayout(zoomVirtual, rotation);
     }
     GoToPage(currPageNo, 0);
@@ -1154,10 +1248,10 @@ bool DisplayModel::GoToPrevPage(int scrollY)
         top = GetContentStart(currPageNo);
     }
 
-    PageInfo * pageInfo = GetPageInfo(currPageNo);
-    if (zoomVirtual == ZOOM_FIT_CONTENT && -pageInfo->pageOnScreen.y <= top.y)
+    RectI pageOnScreen = PageOnScreen(currPageNo);
+    if (zoomVirtual == ZOOM_FIT_CONTENT && -pageOnScreen.y <= top.y)
         scrollY = 0; // continue, even though the current page isn't fully visible
-    else if (max(-pageInfo->pageOnScreen.y, 0) > scrollY && IsContinuous(GetDisplayMode())) {
+    else if (max(-pageOnScreen.y, 0) > scrollY && IsContinuous(GetDisplayMode())) {
         /* the current page isn't fully visible, so show it first */
         GoToPage(currPageNo, scrollY);
         return true;
@@ -1170,7 +1264,7 @@ bool DisplayModel::GoToPrevPage(int scrollY)
 
     // scroll to the bottom of the page
     if (-1 == scrollY)
-        scrollY = GetPageInfo(firstPageInNewRow)->pageOnScreen.dy;
+        scrollY = PageOnScreen(firstPageInNewRow).dy;
 
     GoToPage(firstPageInNewRow, scrollY);
     return true;
@@ -1248,7 +1342,6 @@ void DisplayModel::ScrollYTo(int yOff)
    of current page */
 void DisplayModel::ScrollYBy(int dy, bool changePage)
 {
-    PageInfo *      pageInfo;
     int             currYOff = viewPort.y;
     int             newPageNo;
     int             currPageNo;
@@ -1263,8 +1356,7 @@ void DisplayModel::ScrollYBy(int dy, bool changePage)
             if (startPage > 1) {
                 newPageNo = startPage - 1;
                 assert(ValidPageNo(newPageNo));
-                pageInfo = GetPageInfo(newPageNo);
-                newYOff = pageInfo->pos.dy - viewPort.dy;
+                newYOff = PagePos(newPageNo).dy - viewPort.dy;
                 if (newYOff < 0)
                     newYOff = 0; /* TODO: center instead? */
                 GoToPrevPage(newYOff);
@@ -1373,15 +1465,13 @@ float DisplayModel::NextZoomStep(float towardsLevel)
 
     float currZoom = ZoomAbsolute();
     float pageZoom = (float)HUGE_VAL, widthZoom = (float)HUGE_VAL;
-    for (int pageNo = 1; pageNo <= PageCount(); pageNo++) {
-        if (PageShown(pageNo)) {
-            float pagePageZoom = ZoomRealFromVirtualForPage(ZOOM_FIT_PAGE, pageNo);
-            pageZoom = min(pageZoom, pagePageZoom);
-            float pageWidthZoom = ZoomRealFromVirtualForPage(ZOOM_FIT_WIDTH, pageNo);
-            widthZoom = min(widthZoom, pageWidthZoom);
-        }
+    if (!AsChmEngine()) {
+        // the largest of the shown pages determines both zoom levels
+        SizeD row = maxPageSize;
+        row.dx *= ColumnsFromDisplayMode(GetDisplayMode());
+        pageZoom = ZoomRealToFit(ZOOM_FIT_PAGE, row);
+        widthZoom = ZoomRealToFit(ZOOM_FIT_WIDTH, row);
     }
-    CrashIf(!AsChmEngine() && (pageZoom == (float)HUGE_VAL || widthZoom == (float)HUGE_VAL));
     CrashIf(pageZoom > widthZoom);
     pageZoom *= 100 / dpiFactor; widthZoom *= 100 / dpiFactor;
 
@@ -1469,7 +1559,7 @@ bool DisplayModel::ShowResultRectToScreen(TextSel *res)
     if (RectI(PointI(), viewPort.Size()).Intersect(extremes) == extremes)
         return false;
 
-    PageInfo *pageInfo = GetPageInfo(res->pages[0]);
+    RectI pageOnScreen = PageOnScreen(res->pages[0]);
     int sx = 0, sy = 0;
 
     // vertically, we try to position the search result between 40%
@@ -1487,10 +1577,10 @@ bool DisplayModel::ShowResultRectToScreen(TextSel *res)
     // boundaries, so that as much context as possible remains visible
     if (extremes.x < 0)
         sx = max(extremes.x + extremes.dx / 2 - viewPort.dx / 2,
-        pageInfo->pageOnScreen.x);
+        pageOnScreen.x);
     else if (extremes.x + extremes.dx >= viewPort.dx)
         sx = min(extremes.x + extremes.dx / 2 - viewPort.dx / 2,
-                 pageInfo->pageOnScreen.x + pageInfo->pageOnScreen.dx - viewPort.dx);
+                 pageOnScreen.x + pageOnScreen.dx - viewPort.dx);
 
     if (sx != 0)
         ScrollXBy(sx);
@@ -1507,20 +1597,21 @@ ScrollState DisplayModel::GetScrollState()
         state.page = CurrentPageNo();
 
     PageInfo *pageInfo = GetPageInfo(state.page);
+    RectI pageOnScreen = PageOnScreen(state.page);
     // Shortcut: don't calculate precise positions, if the
     // page wasn't scrolled right/down at all
-    if (!pageInfo || pageInfo->pageOnScreen.x > 0 && pageInfo->pageOnScreen.y > 0)
+    if (!pageInfo || pageOnScreen.x > 0 && pageOnScreen.y > 0)
         return state;
 
     RectI screen(PointI(), viewPort.Size());
-    RectI pageVis = pageInfo->pageOnScreen.Intersect(screen);
+    RectI pageVis = pageOnScreen.Intersect(screen);
     state.page = GetPageNextToPoint(pageVis.TL());
     PointD ptD = CvtFromScreen(pageVis.TL(), state.page);
 
     // Remember to show the margin, if it's currently visible
-    if (pageInfo->pageOnScreen.x <= 0)
+    if (pageOnScreen.x <= 0)
         state.x = ptD.x;
-    if (pageInfo->pageOnScreen.y <= 0)
+    if (pageOnScreen.y <= 0)
         state.y = ptD.y;
 
     return state;
@@ -23,20 +23,12 @@ struct PageInfo {
     /* data that is calculated when needed. actual content size within a page (View target) */
     RectD           contentBox;
 
-    /* data that needs to be set before DisplayModel::Relayout().
-       Determines whether a given page should be shown on the screen. */
-    bool            shown;
-
-    /* data that changes when zoom and rotation changes */
-    /* position and size within total area after applying zoom and rotation.
-       Represents display rectangle for a given page.
-       Calculated in DisplayModel::Relayout() */
-    RectI           pos;
-
     /* data that changes due to scrolling. Calculated in DisplayModel::RecalcVisibleParts() */
     float           visibleRatio; /* (0.0 = invisible, 1.0 = fully visible) */
-    /* position of page relative to visible view port: pos.Offset(-viewPort.x, -viewPort.y) */
-    RectI           pageOnScreen;
+    /* (whether a page is shown, its position within the total area and its position
+       relative to the view port are returned by DisplayModel::PageShown(), PagePos()
+       and PageOnScreen(), so that neither paging nor zooming nor scrolling has to
+       update all pages) */
 };
 
 /* The current scroll state (needed for saving/restoring the scroll position) */
@@ -99,6 +91,7 @@ public:
     float ZoomReal() const { return zoomReal; }
     float ZoomReal(int pageNo);
     float ZoomAbsolute() const { return zoomReal * 100 / dpiFactor; }
+    int ScreenDPI() const { return (int)(dpiFactor * engine->GetFileDPI() + 0.5f); }
 
     bool HasTocTree() const { return engine && engine->HasTocTree();}
     int CurrentPageNo() const;
@@ -112,6 +105,13 @@ public:
     TextSearch *    textSearch;
 
     PageInfo *      GetPageInfo(int pageNo) const;
+    /* position and size within total area after applying zoom and rotation
+       (only the size for pages which aren't shown) */
+    RectI           PagePos(int pageNo) const;
+    /* position of page relative to visible view port: PagePos(pageNo).Offset(-viewPort.x, -viewPort.y) */
+    RectI           PageOnScreen(int pageNo) const;
+    /* numbers of all pages with visibleRatio > 0 in ascending order */
+    const Vec<int>& VisiblePages() const { return visiblePages; }
 
     /* size and position of the viewport on the canvas (resp size of the visible
        part of the canvase available for content (totalViewPortSize minus scroll bars)
@@ -125,10 +125,11 @@ public:
     bool            NeedHScroll() const { return viewPort.dy < totalViewPortSize.dy; }
     bool            NeedVScroll() const { return viewPort.dx < totalViewPortSize.dx; }
     SizeI           GetCanvasSize() const { return canvasSize; }
+    SizeI           GetTotalViewPortSize() const { return totalViewPortSize; }
 
     void            ChangeViewPortSize(SizeI newViewPortSize);
 
-    bool            PageShown(int pageNo);
+    bool            PageShown(int pageNo) const;
     bool            PageVisible(int pageNo);
     bool            PageVisibleNearby(int pageNo);
     int             FirstVisiblePageNo() const;
@@ -189,12 +190,20 @@ protected:
 
     void            BuildPagesInfo();
     float           ZoomRealFromVirtualForPage(float zoomVirtual, int pageNo);
+    float           ZoomRealToFit(float zoomVirtual, SizeD row);
     SizeD           PageSizeAfterRotation(int pageNo, bool fitToContent=false);
     void            ChangeStartPage(int startPage);
     PointI          GetContentStart(int pageNo);
     void            SetZoomVirtual(float zoomVirtual);
     void            RecalcVisibleParts();
+    void            ResetVisibleParts();
     void            RenderVisibleParts();
+    void            BuildLayout();
+    int             LayoutStartPage() const;
+    int             LastShownPageNo() const;
+    size_t          FindLayoutRun(int row) const;
+    int             FindShownPageNo(int y) const;
+    int             FindWidePageNo(int viewPortDx) const;
 
     void            AddNavPoint();
     RectD           GetContentBox(int pageNo, RenderTarget target=Target_View);
@@ -203,6 +212,33 @@ protected:
 
     /* an array of PageInfo, len of array is pageCount */
     PageInfo *      pagesInfo;
+    /* numbers of all pages with visibleRatio > 0 in ascending order */
+    Vec<int>        visiblePages;
+
+    /* rows of shown pages (in document units), where consecutive rows of the
+       same height are collected into a single run. Calculated in
+       DisplayModel::BuildLayout() so that a zoom change only has to scale the
+       runs instead of moving every page (and so that the pages at a canvas
+       position can be found through binary search) */
+    struct LayoutRun {
+        int         firstRow;
+        double      rowDy;
+        /* position and height of the run's rows within total area (after
+           applying zoom, calculated in DisplayModel::Relayout()) */
+        int         y, dy;
+    };
+    Vec<LayoutRun>  layoutRuns;
+    int             layoutRows;
+    int             layoutRotation;
+    /* width of the widest page in each column and largest page size (in document units) */
+    double          columnMaxDx[2];
+    SizeD           maxPageSize;
+    /* pages which are wider than all previous pages in their column */
+    Vec<int>        widerPages;
+    /* the same widths after applying zoom and the offset of all pages within
+       total area (calculated in DisplayModel::Relayout()) */
+    int             columnMaxWidth[2];
+    PointI          layoutOffset;
 
     DisplayMode     displayMode;
     /* In non-continuous mode is the first page from a file that we're
@@ -12,6 +12,8 @@ using namespace Gdiplus;
 #include "GdiPlusUtil.h"
 #include "PdfEngine.h"
 #include "TgaReader.h"
+#include "ThumbnailCache.h"
+#include "Timer.h"
 #include "WinUtil.h"
 
 #define Out(msg, ...) printf(msg, __VA_ARGS__)
@@ -269,18 +271,39 @@ void DumpPageContent(BaseEngine *engine, int pageNo, bool fullDump)
     Out("\t</Page>\n");
 }
 
-void DumpThumbnail(BaseEngine *engine)
+RenderedBitmap *RenderThumbnail(BaseEngine *engine, ThumbnailCache *cache)
 {
-    RectD rect = engine->Transform(engine->PageMediabox(1), 1, 1.0, 0);
-    if (rect.IsEmpty()) {
-        Out("\t<Thumbnail />\n");
-        return;
+    unsigned char digest[16];
+    size_t len;
+    if (cache && engine->FileName() && CalcThumbnailDigest(engine->FileName(), digest)) {
+        ScopedMem<char> pngData(cache->Load(digest, 1, SizeI(128, 128), &len));
+        SizeI size;
+        HBITMAP hbmp = pngData ? HBitmapFromData(pngData, len, &size) : NULL;
+        if (hbmp)
+            return new RenderedBitmap(hbmp, size);
     }
+    else
+        cache = NULL;
+
+    RectD rect = engine->Transform(engine->PageMediabox(1), 1, 1.0, 0);
+    if (rect.IsEmpty())
+        return NULL;
 
     float zoom = min(128 / (float)rect.dx, 128 / (float)rect.dy) - 0.001f;
     RectI thumb = RectD(0, 0, rect.dx * zoom, rect.dy * zoom).Round();
     rect = engine->Transform(thumb.Convert<double>(), 1, zoom, 0, true);
     RenderedBitmap *bmp = engine->RenderBitmap(1, zoom, 0, &rect);
+
+    ScopedMem<char> pngData(bmp && cache ? SerializeBitmapAsPng(bmp->GetBitmap(), &len) : NULL);
+    if (pngData)
+        cache->Save(digest, 1, SizeI(128, 128), pngData, len);
+
+    return bmp;
+}
+
+void DumpThumbnail(BaseEngine *engine, ThumbnailCache *cache)
+{
+    RenderedBitmap *bmp = RenderThumbnail(engine, cache);
     if (!bmp) {
         Out("\t<Thumbnail />\n");
         return;
@@ -297,7 +320,7 @@ void DumpThumbnail(BaseEngine *engine)
     delete bmp;
 }
 
-void DumpData(BaseEngine *engine, bool fullDump)
+void DumpData(BaseEngine *engine, bool fullDump, ThumbnailCache *thumbCache)
 {
     Out(UTF8_BOM);
     Out("<?xml version=\"1.0\"?>\n");
@@ -307,7 +330,7 @@ void DumpData(BaseEngine *engine, bool fullDump)
     for (int i = 1; i <= engine->PageCount(); i++)
         DumpPageContent(engine, i, fullDump);
     if (fullDump)
-        DumpThumbnail(engine);
+        DumpThumbnail(engine, thumbCache);
     Out("</EngineDump>\n");
 }
 
@@ -362,7 +385,7 @@ int main(int argc, char **argv)
     ParseCmdLine(GetCommandLine(), argList);
     if (argList.Count() < 2) {
 Usage:
-        ErrOut("%s <filename> [-pwd <password>][-full][-alt][-render <path-%%d.tga>]\n",
+        ErrOut("%s <filename> [-pwd <password>][-full][-alt][-render <path-%%d.tga>][-cachethumb][-objstms <threads>]\n",
             path::GetBaseName(argList.At(0)));
         return 2;
     }
@@ -386,6 +409,8 @@ Usage:
     WCHAR *renderPath = NULL;
     bool useAlternateHandlers = false;
     bool loadOnly = false, silent = false;
+    bool cacheThumbnail = false;
+    int objStmThreads = -1;
     int breakAlloc = 0;
 
     for (size_t i = 2; i < argList.Count(); i++) {
@@ -395,8 +420,15 @@ Usage:
             password = argList.At(++i);
         else if (str::Eq(argList.At(i), L"-render") && i + 1 < argList.Count())
             renderPath = argList.At(++i);
+        // use (and update) the thumbnail cache shared with the previewer
+        else if (str::Eq(argList.At(i), L"-cachethumb"))
+            cacheThumbnail = true;
         else if (str::Eq(argList.At(i), L"-alt"))
             useAlternateHandlers = true;
+        // decode all PDF object streams while loading (0 for decoding them
+        // when needed) and report how long loading took
+        else if (str::Eq(argList.At(i), L"-objstms") && i + 1 < argList.Count())
+            objStmThreads = _wtoi(argList.At(++i));
         // -loadonly and -silent are only meant for profiling
         else if (str::Eq(argList.At(i), L"-loadonly"))
             loadOnly = true;
@@ -426,20 +458,24 @@ Usage:
     // optionally use GDI+ rendering for PDF/XPS and the original ChmEngine for CHM
     DebugGdiPlusDevice(useAlternateHandlers);
     bool useChm2Engine = !useAlternateHandlers;
+    PreloadPdfObjStms(objStmThreads);
 
     ScopedGdiPlus gdiPlus;
     DocType engineType;
     PasswordHolder pwdUI(password);
+    Timer t(true);
     BaseEngine *engine = EngineManager::CreateEngine(filePath, &pwdUI, &engineType, useChm2Engine);
     if (!engine) {
         ErrOut("Error: Couldn't create an engine for %s!\n", path::GetBaseName(filePath));
         return 1;
     }
+    if (objStmThreads >= 0)
+        ErrOut("Loading took %.2f ms (with %d object stream threads)\n", t.GetTimeInMs(), objStmThreads);
     Vec<PageAnnotation> *userAnnots = LoadFileModifications(engine->FileName());
     engine->UpdateUserAnnotations(userAnnots);
     delete userAnnots;
     if (!loadOnly)
-        DumpData(engine, fullDump);
+        DumpData(engine, fullDump, cacheThumbnail ? GetSharedThumbnailCache() : NULL);
     if (renderPath)
         RenderDocument(engine, renderPath, silent);
     delete engine;
@@ -233,6 +233,19 @@ void CommandLineInfo::ParseCommandLine(WCHAR *cmdLine)
         else if (is_arg("-rand")) {
             stressRandomizeFiles = true;
         }
+        else if (is_arg_with_param("-render-trace")) {
+            // records all rendering requests, cache hits and rendering times
+            // (to be analyzed and replayed with -replay-render-trace)
+            str::ReplacePtr(&renderTracePath, argList.At(++n));
+        }
+        else if (is_arg_with_param("-replay-render-trace") && argCount > n + 2) {
+            // -replay-render-trace <trace> <file path>
+            // replays the recorded paints of a trace recorded for <file path>
+            // and compares the resulting cache behavior with the recorded one
+            str::ReplacePtr(&replayTracePath, argList.At(++n));
+            str::ReplacePtr(&replayFilePath, argList.At(++n));
+            exitImmediately = true;
+        }
         else if (is_arg_with_param("-bench")) {
             WCHAR *s = str::Dup(argList.At(++n));
             pathsToBenchmark.Push(s);
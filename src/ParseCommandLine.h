@@ -53,6 +53,10 @@ public:
     int         stressParallelCount;
     bool        stressRandomizeFiles;
 
+    WCHAR *     renderTracePath;
+    WCHAR *     replayTracePath;
+    WCHAR *     replayFilePath;
+
     bool        crashOnOpen;
 
     CommandLineInfo() : makeDefault(false), exitWhenDone(false), printDialog(false),
@@ -66,7 +70,8 @@ public:
         forwardSearchOrigin(NULL), forwardSearchLine(0),
         stressTestPath(NULL), stressTestFilter(NULL),
         stressTestRanges(NULL), stressTestCycles(1), stressParallelCount(1),
-        stressRandomizeFiles(false),
+        stressRandomizeFiles(false), renderTracePath(NULL),
+        replayTracePath(NULL), replayFilePath(NULL),
         crashOnOpen(false)
     {
         textColor = RGB(0, 0, 0); // black
@@ -87,6 +92,9 @@ public:
         free(stressTestPath);
         free(stressTestRanges);
         free(stressTestFilter);
+        free(renderTracePath);
+        free(replayTracePath);
+        free(replayFilePath);
         free(pluginURL);
     }
 
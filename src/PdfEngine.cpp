@@ -8,8 +8,10 @@ extern "C" {
 #include "BaseUtil.h"
 #include "PdfEngine.h"
 
+#include "DebugLog.h"
 #include "FileUtil.h"
 #include "HtmlPullParser.h"
+#include "Timer.h"
 #include "TrivialHtmlParser.h"
 #include "WinUtil.h"
 #include "ZipUtil.h"
@@ -29,6 +31,10 @@ extern "C" {
 
 // maximum amount of memory that MuPDF should use per fz_context store
 #define MAX_CONTEXT_MEMORY  (256 * 1024 * 1024)
+// maximum amount of that memory to use for fonts, colorspaces and other
+// resources (which MuPDF protects once they're reused), so that these
+// can't crowd out decoded images
+#define MAX_RESOURCE_MEMORY (MAX_CONTEXT_MEMORY / 4)
 
 // when set, always uses GDI+ for rendering (else GDI+ is only used for
 // zoom levels above 4000% and for rendering directly into an HDC)
@@ -39,6 +45,15 @@ void DebugGdiPlusDevice(bool enable)
     gDebugGdiPlusDevice = enable;
 }
 
+// when set, all object streams of a PDF document are decoded right after
+// loading it (with that many threads) instead of whenever they're needed
+static int gPreloadObjStmThreads = 0;
+
+void PreloadPdfObjStms(int threads)
+{
+    gPreloadObjStmThreads = limitValue(threads, 0, MAXIMUM_WAIT_OBJECTS);
+}
+
 void CalcMD5Digest(const unsigned char *data, size_t byteCount, unsigned char digest[16])
 {
     fz_md5 md5;
@@ -755,28 +770,35 @@ public:
     virtual void Abort() { cookie.abort = 1; }
 };
 
-extern "C" static void
-fz_lock_context_cs(void *user, int lock)
-{
-    // we use a single critical section for all locks,
-    // since that critical section (ctxAccess) should
-    // be guarding all fz_context access anyway and
-    // thus already be in place (in debug builds we
-    // crash if that assertion doesn't hold)
-    CRITICAL_SECTION *cs = (CRITICAL_SECTION *)user;
-    BOOL ok = TryEnterCriticalSection(cs);
-    if (!ok) {
-        CrashIf(true);
-        EnterCriticalSection(cs);
+// fitz expects FZ_LOCK_MAX distinct locks: while an engine's own
+// ctxAccess serializes all access through its main fz_context, contexts
+// cloned for worker threads must only block each other on the same lock
+// (e.g. the same glyph cache shard) and never on ctxAccess
+class FitzLocks {
+    CRITICAL_SECTION cs[FZ_LOCK_MAX];
+
+    static void Lock(void *user, int lock) {
+        EnterCriticalSection(&((FitzLocks *)user)->cs[lock]);
+    }
+    static void Unlock(void *user, int lock) {
+        LeaveCriticalSection(&((FitzLocks *)user)->cs[lock]);
     }
-}
 
-extern "C" static void
-fz_unlock_context_cs(void *user, int lock)
-{
-    CRITICAL_SECTION *cs = (CRITICAL_SECTION *)user;
-    LeaveCriticalSection(cs);
-}
+public:
+    fz_locks_context ctx;
+
+    FitzLocks() {
+        for (int i = 0; i < FZ_LOCK_MAX; i++)
+            InitializeCriticalSection(&cs[i]);
+        ctx.user = this;
+        ctx.lock = Lock;
+        ctx.unlock = Unlock;
+    }
+    ~FitzLocks() {
+        for (int i = 0; i < FZ_LOCK_MAX; i++)
+            DeleteCriticalSection(&cs[i]);
+    }
+};
 
 static Vec<PageAnnotation> fz_get_user_page_annots(Vec<PageAnnotation>& userAnnots, int pageNo)
 {
@@ -1116,6 +1138,64 @@ pdf_load_page_objs(pdf_document *doc, pdf_obj **page_objs)
     }
 }
 
+struct ObjStmDecoder {
+    fz_context *ctx;
+    pdf_obj_stm_batch *batch;
+    int thread, threads;
+};
+
+static DWORD WINAPI DecodeObjStmsThread(LPVOID data)
+{
+    ObjStmDecoder *dec = (ObjStmDecoder *)data;
+    pdf_decode_obj_stms(dec->ctx, dec->batch, dec->thread, dec->threads);
+    return 0;
+}
+
+// decodes all object streams with the given number of threads, so that
+// loading the page tree (and everything else) only has to parse objects
+static void
+pdf_preload_obj_stms(pdf_document *doc, int threads)
+{
+    fz_context *ctx = doc->ctx;
+    pdf_obj_stm_batch *batch = pdf_read_obj_stms(doc);
+
+    ScopedMem<ObjStmDecoder> decoders(AllocArray<ObjStmDecoder>(threads));
+    ScopedMem<HANDLE> handles(AllocArray<HANDLE>(threads));
+    if (!decoders || !handles)
+        threads = 1;
+
+    // this thread decodes the first share itself, the others each get
+    // a context of their own (shares of threads which fail to start are
+    // left to be decoded whenever they're needed)
+    int started = 0;
+    for (int i = 1; i < threads; i++) {
+        decoders[i].ctx = fz_clone_context(ctx);
+        decoders[i].batch = batch;
+        decoders[i].thread = i;
+        decoders[i].threads = threads;
+        HANDLE hThread = NULL;
+        if (decoders[i].ctx)
+            hThread = CreateThread(NULL, 0, DecodeObjStmsThread, &decoders[i], 0, NULL);
+        if (hThread)
+            handles[started++] = hThread;
+        else {
+            fz_free_context(decoders[i].ctx);
+            decoders[i].ctx = NULL;
+        }
+    }
+    pdf_decode_obj_stms(ctx, batch, 0, threads);
+
+    if (started > 0)
+        WaitForMultipleObjects(started, handles, TRUE, INFINITE);
+    for (int i = 0; i < started; i++) {
+        CloseHandle(handles[i]);
+    }
+    for (int i = 1; i < threads; i++) {
+        fz_free_context(decoders[i].ctx);
+    }
+    pdf_load_obj_stms(doc, batch);
+}
+
 ///// Above are extensions to Fitz and MuPDF, now follows PdfEngine /////
 
 struct PdfPageRun {
@@ -1215,7 +1295,7 @@ protected:
     // protected critical section in order to avoid deadlocks
     CRITICAL_SECTION ctxAccess;
     fz_context *    ctx;
-    fz_locks_context fz_locks_ctx;
+    FitzLocks       fz_locks;
     pdf_document *  _doc;
 
     CRITICAL_SECTION pagesAccess;
@@ -1359,10 +1439,9 @@ PdfEngineImpl::PdfEngineImpl() : _fileName(NULL), _doc(NULL),
     InitializeCriticalSection(&pagesAccess);
     InitializeCriticalSection(&ctxAccess);
 
-    fz_locks_ctx.user = &ctxAccess;
-    fz_locks_ctx.lock = fz_lock_context_cs;
-    fz_locks_ctx.unlock = fz_unlock_context_cs;
-    ctx = fz_new_context(NULL, &fz_locks_ctx, MAX_CONTEXT_MEMORY);
+    ctx = fz_new_context(NULL, &fz_locks.ctx, MAX_CONTEXT_MEMORY);
+    if (ctx)
+        fz_set_store_class_max(ctx, FZ_STORE_CLASS_RESOURCE, MAX_RESOURCE_MEMORY);
 
     AssertCrash(!pdf_js_supported());
 }
@@ -1650,12 +1729,24 @@ bool PdfEngineImpl::FinishLoading()
 
     ScopedCritSec scope(&ctxAccess);
 
+    Timer t(true);
+    if (gPreloadObjStmThreads > 0) {
+        fz_try(ctx) {
+            pdf_preload_obj_stms(_doc, gPreloadObjStmThreads);
+        }
+        fz_catch(ctx) {
+            fz_warn(ctx, "Couldn't preload object streams");
+        }
+        dbglog::LogF("pdf_preload_obj_stms(%d): %.2f ms", gPreloadObjStmThreads, t.GetTimeInMs());
+        t.Start();
+    }
     fz_try(ctx) {
         pdf_load_page_objs(_doc, _pageObjs);
     }
     fz_catch(ctx) {
         fz_warn(ctx, "Couldn't load all page objects");
     }
+    dbglog::LogF("pdf_load_page_objs(): %.2f ms", t.GetTimeInMs());
     fz_try(ctx) {
         outline = pdf_load_outline(_doc);
     }
@@ -3459,7 +3550,7 @@ protected:
     // protected critical section in order to avoid deadlocks
     CRITICAL_SECTION ctxAccess;
     fz_context *    ctx;
-    fz_locks_context fz_locks_ctx;
+    FitzLocks       fz_locks;
     xps_document *  _doc;
 
     CRITICAL_SECTION _pagesAccess;
@@ -3585,10 +3676,9 @@ XpsEngineImpl::XpsEngineImpl() : _fileName(NULL), _doc(NULL), _pages(NULL), _med
     InitializeCriticalSection(&_pagesAccess);
     InitializeCriticalSection(&ctxAccess);
 
-    fz_locks_ctx.user = &ctxAccess;
-    fz_locks_ctx.lock = fz_lock_context_cs;
-    fz_locks_ctx.unlock = fz_unlock_context_cs;
-    ctx = fz_new_context(NULL, &fz_locks_ctx, MAX_CONTEXT_MEMORY);
+    ctx = fz_new_context(NULL, &fz_locks.ctx, MAX_CONTEXT_MEMORY);
+    if (ctx)
+        fz_set_store_class_max(ctx, FZ_STORE_CLASS_RESOURCE, MAX_RESOURCE_MEMORY);
 }
 
 XpsEngineImpl::~XpsEngineImpl()
@@ -28,5 +28,6 @@ public:
 
 void CalcMD5Digest(const unsigned char *data, size_t byteCount, unsigned char digest[16]);
 void DebugGdiPlusDevice(bool enable);
+void PreloadPdfObjStms(int threads);
 
 #endif
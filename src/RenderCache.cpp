@@ -14,10 +14,15 @@
 // define to view the tile boundaries
 #undef SHOW_TILE_LAYOUT
 
+// pages rendering faster than this get larger tiles,
+// pages rendering slower than this get smaller tiles
+#define CHEAP_RENDER_MS_PER_MP      20.0f
+#define EXPENSIVE_RENDER_MS_PER_MP  150.0f
+
 RenderCache::RenderCache()
-    : cacheCount(0), requestCount(0),
+    : cacheCount(0), requestCount(0), costCount(0),
       maxTileSize(GetSystemMetrics(SM_CXSCREEN), GetSystemMetrics(SM_CYSCREEN)),
-      isRemoteSession(GetSystemMetrics(SM_REMOTESESSION))
+      isRemoteSession(GetSystemMetrics(SM_REMOTESESSION)), trace(NULL)
 {
     textColor = WIN_COL_BLACK;
     backgroundColor = WIN_COL_WHITE;
@@ -43,6 +48,15 @@ RenderCache::~RenderCache()
     DeleteCriticalSection(&cacheAccess);
     LeaveCriticalSection(&requestAccess);
     DeleteCriticalSection(&requestAccess);
+
+    delete trace;
+}
+
+void RenderCache::TraceTile(RenderTraceEvent event, DisplayModel *dm, int pageNo, int rotation, float zoom,
+                            TilePosition tile, RectD *pageRect, DWORD param)
+{
+    if (trace)
+        trace->Record(event, dm, pageNo, rotation, zoom, tile.res, tile.row, tile.col, pageRect, param);
 }
 
 /* Find a bitmap for a page defined by <dm> and <pageNo> and optionally also
@@ -77,6 +91,7 @@ void RenderCache::DropCacheEntry(BitmapCacheEntry *entry)
     assert(entry);
     if (!entry) return;
     if (0 == --entry->refs) {
+        TraceTile(Trace_Evict, entry->dm, entry->pageNo, entry->rotation, entry->zoom, entry->tile);
         delete entry;
     }
 }
@@ -146,6 +161,48 @@ static RectD GetTileRectUser(BaseEngine *engine, int pageNo, int rotation, float
     return engine->Transform(pixelbox.Convert<double>(), pageNo, zoom, rotation, true);
 }
 
+// copies a re-rendered part of a tile into the cached tile (see Invalidate)
+void RenderCache::Patch(PageRenderRequest &req, RenderedBitmap *bitmap)
+{
+    ScopedCritSec scope(&cacheAccess);
+
+    // the tile might have been replaced or dropped in the meantime
+    BitmapCacheEntry *entry = Find(req.dm, req.pageNo, req.rotation, req.zoom, &req.tile);
+    if (entry && entry->pendingPatches > 0)
+        entry->pendingPatches--;
+    if (entry && entry->outOfDate && bitmap && bitmap->GetBitmap()) {
+        BaseEngine *engine = req.dm->engine;
+        RectI tileRect = GetTileRectDevice(engine, req.pageNo, req.rotation, req.zoom, req.tile);
+        RectI patchRect = engine->Transform(req.pageRect, req.pageNo, req.zoom, req.rotation).Round();
+        SizeI size = bitmap->Size();
+
+        HDC hdc = GetDC(NULL);
+        HDC tileDC = CreateCompatibleDC(hdc);
+        HDC patchDC = CreateCompatibleDC(hdc);
+        HGDIOBJ oldTileBmp = SelectObject(tileDC, entry->bitmap->GetBitmap());
+        HGDIOBJ oldPatchBmp = SelectObject(patchDC, bitmap->GetBitmap());
+        // PaintTile only selects tile bitmaps while holding cacheAccess
+        bool ok = oldTileBmp && oldPatchBmp &&
+                  BitBlt(tileDC, patchRect.x - tileRect.x, patchRect.y - tileRect.y,
+                         size.dx, size.dy, patchDC, 0, 0, SRCCOPY);
+        SelectObject(tileDC, oldTileBmp);
+        SelectObject(patchDC, oldPatchBmp);
+        DeleteDC(tileDC);
+        DeleteDC(patchDC);
+        ReleaseDC(NULL, hdc);
+
+        // other patches for the same tile might still be pending
+        if (ok && entry->pendingPatches == 0)
+            entry->outOfDate = false;
+        // if patching failed, the tile is rendered anew at the next repaint
+        else if (!ok)
+            entry->zoom = INVALID_ZOOM;
+    }
+    if (entry)
+        DropCacheEntry(entry);
+    delete bitmap;
+}
+
 static RectI GetTileOnScreen(BaseEngine *engine, int pageNo, int rotation, float zoom, TilePosition tile, RectI pageOnScreen)
 {
     RectI bbox = GetTileRectDevice(engine, pageNo, rotation, zoom, tile);
@@ -158,7 +215,7 @@ static bool IsTileVisible(DisplayModel *dm, int pageNo, TilePosition tile, float
     if (!dm) return false;
     PageInfo *pageInfo = dm->GetPageInfo(pageNo);
     if (!dm->engine || !pageInfo) return false;
-    RectI tileOnScreen = GetTileOnScreen(dm->engine, pageNo, dm->Rotation(), dm->ZoomReal(), tile, pageInfo->pageOnScreen);
+    RectI tileOnScreen = GetTileOnScreen(dm->engine, pageNo, dm->Rotation(), dm->ZoomReal(), tile, dm->PageOnScreen(pageNo));
     // consider nearby tiles visible depending on the fuzz factor
     tileOnScreen.x -= (int)(tileOnScreen.dx * fuzz * 0.5);
     tileOnScreen.dx = (int)(tileOnScreen.dx * (fuzz + 1));
@@ -226,27 +283,136 @@ void RenderCache::KeepForDisplayModel(DisplayModel *oldDm, DisplayModel *newDm)
             cache[i]->outOfDate = true;
         }
     }
+    // the document is the same, so are the pages' rendering costs
+    for (int i = 0; i < costCount; i++) {
+        if (costs[i].dm == oldDm)
+            costs[i].dm = newDm;
+    }
+}
+
+/* Find the measured rendering cost for page <pageNo> in <dm> (optionally
+   replacing the least recently used entry, if there's none yet). Must be
+   called from within the cacheAccess critical section. */
+PageRenderCost *RenderCache::GetRenderCost(DisplayModel *dm, int pageNo, bool create)
+{
+    for (int i = 0; i < costCount; i++) {
+        if (costs[i].dm == dm && costs[i].pageNo == pageNo) {
+            costs[i].lastUsed = GetTickCount();
+            return &costs[i];
+        }
+    }
+    if (!create)
+        return NULL;
+
+    PageRenderCost *cost = &costs[costCount];
+    if (costCount < MAX_PAGE_COSTS) {
+        costCount++;
+    }
+    else {
+        cost = &costs[0];
+        for (int i = 1; i < costCount; i++) {
+            if (GetTickCount() - costs[i].lastUsed > GetTickCount() - cost->lastUsed)
+                cost = &costs[i];
+        }
+    }
+    ZeroMemory(cost, sizeof(*cost));
+    cost->dm = dm;
+    cost->pageNo = pageNo;
+    cost->lastUsed = GetTickCount();
+    return cost;
+}
+
+void RenderCache::FreeRenderCosts(DisplayModel *dm)
+{
+    ScopedCritSec scope(&cacheAccess);
+    int curPos = 0;
+    for (int i = 0; i < costCount; i++) {
+        if (costs[i].dm == dm)
+            continue;
+        if (curPos != i)
+            costs[curPos] = costs[i];
+        curPos++;
+    }
+    costCount = curPos;
+}
+
+// update a page's rendering cost history with the time it took to render a tile
+void RenderCache::RecordRenderCost(PageRenderRequest &req, RenderedBitmap *bitmap, DWORD renderTime)
+{
+    if (!bitmap || !bitmap->GetBitmap())
+        return;
+    SizeI size = bitmap->Size();
+    float megapixels = 1e-6f * size.dx * size.dy;
+    // the timings of tiny renderings are dominated by fixed costs
+    if (megapixels < 0.01f)
+        return;
+
+    ScopedCritSec scope(&cacheAccess);
+    PageRenderCost *cost = GetRenderCost(req.dm, req.pageNo, true);
+    float msPerMegapixel = renderTime / megapixels;
+    if (0 == cost->samples)
+        cost->msPerMegapixel = msPerMegapixel;
+    else
+        cost->msPerMegapixel = 0.7f * cost->msPerMegapixel + 0.3f * msPerMegapixel;
+    cost->samples++;
 }
 
-// marks all tiles containing rect of pageNo as out of date
+// marks all tiles containing rect of pageNo as out of date and re-renders
+// the invalidated part of those tiles (e.g. after an annotation has been
+// added) so that the rest of the tiles' content doesn't have to be redone
 void RenderCache::Invalidate(DisplayModel *dm, int pageNo, RectD rect)
 {
     ScopedCritSec scopeReq(&requestAccess);
 
-    ClearQueueForDisplayModel(dm, pageNo);
-    if (curReq && curReq->dm == dm && curReq->pageNo == pageNo)
+    // renderings started before the page changed are out of date
+    // (queued requests are rendered from the updated page later on)
+    if (curReq && curReq->dm == dm && curReq->pageNo == pageNo && !curReq->patch)
         AbortCurrentRequest();
 
-    ScopedCritSec scopeCache(&cacheAccess);
+    Vec<PageRenderRequest> patches;
+    {
+        ScopedCritSec scopeCache(&cacheAccess);
 
-    RectD mediabox = dm->engine->PageMediabox(pageNo);
-    for (int i = 0; i < cacheCount; i++) {
-        if (cache[i]->dm == dm && cache[i]->pageNo == pageNo &&
-            !GetTileRect(mediabox, cache[i]->tile).Intersect(rect).IsEmpty()) {
-            cache[i]->zoom = INVALID_ZOOM;
-            cache[i]->outOfDate = true;
+        BaseEngine *engine = dm->engine;
+        RectD mediabox = engine->PageMediabox(pageNo);
+        for (int i = 0; i < cacheCount; i++) {
+            BitmapCacheEntry *entry = cache[i];
+            if (entry->dm != dm || entry->pageNo != pageNo ||
+                GetTileRect(mediabox, entry->tile).Intersect(rect).IsEmpty())
+                continue;
+            entry->outOfDate = true;
+            // only patch tiles which are still displayed as they are
+            bool canPatch = entry->zoom == dm->ZoomReal(pageNo) &&
+                            entry->rotation == NormalizeRotation(dm->Rotation()) &&
+                            entry->bitmap && entry->bitmap->GetBitmap() &&
+                            requestCount + patches.Count() < MAX_PAGE_REQUESTS;
+            if (!canPatch) {
+                entry->zoom = INVALID_ZOOM;
+                continue;
+            }
+            RectI tileRect = GetTileRectDevice(engine, pageNo, entry->rotation, entry->zoom, entry->tile);
+            RectI dirty = engine->Transform(rect, pageNo, entry->zoom, entry->rotation).Round();
+            // include anti-aliased edges bleeding into neighboring pixels
+            dirty.Inflate(2, 2);
+            dirty = dirty.Intersect(tileRect);
+            if (dirty.IsEmpty()) {
+                entry->outOfDate = entry->pendingPatches > 0;
+                continue;
+            }
+            entry->pendingPatches++;
+            PageRenderRequest patch;
+            patch.rotation = entry->rotation;
+            patch.zoom = entry->zoom;
+            patch.tile = entry->tile;
+            patch.pageRect = engine->Transform(dirty.Convert<double>(), pageNo, entry->zoom, entry->rotation, true);
+            patches.Append(patch);
         }
     }
+
+    for (size_t i = 0; i < patches.Count(); i++) {
+        PageRenderRequest& patch = patches.At(i);
+        Render(dm, pageNo, patch.rotation, patch.zoom, &patch.tile, &patch.pageRect);
+    }
 }
 
 // determine the count of tiles required for a page at a given zoom level
@@ -262,18 +428,33 @@ USHORT RenderCache::GetTileRes(DisplayModel *dm, int pageNo)
     // to maxTileSize (but remains smaller)
     float factorAvg = sqrtf(factorW * factorH);
 
+    PageRenderCost cost = { 0 };
+    {
+        ScopedCritSec scope(&cacheAccess);
+        PageRenderCost *pageCost = GetRenderCost(dm, pageNo);
+        if (pageCost)
+            cost = *pageCost;
+    }
+
     // use larger tiles when fitting page or width or when a page is smaller
     // than the visible canvas width/height or when rendering pages
-    // without clipping optimizations
+    // without clipping optimizations or which are known to render quickly
     if (dm->ZoomVirtual() == ZOOM_FIT_PAGE || dm->ZoomVirtual() == ZOOM_FIT_WIDTH ||
         pixelbox.dx <= dm->viewPort.dx || pixelbox.dy < dm->viewPort.dy ||
-        !dm->engine->HasClipOptimizations(pageNo)) {
+        !dm->engine->HasClipOptimizations(pageNo) ||
+        (cost.samples > 0 && cost.msPerMegapixel < CHEAP_RENDER_MS_PER_MP)) {
         factorAvg /= 2.0;
     }
+    // use smaller tiles for pages which are known to render slowly
+    // (provided that the engine can render partial pages more quickly)
+    else if (cost.samples > 0 && cost.msPerMegapixel > EXPENSIVE_RENDER_MS_PER_MP) {
+        factorAvg *= 2.0;
+    }
 
     USHORT res = 0;
     if (factorAvg > 1.5)
         res = (USHORT)ceilf(log(factorAvg) / log(2.0f));
+    res += cost.extraRes;
     // limit res to 30, so that (1 << res) doesn't overflow for 32-bit signed int
     return min(res, 30);
 }
@@ -292,26 +473,25 @@ USHORT RenderCache::GetMaxTileRes(DisplayModel *dm, int pageNo, int rotation)
     return maxRes;
 }
 
-// reduce the size of tiles in order to hopefully use less memory overall
-bool RenderCache::ReduceTileSize()
+// reduce the size of a page's tiles after a failed rendering in order to
+// hopefully use less memory for it (all other pages keep their tiles)
+bool RenderCache::ReduceTileSize(DisplayModel *dm, int pageNo)
 {
-    if (maxTileSize.dx < 200 || maxTileSize.dy < 200)
-        return false;
-
     ScopedCritSec scope1(&requestAccess);
     ScopedCritSec scope2(&cacheAccess);
 
-    if (maxTileSize.dx > maxTileSize.dy)
-        maxTileSize.dx /= 2;
-    else
-        maxTileSize.dy /= 2;
+    PageRenderCost *cost = GetRenderCost(dm, pageNo, true);
+    // each additional resolution step halves both tile dimensions
+    if ((maxTileSize.dx >> (cost->extraRes + 1)) < 100 ||
+        (maxTileSize.dy >> (cost->extraRes + 1)) < 100)
+        return false;
+    cost->extraRes++;
 
-    // invalidate all rendered bitmaps and all requests
-    while (cacheCount > 0)
-        FreeForDisplayModel(cache[0]->dm);
-    while (requestCount > 0)
-        ClearQueueForDisplayModel(requests[0].dm);
-    AbortCurrentRequest();
+    // invalidate all rendered bitmaps and all requests for this page
+    FreePage(dm, pageNo);
+    ClearQueueForDisplayModel(dm, pageNo);
+    if (curReq && curReq->dm == dm && curReq->pageNo == pageNo)
+        AbortCurrentRequest();
 
     return true;
 }
@@ -344,7 +524,7 @@ void RenderCache::RequestRendering(DisplayModel *dm, int pageNo, TilePosition ti
     int rotation = NormalizeRotation(dm->Rotation());
     float zoom = dm->ZoomReal(pageNo);
 
-    if (curReq && (curReq->pageNo == pageNo) && (curReq->dm == dm) && (curReq->tile == tile)) {
+    if (curReq && (curReq->pageNo == pageNo) && (curReq->dm == dm) && (curReq->tile == tile) && !curReq->patch) {
         if ((curReq->zoom == zoom) && (curReq->rotation == rotation)) {
             /* we're already rendering exactly the same page */
             return;
@@ -360,7 +540,7 @@ void RenderCache::RequestRendering(DisplayModel *dm, int pageNo, TilePosition ti
 
     for (int i = 0; i < requestCount; i++) {
         PageRenderRequest* req = &(requests[i]);
-        if ((req->pageNo == pageNo) && (req->dm == dm) && (req->tile == tile)) {
+        if ((req->pageNo == pageNo) && (req->dm == dm) && (req->tile == tile) && !req->patch) {
             if ((req->zoom == zoom) && (req->rotation == rotation)) {
                 /* Request with exactly the same parameters already queued for
                    rendering. Move it to the top of the queue so that it'll
@@ -379,7 +559,11 @@ void RenderCache::RequestRendering(DisplayModel *dm, int pageNo, TilePosition ti
         }
     }
 
-    if (Exists(dm, pageNo, rotation, zoom, &tile)) {
+    BitmapCacheEntry *entry = Find(dm, pageNo, rotation, zoom, &tile);
+    bool isUpToDate = entry && !entry->outOfDate;
+    if (entry)
+        DropCacheEntry(entry);
+    if (isUpToDate) {
         /* This page has already been rendered in the correct dimensions
            and isn't about to be rerendered in different dimensions */
         return;
@@ -403,6 +587,7 @@ bool RenderCache::Render(DisplayModel *dm, int pageNo, int rotation, float zoom,
         return false;
 
     assert(tile || pageRect && renderCb);
+    assert(!(tile && renderCb));
     if (!tile && !(pageRect && renderCb))
         return false;
 
@@ -426,8 +611,10 @@ bool RenderCache::Render(DisplayModel *dm, int pageNo, int rotation, float zoom,
     newRequest->pageNo = pageNo;
     newRequest->rotation = rotation;
     newRequest->zoom = zoom;
+    // a request for both a tile and a pageRect patches the cached tile
+    newRequest->patch = tile && pageRect;
     if (tile) {
-        newRequest->pageRect = GetTileRectUser(dm->engine, pageNo, rotation, zoom, *tile);
+        newRequest->pageRect = pageRect ? *pageRect : GetTileRectUser(dm->engine, pageNo, rotation, zoom, *tile);
         newRequest->tile = *tile;
     }
     else if (pageRect) {
@@ -441,6 +628,8 @@ bool RenderCache::Render(DisplayModel *dm, int pageNo, int rotation, float zoom,
     newRequest->abortCookie = NULL;
     newRequest->timestamp = GetTickCount();
     newRequest->renderCb = renderCb;
+    if (tile)
+        TraceTile(Trace_Request, dm, pageNo, rotation, zoom, *tile, &newRequest->pageRect);
 
     SetEvent(startRendering);
 
@@ -495,6 +684,8 @@ bool RenderCache::ClearCurrentRequest()
    user know he has to wait until we finish */
 void RenderCache::CancelRendering(DisplayModel *dm)
 {
+    if (trace)
+        trace->Record(Trace_Cancel, dm, INVALID_PAGE_NO, 0, INVALID_ZOOM);
     ClearQueueForDisplayModel(dm);
 
     for (;;) {
@@ -575,7 +766,14 @@ DWORD WINAPI RenderCache::RenderCacheThread(LPVOID data)
             req.dm->textCache->GetData(req.pageNo);
 
         CrashIf(req.abortCookie != NULL);
+        if (!req.renderCb)
+            cache->TraceTile(Trace_RenderStart, req.dm, req.pageNo, req.rotation, req.zoom, req.tile, &req.pageRect);
+        DWORD renderStart = GetTickCount();
         bmp = req.dm->engine->RenderBitmap(req.pageNo, req.zoom, req.rotation, &req.pageRect, Target_View, &req.abortCookie);
+        DWORD renderTime = GetTickCount() - renderStart;
+        if (!req.renderCb)
+            cache->TraceTile(req.abort ? Trace_RenderAbort : Trace_RenderDone, req.dm, req.pageNo,
+                             req.rotation, req.zoom, req.tile, &req.pageRect, renderTime);
         if (req.abort) {
             delete bmp;
             if (req.renderCb)
@@ -592,7 +790,12 @@ DWORD WINAPI RenderCache::RenderCacheThread(LPVOID data)
             // don't replace colors for individual images
             if (bmp && !req.dm->engine->IsImageCollection())
                 UpdateBitmapColors(bmp->GetBitmap(), cache->textColor, cache->backgroundColor);
-            cache->Add(req, bmp);
+            if (req.patch)
+                cache->Patch(req, bmp);
+            else {
+                cache->RecordRenderCost(req, bmp, renderTime);
+                cache->Add(req, bmp);
+            }
             req.dm->RepaintDisplay();
         }
     }
@@ -607,7 +810,15 @@ UINT RenderCache::PaintTile(HDC hdc, RectI bounds, DisplayModel *dm, int pageNo,
     BitmapCacheEntry *entry = Find(dm, pageNo, dm->Rotation(), dm->ZoomReal(), &tile);
     UINT renderDelay = 0;
 
-    if (!entry) {
+    if (entry && entry->outOfDate) {
+        // the tile is waiting to be patched, else it'll have to be rendered anew
+        if (renderedReplacement)
+            *renderedReplacement = true;
+        renderDelay = GetRenderDelay(dm, pageNo, tile);
+        if (renderMissing && RENDER_DELAY_UNDEFINED == renderDelay && !IsRenderQueueFull())
+            RequestRendering(dm, pageNo, tile);
+    }
+    else if (!entry) {
         if (!isRemoteSession) {
             if (renderedReplacement)
                 *renderedReplacement = true;
@@ -619,9 +830,13 @@ UINT RenderCache::PaintTile(HDC hdc, RectI bounds, DisplayModel *dm, int pageNo,
     }
     RenderedBitmap *renderedBmp = entry ? entry->bitmap : NULL;
     HBITMAP hbmp = renderedBmp ? renderedBmp->GetBitmap() : NULL;
+    if (trace) {
+        bool isHit = hbmp && !entry->outOfDate && entry->zoom == dm->ZoomReal();
+        TraceTile(isHit ? Trace_Hit : Trace_Miss, dm, pageNo, NormalizeRotation(dm->Rotation()), dm->ZoomReal(), tile);
+    }
 
     if (!hbmp) {
-        if (entry && !(renderedBmp && ReduceTileSize()))
+        if (entry && !(renderedBmp && ReduceTileSize(dm, pageNo)))
             renderDelay = RENDER_DELAY_FAILED;
         else if (0 == renderDelay)
             renderDelay = 1;
@@ -630,6 +845,8 @@ UINT RenderCache::PaintTile(HDC hdc, RectI bounds, DisplayModel *dm, int pageNo,
         return renderDelay;
     }
 
+    // tile bitmaps might be patched by the rendering thread
+    ScopedCritSec scope(&cacheAccess);
     HDC bmpDC = CreateCompatibleDC(hdc);
     if (bmpDC) {
         SizeI bmpSize = renderedBmp->Size();
@@ -677,10 +894,19 @@ static int cmpTilePosition(const void *a, const void *b)
 UINT RenderCache::Paint(HDC hdc, RectI bounds, DisplayModel *dm, int pageNo,
                         PageInfo *pageInfo, bool *renderOutOfDateCue)
 {
-    assert(pageInfo->shown && 0.0 != pageInfo->visibleRatio);
+    assert(dm->PageShown(pageNo) && 0.0 != pageInfo->visibleRatio);
+
+    if (trace) {
+        // record the view state which led to this paint (for replaying)
+        SizeI size = dm->GetTotalViewPortSize();
+        RectD viewPort(dm->viewPort.x, dm->viewPort.y, size.dx, size.dy);
+        trace->Record(Trace_Paint, dm, pageNo, dm->Rotation(), dm->ZoomVirtual(),
+                      (USHORT)dm->ScreenDPI(), 0, 0, &viewPort, dm->GetDisplayMode());
+    }
 
     int rotation = dm->Rotation();
     float zoom = dm->ZoomReal();
+    RectI pageOnScreen = dm->PageOnScreen(pageNo);
     USHORT targetRes = GetTileRes(dm, pageNo);
     USHORT maxRes = GetMaxTileRes(dm, pageNo, rotation);
     if (maxRes < targetRes)
@@ -694,8 +920,8 @@ UINT RenderCache::Paint(HDC hdc, RectI bounds, DisplayModel *dm, int pageNo,
     while (queue.Count() > 0) {
         TilePosition tile = queue.At(0);
         queue.RemoveAt(0);
-        RectI tileOnScreen = GetTileOnScreen(dm->engine, pageNo, rotation, zoom, tile, pageInfo->pageOnScreen);
-        tileOnScreen = pageInfo->pageOnScreen.Intersect(tileOnScreen);
+        RectI tileOnScreen = GetTileOnScreen(dm->engine, pageNo, rotation, zoom, tile, pageOnScreen);
+        tileOnScreen = pageOnScreen.Intersect(tileOnScreen);
         RectI isect = bounds.Intersect(tileOnScreen);
         if (isect.IsEmpty())
             continue;
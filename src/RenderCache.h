@@ -5,6 +5,7 @@
 #define RenderCache_h
 
 #include "DisplayModel.h"
+#include "RenderTrace.h"
 
 #define RENDER_DELAY_UNDEFINED ((UINT)-1)
 #define RENDER_DELAY_FAILED    ((UINT)-2)
@@ -40,10 +41,13 @@ struct BitmapCacheEntry {
     // owned by the BitmapCacheEntry
     RenderedBitmap * bitmap;
     bool             outOfDate;
+    // number of queued patches (the tile is up to date once the last one has landed)
+    int              pendingPatches;
     int              refs;
 
     BitmapCacheEntry(DisplayModel *dm, int pageNo, int rotation, float zoom, TilePosition tile, RenderedBitmap *bitmap) :
-        dm(dm), pageNo(pageNo), rotation(rotation), zoom(zoom), tile(tile), bitmap(bitmap), outOfDate(false), refs(1) { }
+        dm(dm), pageNo(pageNo), rotation(rotation), zoom(zoom), tile(tile), bitmap(bitmap), outOfDate(false),
+        pendingPatches(0), refs(1) { }
     ~BitmapCacheEntry() { delete bitmap; }
 };
 
@@ -58,6 +62,8 @@ struct PageRenderRequest {
     TilePosition        tile;
 
     RectD               pageRect; // calculated from TilePosition
+    // if set, only pageRect is rendered and copied into the cached tile
+    bool                patch;
     bool                abort;
     AbortCookie *       abortCookie;
     DWORD               timestamp;
@@ -66,12 +72,29 @@ struct PageRenderRequest {
     RenderingCallback * renderCb;
 };
 
+/* Measured rendering cost of a page, used for choosing the page's tile size:
+   cheap pages are rendered in large tiles, while expensive pages are split
+   into smaller tiles which can be aborted and replaced more quickly. */
+struct PageRenderCost {
+    DisplayModel *  dm;
+    int             pageNo;
+    // exponential moving average of the time it takes to render a megapixel
+    float           msPerMegapixel;
+    int             samples;
+    // additional tile subdivisions after renderings failed for this page
+    USHORT          extraRes;
+    DWORD           lastUsed;
+};
+
 #define MAX_PAGE_REQUESTS 8
 
 // keep this value reasonably low, else we'll run
 // out of GDI memory when caching many larger bitmaps
 #define MAX_BITMAPS_CACHED 64
 
+// number of pages for which rendering costs are remembered
+#define MAX_PAGE_COSTS 64
+
 class RenderCache
 {
 private:
@@ -90,9 +113,16 @@ private:
     SizeI               maxTileSize;
     bool                isRemoteSession;
 
+    // protected by cacheAccess
+    PageRenderCost      costs[MAX_PAGE_COSTS];
+    int                 costCount;
+
 public:
     COLORREF            textColor;
     COLORREF            backgroundColor;
+    // if set, all requests, cache hits and renderings are recorded
+    // (owned by the RenderCache)
+    RenderTrace *       trace;
 
     RenderCache();
     ~RenderCache();
@@ -103,7 +133,7 @@ public:
     void    CancelRendering(DisplayModel *dm);
     bool    Exists(DisplayModel *dm, int pageNo, int rotation,
                    float zoom=INVALID_ZOOM, TilePosition *tile=NULL);
-    void    FreeForDisplayModel(DisplayModel *dm) { FreePage(dm); }
+    void    FreeForDisplayModel(DisplayModel *dm) { FreePage(dm); FreeRenderCosts(dm); }
     void    KeepForDisplayModel(DisplayModel *oldDm, DisplayModel *newDm);
     void    Invalidate(DisplayModel *dm, int pageNo, RectD rect);
     // returns how much time in ms has past since the most recent rendering
@@ -119,11 +149,16 @@ protected:
     bool    ClearCurrentRequest();
     bool    GetNextRequest(PageRenderRequest *req);
     void    Add(PageRenderRequest &req, RenderedBitmap *bitmap);
+    void    Patch(PageRenderRequest &req, RenderedBitmap *bitmap);
+    void    RecordRenderCost(PageRenderRequest &req, RenderedBitmap *bitmap, DWORD renderTime);
 
 private:
     USHORT  GetTileRes(DisplayModel *dm, int pageNo);
     USHORT  GetMaxTileRes(DisplayModel *dm, int pageNo, int rotation);
-    bool    ReduceTileSize();
+    bool    ReduceTileSize(DisplayModel *dm, int pageNo);
+
+    PageRenderCost *GetRenderCost(DisplayModel *dm, int pageNo, bool create=false);
+    void    FreeRenderCosts(DisplayModel *dm);
 
     bool    IsRenderQueueFull() const {
                 return requestCount == MAX_PAGE_REQUESTS;
@@ -136,6 +171,8 @@ private:
     void    ClearQueueForDisplayModel(DisplayModel *dm, int pageNo=INVALID_PAGE_NO,
                                       TilePosition *tile=NULL);
     void    AbortCurrentRequest();
+    void    TraceTile(RenderTraceEvent event, DisplayModel *dm, int pageNo, int rotation, float zoom,
+                      TilePosition tile, RectD *pageRect=NULL, DWORD param=0);
 
     static DWORD WINAPI RenderCacheThread(LPVOID data);
 
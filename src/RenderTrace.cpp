@@ -0,0 +1,185 @@
+/* Copyright 2013 the SumatraPDF project authors (see AUTHORS file).
+   License: GPLv3 */
+
+#include "BaseUtil.h"
+#include "RenderTrace.h"
+
+#include "FileUtil.h"
+
+// flush recorded events to disk in batches
+#define MAX_PENDING_RECORDS 1024
+
+RenderTrace::RenderTrace(const WCHAR *filePath) : file(NULL), inMemory(!filePath)
+{
+    InitializeCriticalSection(&access);
+    startTime = GetTickCount();
+    if (inMemory)
+        return;
+    if (_wfopen_s(&file, filePath, L"wb") != 0) {
+        file = NULL;
+        return;
+    }
+    DWORD version = RENDER_TRACE_VERSION;
+    fwrite(RENDER_TRACE_MAGIC, 1, 8, file);
+    fwrite(&version, sizeof(version), 1, file);
+}
+
+RenderTrace::~RenderTrace()
+{
+    Flush();
+    if (file)
+        fclose(file);
+    DeleteCriticalSection(&access);
+}
+
+void RenderTrace::Record(RenderTraceEvent event, void *doc, int pageNo, int rotation, float zoom,
+                         USHORT res, USHORT row, USHORT col, RectD *rect, DWORD param)
+{
+    ScopedCritSec scope(&access);
+    if (!IsRecording())
+        return;
+
+    RenderTraceRecord rec = { 0 };
+    rec.time = GetTickCount() - startTime;
+    rec.event = (BYTE)event;
+    int docId = docs.Find(doc);
+    if (-1 == docId) {
+        docId = (int)docs.Count();
+        docs.Append(doc);
+    }
+    rec.docId = (BYTE)min(docId, 255);
+    rec.rotation = (USHORT)rotation;
+    rec.pageNo = pageNo;
+    rec.zoom = zoom;
+    rec.res = res;
+    rec.row = row;
+    rec.col = col;
+    if (rect) {
+        rec.x = (float)rect->x;
+        rec.y = (float)rect->y;
+        rec.dx = (float)rect->dx;
+        rec.dy = (float)rect->dy;
+    }
+    rec.param = param;
+    pending.Append(rec);
+
+    if (file && pending.Count() >= MAX_PENDING_RECORDS)
+        Flush();
+}
+
+void RenderTrace::Flush()
+{
+    ScopedCritSec scope(&access);
+    if (inMemory)
+        return;
+    if (file && pending.Count() > 0) {
+        fwrite(pending.LendData(), sizeof(RenderTraceRecord), pending.Count(), file);
+        fflush(file);
+    }
+    pending.Reset();
+}
+
+void RenderTrace::GetRecords(Vec<RenderTraceRecord>& records)
+{
+    ScopedCritSec scope(&access);
+    records.Append(pending.LendData(), pending.Count());
+    pending.Reset();
+}
+
+Vec<RenderTraceRecord> *LoadRenderTrace(const WCHAR *filePath)
+{
+    size_t len;
+    ScopedMem<char> data(file::ReadAll(filePath, &len));
+    size_t headerLen = 8 + sizeof(DWORD);
+    if (!data || len < headerLen || !str::StartsWith(data.Get(), RENDER_TRACE_MAGIC))
+        return NULL;
+    if (*(DWORD *)(data + 8) != RENDER_TRACE_VERSION)
+        return NULL;
+
+    size_t count = (len - headerLen) / sizeof(RenderTraceRecord);
+    Vec<RenderTraceRecord> *records = new Vec<RenderTraceRecord>(count);
+    records->Append((RenderTraceRecord *)(data + headerLen), count);
+    return records;
+}
+
+static int cmpDouble(const void *a, const void *b)
+{
+    double da = *(const double *)a, db = *(const double *)b;
+    return da < db ? -1 : da > db ? 1 : 0;
+}
+
+static double GetPercentile(Vec<double>& sorted, int percent)
+{
+    if (0 == sorted.Count())
+        return 0;
+    size_t idx = (sorted.Count() * percent + 99) / 100;
+    return sorted.At(limitValue(idx, (size_t)1, sorted.Count()) - 1);
+}
+
+void AnalyzeRenderTrace(Vec<RenderTraceRecord>& records, RenderTraceStats *stats)
+{
+    ZeroMemory(stats, sizeof(*stats));
+    Vec<double> latencies, renderTimes;
+    // rendered tiles which haven't been painted yet
+    Vec<RenderTraceRecord> unpainted;
+    // requested tiles which haven't been painted yet
+    Vec<RenderTraceRecord> waiting;
+
+    for (size_t i = 0; i < records.Count(); i++) {
+        RenderTraceRecord& rec = records.At(i);
+        switch (rec.event) {
+        case Trace_Request:
+            stats->requests++;
+            waiting.Append(rec);
+            break;
+        case Trace_Hit:
+            stats->hits++;
+            for (size_t j = waiting.Count(); j > 0; j--) {
+                if (waiting.At(j - 1).SameTile(rec)) {
+                    latencies.Append(rec.time - waiting.At(j - 1).time);
+                    waiting.RemoveAt(j - 1);
+                }
+            }
+            for (size_t j = unpainted.Count(); j > 0; j--) {
+                if (unpainted.At(j - 1).SameTile(rec))
+                    unpainted.RemoveAt(j - 1);
+            }
+            break;
+        case Trace_Miss:
+            stats->misses++;
+            break;
+        case Trace_RenderDone:
+            stats->renders++;
+            renderTimes.Append(rec.param);
+            unpainted.Append(rec);
+            break;
+        case Trace_RenderAbort:
+            stats->aborts++;
+            break;
+        case Trace_Cancel:
+        case Trace_Evict:
+            for (size_t j = unpainted.Count(); j > 0; j--) {
+                RenderTraceRecord& tile = unpainted.At(j - 1);
+                if (tile.docId == rec.docId && (Trace_Cancel == rec.event || tile.SameTile(rec))) {
+                    stats->wastedRenders++;
+                    unpainted.RemoveAt(j - 1);
+                }
+            }
+            break;
+        }
+    }
+    // tiles rendered but never painted until the end of the trace
+    stats->wastedRenders += unpainted.Count();
+
+    latencies.Sort(cmpDouble);
+    stats->latencyP50 = GetPercentile(latencies, 50);
+    stats->latencyP90 = GetPercentile(latencies, 90);
+    stats->latencyP99 = GetPercentile(latencies, 99);
+    stats->latencyMax = GetPercentile(latencies, 100);
+
+    renderTimes.Sort(cmpDouble);
+    stats->renderP50 = GetPercentile(renderTimes, 50);
+    stats->renderP90 = GetPercentile(renderTimes, 90);
+    stats->renderP99 = GetPercentile(renderTimes, 99);
+    stats->renderMax = GetPercentile(renderTimes, 100);
+}
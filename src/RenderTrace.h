@@ -0,0 +1,97 @@
+/* Copyright 2013 the SumatraPDF project authors (see AUTHORS file).
+   License: GPLv3 */
+
+#ifndef RenderTrace_h
+#define RenderTrace_h
+
+/* A render trace is a compact binary log of what RenderCache was asked
+   to do and how long it took. It allows to reproduce scrolling and zooming
+   issues and to benchmark changes to the rendering pipeline (see
+   ReplayRenderTrace and SumatraPDF's -replay-render-trace option).
+
+   Note: replaying drives DisplayModel and RenderCache, which render into
+   GDI bitmaps, so traces can only be replayed on Windows (e.g. on the
+   build machine, but not in a Linux CI job). */
+
+#define RENDER_TRACE_MAGIC      "SumTrace"
+#define RENDER_TRACE_VERSION    2
+
+enum RenderTraceEvent {
+    Trace_Request = 1,  // a tile was queued for rendering
+    Trace_Hit,          // a tile was painted from an up-to-date cache entry
+    Trace_Miss,         // a tile was painted from a replacement or not at all
+    Trace_RenderStart,  // a tile is about to be rendered
+    Trace_RenderDone,   // a tile has been rendered (param: time in ms)
+    Trace_RenderAbort,  // a tile's rendering has been aborted (param: time in ms)
+    Trace_Cancel,       // all requests for a document have been cancelled
+    Trace_Evict,        // a tile has been dropped from the cache
+    // a page is about to be painted (zoom: virtual zoom level, res: screen dpi,
+    // rect: view port, param: display mode) - this is what's being replayed
+    Trace_Paint,
+};
+
+#pragma pack(push, 1)
+struct RenderTraceRecord {
+    DWORD   time;       // in ms since the start of recording
+    BYTE    event;      // RenderTraceEvent
+    BYTE    docId;      // index of the document in order of appearance
+    USHORT  rotation;
+    int     pageNo;
+    float   zoom;
+    USHORT  res, row, col;
+    USHORT  reserved;
+    // the rendered area in user space (for replaying)
+    float   x, y, dx, dy;
+    DWORD   param;
+
+    bool SameTile(const RenderTraceRecord& other) const {
+        return docId == other.docId && pageNo == other.pageNo &&
+               rotation == other.rotation && zoom == other.zoom &&
+               res == other.res && row == other.row && col == other.col;
+    }
+};
+#pragma pack(pop)
+
+class RenderTrace {
+    CRITICAL_SECTION            access;
+    FILE *                      file;
+    // records are kept in memory (instead of being
+    // written to a file) until they're retrieved
+    bool                        inMemory;
+    DWORD                       startTime;
+    Vec<RenderTraceRecord>      pending;
+    Vec<void *>                 docs;
+
+public:
+    // records into memory if filePath is NULL (see GetRecords)
+    explicit RenderTrace(const WCHAR *filePath=NULL);
+    ~RenderTrace();
+
+    bool IsRecording() const { return file != NULL || inMemory; }
+    // doc is an opaque identifier (e.g. the DisplayModel) for telling
+    // records for different documents apart
+    void Record(RenderTraceEvent event, void *doc, int pageNo, int rotation, float zoom,
+                USHORT res=0, USHORT row=0, USHORT col=0, RectD *rect=NULL, DWORD param=0);
+    void Flush();
+    // moves all records recorded into memory so far into records
+    void GetRecords(Vec<RenderTraceRecord>& records);
+};
+
+struct RenderTraceStats {
+    size_t  requests;
+    size_t  hits, misses;
+    size_t  renders, aborts;
+    // rendered tiles which were evicted or cancelled before being painted
+    size_t  wastedRenders;
+    // time from a tile's request until it's first painted from cache
+    double  latencyP50, latencyP90, latencyP99, latencyMax;
+    // rendering times as recorded resp. as replayed
+    double  renderP50, renderP90, renderP99, renderMax;
+
+    double HitRate() const { return hits + misses > 0 ? 1.0 * hits / (hits + misses) : 0; }
+};
+
+Vec<RenderTraceRecord> *LoadRenderTrace(const WCHAR *filePath);
+void AnalyzeRenderTrace(Vec<RenderTraceRecord>& records, RenderTraceStats *stats);
+
+#endif
@@ -29,11 +29,11 @@ Vec<SelectionOnPage> *SelectionOnPage::FromRectangle(DisplayModel *dm, RectI rec
 
     for (int pageNo = dm->PageCount(); pageNo >= 1; --pageNo) {
         PageInfo *pageInfo = dm->GetPageInfo(pageNo);
-        assert(!pageInfo || 0.0 == pageInfo->visibleRatio || pageInfo->shown);
-        if (!pageInfo || !pageInfo->shown)
+        assert(!pageInfo || 0.0 == pageInfo->visibleRatio || dm->PageShown(pageNo));
+        if (!pageInfo || !dm->PageShown(pageNo))
             continue;
 
-        RectI intersect = rect.Intersect(pageInfo->pageOnScreen);
+        RectI intersect = rect.Intersect(dm->PageOnScreen(pageNo));
         if (intersect.IsEmpty())
             continue;
 
@@ -195,7 +195,7 @@ void ZoomToSelection(WindowInfo *win, float factor, bool scrollToFit, bool relat
         int page = win->dm->FirstVisiblePageNo();
         PageInfo *pageInfo = win->dm->GetPageInfo(page);
         if (pageInfo) {
-            RectI visible = pageInfo->pageOnScreen.Intersect(win->canvasRc);
+            RectI visible = win->dm->PageOnScreen(page).Intersect(win->canvasRc);
             pt = visible.TL();
 
             int pageNo = win->dm->GetPageNoByPoint(pt);
@@ -288,9 +288,9 @@ void OnSelectAll(WindowInfo *win, bool textOnly)
 
     if (textOnly) {
         int pageNo;
-        for (pageNo = 1; !win->dm->GetPageInfo(pageNo)->shown; pageNo++);
+        for (pageNo = 1; !win->dm->PageShown(pageNo); pageNo++);
         win->dm->textSelection->StartAt(pageNo, 0);
-        for (pageNo = win->dm->PageCount(); !win->dm->GetPageInfo(pageNo)->shown; pageNo--);
+        for (pageNo = win->dm->PageCount(); !win->dm->PageShown(pageNo); pageNo--);
         win->dm->textSelection->SelectUpTo(pageNo, -1);
         win->selectionRect = RectI::FromXY(INT_MIN / 2, INT_MIN / 2, INT_MAX, INT_MAX);
         UpdateTextSelection(win);
@@ -193,6 +193,163 @@ void BenchFileOrDir(WStrVec& pathsToBench)
     delete gLog;
 }
 
+// drives a DisplayModel like a window would, except that
+// painting only ever happens when a render trace says so
+class ReplayWindow : public DisplayModelCallback {
+    RenderCache *renderCache;
+
+public:
+    DisplayModel *dm;
+
+    explicit ReplayWindow(RenderCache *renderCache) : renderCache(renderCache), dm(NULL) { }
+
+    virtual void PageNoChanged(int pageNo) { }
+    virtual void LaunchBrowser(const WCHAR *url) { }
+    virtual void FocusFrame(bool always) { }
+    virtual void Repaint() { }
+    virtual void UpdateScrollbars(SizeI canvas) { }
+    virtual void RequestRendering(int pageNo) {
+        if (dm)
+            renderCache->RequestRendering(dm, pageNo);
+    }
+    virtual void CleanUp(DisplayModel *dm) {
+        renderCache->CancelRendering(dm);
+        renderCache->FreeForDisplayModel(dm);
+    }
+};
+
+// repeats all recorded paints at the recorded time and view settings, so that
+// renderCache gets to decide anew what to render, keep and evict; collects what
+// it did into replayed. The DisplayModel takes ownership of the engine.
+static bool ReplayPaints(Vec<RenderTraceRecord>& records, BaseEngine *engine, DocType engineType,
+                         RenderCache *renderCache, Vec<RenderTraceRecord>& replayed)
+{
+    RenderTraceRecord *view = NULL;
+    for (size_t i = 0; i < records.Count() && !view; i++) {
+        if (Trace_Paint == records.At(i).event && engine->PageCount() >= records.At(i).pageNo)
+            view = &records.At(i);
+    }
+    if (!view) {
+        delete engine;
+        return false;
+    }
+
+    ReplayWindow win(renderCache);
+    DisplayModel *dm = new DisplayModel(engine, engineType, &win);
+    SizeI viewPortSize((int)view->dx, (int)view->dy);
+    dm->SetInitialViewSettings((DisplayMode)view->param, view->pageNo, viewPortSize, view->res);
+    dm->Relayout(view->zoom, view->rotation);
+    win.dm = dm;
+
+    HDC hdcScreen = GetDC(NULL);
+    HDC hdc = CreateCompatibleDC(hdcScreen);
+    HBITMAP hbmp = CreateCompatibleBitmap(hdcScreen, viewPortSize.dx, viewPortSize.dy);
+    HGDIOBJ oldBmp = SelectObject(hdc, hbmp);
+
+    RenderTrace *prevTrace = renderCache->trace;
+    renderCache->trace = new RenderTrace();
+    DWORD start = GetTickCount();
+
+    for (size_t i = 0; i < records.Count(); i++) {
+        RenderTraceRecord& rec = records.At(i);
+        if (rec.event != Trace_Paint || !dm->ValidPageNo(rec.pageNo))
+            continue;
+        // paint when the recorded paint happened so that the rendering thread
+        // gets as much (or as little) time to keep up as when recording
+        DWORD elapsed = GetTickCount() - start;
+        if (rec.time > elapsed)
+            Sleep(rec.time - elapsed);
+
+        bool relayout = false;
+        SizeI size((int)rec.dx, (int)rec.dy);
+        if (size != viewPortSize) {
+            dm->ChangeViewPortSize(size);
+            viewPortSize = size;
+            relayout = true;
+        }
+        if ((DisplayMode)rec.param != dm->GetDisplayMode()) {
+            dm->ChangeDisplayMode((DisplayMode)rec.param);
+            relayout = true;
+        }
+        if (rec.zoom != dm->ZoomVirtual() || rec.rotation != dm->Rotation()) {
+            dm->Relayout(rec.zoom, rec.rotation);
+            relayout = true;
+        }
+        if (relayout || (int)rec.x != dm->viewPort.x)
+            dm->ScrollXTo((int)rec.x);
+        // also requests the rendering of visible and predicted pages
+        if (relayout || (int)rec.y != dm->viewPort.y)
+            dm->ScrollYTo((int)rec.y);
+
+        PageInfo *pageInfo = dm->GetPageInfo(rec.pageNo);
+        if (!pageInfo || !dm->PageShown(rec.pageNo) || 0.0f == pageInfo->visibleRatio)
+            continue;
+        RectI screen(PointI(), dm->viewPort.Size());
+        RectI bounds = dm->PageOnScreen(rec.pageNo).Intersect(screen);
+        renderCache->Paint(hdc, bounds, dm, rec.pageNo, pageInfo, NULL);
+    }
+
+    // cancels all pending renderings and frees all cached tiles
+    delete dm;
+    renderCache->trace->GetRecords(replayed);
+    delete renderCache->trace;
+    renderCache->trace = prevTrace;
+
+    SelectObject(hdc, oldBmp);
+    DeleteObject(hbmp);
+    DeleteDC(hdc);
+    ReleaseDC(NULL, hdcScreen);
+    return true;
+}
+
+static void LogRenderTraceStats(const WCHAR *label, RenderTraceStats& stats)
+{
+    logbench("%s: %d requests, %d renderings (%d aborted, %d never painted)", label,
+             (int)stats.requests, (int)stats.renders, (int)stats.aborts, (int)stats.wastedRenders);
+    logbench("%s: cache hit rate %.1f%% (%d hits, %d misses)", label,
+             stats.HitRate() * 100, (int)stats.hits, (int)stats.misses);
+    logbench("%s: paint latency (ms) p50 %.0f, p90 %.0f, p99 %.0f, max %.0f", label,
+             stats.latencyP50, stats.latencyP90, stats.latencyP99, stats.latencyMax);
+    logbench("%s: rendering (ms) p50 %.0f, p90 %.0f, p99 %.0f, max %.0f", label,
+             stats.renderP50, stats.renderP90, stats.renderP99, stats.renderMax);
+}
+
+void ReplayRenderTrace(const WCHAR *tracePath, const WCHAR *filePath, RenderCache *renderCache)
+{
+    gLog = new slog::StderrLogger();
+
+    Vec<RenderTraceRecord> *records = LoadRenderTrace(tracePath);
+    if (!records) {
+        logbench("Error: failed to load the render trace %s", tracePath);
+        delete gLog;
+        return;
+    }
+    // only the first traced document is replayed
+    Vec<RenderTraceRecord> recorded;
+    for (size_t i = 0; i < records->Count(); i++) {
+        if (0 == records->At(i).docId)
+            recorded.Append(records->At(i));
+    }
+    delete records;
+
+    DocType engineType;
+    BaseEngine *engine = EngineManager::CreateEngine(filePath, NULL, &engineType, true);
+    Vec<RenderTraceRecord> replayed;
+    if (!engine)
+        logbench("Error: failed to load %s", filePath);
+    else if (!ReplayPaints(recorded, engine, engineType, renderCache, replayed))
+        logbench("Error: the render trace contains no paints for %s", filePath);
+    else {
+        RenderTraceStats stats;
+        AnalyzeRenderTrace(recorded, &stats);
+        LogRenderTraceStats(L"recorded", stats);
+        AnalyzeRenderTrace(replayed, &stats);
+        LogRenderTraceStats(L"replayed", stats);
+    }
+
+    delete gLog;
+}
+
 inline bool IsSpecialDir(const WCHAR *s)
 {
     return str::Eq(s, L".") || str::Eq(s, L"..");
@@ -13,6 +13,8 @@ class WindowInfo;
 class RenderCache;
 class CommandLineInfo;
 
+void ReplayRenderTrace(const WCHAR *tracePath, const WCHAR *filePath, RenderCache *renderCache);
+
 void StartStressTest(CommandLineInfo *, WindowInfo *, RenderCache *);
 
 void OnStressTestTimer(WindowInfo *win, int timerId);
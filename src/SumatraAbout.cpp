@@ -13,6 +13,7 @@ using namespace Gdiplus;
 #include "PdfEngine.h"
 #include "resource.h"
 #include "SumatraPDF.h"
+#include "ThumbnailCache.h"
 #include "Translations.h"
 #include "Version.h"
 #include "WindowInfo.h"
@@ -710,31 +711,66 @@ void DrawStartPage(WindowInfo& win, HDC hdc, FileHistory& fileHistory, COLORREF
     DeleteObject(penLinkLine);
 }
 
-// TODO: create in TEMP directory instead?
-static WCHAR *GetThumbnailPath(const WCHAR *filePath)
-{
-    // create a fingerprint of a (normalized) path for the file name
-    // I'd have liked to also include the file's last modification time
-    // in the fingerprint (much quicker than hashing the entire file's
-    // content), but that's too expensive for files on slow drives
-    unsigned char digest[16];
-    ScopedMem<char> pathU(str::conv::ToUtf8(filePath));
-    if (!pathU)
-        return NULL;
-    if (path::HasVariableDriveLetter(filePath))
-        pathU[0] = '?'; // ignore the drive letter, if it might change
-    CalcMD5Digest((unsigned char *)pathU.Get(), str::Len(pathU), digest);
-    ScopedMem<char> fingerPrint(str::MemToHex(digest, 16));
+#define THUMBNAILS_PAGE_NO      1
+// digests are remembered for the frequently used documents (with some room to spare)
+#define THUMBNAILS_MAX_DIGESTS  (FILE_HISTORY_MAX_FREQUENT * 3)
+
+// content digests of the files shown on the start page, so that a file doesn't
+// have to be hashed again whenever the start page is redrawn
+// (only ever accessed from the UI thread)
+class ThumbnailDigests {
+    struct Digest {
+        WCHAR *         filePath;
+        FILETIME        modified;
+        unsigned char   digest[16];
+    };
+    Vec<Digest> digests;
+
+public:
+    ~ThumbnailDigests() {
+        for (size_t i = 0; i < digests.Count(); i++) {
+            free(digests.At(i).filePath);
+        }
+    }
 
-    ScopedMem<WCHAR> thumbsPath(AppGenDataFilename(THUMBNAILS_DIR_NAME));
-    if (!thumbsPath)
-        return NULL;
-    ScopedMem<WCHAR> fname(str::conv::FromAnsi(fingerPrint));
+    bool Get(const WCHAR *filePath, unsigned char digest[16]) {
+        FILETIME modified = file::GetModificationTime(filePath);
+        for (size_t i = 0; i < digests.Count(); i++) {
+            Digest& d = digests.At(i);
+            if (!str::EqI(d.filePath, filePath))
+                continue;
+            if (CompareFileTime(&modified, &d.modified) == 0) {
+                memcpy(digest, d.digest, 16);
+                return true;
+            }
+            free(d.filePath);
+            digests.RemoveAt(i);
+            break;
+        }
 
-    return str::Format(L"%s\\%s.png", thumbsPath, fname);
+        if (!CalcThumbnailDigest(filePath, digest))
+            return false;
+        if (digests.Count() >= THUMBNAILS_MAX_DIGESTS) {
+            free(digests.At(0).filePath);
+            digests.RemoveAt(0);
+        }
+        Digest d = { str::Dup(filePath), modified };
+        memcpy(d.digest, digest, 16);
+        digests.Append(d);
+        return true;
+    }
+};
+
+static ThumbnailDigests gThumbnailDigests;
+
+static bool GetThumbnailDigest(const WCHAR *filePath, unsigned char digest[16])
+{
+    return gThumbnailDigests.Get(filePath, digest);
 }
 
-// removes thumbnails that don't belong to any frequently used item in file history
+// removes thumbnails stored as individual files by older versions
+// (thumbnails are now kept in the shared thumbnail cache, which drops
+// the least recently used ones by itself)
 void CleanUpThumbnailCache(FileHistory& fileHistory)
 {
     ScopedMem<WCHAR> thumbsPath(AppGenDataFilename(THUMBNAILS_DIR_NAME));
@@ -742,68 +778,37 @@ void CleanUpThumbnailCache(FileHistory& fileHistory)
         return;
     ScopedMem<WCHAR> pattern(path::Join(thumbsPath, L"*.png"));
 
-    WStrVec files;
     WIN32_FIND_DATA fdata;
-
     HANDLE hfind = FindFirstFile(pattern, &fdata);
-    if (INVALID_HANDLE_VALUE == hfind)
-        return;
-    do {
-        if (!(fdata.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
-            files.Append(str::Dup(fdata.cFileName));
-    } while (FindNextFile(hfind, &fdata));
-    FindClose(hfind);
-
-    Vec<DisplayState *> list;
-    fileHistory.GetFrequencyOrder(list);
-    for (size_t i = 0; i < list.Count() && i < FILE_HISTORY_MAX_FREQUENT * 2; i++) {
-        ScopedMem<WCHAR> bmpPath(GetThumbnailPath(list.At(i)->filePath));
-        if (!bmpPath)
-            continue;
-        int idx = files.Find(path::GetBaseName(bmpPath));
-        if (idx != -1) {
-            CrashIf(idx < 0 || files.Count() <= (size_t)idx);
-            WCHAR *fileName = files.At(idx);
-            files.RemoveAt(idx);
-            free(fileName);
-        }
-    }
-
-    for (size_t i = 0; i < files.Count(); i++) {
-        ScopedMem<WCHAR> bmpPath(path::Join(thumbsPath, files.At(i)));
-        file::Delete(bmpPath);
+    if (INVALID_HANDLE_VALUE != hfind) {
+        do {
+            ScopedMem<WCHAR> bmpPath(path::Join(thumbsPath, fdata.cFileName));
+            if (!(fdata.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+                file::Delete(bmpPath);
+        } while (FindNextFile(hfind, &fdata));
+        FindClose(hfind);
     }
 }
 
-static RenderedBitmap *LoadRenderedBitmap(const WCHAR *filePath)
-{
-    size_t len;
-    ScopedMem<char> data(file::ReadAll(filePath, &len));
-    if (!data)
-        return NULL;
-    Bitmap *bmp = BitmapFromData(data, len);
-    if (!bmp)
-        return NULL;
-
-    HBITMAP hbmp;
-    RenderedBitmap *rendered = NULL;
-    if (bmp->GetHBITMAP((ARGB)Color::White, &hbmp) == Ok)
-        rendered = new RenderedBitmap(hbmp, SizeI(bmp->GetWidth(), bmp->GetHeight()));
-    delete bmp;
-
-    return rendered;
-}
-
 static bool LoadThumbnail(DisplayState& ds)
 {
     delete ds.thumbnail;
     ds.thumbnail = NULL;
 
-    ScopedMem<WCHAR> bmpPath(GetThumbnailPath(ds.filePath));
-    if (!bmpPath)
+    unsigned char digest[16];
+    ThumbnailCache *cache = GetSharedThumbnailCache();
+    if (!cache || !GetThumbnailDigest(ds.filePath, digest))
+        return false;
+
+    size_t len;
+    ScopedMem<char> data(cache->Load(digest, THUMBNAILS_PAGE_NO, SizeI(THUMBNAIL_DX, THUMBNAIL_DY), &len));
+    if (!data)
         return false;
 
-    ds.thumbnail = LoadRenderedBitmap(bmpPath);
+    SizeI size;
+    HBITMAP hbmp = HBitmapFromData(data, len, &size);
+    if (hbmp)
+        ds.thumbnail = new RenderedBitmap(hbmp, size);
     return ds.thumbnail != NULL;
 }
 
@@ -812,13 +817,13 @@ bool HasThumbnail(DisplayState& ds)
     if (!ds.thumbnail && !LoadThumbnail(ds))
         return false;
 
-    ScopedMem<WCHAR> bmpPath(GetThumbnailPath(ds.filePath));
-    if (!bmpPath)
+    unsigned char digest[16];
+    ThumbnailCache *cache = GetSharedThumbnailCache();
+    if (!cache || !GetThumbnailDigest(ds.filePath, digest))
         return true;
-    FILETIME bmpTime = file::GetModificationTime(bmpPath);
-    FILETIME fileTime = file::GetModificationTime(ds.filePath);
-    // delete the thumbnail if the file is newer than the thumbnail
-    if (FileTimeDiffInSecs(fileTime, bmpTime) > 0) {
+    // delete the thumbnail if the file's content has changed
+    // (or if the thumbnail has been dropped from the cache)
+    if (!cache->Lookup(digest, THUMBNAILS_PAGE_NO, SizeI(THUMBNAIL_DX, THUMBNAIL_DY))) {
         delete ds.thumbnail;
         ds.thumbnail = NULL;
     }
@@ -831,16 +836,14 @@ void SaveThumbnail(DisplayState& ds)
     if (!ds.thumbnail)
         return;
 
-    ScopedMem<WCHAR> bmpPath(GetThumbnailPath(ds.filePath));
-    if (!bmpPath)
+    unsigned char digest[16];
+    ThumbnailCache *cache = GetSharedThumbnailCache();
+    if (!cache || !GetThumbnailDigest(ds.filePath, digest))
         return;
-    ScopedMem<WCHAR> thumbsPath(path::GetDir(bmpPath));
-    if (dir::Create(thumbsPath)) {
-        CrashIf(!str::EndsWithI(bmpPath, L".png"));
-        Bitmap bmp(ds.thumbnail->GetBitmap(), NULL);
-        CLSID tmpClsid = GetEncoderClsid(L"image/png");
-        bmp.Save(bmpPath, &tmpClsid);
-    }
+    size_t len;
+    ScopedMem<char> data(SerializeBitmapAsPng(ds.thumbnail->GetBitmap(), &len));
+    if (data)
+        cache->Save(digest, THUMBNAILS_PAGE_NO, SizeI(THUMBNAIL_DX, THUMBNAIL_DY), data, len);
 }
 
 void RemoveThumbnail(DisplayState& ds)
@@ -848,9 +851,10 @@ void RemoveThumbnail(DisplayState& ds)
     if (!HasThumbnail(ds))
         return;
 
-    ScopedMem<WCHAR> bmpPath(GetThumbnailPath(ds.filePath));
-    if (bmpPath)
-        file::Delete(bmpPath);
+    unsigned char digest[16];
+    ThumbnailCache *cache = GetSharedThumbnailCache();
+    if (cache && GetThumbnailDigest(ds.filePath, digest))
+        cache->Remove(digest, THUMBNAILS_PAGE_NO, SizeI(THUMBNAIL_DX, THUMBNAIL_DY));
     delete ds.thumbnail;
     ds.thumbnail = NULL;
 }
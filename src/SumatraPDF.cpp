@@ -1986,11 +1986,8 @@ static void DebugShowLinks(DisplayModel& dm, HDC hdc)
     HPEN pen = CreatePen(PS_SOLID, 1, RGB(0x00, 0xff, 0xff));
     HGDIOBJ oldPen = SelectObject(hdc, pen);
 
-    for (int pageNo = dm.PageCount(); pageNo >= 1; --pageNo) {
-        PageInfo *pageInfo = dm.GetPageInfo(pageNo);
-        if (!pageInfo || !pageInfo->shown || 0.0 == pageInfo->visibleRatio)
-            continue;
-
+    for (size_t i = dm.VisiblePages().Count(); i > 0; i--) {
+        int pageNo = dm.VisiblePages().At(i - 1);
         Vec<PageElement *> *els = dm.engine->GetElements(pageNo);
         if (els) {
             for (size_t i = 0; i < els->Count(); i++) {
@@ -2013,11 +2010,8 @@ static void DebugShowLinks(DisplayModel& dm, HDC hdc)
         pen = CreatePen(PS_SOLID, 1, RGB(0xff, 0x00, 0xff));
         oldPen = SelectObject(hdc, pen);
 
-        for (int pageNo = dm.PageCount(); pageNo >= 1; --pageNo) {
-            PageInfo *pageInfo = dm.GetPageInfo(pageNo);
-            if (!pageInfo->shown || 0.0 == pageInfo->visibleRatio)
-                continue;
-
+        for (size_t i = dm.VisiblePages().Count(); i > 0; i--) {
+            int pageNo = dm.VisiblePages().At(i - 1);
             RectI rect = dm.CvtToScreen(pageNo, dm.engine->PageContentBox(pageNo));
             PaintRect(hdc, rect);
         }
@@ -2100,24 +2094,24 @@ static void DrawDocument(WindowInfo& win, HDC hdc, RECT *rcArea)
     bool rendering = false;
     RectI screen(PointI(), dm->viewPort.Size());
 
-    for (int pageNo = 1; pageNo <= dm->PageCount(); ++pageNo) {
+    for (size_t i = 0; i < dm->VisiblePages().Count(); i++) {
+        int pageNo = dm->VisiblePages().At(i);
         PageInfo *pageInfo = dm->GetPageInfo(pageNo);
-        if (!pageInfo || 0.0f == pageInfo->visibleRatio)
-            continue;
-        assert(pageInfo->shown);
-        if (!pageInfo->shown)
+        assert(pageInfo && 0.0f != pageInfo->visibleRatio && dm->PageShown(pageNo));
+        if (!pageInfo)
             continue;
 
-        RectI bounds = pageInfo->pageOnScreen.Intersect(screen);
+        RectI pageOnScreen = dm->PageOnScreen(pageNo);
+        RectI bounds = pageOnScreen.Intersect(screen);
         // don't paint the frame background for images
         if (!(dm->engine && dm->engine->IsImageCollection()))
-            PaintPageFrameAndShadow(hdc, bounds, pageInfo->pageOnScreen, win.presentation);
+            PaintPageFrameAndShadow(hdc, bounds, pageOnScreen, win.presentation);
 
         bool renderOutOfDateCue = false;
         UINT renderDelay = 0;
         if (!DoCachePageRendering(&win, pageNo)) {
             if (dm->engine)
-                dm->engine->RenderPage(hdc, pageInfo->pageOnScreen, pageNo, dm->ZoomReal(pageNo), dm->Rotation());
+                dm->engine->RenderPage(hdc, pageOnScreen, pageNo, dm->ZoomReal(pageNo), dm->Rotation());
         }
         else
             renderDelay = gRenderCache.Paint(hdc, bounds, dm, pageNo, pageInfo, &renderOutOfDateCue);
@@ -3954,10 +3948,26 @@ static void FrameOnChar(WindowInfo& win, WPARAM key)
             for (size_t i = 0; i < win.selectionOnPage->Count(); i++) {
                 SelectionOnPage& sel = win.selectionOnPage->At(i);
                 win.userAnnots->Append(PageAnnotation(Annot_Highlight, sel.pageNo, sel.rect, PageAnnotation::Color(gGlobalPrefs->annotationDefaults.highlightColor, 0xCC)));
-                gRenderCache.Invalidate(win.dm, sel.pageNo, sel.rect);
             }
             win.userAnnotsModified = true;
             win.dm->engine->UpdateUserAnnotations(win.userAnnots);
+            // patches must only be rendered once the engine knows about the new annotations
+            // (and each page only has to be invalidated once)
+            for (size_t i = 0; i < win.selectionOnPage->Count(); i++) {
+                int pageNo = win.selectionOnPage->At(i).pageNo;
+                bool seen = false;
+                for (size_t j = 0; j < i && !seen; j++) {
+                    seen = win.selectionOnPage->At(j).pageNo == pageNo;
+                }
+                if (seen)
+                    continue;
+                RectD dirty;
+                for (size_t j = i; j < win.selectionOnPage->Count(); j++) {
+                    if (win.selectionOnPage->At(j).pageNo == pageNo)
+                        dirty = dirty.Union(win.selectionOnPage->At(j).rect);
+                }
+                gRenderCache.Invalidate(win.dm, pageNo, dirty);
+            }
             ClearSearchResult(&win); // causes invalidated tiles to be rerendered
         }
 #endif
@@ -353,6 +353,11 @@ int APIENTRY WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLi
         if (i.showConsole)
             system("pause");
     }
+    if (i.replayTracePath) {
+        ReplayRenderTrace(i.replayTracePath, i.replayFilePath, &gRenderCache);
+        if (i.showConsole)
+            system("pause");
+    }
     if (i.exitImmediately)
         goto Exit;
     gCrashOnOpen = i.crashOnOpen;
@@ -370,6 +375,8 @@ int APIENTRY WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLi
     gPolicyRestrictions = GetPolicies(i.restrictedUse);
     gRenderCache.textColor = i.textColor;
     gRenderCache.backgroundColor = i.backgroundColor;
+    if (i.renderTracePath)
+        gRenderCache.trace = new RenderTrace(i.renderTracePath);
     DebugGdiPlusDevice(gUseGdiRenderer);
 
     if (i.inverseSearchCmdLine) {
@@ -472,6 +479,8 @@ int APIENTRY WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLi
 
 Exit:
     prefs::UnregisterForFileChanges();
+    if (gRenderCache.trace)
+        gRenderCache.trace->Flush();
 
     while (gWindows.Count() > 0) {
         DeleteWindowInfo(gWindows.At(0));
@@ -323,8 +323,7 @@ void LinkHandler::ScrollTo(PageDestination *dest)
         if (DEST_USE_DEFAULT == rect.x)
             scroll.x = -1;
         if (DEST_USE_DEFAULT == rect.y) {
-            PageInfo *pageInfo = dm->GetPageInfo(dm->CurrentPageNo());
-            scroll.y = -(pageInfo->pageOnScreen.y - dm->GetWindowMargin()->top);
+            scroll.y = -(dm->PageOnScreen(dm->CurrentPageNo()).y - dm->GetWindowMargin()->top);
             scroll.y = max(scroll.y, 0); // Adobe Reader never shows the previous page
         }
     }
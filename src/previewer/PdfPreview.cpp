@@ -3,17 +3,50 @@
 
 #include "BaseUtil.h"
 #include "PdfPreview.h"
+#include "GdiPlusUtil.h"
+#include "PdfEngine.h"
+#include "ThumbnailCache.h"
 #include "WinUtil.h"
 
-IFACEMETHODIMP PreviewBase::GetThumbnail(UINT cx, HBITMAP *phbmp, WTS_ALPHATYPE *pdwAlpha)
+// renders the first page or loads it from the shared thumbnail cache
+RenderedBitmap *PreviewBase::GetThumbnailBitmap(UINT cx)
 {
+    // cached thumbnails are PNG images (not all previewers preload GDI+)
+    ScopedGdiPlus gdiPlus;
+    unsigned char digest[16];
+    size_t len;
+    ThumbnailCache *cache = CalcThumbnailDigest(m_pStream, digest) ? GetSharedThumbnailCache() : NULL;
+    if (cache) {
+        ScopedMem<char> pngData(cache->Load(digest, 1, SizeI(cx, cx), &len));
+        SizeI size;
+        HBITMAP hbmp = pngData ? HBitmapFromData(pngData, len, &size) : NULL;
+        if (hbmp)
+            return new RenderedBitmap(hbmp, size);
+    }
+
     BaseEngine *engine = GetEngine();
     if (!engine)
-        return E_FAIL;
+        return NULL;
 
     RectD page = engine->Transform(engine->PageMediabox(1), 1, 1.0, 0);
     float zoom = min(cx / (float)page.dx, cx / (float)page.dy) - 0.001f;
     RectI thumb = RectD(0, 0, page.dx * zoom, page.dy * zoom).Round();
+    page = engine->Transform(thumb.Convert<double>(), 1, zoom, 0, true);
+    RenderedBitmap *bmp = engine->RenderBitmap(1, zoom, 0, &page);
+
+    ScopedMem<char> pngData(bmp && cache ? SerializeBitmapAsPng(bmp->GetBitmap(), &len) : NULL);
+    if (pngData)
+        cache->Save(digest, 1, SizeI(cx, cx), pngData, len);
+
+    return bmp;
+}
+
+IFACEMETHODIMP PreviewBase::GetThumbnail(UINT cx, HBITMAP *phbmp, WTS_ALPHATYPE *pdwAlpha)
+{
+    RenderedBitmap *bmp = GetThumbnailBitmap(cx);
+    if (!bmp)
+        return E_FAIL;
+    RectI thumb(PointI(), bmp->Size());
 
     BITMAPINFO bmi = { 0 };
     bmi.bmiHeader.biSize = sizeof(bmi.bmiHeader);
@@ -25,14 +58,13 @@ IFACEMETHODIMP PreviewBase::GetThumbnail(UINT cx, HBITMAP *phbmp, WTS_ALPHATYPE
 
     unsigned char *bmpData = NULL;
     HBITMAP hthumb = CreateDIBSection(NULL, &bmi, DIB_RGB_COLORS, (void **)&bmpData, NULL, 0);
-    if (!hthumb)
+    if (!hthumb) {
+        delete bmp;
         return E_OUTOFMEMORY;
-
-    page = engine->Transform(thumb.Convert<double>(), 1, zoom, 0, true);
-    RenderedBitmap *bmp = engine->RenderBitmap(1, zoom, 0, &page);
+    }
 
     HDC hdc = GetDC(NULL);
-    if (bmp && GetDIBits(hdc, bmp->GetBitmap(), 0, thumb.dy, bmpData, &bmi, DIB_RGB_COLORS)) {
+    if (GetDIBits(hdc, bmp->GetBitmap(), 0, thumb.dy, bmpData, &bmi, DIB_RGB_COLORS)) {
         // cf. http://msdn.microsoft.com/en-us/library/bb774612(v=VS.85).aspx
         for (int i = 0; i < thumb.dx * thumb.dy; i++)
             bmpData[4 * i + 3] = 0xFF;
@@ -303,8 +335,6 @@ IFACEMETHODIMP PreviewBase::DoPreview()
     return S_OK;
 }
 
-#include "PdfEngine.h"
-
 BaseEngine *CPdfPreview::LoadEngine(IStream *stream)
 {
     return PdfEngine::CreateFromStream(stream);
@@ -233,6 +233,9 @@ protected:
     FILETIME    m_dateStamp;
 
     virtual BaseEngine *LoadEngine(IStream *stream) = 0;
+
+private:
+    RenderedBitmap *GetThumbnailBitmap(UINT cx);
 };
 
 class CPdfPreview : public PreviewBase {
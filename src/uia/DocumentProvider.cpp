@@ -311,7 +311,7 @@ HRESULT STDMETHODCALLTYPE SumatraUIAutomationDocumentProvider::GetVisibleRanges(
     SumatraUIAutomationPageProvider* it = child_first;
     while (it) {
         if (it->dm->GetPageInfo(it->pageNum) &&
-            it->dm->GetPageInfo(it->pageNum)->shown &&
+            it->dm->PageShown(it->pageNum) &&
             it->dm->GetPageInfo(it->pageNum)->visibleRatio > 0.0f) {
             rangeArray.Append(new SumatraUIAutomationTextRange(this, it->pageNum));
         }
@@ -503,3 +503,27 @@ CLSID GetEncoderClsid(const WCHAR *format)
     }
     return null;
 }
+
+// compresses a bitmap for storing it e.g. in a ThumbnailCache
+char *SerializeBitmapAsPng(HBITMAP hbmp, size_t *lenOut)
+{
+    ScopedComPtr<IStream> stream;
+    if (FAILED(CreateStreamOnHGlobal(NULL, TRUE, &stream)))
+        return NULL;
+    Bitmap bmp(hbmp, NULL);
+    CLSID pngClsid = GetEncoderClsid(L"image/png");
+    if (bmp.Save(stream, &pngClsid) != Ok)
+        return NULL;
+    return (char *)GetDataFromStream(stream, lenOut);
+}
+
+HBITMAP HBitmapFromData(const char *data, size_t len, SizeI *sizeOut)
+{
+    ScopedPtr<Bitmap> bmp(BitmapFromData(data, len));
+    HBITMAP hbmp;
+    if (!bmp || bmp->GetHBITMAP((ARGB)Color::White, &hbmp) != Ok)
+        return NULL;
+    if (sizeOut)
+        *sizeOut = SizeI(bmp->GetWidth(), bmp->GetHeight());
+    return hbmp;
+}
@@ -28,5 +28,8 @@ bool          IsGdiPlusNativeFormat(const char *data, size_t len);
 Bitmap *      BitmapFromData(const char *data, size_t len);
 Size          BitmapSizeFromData(const char *data, size_t len);
 CLSID         GetEncoderClsid(const WCHAR *format);
+// caller must free() the result
+char *        SerializeBitmapAsPng(HBITMAP hbmp, size_t *lenOut);
+HBITMAP       HBitmapFromData(const char *data, size_t len, SizeI *sizeOut=NULL);
 
 #endif
@@ -0,0 +1,388 @@
+/* Copyright 2013 the SumatraPDF project authors (see AUTHORS file).
+   License: Simplified BSD (see COPYING.BSD) */
+
+#include "BaseUtil.h"
+#include "ThumbnailCache.h"
+
+#include "FileUtil.h"
+#include "WinUtil.h"
+
+#define PACK_MAGIC      "SumPack1"
+#define PACK_MAGIC_LEN  8
+
+struct PackHeader {
+    char        magic[PACK_MAGIC_LEN];
+    UINT        maxEntries;
+    UINT        entryCount;
+    // length of the data following the index (including data of removed entries)
+    UINT        dataLen;
+    // increased on every access, for determining the least recently used entries
+    UINT        clock;
+};
+
+struct PackEntry {
+    unsigned char digest[16];
+    int         pageNo;
+    USHORT      dx, dy;
+    // relative to the end of the index
+    UINT        offset;
+    UINT        len;
+    UINT        lastUsed;
+    FILETIME    created;
+};
+
+static inline size_t GetIndexLen(UINT maxEntries)
+{
+    return sizeof(PackHeader) + maxEntries * sizeof(PackEntry);
+}
+
+static inline PackEntry *GetEntries(char *view)
+{
+    return (PackEntry *)(view + sizeof(PackHeader));
+}
+
+ThumbnailCache::ThumbnailCache(const WCHAR *filePath, UINT maxEntries, size_t maxDataLen) :
+    filePath(str::Dup(filePath)), maxEntries(maxEntries), maxDataLen(maxDataLen),
+    hFile(INVALID_HANDLE_VALUE), hMap(NULL), view(NULL), viewLen(0)
+{
+    // all processes accessing the same pack file must use the same mutex
+    ScopedMem<WCHAR> normPath(path::Normalize(filePath));
+    UINT hash = 0;
+    for (const WCHAR *c = normPath ? normPath.Get() : filePath; *c; c++) {
+        hash = hash * 31 + towlower(*c);
+    }
+    ScopedMem<WCHAR> mutexName(str::Format(L"SumatraPDF-ThumbnailCache-%08x", hash));
+    mutex = CreateMutex(NULL, FALSE, mutexName);
+}
+
+ThumbnailCache::~ThumbnailCache()
+{
+    Unmap();
+    if (mutex)
+        CloseHandle(mutex);
+    free(filePath);
+}
+
+// acquires the mutex and makes sure that the pack file is mapped
+bool ThumbnailCache::Lock()
+{
+    if (!mutex)
+        return false;
+    DWORD res = WaitForSingleObject(mutex, 10000);
+    // an abandoned mutex indicates a crashed process which
+    // might have left the index in an inconsistent state
+    // (which is partially checked for in Map)
+    if (res != WAIT_OBJECT_0 && res != WAIT_ABANDONED)
+        return false;
+    if (!Map()) {
+        ReleaseMutex(mutex);
+        return false;
+    }
+    return true;
+}
+
+void ThumbnailCache::Unlock()
+{
+    ReleaseMutex(mutex);
+}
+
+// maps the pack file into memory, creating a new one or growing it to <minLen> as needed
+// and renewing the mapping if the file has been grown (possibly by another process)
+// (must be called from within Lock/Unlock)
+bool ThumbnailCache::Map(size_t minLen)
+{
+    if (INVALID_HANDLE_VALUE == hFile) {
+        hFile = CreateFile(filePath, GENERIC_READ | GENERIC_WRITE,
+                           FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL,
+                           OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (INVALID_HANDLE_VALUE == hFile)
+            return false;
+    }
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(hFile, &size) || size.HighPart != 0) {
+        Unmap();
+        return false;
+    }
+    size_t fileLen = size.LowPart;
+    minLen = max(minLen, GetIndexLen(maxEntries));
+    if (fileLen < minLen) {
+        size.QuadPart = minLen;
+        if (!SetFilePointerEx(hFile, size, NULL, FILE_BEGIN) || !SetEndOfFile(hFile)) {
+            Unmap();
+            return false;
+        }
+        fileLen = minLen;
+    }
+
+    if (view && viewLen != fileLen) {
+        UnmapViewOfFile(view);
+        CloseHandle(hMap);
+        view = NULL;
+        hMap = NULL;
+    }
+    if (!view) {
+        hMap = CreateFileMapping(hFile, NULL, PAGE_READWRITE, 0, 0, NULL);
+        if (hMap)
+            view = (char *)MapViewOfFile(hMap, FILE_MAP_WRITE, 0, 0, 0);
+        if (!view) {
+            Unmap();
+            return false;
+        }
+        viewLen = fileLen;
+    }
+
+    PackHeader *header = (PackHeader *)view;
+    if (memcmp(header->magic, PACK_MAGIC, PACK_MAGIC_LEN) != 0 ||
+        header->maxEntries > (viewLen - sizeof(PackHeader)) / sizeof(PackEntry) ||
+        header->entryCount > header->maxEntries ||
+        header->dataLen > viewLen - GetIndexLen(header->maxEntries)) {
+        // start over with an empty cache (a new pack file is all zeroes and a
+        // broken one can't be replaced while other processes might have it mapped)
+        ZeroMemory(view, GetIndexLen(maxEntries));
+        memcpy(header->magic, PACK_MAGIC, PACK_MAGIC_LEN);
+        header->maxEntries = maxEntries;
+    }
+
+    return true;
+}
+
+void ThumbnailCache::Unmap()
+{
+    if (view)
+        UnmapViewOfFile(view);
+    if (hMap)
+        CloseHandle(hMap);
+    if (hFile != INVALID_HANDLE_VALUE)
+        CloseHandle(hFile);
+    view = NULL;
+    viewLen = 0;
+    hMap = NULL;
+    hFile = INVALID_HANDLE_VALUE;
+}
+
+PackEntry *ThumbnailCache::Find(const unsigned char digest[16], int pageNo, SizeI size)
+{
+    PackHeader *header = (PackHeader *)view;
+    PackEntry *entries = GetEntries(view);
+    for (UINT i = 0; i < header->entryCount; i++) {
+        if (entries[i].pageNo == pageNo && entries[i].dx == size.dx && entries[i].dy == size.dy &&
+            memeq(entries[i].digest, digest, sizeof(entries[i].digest))) {
+            // ignore entries with invalid data
+            if (entries[i].offset + entries[i].len > header->dataLen)
+                return NULL;
+            return &entries[i];
+        }
+    }
+    return NULL;
+}
+
+static int cmpEntriesByLastUse(const void *a, const void *b)
+{
+    UINT usedA = ((const PackEntry *)a)->lastUsed, usedB = ((const PackEntry *)b)->lastUsed;
+    return usedA > usedB ? -1 : usedA < usedB ? 1 : 0;
+}
+
+static int cmpEntriesByOffset(const void *a, const void *b)
+{
+    UINT offsetA = ((const PackEntry *)a)->offset, offsetB = ((const PackEntry *)b)->offset;
+    return offsetA < offsetB ? -1 : offsetA > offsetB ? 1 : 0;
+}
+
+// drops the data of removed entries and, if that isn't enough, the least recently
+// used entries so that there's again space for more entries (incl. one of <extraLen> bytes)
+bool ThumbnailCache::Compact(size_t extraLen)
+{
+    PackHeader *header = (PackHeader *)view;
+    PackEntry *entries = GetEntries(view);
+    char *data = view + GetIndexLen(header->maxEntries);
+
+    size_t usedLen = extraLen;
+    for (UINT i = 0; i < header->entryCount; i++) {
+        usedLen += entries[i].len;
+    }
+    UINT count = header->entryCount;
+    // only drop entries if dropping the data of removed entries doesn't suffice
+    if (count >= header->maxEntries || usedLen > maxDataLen) {
+        qsort(entries, header->entryCount, sizeof(PackEntry), cmpEntriesByLastUse);
+        size_t dataLen = extraLen;
+        for (count = 0; count < header->entryCount; count++) {
+            if (count >= header->maxEntries * 3 / 4 || dataLen + entries[count].len > maxDataLen * 3 / 4)
+                break;
+            dataLen += entries[count].len;
+        }
+        header->entryCount = count;
+    }
+
+    qsort(entries, count, sizeof(PackEntry), cmpEntriesByOffset);
+    UINT offset = 0;
+    for (UINT i = 0; i < count; i++) {
+        memmove(data + offset, data + entries[i].offset, entries[i].len);
+        entries[i].offset = offset;
+        offset += entries[i].len;
+    }
+    header->dataLen = offset;
+
+    return header->entryCount < header->maxEntries && offset + extraLen <= maxDataLen;
+}
+
+char *ThumbnailCache::Load(const unsigned char digest[16], int pageNo, SizeI size, size_t *lenOut, FILETIME *createdOut)
+{
+    if (!Lock())
+        return NULL;
+
+    char *data = NULL;
+    PackHeader *header = (PackHeader *)view;
+    PackEntry *entry = Find(digest, pageNo, size);
+    if (entry) {
+        data = (char *)memdup(view + GetIndexLen(header->maxEntries) + entry->offset, entry->len);
+        if (data && lenOut)
+            *lenOut = entry->len;
+        if (data && createdOut)
+            *createdOut = entry->created;
+        entry->lastUsed = ++header->clock;
+    }
+
+    Unlock();
+    return data;
+}
+
+bool ThumbnailCache::Lookup(const unsigned char digest[16], int pageNo, SizeI size, FILETIME *createdOut)
+{
+    if (!Lock())
+        return false;
+
+    PackEntry *entry = Find(digest, pageNo, size);
+    if (entry && createdOut)
+        *createdOut = entry->created;
+
+    Unlock();
+    return entry != NULL;
+}
+
+bool ThumbnailCache::Save(const unsigned char digest[16], int pageNo, SizeI size, const char *data, size_t len)
+{
+    // don't let a single entry push out most of the others
+    if (len > maxDataLen / 4)
+        return false;
+    if (!Lock())
+        return false;
+
+    PackHeader *header = (PackHeader *)view;
+    PackEntry *entry = Find(digest, pageNo, size);
+    if (entry) {
+        // the old data will be dropped at the next compaction
+        *entry = GetEntries(view)[--header->entryCount];
+    }
+    bool ok = true;
+    if (header->entryCount >= header->maxEntries || header->dataLen + len > maxDataLen)
+        ok = Compact(len);
+    size_t neededLen = GetIndexLen(header->maxEntries) + header->dataLen + len;
+    if (ok && neededLen > viewLen)
+        ok = Map(neededLen);
+    if (ok) {
+        // the view might have moved
+        header = (PackHeader *)view;
+        entry = &GetEntries(view)[header->entryCount];
+        memcpy(entry->digest, digest, sizeof(entry->digest));
+        entry->pageNo = pageNo;
+        entry->dx = (USHORT)size.dx;
+        entry->dy = (USHORT)size.dy;
+        entry->offset = header->dataLen;
+        entry->len = (UINT)len;
+        entry->lastUsed = ++header->clock;
+        GetSystemTimeAsFileTime(&entry->created);
+        memcpy(view + GetIndexLen(header->maxEntries) + entry->offset, data, len);
+        header->dataLen += (UINT)len;
+        header->entryCount++;
+    }
+
+    Unlock();
+    return ok;
+}
+
+bool ThumbnailCache::Remove(const unsigned char digest[16], int pageNo, SizeI size)
+{
+    if (!Lock())
+        return false;
+
+    PackHeader *header = (PackHeader *)view;
+    PackEntry *entry = Find(digest, pageNo, size);
+    if (entry) {
+        // the data will be dropped at the next compaction
+        *entry = GetEntries(view)[--header->entryCount];
+    }
+
+    Unlock();
+    return entry != NULL;
+}
+
+void ThumbnailCache::RemoveAllExcept(const unsigned char *digests, size_t count)
+{
+    if (!Lock())
+        return;
+
+    PackHeader *header = (PackHeader *)view;
+    PackEntry *entries = GetEntries(view);
+    for (UINT i = header->entryCount; i > 0; i--) {
+        bool keep = false;
+        for (size_t j = 0; j < count && !keep; j++) {
+            keep = memeq(entries[i - 1].digest, digests + j * 16, 16);
+        }
+        if (!keep)
+            entries[i - 1] = entries[--header->entryCount];
+    }
+    // make sure that the removed data is actually dropped
+    Compact(0);
+
+    Unlock();
+}
+
+bool CalcThumbnailDigest(IStream *stream, unsigned char digest[16])
+{
+    LARGE_INTEGER zero = { 0 };
+    if (FAILED(stream->Seek(zero, STREAM_SEEK_SET, NULL)))
+        return false;
+    bool ok = CalcMD5DigestWin(stream, digest);
+    // leave the stream as we've found it for whoever reads it next
+    stream->Seek(zero, STREAM_SEEK_SET, NULL);
+    return ok;
+}
+
+bool CalcThumbnailDigest(const WCHAR *filePath, unsigned char digest[16])
+{
+    ScopedComPtr<IStream> stream;
+    if (FAILED(SHCreateStreamOnFile(filePath, STGM_READ | STGM_SHARE_DENY_NONE, &stream)))
+        return false;
+    return CalcThumbnailDigest(stream, digest);
+}
+
+// kept for the whole process, so that the pack file remains mapped
+class SharedThumbnailCache {
+public:
+    ThumbnailCache *cache;
+
+    SharedThumbnailCache() : cache(NULL) { }
+    ~SharedThumbnailCache() { delete cache; }
+};
+
+static SharedThumbnailCache gSharedCache;
+
+ThumbnailCache *GetSharedThumbnailCache()
+{
+    if (gSharedCache.cache)
+        return gSharedCache.cache;
+
+    ScopedMem<WCHAR> dataDir(GetSpecialFolder(CSIDL_LOCAL_APPDATA, true));
+    if (!dataDir)
+        return NULL;
+    ScopedMem<WCHAR> cacheDir(path::Join(dataDir, L"SumatraPDF"));
+    if (!dir::Create(cacheDir))
+        return NULL;
+    ScopedMem<WCHAR> cachePath(path::Join(cacheDir, L"thumbnails.pack"));
+    ThumbnailCache *cache = new ThumbnailCache(cachePath);
+    // several previewer threads might get here at the same time
+    if (InterlockedCompareExchangePointer((void **)&gSharedCache.cache, cache, NULL) != NULL)
+        delete cache;
+    return gSharedCache.cache;
+}
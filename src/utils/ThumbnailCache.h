@@ -0,0 +1,61 @@
+/* Copyright 2013 the SumatraPDF project authors (see AUTHORS file).
+   License: Simplified BSD (see COPYING.BSD) */
+
+#ifndef ThumbnailCache_h
+#define ThumbnailCache_h
+
+/* ThumbnailCache stores small page renderings in a single pack file.
+   Entries are keyed by a document fingerprint (see CalcThumbnailDigest),
+   a page number and a size and contain opaque data (usually a PNG image).
+
+   The pack file consists of a header, an index of fixed capacity and the
+   entries' data. It is accessed through a file mapping which is protected
+   by a named mutex, so that it can safely be shared between threads and
+   processes (e.g. SumatraPDF and the Explorer previewer). The mapping is
+   kept between calls and only renewed when the pack file has grown. The least
+   recently used entries are dropped when either the index or the data grows
+   too large. */
+
+class ThumbnailCache {
+    WCHAR *     filePath;
+    HANDLE      mutex;
+    UINT        maxEntries;
+    size_t      maxDataLen;
+
+    // only to be accessed between Lock() and Unlock()
+    HANDLE      hFile;
+    HANDLE      hMap;
+    char *      view;
+    size_t      viewLen;
+
+    bool        Lock();
+    void        Unlock();
+    bool        Map(size_t minLen=0);
+    void        Unmap();
+    bool        Compact(size_t extraLen);
+    struct PackEntry *Find(const unsigned char digest[16], int pageNo, SizeI size);
+
+public:
+    ThumbnailCache(const WCHAR *filePath, UINT maxEntries=8192, size_t maxDataLen=128 * 1024 * 1024);
+    ~ThumbnailCache();
+
+    // caller must free() the result
+    char *  Load(const unsigned char digest[16], int pageNo, SizeI size, size_t *lenOut,
+                 FILETIME *createdOut=NULL);
+    bool    Lookup(const unsigned char digest[16], int pageNo, SizeI size, FILETIME *createdOut=NULL);
+    bool    Save(const unsigned char digest[16], int pageNo, SizeI size, const char *data, size_t len);
+    bool    Remove(const unsigned char digest[16], int pageNo, SizeI size);
+    // removes all entries whose digest isn't among the given <count> digests
+    void    RemoveAllExcept(const unsigned char *digests, size_t count);
+};
+
+// fingerprints a document through the MD5 digest of its entire content
+// (so that a thumbnail remains valid if a file is moved or copied)
+bool CalcThumbnailDigest(IStream *stream, unsigned char digest[16]);
+bool CalcThumbnailDigest(const WCHAR *filePath, unsigned char digest[16]);
+
+// the process-wide instance for the pack file shared between all users of
+// thumbnails keyed by CalcThumbnailDigest (previewer, start page, EngineDump)
+ThumbnailCache *GetSharedThumbnailCache();
+
+#endif
@@ -1128,6 +1128,37 @@ void CalcMD5DigestWin(const void *data, size_t byteCount, unsigned char digest[1
     CryptReleaseContext(hProv,0);
 }
 
+// MD5 digest of a stream's content from the current position on (read in chunks,
+// so that large files don't have to be loaded into memory at once)
+bool CalcMD5DigestWin(IStream *stream, unsigned char digest[16])
+{
+    HCRYPTPROV hProv = 0;
+    HCRYPTHASH hHash = 0;
+
+    BOOL ok = CryptAcquireContext(&hProv, NULL, MS_DEF_PROV, PROV_RSA_FULL, CRYPT_VERIFYCONTEXT);
+    if (!ok)
+        ok = CryptAcquireContext(&hProv, NULL, MS_ENH_RSA_AES_PROV_XP, PROV_RSA_AES, CRYPT_VERIFYCONTEXT);
+    if (!ok)
+        return false;
+    ok = CryptCreateHash(hProv, CALG_MD5, 0, 0, &hHash);
+
+    const ULONG chunkLen = 64 * 1024;
+    ScopedMem<char> chunk((char *)malloc(chunkLen));
+    ok = ok && chunk;
+    for (ULONG read = chunkLen; ok && read == chunkLen; ) {
+        read = 0;
+        ok = SUCCEEDED(stream->Read(chunk, chunkLen, &read)) &&
+             CryptHashData(hHash, (const BYTE *)chunk.Get(), read, 0);
+    }
+
+    DWORD hashLen = 16;
+    ok = ok && CryptGetHashParam(hHash, HP_HASHVAL, digest, &hashLen, 0) && 16 == hashLen;
+    if (hHash)
+        CryptDestroyHash(hHash);
+    CryptReleaseContext(hProv, 0);
+    return ok != FALSE;
+}
+
 // SHA1 digest that uses Windows' CryptoAPI. It's good for code that doesn't already
 // have SHA1 code (smaller code) and it's probably faster than most other implementations
 // TODO: hasn't been tested for corectness
@@ -0,0 +1,92 @@
+/* Copyright 2013 the SumatraPDF project authors (see AUTHORS file).
+   License: Simplified BSD (see COPYING.BSD) */
+
+#include "BaseUtil.h"
+#include "FileUtil.h"
+#include "ThumbnailCache.h"
+
+// must be last due to assert() over-write
+#include "UtAssert.h"
+
+static void GenDigest(int seed, unsigned char digest[16])
+{
+    for (int i = 0; i < 16; i++) {
+        digest[i] = (unsigned char)(seed * 31 + i);
+    }
+}
+
+void ThumbnailCacheTest()
+{
+    ScopedMem<WCHAR> packPath(path::GetTempPath(L"utpack"));
+    utassert(packPath);
+    if (!packPath)
+        return;
+
+    unsigned char digest[16];
+    char data[1024];
+    size_t len;
+    {
+        ThumbnailCache cache(packPath, 8, 4 * sizeof(data));
+        GenDigest(1, digest);
+        utassert(!cache.Load(digest, 1, SizeI(16, 16), &len));
+
+        memset(data, 'a', sizeof(data));
+        utassert(cache.Save(digest, 1, SizeI(16, 16), data, sizeof(data)));
+        ScopedMem<char> loaded(cache.Load(digest, 1, SizeI(16, 16), &len));
+        utassert(loaded && len == sizeof(data) && memeq(loaded, data, len));
+        utassert(!cache.Lookup(digest, 2, SizeI(16, 16)));
+        utassert(!cache.Lookup(digest, 1, SizeI(16, 32)));
+
+        // replacing an entry
+        memset(data, 'b', sizeof(data));
+        utassert(cache.Save(digest, 1, SizeI(16, 16), data, sizeof(data) / 2));
+        loaded.Set(cache.Load(digest, 1, SizeI(16, 16), &len));
+        utassert(loaded && len == sizeof(data) / 2 && memeq(loaded, data, len));
+
+        utassert(cache.Remove(digest, 1, SizeI(16, 16)));
+        utassert(!cache.Lookup(digest, 1, SizeI(16, 16)));
+    }
+    {
+        // the least recently used entries are dropped first
+        ThumbnailCache cache(packPath, 8, 4 * sizeof(data));
+        for (int i = 0; i < 10; i++) {
+            GenDigest(i, digest);
+            memset(data, 'a' + i, sizeof(data));
+            utassert(cache.Save(digest, 1, SizeI(16, 16), data, sizeof(data) / 4));
+            // keep the first entry in use
+            GenDigest(0, digest);
+            utassert(cache.Lookup(digest, 1, SizeI(16, 16)));
+            ScopedMem<char> loaded(cache.Load(digest, 1, SizeI(16, 16), &len));
+            utassert(loaded && loaded[0] == 'a');
+        }
+        GenDigest(1, digest);
+        utassert(!cache.Lookup(digest, 1, SizeI(16, 16)));
+        GenDigest(9, digest);
+        utassert(cache.Lookup(digest, 1, SizeI(16, 16)));
+
+        unsigned char keep[16];
+        GenDigest(0, keep);
+        cache.RemoveAllExcept(keep, 1);
+        utassert(!cache.Lookup(digest, 1, SizeI(16, 16)));
+        utassert(cache.Lookup(keep, 1, SizeI(16, 16)));
+    }
+    {
+        // instances sharing a pack file see each other's changes,
+        // even after the file has grown underneath an existing mapping
+        ThumbnailCache cache1(packPath, 8, 4 * sizeof(data));
+        ThumbnailCache cache2(packPath, 8, 4 * sizeof(data));
+        GenDigest(0, digest);
+        utassert(cache2.Lookup(digest, 1, SizeI(16, 16)));
+        for (int i = 1; i < 4; i++) {
+            GenDigest(i, digest);
+            memset(data, 'a' + i, sizeof(data));
+            utassert(cache1.Save(digest, 1, SizeI(16, 16), data, sizeof(data)));
+            ScopedMem<char> loaded(cache2.Load(digest, 1, SizeI(16, 16), &len));
+            utassert(loaded && len == sizeof(data) && memeq(loaded, data, len));
+        }
+        utassert(cache2.Remove(digest, 1, SizeI(16, 16)));
+        utassert(!cache1.Lookup(digest, 1, SizeI(16, 16)));
+    }
+
+    file::Delete(packPath);
+}
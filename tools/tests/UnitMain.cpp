@@ -26,6 +26,7 @@ extern void SimpleLogTest();
 extern void SquareTreeTest();
 extern void StrFormatTest();
 extern void StrTest();
+extern void ThumbnailCacheTest();
 extern void TrivialHtmlParser_UnitTests();
 extern void VarintGobTest();
 extern void VecTest();
@@ -48,6 +49,7 @@ int main(int argc, char **argv)
     SquareTreeTest();
     StrFormatTest();
     StrTest();
+    ThumbnailCacheTest();
     TrivialHtmlParser_UnitTests();
     VarintGobTest();
     VecTest();